@@ -3,7 +3,7 @@ set -e
 export LC_ALL=C.UTF-8
 mkdir -p build && cd build
 rm -rf *
-meson ..
+meson .. -Dfault_injection=true
 ninja -v || bash
 ninja test -v
 DESTDIR=/tmp/install-ninja ninja install
@@ -0,0 +1,466 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+#
+# SPDX-License-Identifier: LGPL-2.1+
+#
+# A stand-in for the parts of org.freedesktop.Avahi used by passimd, for use on one or
+# more private dbus-daemons which are set as DBUS_SYSTEM_BUS_ADDRESS. Each bus address
+# is treated as a different host on the same LAN, and services are resolved to the
+# loopback address 127.0.0.N where N is the position of the address on the command
+# line. Each commit is written to stdout as "commit HOST NAME SUBTYPES TIMESTAMP" so
+# that a harness can tell when a daemon has registered.
+
+import argparse
+import itertools
+import random
+import sys
+import time
+
+from gi.repository import Gio, GLib
+
+INTROSPECTION_XML = """
+<node>
+  <interface name="org.freedesktop.Avahi.Server2">
+    <method name="GetVersionString">
+      <arg name="version" type="s" direction="out"/>
+    </method>
+    <method name="EntryGroupNew">
+      <arg name="path" type="o" direction="out"/>
+    </method>
+    <method name="ServiceBrowserPrepare">
+      <arg name="interface" type="i" direction="in"/>
+      <arg name="protocol" type="i" direction="in"/>
+      <arg name="type" type="s" direction="in"/>
+      <arg name="domain" type="s" direction="in"/>
+      <arg name="flags" type="u" direction="in"/>
+      <arg name="path" type="o" direction="out"/>
+    </method>
+    <method name="ServiceResolverPrepare">
+      <arg name="interface" type="i" direction="in"/>
+      <arg name="protocol" type="i" direction="in"/>
+      <arg name="name" type="s" direction="in"/>
+      <arg name="type" type="s" direction="in"/>
+      <arg name="domain" type="s" direction="in"/>
+      <arg name="aprotocol" type="i" direction="in"/>
+      <arg name="flags" type="u" direction="in"/>
+      <arg name="path" type="o" direction="out"/>
+    </method>
+  </interface>
+  <interface name="org.freedesktop.Avahi.EntryGroup">
+    <method name="Free"/>
+    <method name="Commit"/>
+    <method name="Reset"/>
+    <method name="GetState">
+      <arg name="state" type="i" direction="out"/>
+    </method>
+    <method name="AddService">
+      <arg name="interface" type="i" direction="in"/>
+      <arg name="protocol" type="i" direction="in"/>
+      <arg name="flags" type="u" direction="in"/>
+      <arg name="name" type="s" direction="in"/>
+      <arg name="type" type="s" direction="in"/>
+      <arg name="domain" type="s" direction="in"/>
+      <arg name="host" type="s" direction="in"/>
+      <arg name="port" type="q" direction="in"/>
+      <arg name="txt" type="aay" direction="in"/>
+    </method>
+    <method name="AddServiceSubtype">
+      <arg name="interface" type="i" direction="in"/>
+      <arg name="protocol" type="i" direction="in"/>
+      <arg name="flags" type="u" direction="in"/>
+      <arg name="name" type="s" direction="in"/>
+      <arg name="type" type="s" direction="in"/>
+      <arg name="domain" type="s" direction="in"/>
+      <arg name="subtype" type="s" direction="in"/>
+    </method>
+    <signal name="StateChanged">
+      <arg name="state" type="i"/>
+      <arg name="error" type="s"/>
+    </signal>
+  </interface>
+  <interface name="org.freedesktop.Avahi.ServiceBrowser">
+    <method name="Free"/>
+    <method name="Start"/>
+    <signal name="ItemNew">
+      <arg name="interface" type="i"/>
+      <arg name="protocol" type="i"/>
+      <arg name="name" type="s"/>
+      <arg name="type" type="s"/>
+      <arg name="domain" type="s"/>
+      <arg name="flags" type="u"/>
+    </signal>
+    <signal name="AllForNow"/>
+    <signal name="CacheExhausted"/>
+    <signal name="Failure">
+      <arg name="error" type="s"/>
+    </signal>
+  </interface>
+  <interface name="org.freedesktop.Avahi.ServiceResolver">
+    <method name="Free"/>
+    <method name="Start"/>
+    <signal name="Found">
+      <arg name="interface" type="i"/>
+      <arg name="protocol" type="i"/>
+      <arg name="name" type="s"/>
+      <arg name="type" type="s"/>
+      <arg name="domain" type="s"/>
+      <arg name="host" type="s"/>
+      <arg name="aprotocol" type="i"/>
+      <arg name="address" type="s"/>
+      <arg name="port" type="q"/>
+      <arg name="txt" type="aay"/>
+      <arg name="flags" type="u"/>
+    </signal>
+    <signal name="Failure">
+      <arg name="error" type="s"/>
+    </signal>
+  </interface>
+</node>
+"""
+
+AVAHI_ENTRY_GROUP_UNCOMMITED = 0
+AVAHI_ENTRY_GROUP_ESTABLISHED = 2
+
+AVAHI_IF_LOOPBACK = 1
+AVAHI_PROTO_INET = 0
+AVAHI_LOOKUP_RESULT_LOCAL = 8
+
+
+class EntryGroup:
+    def __init__(self, host, path):
+        self.host = host
+        self.path = path
+        self.state = AVAHI_ENTRY_GROUP_UNCOMMITED
+        self.pending = {}
+        self.committed = {}
+
+    def method_call(self, method_name, parameters):
+        if method_name == "AddService":
+            _, _, _, name, kind, domain, _, port, _ = parameters.unpack()
+            self.pending[name] = {
+                "host": self.host,
+                "type": kind,
+                "domain": domain,
+                "port": port,
+                "subtypes": set(),
+            }
+            return None
+        if method_name == "AddServiceSubtype":
+            _, _, _, name, _, _, subtype = parameters.unpack()
+            self.pending[name]["subtypes"].add(subtype)
+            return None
+        if method_name == "Commit":
+            self.committed = self.pending
+            self.pending = {}
+            self.state = AVAHI_ENTRY_GROUP_ESTABLISHED
+            for name, service in self.committed.items():
+                print(
+                    "commit {} {} {} {:.6f}".format(
+                        self.host.index,
+                        name,
+                        len(service["subtypes"]),
+                        time.monotonic(),
+                    ),
+                    flush=True,
+                )
+            return None
+        if method_name == "Reset":
+            self.pending = {}
+            self.committed = {}
+            self.state = AVAHI_ENTRY_GROUP_UNCOMMITED
+            return None
+        if method_name == "GetState":
+            return GLib.Variant("(i)", (self.state,))
+        if method_name == "Free":
+            self.host.unregister(self.path)
+            self.host.entry_groups.pop(self.path, None)
+            return None
+        raise NotImplementedError(method_name)
+
+
+class ServiceBrowser:
+    def __init__(self, host, path, kind):
+        self.host = host
+        self.path = path
+        self.kind = kind
+
+    def start(self):
+        mock = self.host.mock
+        for name, service in mock.services().items():
+            if self.kind not in service["subtypes"] and self.kind != service["type"]:
+                continue
+            if mock.is_lost():
+                continue
+            flags = 0
+            if service["host"] is self.host:
+                flags |= AVAHI_LOOKUP_RESULT_LOCAL
+            self.emit(
+                "ItemNew",
+                GLib.Variant(
+                    "(iisssu)",
+                    (
+                        AVAHI_IF_LOOPBACK,
+                        AVAHI_PROTO_INET,
+                        name,
+                        service["type"],
+                        service["domain"],
+                        flags,
+                    ),
+                ),
+            )
+        self.emit("CacheExhausted", None)
+        self.emit("AllForNow", None)
+
+    def emit(self, signal_name, parameters):
+        self.host.connection.emit_signal(
+            None,
+            self.path,
+            "org.freedesktop.Avahi.ServiceBrowser",
+            signal_name,
+            parameters,
+        )
+
+    def method_call(self, method_name, parameters):
+        if method_name == "Start":
+            self.host.mock.later(self.start)
+            return None
+        if method_name == "Free":
+            self.host.unregister(self.path)
+            return None
+        raise NotImplementedError(method_name)
+
+
+class ServiceResolver:
+    def __init__(self, host, path, name):
+        self.host = host
+        self.path = path
+        self.name = name
+        self.lost = False
+
+    def start(self):
+        service = self.host.mock.services().get(self.name)
+        if service is None or self.lost:
+            self.emit("Failure", GLib.Variant("(s)", ("Timeout reached",)))
+            return
+        self.emit(
+            "Found",
+            GLib.Variant(
+                "(iissssisqaayu)",
+                (
+                    AVAHI_IF_LOOPBACK,
+                    AVAHI_PROTO_INET,
+                    self.name,
+                    service["type"],
+                    service["domain"],
+                    "host{}.local".format(service["host"].index),
+                    AVAHI_PROTO_INET,
+                    service["host"].address,
+                    service["port"],
+                    [],
+                    0,
+                ),
+            ),
+        )
+
+    def emit(self, signal_name, parameters):
+        self.host.connection.emit_signal(
+            None,
+            self.path,
+            "org.freedesktop.Avahi.ServiceResolver",
+            signal_name,
+            parameters,
+        )
+
+    def method_call(self, method_name, parameters):
+        if method_name == "Start":
+            # a lost resolve only fails when the real daemon would give up
+            mock = self.host.mock
+            self.lost = self.name not in mock.services() or mock.is_lost()
+            mock.later(self.start, mock.args.timeout if self.lost else None)
+            return None
+        if method_name == "Free":
+            self.host.unregister(self.path)
+            return None
+        raise NotImplementedError(method_name)
+
+
+class Host:
+    """one bus, which is one machine on the simulated LAN"""
+
+    def __init__(self, mock, index, connection):
+        self.mock = mock
+        self.index = index
+        self.address = "127.0.0.{}".format(index + 1)
+        self.connection = connection
+        self.entry_groups = {}
+        self.registrations = {}
+
+    def register(self, path, interface_name, obj):
+        def _method_call_cb(
+            connection, sender, path, iface, method, params, invocation
+        ):
+            self.mock.reply_later(invocation, obj.method_call(method, params))
+
+        self.registrations[path] = self.connection.register_object(
+            path,
+            self.mock.node_info.lookup_interface(interface_name),
+            _method_call_cb,
+            None,
+            None,
+        )
+
+    def unregister(self, path):
+        registration_id = self.registrations.pop(path, None)
+        if registration_id is not None:
+            self.connection.unregister_object(registration_id)
+
+    def server_method_call(
+        self,
+        connection,
+        sender,
+        object_path,
+        interface_name,
+        method_name,
+        parameters,
+        invocation,
+    ):
+        mock = self.mock
+        if method_name == "GetVersionString":
+            invocation.return_value(GLib.Variant("(s)", ("avahi 0.8 (mock)",)))
+            return
+        if method_name == "EntryGroupNew":
+            path = mock.new_object_path("EntryGroup")
+            entry_group = EntryGroup(self, path)
+            self.entry_groups[path] = entry_group
+            self.register(path, "org.freedesktop.Avahi.EntryGroup", entry_group)
+            invocation.return_value(GLib.Variant("(o)", (path,)))
+            return
+        if method_name == "ServiceBrowserPrepare":
+            _, _, kind, _, _ = parameters.unpack()
+            path = mock.new_object_path("ServiceBrowser")
+            browser = ServiceBrowser(self, path, kind)
+            self.register(path, "org.freedesktop.Avahi.ServiceBrowser", browser)
+            mock.reply_later(invocation, GLib.Variant("(o)", (path,)))
+            return
+        if method_name == "ServiceResolverPrepare":
+            _, _, name, _, _, _, _ = parameters.unpack()
+            path = mock.new_object_path("ServiceResolver")
+            resolver = ServiceResolver(self, path, name)
+            self.register(path, "org.freedesktop.Avahi.ServiceResolver", resolver)
+            mock.reply_later(invocation, GLib.Variant("(o)", (path,)))
+            return
+        invocation.return_dbus_error(
+            "org.freedesktop.Avahi.NotSupportedError", method_name
+        )
+
+
+class MockAvahi:
+    def __init__(self, args):
+        self.args = args
+        self.node_info = Gio.DBusNodeInfo.new_for_xml(INTROSPECTION_XML)
+        self.hosts = []
+        self.ids = itertools.count(1)
+        self.random = random.Random(args.seed)
+        self.acquired = 0
+
+    def services(self):
+        """all the committed services on every host, as a dict of name:service"""
+        services = {}
+        for host in self.hosts:
+            for entry_group in host.entry_groups.values():
+                services.update(entry_group.committed)
+        return services
+
+    def is_lost(self):
+        return self.random.uniform(0, 100) < self.args.loss
+
+    def new_object_path(self, kind):
+        return "/Client1/{}{}".format(kind, next(self.ids))
+
+    def later(self, func, delay=None):
+        """run func after the simulated network latency"""
+
+        def _timeout_cb():
+            func()
+            return GLib.SOURCE_REMOVE
+
+        GLib.timeout_add(self.args.latency if delay is None else delay, _timeout_cb)
+
+    def reply_later(self, invocation, value):
+        """optionally delay the reply to simulate a slow daemon"""
+        if self.args.latency <= 0:
+            invocation.return_value(value)
+            return
+        self.later(lambda: invocation.return_value(value))
+
+    def name_acquired_cb(self, connection, name):
+        self.acquired += 1
+        if self.acquired == len(self.hosts):
+            print("ready", flush=True)
+
+    def run(self):
+        if self.args.address:
+            connections = [
+                Gio.DBusConnection.new_for_address_sync(
+                    address,
+                    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT
+                    | Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+                    None,
+                    None,
+                )
+                for address in self.args.address
+            ]
+        else:
+            connections = [Gio.bus_get_sync(Gio.BusType.SYSTEM, None)]
+        for index, connection in enumerate(connections):
+            host = Host(self, index, connection)
+            connection.register_object(
+                "/",
+                self.node_info.lookup_interface("org.freedesktop.Avahi.Server2"),
+                host.server_method_call,
+                None,
+                None,
+            )
+            self.hosts.append(host)
+        for host in self.hosts:
+            Gio.bus_own_name_on_connection(
+                host.connection,
+                "org.freedesktop.Avahi",
+                Gio.BusNameOwnerFlags.NONE,
+                self.name_acquired_cb,
+                lambda connection, name: sys.exit("lost {}".format(name)),
+            )
+        GLib.MainLoop().run()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Mock Avahi daemon for passim")
+    parser.add_argument(
+        "--address",
+        action="append",
+        help="D-Bus address of one host, which can be repeated, default is the "
+        "system bus",
+    )
+    parser.add_argument(
+        "--latency", type=int, default=0, help="delay in ms for each reply and result"
+    )
+    parser.add_argument(
+        "--loss",
+        type=float,
+        default=0,
+        help="percentage of browse and resolve results which are lost",
+    )
+    parser.add_argument(
+        "--timeout",
+        type=int,
+        default=5000,
+        help="delay in ms before a lost resolve fails",
+    )
+    parser.add_argument("--seed", type=int, help="random seed for the loss")
+    MockAvahi(parser.parse_args()).run()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,401 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+#
+# SPDX-License-Identifier: LGPL-2.1+
+#
+# Simulate a LAN of several uninstalled passimd instances, each with its own private
+# dbus-daemon and data directory, all sharing one contrib/mock-avahi.py which resolves
+# each instance to a different loopback address. The catalog is spread over the
+# instances with the given number of replicas, and then this measures the lookup
+# latency, how the redirects are distributed between the replicas and how long it takes
+# to publish and unpublish an item when N items are already registered.
+#
+# Publish and Unpublish can only be called by root, and so this should be run using:
+#
+#   $ sudo contrib/passim-lan-sim.py --passimd build/src/passimd --daemons 4
+
+import argparse
+import collections
+import hashlib
+import http.client
+import json
+import os
+import random
+import shutil
+import signal
+import ssl
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from gi.repository import Gio, GLib
+
+CONTRIB_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE_DIR = os.path.dirname(CONTRIB_DIR)
+
+BUS_CONFIG = """<busconfig>
+  <type>system</type>
+  <listen>unix:path={path}</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*"/>
+    <allow receive_sender="*"/>
+  </policy>
+</busconfig>
+"""
+
+
+def _percentile(values, pct):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+def _summary(values):
+    return {
+        "count": len(values),
+        "p50_ms": round(_percentile(values, 50) * 1000, 3),
+        "p90_ms": round(_percentile(values, 90) * 1000, 3),
+        "p99_ms": round(_percentile(values, 99) * 1000, 3),
+    }
+
+
+class Daemon:
+    """one passimd, with its own bus and SYSCONFDIR, LOCALSTATEDIR and DATADIR"""
+
+    def __init__(self, root, index, port):
+        self.index = index
+        self.port = port
+        self.root = os.path.join(root, "daemon{}".format(index))
+        self.sysconfdir = os.path.join(self.root, "etc")
+        self.localstatedir = os.path.join(self.root, "var")
+        self.datadir = os.path.join(self.root, "share")
+        self.libdir = os.path.join(self.localstatedir, "lib", "passim", "data")
+        self.bus_path = os.path.join(self.root, "bus")
+        self.address = "unix:path={}".format(self.bus_path)
+        self.hashes = set()
+        self.bus = None
+        self.proc = None
+        self.connection = None
+
+    def generate(self):
+        os.makedirs(self.libdir, exist_ok=True)
+        os.makedirs(self.sysconfdir, exist_ok=True)
+        os.makedirs(os.path.join(self.datadir, "dbus-1", "interfaces"), exist_ok=True)
+        shutil.copy(
+            os.path.join(SOURCE_DIR, "src", "org.freedesktop.Passim.xml"),
+            os.path.join(self.datadir, "dbus-1", "interfaces"),
+        )
+        with open(os.path.join(self.sysconfdir, "passim.conf"), "w") as f:
+            f.write("[daemon]\nPort={}\n".format(self.port))
+        with open(os.path.join(self.root, "bus.conf"), "w") as f:
+            f.write(BUS_CONFIG.format(path=self.bus_path))
+
+    def add_item(self, basename, blob, share_limit=1000000):
+        """as if published before the daemon was started"""
+        hash = hashlib.sha256(blob).hexdigest()
+        fn = os.path.join(self.libdir, "{}-{}".format(hash, basename))
+        with open(fn, "wb") as f:
+            f.write(blob)
+        os.setxattr(fn, "user.max_age", struct.pack("=I", 24 * 60 * 60))
+        os.setxattr(fn, "user.share_limit", struct.pack("=I", share_limit))
+        os.setxattr(fn, "user.cmdline", b"passim-lan-sim")
+        self.hashes.add(hash)
+
+    def start_bus(self):
+        self.bus = subprocess.Popen(
+            [
+                "dbus-daemon",
+                "--nofork",
+                "--config-file",
+                os.path.join(self.root, "bus.conf"),
+            ]
+        )
+        while not os.path.exists(self.bus_path):
+            time.sleep(0.01)
+        self.connection = Gio.DBusConnection.new_for_address_sync(
+            self.address,
+            Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT
+            | Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+            None,
+            None,
+        )
+
+    def start(self, passimd):
+        env = dict(os.environ)
+        env.update(
+            {
+                "DBUS_SYSTEM_BUS_ADDRESS": self.address,
+                "PASSIM_SYSCONFDIR": self.sysconfdir,
+                "PASSIM_LOCALSTATEDIR": self.localstatedir,
+                "PASSIM_DATADIR": self.datadir,
+                "G_MESSAGES_DEBUG": "",
+            }
+        )
+        self.proc = subprocess.Popen(
+            [passimd], env=env, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL
+        )
+
+    def wait_for_running(self, deadline):
+        while time.monotonic() < deadline:
+            if self.proc.poll() is not None:
+                raise RuntimeError(
+                    "passimd {} exited with {}".format(self.index, self.proc.returncode)
+                )
+            try:
+                val = self.call(
+                    "org.freedesktop.DBus.Properties",
+                    "Get",
+                    GLib.Variant("(ss)", ("org.freedesktop.Passim", "Status")),
+                )
+                if val.unpack()[0] == "running":
+                    return
+            except GLib.Error:
+                pass
+            time.sleep(0.01)
+        raise TimeoutError("passimd {} did not start".format(self.index))
+
+    def call(self, interface_name, method_name, parameters, fd_list=None):
+        val, _ = self.connection.call_with_unix_fd_list_sync(
+            "org.freedesktop.Passim",
+            "/",
+            interface_name,
+            method_name,
+            parameters,
+            None,
+            Gio.DBusCallFlags.NONE,
+            60000,
+            fd_list,
+            None,
+        )
+        return val
+
+    def get_statistics(self):
+        val = self.call("org.freedesktop.Passim", "GetStatistics", None)
+        return val.unpack()[0]
+
+    def stop(self):
+        if self.proc:
+            self.proc.send_signal(signal.SIGINT)
+            self.proc.wait()
+        if self.bus:
+            self.bus.terminate()
+            self.bus.wait()
+
+
+class Lan:
+    """several passimd instances sharing one mock Avahi"""
+
+    def __init__(self, root, count, port):
+        self.daemons = [Daemon(root, i, port + i) for i in range(count)]
+        self.avahi = None
+        for daemon in self.daemons:
+            daemon.generate()
+
+    def start(self, passimd, latency, loss, seed, timeout):
+        for daemon in self.daemons:
+            daemon.start_bus()
+        cmd = [
+            sys.executable,
+            os.path.join(CONTRIB_DIR, "mock-avahi.py"),
+            "--latency",
+            str(latency),
+            "--loss",
+            str(loss),
+            "--seed",
+            str(seed),
+        ]
+        for daemon in self.daemons:
+            cmd.extend(["--address", daemon.address])
+        self.avahi = subprocess.Popen(cmd, stdout=subprocess.PIPE, text=True)
+        self.avahi.stdout.readline()
+
+        # the commit lines are not needed, but the pipe must not fill up
+        threading.Thread(target=self.avahi.stdout.read, daemon=True).start()
+        for daemon in self.daemons:
+            daemon.start(passimd)
+        deadline = time.monotonic() + timeout
+        for daemon in self.daemons:
+            daemon.wait_for_running(deadline)
+
+    def stop(self):
+        for daemon in self.daemons:
+            daemon.stop()
+        if self.avahi:
+            self.avahi.terminate()
+            self.avahi.wait()
+
+
+def _lookup(daemon, basename, hash, timeout):
+    """returns the HTTP status, the redirect port if any, and the duration"""
+    conn = http.client.HTTPSConnection(
+        "127.0.0.1",
+        daemon.port,
+        context=ssl._create_unverified_context(),
+        timeout=timeout,
+    )
+    start = time.monotonic()
+    try:
+        conn.request("GET", "/{}?sha256={}".format(basename, hash))
+        response = conn.getresponse()
+        response.read()
+        duration = time.monotonic() - start
+        port = None
+        location = response.getheader("Location")
+        if location:
+            port = int(location.split("/")[2].split(":")[1])
+        return response.status, port, duration
+    finally:
+        conn.close()
+
+
+def measure_lookups(args, daemons, catalog, rnd):
+    by_port = {daemon.port: daemon for daemon in daemons}
+    durations = collections.defaultdict(list)
+    redirects = collections.Counter()
+    misdirected = 0
+    for _ in range(args.lookups):
+        basename, hash = rnd.choice(catalog)
+        candidates = [daemon for daemon in daemons if hash not in daemon.hashes]
+        if not candidates:
+            continue
+        status, port, duration = _lookup(rnd.choice(candidates), basename, hash, 30)
+        durations[status].append(duration)
+        if port is None:
+            continue
+        target = by_port.get(port)
+        if target is None or hash not in target.hashes:
+            misdirected += 1
+            continue
+        redirects[target.index] += 1
+    total = sum(redirects.values())
+    return {
+        "lookup": {str(status): _summary(val) for status, val in durations.items()},
+        "redirects": {
+            str(daemon.index): {
+                "count": redirects[daemon.index],
+                "share": round(redirects[daemon.index] / total, 3) if total else 0,
+            }
+            for daemon in daemons
+        },
+        "misdirected": misdirected,
+    }
+
+
+def measure_churn(args, daemon):
+    publish = []
+    unpublish = []
+    for i in range(args.churn):
+        blob = os.urandom(args.size)
+        hash = hashlib.sha256(blob).hexdigest()
+        rfd, wfd = os.pipe()
+        writer = threading.Thread(target=lambda: (os.write(wfd, blob), os.close(wfd)))
+        writer.start()
+        attrs = {
+            "filename": GLib.Variant("s", "churn{}.bin".format(i)),
+            "max-age": GLib.Variant("u", 24 * 60 * 60),
+            "share-limit": GLib.Variant("u", 5),
+        }
+        start = time.monotonic()
+        try:
+            daemon.call(
+                "org.freedesktop.Passim",
+                "Publish",
+                GLib.Variant("(ha{sv})", (0, attrs)),
+                Gio.UnixFDList.new_from_array([rfd]),
+            )
+        finally:
+            writer.join()
+        publish.append(time.monotonic() - start)
+        start = time.monotonic()
+        daemon.call("org.freedesktop.Passim", "Unpublish", GLib.Variant("(s)", (hash,)))
+        unpublish.append(time.monotonic() - start)
+    return {
+        "items": len(daemon.hashes),
+        "publish": _summary(publish),
+        "unpublish": _summary(unpublish),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate a LAN of passimd instances")
+    parser.add_argument("--passimd", default="build/src/passimd")
+    parser.add_argument("--daemons", type=int, default=4)
+    parser.add_argument("--items", type=int, default=100, help="items in the catalog")
+    parser.add_argument("--replicas", type=int, default=2, help="copies of each item")
+    parser.add_argument("--size", type=int, default=4096, help="bytes per item")
+    parser.add_argument("--lookups", type=int, default=200)
+    parser.add_argument("--churn", type=int, default=20, help="publish cycles")
+    parser.add_argument("--latency", type=int, default=0, help="mDNS latency in ms")
+    parser.add_argument("--loss", type=float, default=0, help="mDNS loss percentage")
+    parser.add_argument("--port", type=int, default=27600, help="first port")
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--timeout", type=float, default=120)
+    parser.add_argument("--json", action="store_true", help="output JSON")
+    parser.add_argument("--keep", action="store_true", help="keep the temporary tree")
+    args = parser.parse_args()
+    if args.replicas >= args.daemons:
+        parser.error("--replicas must be less than --daemons")
+
+    # spread the catalog over the daemons
+    rnd = random.Random(args.seed)
+    root = tempfile.mkdtemp(prefix="passim-lan-sim-", dir=os.getcwd())
+    print("generating {}".format(root), file=sys.stderr)
+    lan = Lan(root, args.daemons, args.port)
+    daemons = lan.daemons
+    catalog = []
+    for i in range(args.items):
+        basename = "item{}.bin".format(i)
+        blob = os.urandom(args.size)
+        for daemon in rnd.sample(daemons, args.replicas):
+            daemon.add_item(basename, blob)
+        catalog.append((basename, hashlib.sha256(blob).hexdigest()))
+
+    try:
+        lan.start(args.passimd, args.latency, args.loss, args.seed, args.timeout)
+        result = {
+            "daemons": args.daemons,
+            "items": args.items,
+            "replicas": args.replicas,
+            "latency_ms": args.latency,
+            "loss": args.loss,
+        }
+        result.update(measure_lookups(args, daemons, catalog, rnd))
+        if args.churn > 0:
+            result["churn"] = measure_churn(args, daemons[0])
+    finally:
+        lan.stop()
+        if not args.keep:
+            shutil.rmtree(root)
+
+    if args.json:
+        print(json.dumps(result))
+        return 0
+    for status, summary in sorted(result["lookup"].items()):
+        print(
+            "lookup {} count={count} p50={p50_ms:.1f}ms p90={p90_ms:.1f}ms "
+            "p99={p99_ms:.1f}ms".format(status, **summary)
+        )
+    for index, redirect in sorted(result["redirects"].items()):
+        print("redirect daemon{} count={count} share={share}".format(index, **redirect))
+    print("misdirected {}".format(result["misdirected"]))
+    if "churn" in result:
+        churn = result["churn"]
+        for action in ["publish", "unpublish"]:
+            print(
+                "{} items={} p50={p50_ms:.1f}ms p99={p99_ms:.1f}ms".format(
+                    action, churn["items"], **churn[action]
+                )
+            )
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
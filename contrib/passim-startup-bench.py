@@ -0,0 +1,277 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+#
+# SPDX-License-Identifier: LGPL-2.1+
+#
+# Measure how long an uninstalled passimd takes to start against a synthetic data
+# directory, using a private dbus-daemon and contrib/mock-avahi.py so that nothing
+# needs to be installed. The temporary tree is created in the current directory as
+# user xattrs are required.
+#
+#   $ contrib/passim-startup-bench.py --passimd build/src/passimd --items 5000
+
+import argparse
+import hashlib
+import json
+import os
+import shutil
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from gi.repository import Gio, GLib
+
+CONTRIB_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE_DIR = os.path.dirname(CONTRIB_DIR)
+
+BUS_CONFIG = """<busconfig>
+  <type>system</type>
+  <listen>unix:path={path}</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*"/>
+    <allow receive_sender="*"/>
+  </policy>
+</busconfig>
+"""
+
+
+class Tree:
+    """a synthetic SYSCONFDIR, LOCALSTATEDIR and DATADIR for passimd"""
+
+    def __init__(self, root):
+        self.root = root
+        self.sysconfdir = os.path.join(root, "etc")
+        self.localstatedir = os.path.join(root, "var")
+        self.datadir = os.path.join(root, "share")
+        self.libdir = os.path.join(self.localstatedir, "lib", "passim", "data")
+        self.files = []
+
+    def generate(self, args):
+        os.makedirs(self.libdir, exist_ok=True)
+        os.makedirs(os.path.join(self.sysconfdir, "passim.d"), exist_ok=True)
+        os.makedirs(os.path.join(self.datadir, "dbus-1", "interfaces"), exist_ok=True)
+        shutil.copy(
+            os.path.join(SOURCE_DIR, "src", "org.freedesktop.Passim.xml"),
+            os.path.join(self.datadir, "dbus-1", "interfaces"),
+        )
+        with open(os.path.join(self.sysconfdir, "passim.conf"), "w") as f:
+            f.write("[daemon]\nPort={}\n".format(args.port))
+
+        # {hash}-{name} files with the xattrs set by the daemon when publishing
+        for i in range(args.items):
+            blob = os.urandom(args.size)
+            fn = os.path.join(
+                self.libdir,
+                "{}-item{}.bin".format(hashlib.sha256(blob).hexdigest(), i),
+            )
+            with open(fn, "wb") as f:
+                f.write(blob)
+            os.setxattr(fn, "user.max_age", struct.pack("=I", 24 * 60 * 60))
+            os.setxattr(fn, "user.share_limit", struct.pack("=I", 5))
+            os.setxattr(fn, "user.cmdline", b"passim-startup-bench")
+            self.files.append(fn)
+
+        # passim.d trees, each pointing to a directory of files
+        for i in range(args.pkgdirs):
+            path = os.path.join(self.root, "pkg{}".format(i))
+            os.makedirs(path, exist_ok=True)
+            with open(
+                os.path.join(self.sysconfdir, "passim.d", "pkg{}.conf".format(i)), "w"
+            ) as f:
+                f.write("[passim]\nPath={}\n".format(path))
+            for j in range(args.pkgitems):
+                fn = os.path.join(path, "file{}.bin".format(j))
+                with open(fn, "wb") as f:
+                    f.write(os.urandom(args.size))
+                self.files.append(fn)
+
+    def drop_cache(self):
+        for fn in self.files:
+            fd = os.open(fn, os.O_RDONLY)
+            try:
+                os.fsync(fd)
+                os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+            finally:
+                os.close(fd)
+
+    def clear_checksums(self):
+        """passimd caches the hash of passim.d files in an xattr on first scan"""
+        for fn in self.files:
+            try:
+                os.removexattr(fn, "user.checksum.sha256")
+            except OSError:
+                pass
+
+
+def _peak_rss_kb(pid):
+    with open("/proc/{}/status".format(pid)) as f:
+        for line in f:
+            if line.startswith("VmHWM:"):
+                return int(line.split()[1])
+    return 0
+
+
+def _wait_for_listen(port, proc, deadline):
+    while time.monotonic() < deadline:
+        if proc.poll() is not None:
+            raise RuntimeError("passimd exited with {}".format(proc.returncode))
+        try:
+            with socket.create_connection(("127.0.0.1", port), timeout=0.1):
+                return time.monotonic()
+        except OSError:
+            time.sleep(0.002)
+    raise TimeoutError("passimd did not start listening")
+
+
+def _wait_for_status(connection, status, proc, deadline):
+    while time.monotonic() < deadline:
+        if proc.poll() is not None:
+            raise RuntimeError("passimd exited with {}".format(proc.returncode))
+        try:
+            val = connection.call_sync(
+                "org.freedesktop.Passim",
+                "/",
+                "org.freedesktop.DBus.Properties",
+                "Get",
+                GLib.Variant("(ss)", ("org.freedesktop.Passim", "Status")),
+                GLib.VariantType("(v)"),
+                Gio.DBusCallFlags.NONE,
+                1000,
+                None,
+            )
+            if val.unpack()[0] == status:
+                return time.monotonic()
+        except GLib.Error:
+            pass
+        time.sleep(0.002)
+    raise TimeoutError("passimd did not reach status {}".format(status))
+
+
+def run_once(args, tree, address, connection, cache):
+    if cache == "cold":
+        tree.drop_cache()
+    if args.rehash:
+        tree.clear_checksums()
+    env = dict(os.environ)
+    env.update(
+        {
+            "DBUS_SYSTEM_BUS_ADDRESS": address,
+            "PASSIM_SYSCONFDIR": tree.sysconfdir,
+            "PASSIM_LOCALSTATEDIR": tree.localstatedir,
+            "PASSIM_DATADIR": tree.datadir,
+            "G_MESSAGES_DEBUG": "",
+        }
+    )
+    start = time.monotonic()
+    proc = subprocess.Popen(
+        [args.passimd], env=env, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL
+    )
+    try:
+        deadline = start + args.timeout
+        listen = _wait_for_listen(args.port, proc, deadline)
+        register = _wait_for_status(connection, "running", proc, deadline)
+        rss = _peak_rss_kb(proc.pid)
+    finally:
+        proc.send_signal(signal.SIGINT)
+        proc.wait()
+    return {
+        "cache": cache,
+        "items": args.items + args.pkgdirs * args.pkgitems,
+        "size": args.size,
+        "time_to_listen_ms": round((listen - start) * 1000, 3),
+        "time_to_register_ms": round((register - start) * 1000, 3),
+        "peak_rss_kb": rss,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure passimd startup cost")
+    parser.add_argument("--passimd", default="build/src/passimd")
+    parser.add_argument("--items", type=int, default=1000, help="items in the libdir")
+    parser.add_argument("--pkgdirs", type=int, default=1, help="passim.d trees")
+    parser.add_argument("--pkgitems", type=int, default=100, help="files in each tree")
+    parser.add_argument("--size", type=int, default=64 * 1024, help="bytes per file")
+    parser.add_argument("--runs", type=int, default=3, help="runs for each cache state")
+    parser.add_argument("--port", type=int, default=27600)
+    parser.add_argument("--timeout", type=float, default=120)
+    parser.add_argument(
+        "--rehash", action="store_true", help="clear the cached passim.d checksums"
+    )
+    parser.add_argument("--json", action="store_true", help="output JSON lines")
+    parser.add_argument("--keep", action="store_true", help="keep the temporary tree")
+    args = parser.parse_args()
+
+    root = tempfile.mkdtemp(prefix="passim-startup-bench-", dir=os.getcwd())
+    tree = Tree(root)
+    print("generating {}".format(root), file=sys.stderr)
+    tree.generate(args)
+
+    # private bus with a mock Avahi on it
+    bus_path = os.path.join(root, "bus")
+    with open(os.path.join(root, "bus.conf"), "w") as f:
+        f.write(BUS_CONFIG.format(path=bus_path))
+    bus = subprocess.Popen(
+        ["dbus-daemon", "--nofork", "--config-file", os.path.join(root, "bus.conf")]
+    )
+    address = "unix:path={}".format(bus_path)
+    avahi = None
+    try:
+        while not os.path.exists(bus_path):
+            time.sleep(0.01)
+        avahi = subprocess.Popen(
+            [
+                sys.executable,
+                os.path.join(CONTRIB_DIR, "mock-avahi.py"),
+                "--address",
+                address,
+            ],
+            stdout=subprocess.PIPE,
+            text=True,
+        )
+        avahi.stdout.readline()
+
+        # the commit lines are not needed, but the pipe must not fill up
+        threading.Thread(target=avahi.stdout.read, daemon=True).start()
+        connection = Gio.DBusConnection.new_for_address_sync(
+            address,
+            Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT
+            | Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+            None,
+            None,
+        )
+        results = []
+        for cache in ["cold", "warm"]:
+            for _ in range(args.runs):
+                results.append(run_once(args, tree, address, connection, cache))
+    finally:
+        if avahi:
+            avahi.terminate()
+            avahi.wait()
+        bus.terminate()
+        bus.wait()
+        if not args.keep:
+            shutil.rmtree(root)
+
+    for result in results:
+        if args.json:
+            print(json.dumps(result))
+        else:
+            print(
+                "{cache:5} items={items} listen={time_to_listen_ms:.1f}ms "
+                "register={time_to_register_ms:.1f}ms "
+                "rss={peak_rss_kb}kB".format(**result)
+            )
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
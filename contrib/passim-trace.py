@@ -0,0 +1,417 @@
+#!/usr/bin/python3
+#
+# Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+#
+# SPDX-License-Identifier: LGPL-2.1+
+#
+# Record anonymised request traces from the passimd access log, and replay them against
+# a local daemon or a simulated LAN with the same timing.
+#
+# A trace is a JSON lines file with one object for each request, with the offset from
+# the first request in microseconds, the hash, the item size and the outcome. The
+# client address and request ID are dropped, and the hash is replaced with a keyed
+# HMAC so that requests for the same item can still be matched. Use the same --key
+# when capturing from several machines so the traces can be merged.
+#
+#   $ contrib/passim-trace.py capture --access-log /var/log/passim/access.log > t.json
+#   $ sudo contrib/passim-trace.py replay --speedup 10 t.json
+#   $ sudo contrib/passim-trace.py replay --lan 8 --passimd build/src/passimd t.json
+
+import argparse
+import collections
+import concurrent.futures
+import datetime
+import hashlib
+import hmac
+import http.client
+import importlib.util
+import json
+import os
+import shutil
+import ssl
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from gi.repository import Gio, GLib
+
+CONTRIB_DIR = os.path.dirname(os.path.abspath(__file__))
+EPOCH = datetime.datetime(1970, 1, 1, tzinfo=datetime.timezone.utc)
+
+
+def _load_lan_sim():
+    spec = importlib.util.spec_from_file_location(
+        "passim_lan_sim", os.path.join(CONTRIB_DIR, "passim-lan-sim.py")
+    )
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def _read_access_log(fn):
+    """yields (realtime_us, hash, outcome, bytes) from the JSON lines file"""
+    with open(fn) as f:
+        for line in f:
+            entry = json.loads(line)
+            if "hash" not in entry or "timestamp" not in entry:
+                continue
+            dt = datetime.datetime.fromisoformat(
+                entry["timestamp"].replace("Z", "+00:00")
+            )
+            yield (
+                (dt - EPOCH) // datetime.timedelta(microseconds=1),
+                entry["hash"],
+                entry["outcome"],
+                entry["bytes"],
+            )
+
+
+def _read_journal(since):
+    """yields (realtime_us, hash, outcome, bytes) from the systemd journal"""
+    cmd = ["journalctl", "--output=json", "--no-pager", "SYSLOG_IDENTIFIER=passimd"]
+    if since:
+        cmd.append("--since={}".format(since))
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, text=True)
+    for line in proc.stdout:
+        entry = json.loads(line)
+        if not entry.get("PASSIM_HASH"):
+            continue
+        yield (
+            int(entry["__REALTIME_TIMESTAMP"]),
+            entry["PASSIM_HASH"],
+            entry["PASSIM_OUTCOME"],
+            int(entry["PASSIM_BYTES"]),
+        )
+    proc.wait()
+
+
+def capture(args):
+    key = bytes.fromhex(args.key) if args.key else os.urandom(32)
+    if args.access_log:
+        records = list(_read_access_log(args.access_log))
+    else:
+        records = list(_read_journal(args.since))
+    if not records:
+        print("no requests found", file=sys.stderr)
+        return 1
+    records.sort(key=lambda record: record[0])
+
+    # the size is only known when the item was served locally
+    sizes = collections.defaultdict(int)
+    for _, hash, outcome, size in records:
+        if outcome == "served":
+            sizes[hash] = max(sizes[hash], size)
+    anonymised = {}
+    for _, hash, _, _ in records:
+        if hash not in anonymised:
+            anonymised[hash] = hmac.new(key, hash.encode(), hashlib.sha256).hexdigest()
+    start = records[0][0]
+    for timestamp, hash, outcome, _ in records:
+        print(
+            json.dumps(
+                {
+                    "offset_us": timestamp - start,
+                    "hash": anonymised[hash],
+                    "size": sizes[hash],
+                    "outcome": outcome,
+                }
+            )
+        )
+    return 0
+
+
+class Item:
+    """a synthetic item standing in for one hash in the trace"""
+
+    def __init__(self, index, size):
+        self.basename = "trace{}.bin".format(index)
+        self.blob = os.urandom(size)
+        self.hash = hashlib.sha256(self.blob).hexdigest()
+        self.placement = None
+        self.served = 0
+
+
+class LocalDaemon:
+    """the daemon on the system bus, which cannot have any peers"""
+
+    def __init__(self, port):
+        self.port = port
+        self.connection = Gio.bus_get_sync(Gio.BusType.SYSTEM, None)
+
+    def call(self, method_name, parameters, fd_list=None):
+        val, _ = self.connection.call_with_unix_fd_list_sync(
+            "org.freedesktop.Passim",
+            "/",
+            "org.freedesktop.Passim",
+            method_name,
+            parameters,
+            None,
+            Gio.DBusCallFlags.NONE,
+            60000,
+            fd_list,
+            None,
+        )
+        return val
+
+    def get_statistics(self):
+        return self.call("GetStatistics", None).unpack()[0]
+
+    def publish(self, item, share_limit):
+        rfd, wfd = os.pipe()
+        writer = threading.Thread(
+            target=lambda: (os.write(wfd, item.blob), os.close(wfd))
+        )
+        writer.start()
+        attrs = {
+            "filename": GLib.Variant("s", item.basename),
+            "max-age": GLib.Variant("u", 24 * 60 * 60),
+            "share-limit": GLib.Variant("u", share_limit),
+        }
+        try:
+            self.call(
+                "Publish",
+                GLib.Variant("(ha{sv})", (0, attrs)),
+                Gio.UnixFDList.new_from_array([rfd]),
+            )
+        finally:
+            writer.join()
+
+    def unpublish(self, item):
+        try:
+            self.call("Unpublish", GLib.Variant("(s)", (item.hash,)))
+        except GLib.Error:
+            pass  # share-limited items may have already been deleted
+
+
+def _get(host, port, path):
+    conn = http.client.HTTPSConnection(
+        host, port, context=ssl._create_unverified_context(), timeout=60
+    )
+    try:
+        conn.request("GET", path)
+        response = conn.getresponse()
+        return response.status, response.getheader("Location"), len(response.read())
+    finally:
+        conn.close()
+
+
+class Replay:
+    def __init__(self, target, records, items, speedup, clients):
+        self.target = target
+        self.records = records
+        self.items = items
+        self.speedup = speedup
+        self.clients = clients
+        self.lock = threading.Lock()
+        self.results = collections.Counter()
+        self.bytes = collections.Counter()
+        self.latencies = []
+        self.lags = []
+        self.inflight = 0
+        self.inflight_max = 0
+        self.exhausted = 0
+
+    def fetch(self, item, due):
+        """served by the target, a peer, or it would have been fetched from the CDN"""
+        lag = max(0, time.monotonic() - due)
+        with self.lock:
+            self.inflight += 1
+            self.inflight_max = max(self.inflight_max, self.inflight)
+        start = time.monotonic()
+        result = "cdn"
+        size = len(item.blob)
+        try:
+            path = "/{}?sha256={}".format(item.basename, item.hash)
+            status, location, size = _get("127.0.0.1", self.target.port, path)
+            if status == 200:
+                result = "local"
+            elif status == 302 and location:
+                hostport, path = location.split("/", 3)[2:]
+                host, port = hostport.rsplit(":", 1)
+                status, _, size = _get(host, int(port), "/" + path)
+                if status == 200:
+                    result = "peer"
+        except OSError:
+            result = "error"
+        duration = time.monotonic() - start
+        with self.lock:
+            self.inflight -= 1
+            self.results[result] += 1
+            self.bytes[result] += size if result != "cdn" else len(item.blob)
+            self.latencies.append(duration)
+            self.lags.append(lag)
+            if item.placement == "local":
+                if result == "local":
+                    item.served += 1
+                elif item.served > 0:
+                    self.exhausted += 1
+
+    def run(self):
+        with concurrent.futures.ThreadPoolExecutor(self.clients) as executor:
+            start = time.monotonic()
+            for record in self.records:
+                due = start + record["offset_us"] / 1000000 / self.speedup
+                delay = due - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+                executor.submit(self.fetch, self.items[record["hash"]], due)
+        return time.monotonic() - start
+
+
+def _percentile(values, pct):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+def _statistics_delta(before, after, key):
+    return sum(a.get(key, 0) - b.get(key, 0) for b, a in zip(before, after))
+
+
+def replay(args):
+    with open(args.trace) as f:
+        records = [json.loads(line) for line in f if line.strip()]
+    if not records:
+        print("trace is empty", file=sys.stderr)
+        return 1
+
+    # served items were local to the recording host, redirects were on a peer, and
+    # anything else was fetched from the CDN
+    items = {}
+    for record in records:
+        item = items.get(record["hash"])
+        if item is None:
+            item = Item(len(items), record["size"] or args.size)
+            items[record["hash"]] = item
+        if record["outcome"] == "served":
+            item.placement = "local"
+        elif record["outcome"] == "redirect" and item.placement is None:
+            item.placement = "peer"
+
+    lan = None
+    root = None
+    if args.lan:
+        lan_sim = _load_lan_sim()
+        root = tempfile.mkdtemp(prefix="passim-trace-", dir=os.getcwd())
+        print("generating {}".format(root), file=sys.stderr)
+        lan = lan_sim.Lan(root, args.lan, args.port)
+        daemons = lan.daemons
+        for index, item in enumerate(items.values()):
+            if item.placement == "local":
+                daemons[0].add_item(item.basename, item.blob, args.share_limit)
+            elif item.placement == "peer":
+                for i in range(args.replicas):
+                    daemon = daemons[1 + (index + i) % (args.lan - 1)]
+                    daemon.add_item(item.basename, item.blob)
+        target = daemons[0]
+    else:
+        target = LocalDaemon(args.port)
+        daemons = [target]
+        for item in items.values():
+            if item.placement == "local":
+                target.publish(item, args.share_limit)
+
+    try:
+        if lan:
+            lan.start(args.passimd, args.latency, args.loss, 0, args.timeout)
+        before = [daemon.get_statistics() for daemon in daemons]
+        rep = Replay(target, records, items, args.speedup, args.clients)
+        duration = rep.run()
+        after = [daemon.get_statistics() for daemon in daemons]
+    finally:
+        if lan:
+            lan.stop()
+            if not args.keep:
+                shutil.rmtree(root)
+        else:
+            for item in items.values():
+                if item.placement == "local":
+                    target.unpublish(item)
+
+    total = sum(rep.results.values())
+    total_bytes = sum(rep.bytes.values())
+    offload = rep.results["local"] + rep.results["peer"]
+    offload_bytes = rep.bytes["local"] + rep.bytes["peer"]
+    result = {
+        "requests": total,
+        "items": len(items),
+        "speedup": args.speedup,
+        "duration_s": round(duration, 3),
+        "concurrency_max": rep.inflight_max,
+        "results": dict(rep.results),
+        "offload": round(offload / total, 3) if total else 0,
+        "offload_bytes": round(offload_bytes / total_bytes, 3) if total_bytes else 0,
+        "latency_p50_ms": round(_percentile(rep.latencies, 50) * 1000, 3),
+        "latency_p99_ms": round(_percentile(rep.latencies, 99) * 1000, 3),
+        "lag_p99_ms": round(_percentile(rep.lags, 99) * 1000, 3),
+        "share_limit_deletions": _statistics_delta(
+            before, after, "share-limit-deletions"
+        ),
+        "share_limit_fallbacks": rep.exhausted,
+    }
+    if args.json:
+        print(json.dumps(result))
+        return 0
+    print("Requests:      {requests} in {duration_s:.2f}s".format(**result))
+    print("Concurrency:   {concurrency_max} max".format(**result))
+    for name, count in sorted(rep.results.items()):
+        print("  {:12} {}".format(name, count))
+    print(
+        "CDN offload:   {:.1f}% of requests, {:.1f}% of bytes".format(
+            result["offload"] * 100, result["offload_bytes"] * 100
+        )
+    )
+    print(
+        "Latency:       p50 {latency_p50_ms:.1f} ms, "
+        "p99 {latency_p99_ms:.1f} ms".format(**result)
+    )
+    print("Schedule lag:  p99 {lag_p99_ms:.1f} ms".format(**result))
+    print(
+        "Share limit:   {share_limit_deletions} items deleted, "
+        "{share_limit_fallbacks} requests then fell back".format(**result)
+    )
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Capture and replay passimd traces")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    parser_capture = subparsers.add_parser("capture", help="write a trace to stdout")
+    parser_capture.add_argument("--access-log", help="JSON lines access log")
+    parser_capture.add_argument("--since", help="start time when using the journal")
+    parser_capture.add_argument("--key", help="HMAC key as hex, default is random")
+    parser_capture.set_defaults(func=capture)
+
+    parser_replay = subparsers.add_parser("replay", help="replay a trace")
+    parser_replay.add_argument("trace")
+    parser_replay.add_argument("--speedup", type=float, default=1)
+    parser_replay.add_argument("--clients", type=int, default=64)
+    parser_replay.add_argument("--port", type=int, default=27500)
+    parser_replay.add_argument(
+        "--size", type=int, default=65536, help="bytes when the size is unknown"
+    )
+    parser_replay.add_argument(
+        "--share-limit", type=int, default=5, help="for the locally served items"
+    )
+    parser_replay.add_argument("--lan", type=int, help="simulate a LAN of N daemons")
+    parser_replay.add_argument("--passimd", default="build/src/passimd")
+    parser_replay.add_argument("--replicas", type=int, default=1)
+    parser_replay.add_argument("--latency", type=int, default=0)
+    parser_replay.add_argument("--loss", type=float, default=0)
+    parser_replay.add_argument("--timeout", type=float, default=120)
+    parser_replay.add_argument("--json", action="store_true", help="output JSON")
+    parser_replay.add_argument("--keep", action="store_true")
+    parser_replay.set_defaults(func=replay)
+
+    args = parser.parse_args()
+    if getattr(args, "lan", None) is not None and args.lan < 2:
+        parser.error("--lan needs at least two daemons")
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -257,6 +257,45 @@ passim_client_unpublish(PassimClient *self, const gchar *hash, GError **error)
 	return TRUE;
 }
 
+/**
+ * passim_client_get_statistics:
+ * @self: a #PassimClient
+ * @error: (nullable): optional return location for an error
+ *
+ * Gets the serving statistics from the daemon, for instance the uptime, the number of requests
+ * and bytes served, the current rates, and the per-item statistics in `items`.
+ *
+ * Returns: (transfer full): a #GVariant of type `a{sv}`, or %NULL for error
+ *
+ * Since: 0.1.7
+ **/
+GVariant *
+passim_client_get_statistics(PassimClient *self, GError **error)
+{
+	PassimClientPrivate *priv = GET_PRIVATE(self);
+	g_autoptr(GVariant) val = NULL;
+
+	g_return_val_if_fail(PASSIM_IS_CLIENT(self), NULL);
+	g_return_val_if_fail(priv->proxy != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	val = g_dbus_proxy_call_sync(priv->proxy,
+				     "GetStatistics",
+				     NULL,
+				     G_DBUS_CALL_FLAGS_NONE,
+				     1500,
+				     NULL,
+				     error);
+	if (val == NULL) {
+		if (error != NULL)
+			g_dbus_error_strip_remote_error(*error);
+		return NULL;
+	}
+
+	/* success */
+	return g_variant_get_child_value(val, 0);
+}
+
 static GUnixInputStream *
 passim_client_input_stream_from_bytes(GBytes *bytes, GError **error)
 {
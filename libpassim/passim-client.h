@@ -53,5 +53,7 @@ gboolean
 passim_client_publish(PassimClient *self, PassimItem *item, GError **error);
 gboolean
 passim_client_unpublish(PassimClient *self, const gchar *hash, GError **error);
+GVariant *
+passim_client_get_statistics(PassimClient *self, GError **error);
 
 G_END_DECLS
@@ -21,14 +21,19 @@ typedef struct {
 	PassimItemFlags flags;
 	gchar *basename;
 	gchar *cmdline;
+	gchar *uri;
+	gchar *etag;
 	guint32 max_age;
 	guint32 share_limit;
+	guint32 share_limit_effective;
 	guint32 share_count;
 	guint64 size;
+	guint64 served_size;
 	GFile *file;
 	GBytes *bytes;
 	GInputStream *stream;
 	GDateTime *ctime;
+	GDateTime *atime;
 } PassimItemPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE(PassimItem, passim_item, G_TYPE_OBJECT)
@@ -161,6 +166,89 @@ passim_item_set_cmdline(PassimItem *self, const gchar *cmdline)
 	priv->cmdline = g_strdup(cmdline);
 }
 
+/**
+ * passim_item_get_uri:
+ * @self: a #PassimItem
+ *
+ * Gets the URI the file was originally downloaded from.
+ *
+ * Returns: the URI, or %NULL if unset
+ *
+ * Since: 0.1.7
+ **/
+const gchar *
+passim_item_get_uri(PassimItem *self)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(PASSIM_IS_ITEM(self), NULL);
+	return priv->uri;
+}
+
+/**
+ * passim_item_set_uri:
+ * @self: a #PassimItem
+ * @uri: (nullable): the origin URI, e.g. `https://example.com/firmware.cab`
+ *
+ * Sets the URI the file was originally downloaded from, so that other machines that only know
+ * the URI can find the item.
+ *
+ * Since: 0.1.7
+ **/
+void
+passim_item_set_uri(PassimItem *self, const gchar *uri)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(PASSIM_IS_ITEM(self));
+
+	/* not changed */
+	if (g_strcmp0(priv->uri, uri) == 0)
+		return;
+
+	g_free(priv->uri);
+	priv->uri = g_strdup(uri);
+}
+
+/**
+ * passim_item_get_etag:
+ * @self: a #PassimItem
+ *
+ * Gets the ETag sent by the origin server when the file was downloaded.
+ *
+ * Returns: the ETag, or %NULL if unset
+ *
+ * Since: 0.1.7
+ **/
+const gchar *
+passim_item_get_etag(PassimItem *self)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(PASSIM_IS_ITEM(self), NULL);
+	return priv->etag;
+}
+
+/**
+ * passim_item_set_etag:
+ * @self: a #PassimItem
+ * @etag: (nullable): the ETag, including any quotes
+ *
+ * Sets the ETag sent by the origin server when the file was downloaded from the URI.
+ *
+ * Since: 0.1.7
+ **/
+void
+passim_item_set_etag(PassimItem *self, const gchar *etag)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(PASSIM_IS_ITEM(self));
+
+	/* not changed */
+	if (g_strcmp0(priv->etag, etag) == 0)
+		return;
+
+	g_free(priv->etag);
+	priv->etag = g_strdup(etag);
+}
+
 /**
  * passim_item_get_age:
  * @self: a #PassimItem
@@ -252,6 +340,42 @@ passim_item_set_share_limit(PassimItem *self, guint32 share_limit)
 	priv->share_limit = share_limit;
 }
 
+/**
+ * passim_item_get_share_limit_effective:
+ * @self: a #PassimItem
+ *
+ * Gets the share limit the daemon is actually using, which may be more or less than the share
+ * limit that was requested depending on how many other machines have the item.
+ *
+ * Returns: share limit, or 0 if the requested share limit is used
+ *
+ * Since: 0.1.7
+ **/
+guint32
+passim_item_get_share_limit_effective(PassimItem *self)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(PASSIM_IS_ITEM(self), 0);
+	return priv->share_limit_effective;
+}
+
+/**
+ * passim_item_set_share_limit_effective:
+ * @self: a #PassimItem
+ * @share_limit_effective: the share limit, or 0
+ *
+ * Sets the share limit the daemon is actually using.
+ *
+ * Since: 0.1.7
+ **/
+void
+passim_item_set_share_limit_effective(PassimItem *self, guint32 share_limit_effective)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(PASSIM_IS_ITEM(self));
+	priv->share_limit_effective = share_limit_effective;
+}
+
 /**
  * passim_item_get_share_count:
  * @self: a #PassimItem
@@ -322,6 +446,41 @@ passim_item_set_size(PassimItem *self, guint64 size)
 	priv->size = size;
 }
 
+/**
+ * passim_item_get_served_size:
+ * @self: a #PassimItem
+ *
+ * Gets the total number of bytes of the file sent to other machines.
+ *
+ * Returns: size in bytes, or 0 if unset
+ *
+ * Since: 0.1.7
+ **/
+guint64
+passim_item_get_served_size(PassimItem *self)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(PASSIM_IS_ITEM(self), 0);
+	return priv->served_size;
+}
+
+/**
+ * passim_item_set_served_size:
+ * @self: a #PassimItem
+ * @served_size: size in bytes, or 0
+ *
+ * Sets the total number of bytes of the file sent to other machines.
+ *
+ * Since: 0.1.7
+ **/
+void
+passim_item_set_served_size(PassimItem *self, guint64 served_size)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(PASSIM_IS_ITEM(self));
+	priv->served_size = served_size;
+}
+
 /**
  * passim_item_get_file:
  * @self: a #PassimItem
@@ -494,6 +653,50 @@ passim_item_set_ctime(PassimItem *self, GDateTime *ctime)
 		priv->ctime = g_date_time_ref(ctime);
 }
 
+/**
+ * passim_item_get_atime:
+ * @self: a #PassimItem
+ *
+ * Gets the time the file was last requested by another machine.
+ *
+ * Returns: (transfer none): the access time, or %NULL if unset
+ *
+ * Since: 0.1.7
+ **/
+GDateTime *
+passim_item_get_atime(PassimItem *self)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(PASSIM_IS_ITEM(self), NULL);
+	return priv->atime;
+}
+
+/**
+ * passim_item_set_atime:
+ * @self: a #PassimItem
+ * @atime: (nullable): a #GDateTime
+ *
+ * Sets the time the file was last requested by another machine.
+ *
+ * Since: 0.1.7
+ **/
+void
+passim_item_set_atime(PassimItem *self, GDateTime *atime)
+{
+	PassimItemPrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(PASSIM_IS_ITEM(self));
+
+	/* not changed */
+	if (priv->atime == atime)
+		return;
+	if (priv->atime != NULL) {
+		g_date_time_unref(priv->atime);
+		priv->atime = NULL;
+	}
+	if (atime != NULL)
+		priv->atime = g_date_time_ref(atime);
+}
+
 #if !GLIB_CHECK_VERSION(2, 70, 0)
 static GDateTime *
 g_file_info_get_creation_date_time(GFileInfo *info)
@@ -583,6 +786,10 @@ passim_item_to_variant(PassimItem *self)
 				      "cmdline",
 				      g_variant_new_string(priv->cmdline));
 	}
+	if (priv->uri != NULL)
+		g_variant_builder_add(&builder, "{sv}", "uri", g_variant_new_string(priv->uri));
+	if (priv->etag != NULL)
+		g_variant_builder_add(&builder, "{sv}", "etag", g_variant_new_string(priv->etag));
 	if (priv->max_age != 0) {
 		g_variant_builder_add(&builder,
 				      "{sv}",
@@ -598,6 +805,12 @@ passim_item_to_variant(PassimItem *self)
 				      "share-limit",
 				      g_variant_new_uint32(priv->share_limit));
 	}
+	if (priv->share_limit_effective != 0) {
+		g_variant_builder_add(&builder,
+				      "{sv}",
+				      "share-limit-effective",
+				      g_variant_new_uint32(priv->share_limit_effective));
+	}
 	if (priv->size != 0)
 		g_variant_builder_add(&builder, "{sv}", "size", g_variant_new_uint64(priv->size));
 	if (priv->share_count != 0) {
@@ -612,6 +825,18 @@ passim_item_to_variant(PassimItem *self)
 				      "ctime",
 				      g_variant_new_int64(g_date_time_to_unix(priv->ctime)));
 	}
+	if (priv->served_size != 0) {
+		g_variant_builder_add(&builder,
+				      "{sv}",
+				      "served-size",
+				      g_variant_new_uint64(priv->served_size));
+	}
+	if (priv->atime != NULL) {
+		g_variant_builder_add(&builder,
+				      "{sv}",
+				      "atime",
+				      g_variant_new_int64(g_date_time_to_unix(priv->atime)));
+	}
 	return g_variant_builder_end(&builder);
 }
 
@@ -644,10 +869,16 @@ passim_item_from_variant(GVariant *variant)
 			priv->cmdline = g_variant_dup_string(value, NULL);
 		if (g_strcmp0(key, "hash") == 0)
 			priv->hash = g_variant_dup_string(value, NULL);
+		if (g_strcmp0(key, "uri") == 0)
+			priv->uri = g_variant_dup_string(value, NULL);
+		if (g_strcmp0(key, "etag") == 0)
+			priv->etag = g_variant_dup_string(value, NULL);
 		if (g_strcmp0(key, "max-age") == 0)
 			priv->max_age = g_variant_get_uint32(value);
 		if (g_strcmp0(key, "share-limit") == 0)
 			priv->share_limit = g_variant_get_uint32(value);
+		if (g_strcmp0(key, "share-limit-effective") == 0)
+			priv->share_limit_effective = g_variant_get_uint32(value);
 		if (g_strcmp0(key, "size") == 0)
 			priv->size = g_variant_get_uint64(value);
 		if (g_strcmp0(key, "share-count") == 0)
@@ -659,6 +890,13 @@ passim_item_from_variant(GVariant *variant)
 			    g_date_time_new_from_unix_utc(g_variant_get_int64(value));
 			passim_item_set_ctime(self, dt);
 		}
+		if (g_strcmp0(key, "served-size") == 0)
+			priv->served_size = g_variant_get_uint64(value);
+		if (g_strcmp0(key, "atime") == 0) {
+			g_autoptr(GDateTime) dt =
+			    g_date_time_new_from_unix_utc(g_variant_get_int64(value));
+			passim_item_set_atime(self, dt);
+		}
 		g_variant_unref(value);
 	}
 	return g_steal_pointer(&self);
@@ -811,6 +1049,8 @@ passim_item_flag_to_string(PassimItemFlags item_flag)
 		return "disabled";
 	if (item_flag == PASSIM_ITEM_FLAG_NEXT_REBOOT)
 		return "next-reboot";
+	if (item_flag == PASSIM_ITEM_FLAG_REPLICATING)
+		return "replicating";
 	return NULL;
 }
 
@@ -833,6 +1073,8 @@ passim_item_flag_from_string(const gchar *item_flag)
 		return PASSIM_ITEM_FLAG_DISABLED;
 	if (g_strcmp0(item_flag, "next-reboot") == 0)
 		return PASSIM_ITEM_FLAG_NEXT_REBOOT;
+	if (g_strcmp0(item_flag, "replicating") == 0)
+		return PASSIM_ITEM_FLAG_REPLICATING;
 	return PASSIM_ITEM_FLAG_UNKNOWN;
 }
 
@@ -862,14 +1104,24 @@ passim_item_to_string(PassimItem *self)
 	}
 	if (priv->cmdline != NULL)
 		g_string_append_printf(str, " cmdline:%s", priv->cmdline);
+	if (priv->uri != NULL)
+		g_string_append_printf(str, " uri:%s", priv->uri);
+	if (priv->etag != NULL)
+		g_string_append_printf(str, " etag:%s", priv->etag);
 	if (priv->max_age != G_MAXUINT32)
 		g_string_append_printf(str, " age:%u/%u", passim_item_get_age(self), priv->max_age);
 	if (priv->share_limit != G_MAXUINT32)
 		g_string_append_printf(str, " share:%u/%u", priv->share_count, priv->share_limit);
+	if (priv->share_limit_effective != 0)
+		g_string_append_printf(str, " effective:%u", priv->share_limit_effective);
 	if (priv->size != 0) {
 		g_autofree gchar *size = g_format_size(priv->size);
 		g_string_append_printf(str, " size:%s", size);
 	}
+	if (priv->served_size != 0) {
+		g_autofree gchar *served_size = g_format_size(priv->served_size);
+		g_string_append_printf(str, " served:%s", served_size);
+	}
 	return g_string_free(str, FALSE);
 }
 
@@ -895,9 +1147,13 @@ passim_item_finalize(GObject *object)
 		g_object_unref(priv->stream);
 	if (priv->ctime != NULL)
 		g_date_time_unref(priv->ctime);
+	if (priv->atime != NULL)
+		g_date_time_unref(priv->atime);
 	g_free(priv->hash);
 	g_free(priv->basename);
 	g_free(priv->cmdline);
+	g_free(priv->uri);
+	g_free(priv->etag);
 
 	G_OBJECT_CLASS(passim_item_parent_class)->finalize(object);
 }
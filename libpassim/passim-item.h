@@ -52,6 +52,15 @@ struct _PassimItemClass {
  */
 #define PASSIM_ITEM_FLAG_NEXT_REBOOT (1llu << 1)
 
+/**
+ * PASSIM_ITEM_FLAG_REPLICATING:
+ *
+ * The item is kept until enough other machines have a copy.
+ *
+ * Since: 0.1.7
+ */
+#define PASSIM_ITEM_FLAG_REPLICATING (1llu << 2)
+
 /**
  * PASSIM_ITEM_FLAG_UNKNOWN:
  *
@@ -87,6 +96,14 @@ const gchar *
 passim_item_get_cmdline(PassimItem *self);
 void
 passim_item_set_cmdline(PassimItem *self, const gchar *cmdline);
+const gchar *
+passim_item_get_uri(PassimItem *self);
+void
+passim_item_set_uri(PassimItem *self, const gchar *uri);
+const gchar *
+passim_item_get_etag(PassimItem *self);
+void
+passim_item_set_etag(PassimItem *self, const gchar *etag);
 guint32
 passim_item_get_age(PassimItem *self);
 guint32
@@ -97,10 +114,18 @@ guint32
 passim_item_get_share_limit(PassimItem *self);
 void
 passim_item_set_share_limit(PassimItem *self, guint32 share_limit);
+guint32
+passim_item_get_share_limit_effective(PassimItem *self);
+void
+passim_item_set_share_limit_effective(PassimItem *self, guint32 share_limit_effective);
 guint64
 passim_item_get_size(PassimItem *self);
 void
 passim_item_set_size(PassimItem *self, guint64 size);
+guint64
+passim_item_get_served_size(PassimItem *self);
+void
+passim_item_set_served_size(PassimItem *self, guint64 served_size);
 guint32
 passim_item_get_share_count(PassimItem *self);
 void
@@ -121,6 +146,10 @@ GDateTime *
 passim_item_get_ctime(PassimItem *self);
 void
 passim_item_set_ctime(PassimItem *self, GDateTime *ctime);
+GDateTime *
+passim_item_get_atime(PassimItem *self);
+void
+passim_item_set_atime(PassimItem *self, GDateTime *atime);
 
 guint64
 passim_item_get_flags(PassimItem *self);
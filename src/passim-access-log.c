@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <stdatomic.h>
+
+#include "passim-access-log.h"
+#include "passim-metrics.h"
+
+/* must be a power of two */
+#define PASSIM_ACCESS_LOG_RING_SIZE 1024
+
+/*
+ * The main thread is the only producer and the writer thread is the only consumer, so the ring
+ * buffer only needs the head and tail indexes to be atomic -- the hot path never takes a lock
+ * and never formats anything. When the ring is empty the writer thread blocks on the wakeup queue,
+ * and the producer only pushes to it if the writer has said it is about to sleep.
+ */
+struct _PassimAccessLog {
+	GObject parent_instance;
+	PassimAccessLogEntry ring[PASSIM_ACCESS_LOG_RING_SIZE];
+	_Atomic guint64 head; /* written by the producer */
+	_Atomic guint64 tail; /* written by the consumer */
+	_Atomic gboolean stopping;
+	_Atomic gboolean sleeping; /* the writer is waiting for a wakeup */
+	GAsyncQueue *wakeup;
+	GThread *thread;
+	GOutputStream *stream; /* nullable, in which case use the journal */
+	gboolean write_failed;
+};
+
+G_DEFINE_TYPE(PassimAccessLog, passim_access_log, G_TYPE_OBJECT)
+
+static const gchar *
+passim_access_log_entry_get_outcome(const PassimAccessLogEntry *entry)
+{
+	return passim_metrics_outcome_to_string(
+	    passim_metrics_outcome_from_status(entry->status_code));
+}
+
+gchar *
+passim_access_log_entry_to_json(const PassimAccessLogEntry *entry)
+{
+	GString *str = g_string_new(NULL);
+	g_autoptr(GDateTime) dt_secs =
+	    g_date_time_new_from_unix_utc(entry->timestamp / G_USEC_PER_SEC);
+	g_autoptr(GDateTime) dt =
+	    dt_secs != NULL ? g_date_time_add(dt_secs, entry->timestamp % G_USEC_PER_SEC) : NULL;
+	g_autofree gchar *timestamp = dt != NULL ? g_date_time_format_iso8601(dt) : NULL;
+
+	/* client and hash are both validated before they are added to the entry */
+	g_string_append_printf(str, "{\"request_id\":%" G_GUINT64_FORMAT, entry->request_id);
+	if (timestamp != NULL)
+		g_string_append_printf(str, ",\"timestamp\":\"%s\"", timestamp);
+	g_string_append_printf(str, ",\"client\":\"%s\"", entry->client);
+	if (entry->hash[0] != '\0')
+		g_string_append_printf(str, ",\"hash\":\"%s\"", entry->hash);
+	g_string_append_printf(str, ",\"status\":%u", entry->status_code);
+	g_string_append_printf(str,
+			       ",\"outcome\":\"%s\"",
+			       passim_access_log_entry_get_outcome(entry));
+	g_string_append_printf(str, ",\"bytes\":%" G_GUINT64_FORMAT, entry->bytes);
+	if (entry->lookup_us >= 0)
+		g_string_append_printf(str, ",\"lookup_us\":%" G_GINT64_FORMAT, entry->lookup_us);
+	g_string_append_printf(str, ",\"first_byte_us\":%" G_GINT64_FORMAT, entry->first_byte_us);
+	g_string_append_printf(str, ",\"total_us\":%" G_GINT64_FORMAT "}", entry->total_us);
+	return g_string_free(str, FALSE);
+}
+
+static void
+passim_access_log_write_journal(const PassimAccessLogEntry *entry)
+{
+	const gchar *outcome = passim_access_log_entry_get_outcome(entry);
+	g_autofree gchar *message = NULL;
+	g_autofree gchar *request_id = g_strdup_printf("%" G_GUINT64_FORMAT, entry->request_id);
+	g_autofree gchar *status = g_strdup_printf("%u", entry->status_code);
+	g_autofree gchar *bytes = g_strdup_printf("%" G_GUINT64_FORMAT, entry->bytes);
+	g_autofree gchar *lookup = g_strdup_printf("%" G_GINT64_FORMAT, entry->lookup_us);
+	g_autofree gchar *first_byte = g_strdup_printf("%" G_GINT64_FORMAT, entry->first_byte_us);
+	g_autofree gchar *total = g_strdup_printf("%" G_GINT64_FORMAT, entry->total_us);
+	GLogField fields[] = {
+	    {"MESSAGE", NULL, -1},
+	    {"PRIORITY", "6", -1},
+	    {"SYSLOG_IDENTIFIER", "passimd", -1},
+	    {"PASSIM_REQUEST_ID", request_id, -1},
+	    {"PASSIM_CLIENT", entry->client, -1},
+	    {"PASSIM_HASH", entry->hash, -1},
+	    {"PASSIM_STATUS", status, -1},
+	    {"PASSIM_OUTCOME", outcome, -1},
+	    {"PASSIM_BYTES", bytes, -1},
+	    {"PASSIM_LOOKUP_USEC", lookup, -1},
+	    {"PASSIM_FIRST_BYTE_USEC", first_byte, -1},
+	    {"PASSIM_TOTAL_USEC", total, -1},
+	};
+
+	message = g_strdup_printf("%s %u %s %" G_GUINT64_FORMAT " bytes in %" G_GINT64_FORMAT "us",
+				  entry->client,
+				  entry->status_code,
+				  entry->hash[0] != '\0' ? entry->hash : "-",
+				  entry->bytes,
+				  entry->total_us);
+	fields[0].value = message;
+	g_log_writer_journald(G_LOG_LEVEL_INFO, fields, G_N_ELEMENTS(fields), NULL);
+}
+
+static void
+passim_access_log_flush(PassimAccessLog *self, GString *str)
+{
+	g_autoptr(GError) error = NULL;
+
+	if (str->len == 0 || self->write_failed)
+		return;
+	if (!g_output_stream_write_all(self->stream, str->str, str->len, NULL, NULL, &error) ||
+	    !g_output_stream_flush(self->stream, NULL, &error)) {
+		g_warning("failed to write access log, disabling: %s", error->message);
+		self->write_failed = TRUE;
+	}
+	g_string_truncate(str, 0);
+}
+
+static gpointer
+passim_access_log_thread_cb(gpointer user_data)
+{
+	PassimAccessLog *self = PASSIM_ACCESS_LOG(user_data);
+	g_autoptr(GString) str = g_string_new(NULL);
+
+	while (TRUE) {
+		gboolean stopping = atomic_load(&self->stopping);
+		guint64 head = atomic_load_explicit(&self->head, memory_order_acquire);
+		guint64 tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+		/* write everything in one batch */
+		for (; tail < head; tail++) {
+			PassimAccessLogEntry *entry =
+			    &self->ring[tail & (PASSIM_ACCESS_LOG_RING_SIZE - 1)];
+			if (self->stream != NULL) {
+				g_autofree gchar *json = passim_access_log_entry_to_json(entry);
+				g_string_append_printf(str, "%s\n", json);
+			} else {
+				passim_access_log_write_journal(entry);
+			}
+		}
+		atomic_store_explicit(&self->tail, tail, memory_order_release);
+		if (self->stream != NULL)
+			passim_access_log_flush(self, str);
+
+		/* drained everything pushed before we were asked to stop */
+		if (stopping)
+			break;
+
+		/* an entry pushed after we drained may not have seen the flag in time */
+		atomic_store(&self->sleeping, TRUE);
+		if (atomic_load(&self->head) != tail || atomic_load(&self->stopping)) {
+			if (atomic_exchange(&self->sleeping, FALSE))
+				continue;
+		}
+		g_async_queue_pop(self->wakeup);
+	}
+	return NULL;
+}
+
+/* the target is either PASSIM_ACCESS_LOG_TARGET_JOURNAL or a JSON lines filename */
+gboolean
+passim_access_log_open(PassimAccessLog *self, const gchar *target, GError **error)
+{
+	g_return_val_if_fail(PASSIM_IS_ACCESS_LOG(self), FALSE);
+	g_return_val_if_fail(target != NULL, FALSE);
+	g_return_val_if_fail(self->thread == NULL, FALSE);
+
+	if (g_strcmp0(target, PASSIM_ACCESS_LOG_TARGET_JOURNAL) != 0) {
+		g_autoptr(GFile) file = g_file_new_for_path(target);
+		g_autoptr(GFileOutputStream) stream = NULL;
+
+		if (!passim_mkdir_parent(target, error))
+			return FALSE;
+		stream = g_file_append_to(file, G_FILE_CREATE_PRIVATE, NULL, error);
+		if (stream == NULL)
+			return FALSE;
+		self->stream = G_OUTPUT_STREAM(g_steal_pointer(&stream));
+	}
+	self->thread = g_thread_new("passim-access-log", passim_access_log_thread_cb, self);
+	return TRUE;
+}
+
+/* only ever called from the main thread; returns FALSE if the entry was dropped */
+gboolean
+passim_access_log_push(PassimAccessLog *self, const PassimAccessLogEntry *entry)
+{
+	guint64 head;
+
+	g_return_val_if_fail(PASSIM_IS_ACCESS_LOG(self), FALSE);
+	g_return_val_if_fail(entry != NULL, FALSE);
+
+	if (self->thread == NULL)
+		return FALSE;
+	head = atomic_load_explicit(&self->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&self->tail, memory_order_acquire) >=
+	    PASSIM_ACCESS_LOG_RING_SIZE)
+		return FALSE;
+	self->ring[head & (PASSIM_ACCESS_LOG_RING_SIZE - 1)] = *entry;
+	atomic_store(&self->head, head + 1);
+	if (atomic_exchange(&self->sleeping, FALSE))
+		g_async_queue_push(self->wakeup, GUINT_TO_POINTER(1));
+	return TRUE;
+}
+
+static void
+passim_access_log_init(PassimAccessLog *self)
+{
+	self->wakeup = g_async_queue_new();
+}
+
+static void
+passim_access_log_finalize(GObject *object)
+{
+	PassimAccessLog *self = PASSIM_ACCESS_LOG(object);
+
+	if (self->thread != NULL) {
+		atomic_store(&self->stopping, TRUE);
+		g_async_queue_push(self->wakeup, GUINT_TO_POINTER(1));
+		g_thread_join(self->thread);
+	}
+	g_async_queue_unref(self->wakeup);
+	if (self->stream != NULL)
+		g_object_unref(self->stream);
+
+	G_OBJECT_CLASS(passim_access_log_parent_class)->finalize(object);
+}
+
+static void
+passim_access_log_class_init(PassimAccessLogClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = passim_access_log_finalize;
+}
+
+PassimAccessLog *
+passim_access_log_new(void)
+{
+	PassimAccessLog *self;
+	self = g_object_new(PASSIM_TYPE_ACCESS_LOG, NULL);
+	return PASSIM_ACCESS_LOG(self);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include "passim-common.h"
+
+#define PASSIM_TYPE_ACCESS_LOG (passim_access_log_get_type())
+G_DECLARE_FINAL_TYPE(PassimAccessLog, passim_access_log, PASSIM, ACCESS_LOG, GObject)
+
+/* special value for the AccessLog config key, anything else is a filename */
+#define PASSIM_ACCESS_LOG_TARGET_JOURNAL "journal"
+
+typedef struct {
+	guint64 request_id;
+	gint64 timestamp; /* realtime, µs */
+	gchar client[48]; /* INET6_ADDRSTRLEN */
+	gchar hash[136];  /* sha256 hex, or {kind}-{hex} for aliases, or empty */
+	guint status_code;
+	guint64 bytes;
+	gint64 lookup_us; /* or -1 if not required */
+	gint64 first_byte_us;
+	gint64 total_us;
+} PassimAccessLogEntry;
+
+PassimAccessLog *
+passim_access_log_new(void);
+gboolean
+passim_access_log_open(PassimAccessLog *self, const gchar *target, GError **error);
+gboolean
+passim_access_log_push(PassimAccessLog *self, const PassimAccessLogEntry *entry);
+gchar *
+passim_access_log_entry_to_json(const PassimAccessLogEntry *entry);
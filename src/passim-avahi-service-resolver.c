@@ -8,6 +8,7 @@
 
 #include "passim-avahi-service-resolver.h"
 #include "passim-avahi.h"
+#include "passim-fault.h"
 
 typedef struct {
 	gchar *object_path;
@@ -123,6 +124,61 @@ passim_avahi_service_resolver_signal(GTask *task, const gchar *signal_name, GVar
 		  g_variant_get_type_string(parameters));
 }
 
+typedef struct {
+	GTask *task;
+	gchar *signal_name;
+	GVariant *parameters;
+} PassimAvahiDelayedSignal;
+
+static void
+passim_avahi_delayed_signal_free(PassimAvahiDelayedSignal *delayed)
+{
+	g_object_unref(delayed->task);
+	g_free(delayed->signal_name);
+	g_variant_unref(delayed->parameters);
+	g_free(delayed);
+}
+
+static gboolean
+passim_avahi_service_resolver_delay_cb(gpointer user_data)
+{
+	PassimAvahiDelayedSignal *delayed = (PassimAvahiDelayedSignal *)user_data;
+	passim_avahi_service_resolver_signal(delayed->task,
+					     delayed->signal_name,
+					     delayed->parameters);
+	return G_SOURCE_REMOVE;
+}
+
+/* a slow or failing Avahi, when testing */
+static void
+passim_avahi_service_resolver_signal_fault(GTask *task,
+					   const gchar *signal_name,
+					   GVariant *parameters)
+{
+	guint delay_ms = 0;
+	g_autoptr(GError) error = NULL;
+
+	if (!passim_fault_roll(PASSIM_FAULT_POINT_RESOLVER_SIGNAL, &delay_ms, &error)) {
+		g_autoptr(GVariant) failure =
+		    g_variant_ref_sink(g_variant_new("(s)", error->message));
+		passim_avahi_service_resolver_signal(task, "Failure", failure);
+		return;
+	}
+	if (delay_ms > 0) {
+		PassimAvahiDelayedSignal *delayed = g_new0(PassimAvahiDelayedSignal, 1);
+		delayed->task = g_object_ref(task);
+		delayed->signal_name = g_strdup(signal_name);
+		delayed->parameters = g_variant_ref(parameters);
+		g_timeout_add_full(G_PRIORITY_DEFAULT,
+				   delay_ms,
+				   passim_avahi_service_resolver_delay_cb,
+				   delayed,
+				   (GDestroyNotify)passim_avahi_delayed_signal_free);
+		return;
+	}
+	passim_avahi_service_resolver_signal(task, signal_name, parameters);
+}
+
 static void
 passim_avahi_service_resolver_signal_cb(GDBusProxy *proxy,
 					const gchar *sender_name,
@@ -139,7 +195,7 @@ passim_avahi_service_resolver_signal_cb(GDBusProxy *proxy,
 		g_dbus_connection_signal_unsubscribe(helper->connection, helper->subscription_id);
 		helper->subscription_id = 0;
 	}
-	passim_avahi_service_resolver_signal(task, signal_name, parameters);
+	passim_avahi_service_resolver_signal_fault(task, signal_name, parameters);
 }
 
 static void
@@ -166,7 +222,9 @@ passim_avahi_service_resolver_start_cb(GObject *source, GAsyncResult *res, gpoin
 		g_info("working around Ahavi bug: %s sent before Start(), see "
 		       "https://github.com/lathiat/avahi/pull/468",
 		       signal->signal_name);
-		passim_avahi_service_resolver_signal(task, signal->signal_name, signal->parameters);
+		passim_avahi_service_resolver_signal_fault(task,
+							   signal->signal_name,
+							   signal->parameters);
 	}
 }
 
@@ -10,6 +10,8 @@
 #include "passim-avahi-service-resolver.h"
 #include "passim-avahi-service.h"
 #include "passim-avahi.h"
+#include "passim-fault.h"
+#include "passim-trace.h"
 
 struct _PassimAvahi {
 	GObject parent_instance;
@@ -17,6 +19,7 @@ struct _PassimAvahi {
 	GKeyFile *config;
 	GDBusProxy *proxy;
 	GDBusProxy *proxy_eg;
+	PassimMetrics *metrics;
 };
 
 G_DEFINE_TYPE(PassimAvahi, passim_avahi, G_TYPE_OBJECT)
@@ -27,6 +30,23 @@ passim_avahi_get_name(PassimAvahi *self)
 	return self->name;
 }
 
+void
+passim_avahi_set_metrics(PassimAvahi *self, PassimMetrics *metrics)
+{
+	g_return_if_fail(PASSIM_IS_AVAHI(self));
+	g_set_object(&self->metrics, metrics);
+}
+
+/* returns the duration in µs */
+static gint64
+passim_avahi_observe(PassimAvahi *self, PassimMetricsHistogram histogram, gint64 start)
+{
+	gint64 duration = g_get_monotonic_time() - start;
+	if (self->metrics != NULL)
+		passim_metrics_histogram_observe(self->metrics, histogram, duration);
+	return duration;
+}
+
 static gchar *
 passim_avahi_truncate_hash(const gchar *hash)
 {
@@ -164,17 +184,15 @@ passim_avahi_unregister(PassimAvahi *self, GError **error)
 	return TRUE;
 }
 
-gboolean
-passim_avahi_register(PassimAvahi *self, gchar **keys, GError **error)
+static gboolean
+passim_avahi_register_keys(PassimAvahi *self, gchar **keys, GError **error)
 {
+	gint64 start_time;
 	g_autoptr(GVariant) val2 = NULL;
 	g_autoptr(GVariant) val4 = NULL;
 
-	g_return_val_if_fail(PASSIM_IS_AVAHI(self), FALSE);
-	g_return_val_if_fail(keys != NULL, FALSE);
-	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
-	g_return_val_if_fail(self->proxy != NULL, FALSE);
-
+	if (!passim_fault_check(PASSIM_FAULT_POINT_AVAHI_CALL, error))
+		return FALSE;
 	if (!passim_avahi_unregister(self, error))
 		return FALSE;
 	val2 = g_dbus_proxy_call_sync(self->proxy_eg,
@@ -201,6 +219,7 @@ passim_avahi_register(PassimAvahi *self, gchar **keys, GError **error)
 		if (!passim_avahi_register_subtype(self, keys[i], error))
 			return FALSE;
 	}
+	start_time = g_get_monotonic_time();
 	val4 = g_dbus_proxy_call_sync(self->proxy_eg,
 				      "Commit",
 				      NULL,
@@ -212,16 +231,44 @@ passim_avahi_register(PassimAvahi *self, gchar **keys, GError **error)
 		g_prefix_error(error, "failed to commit entry group: ");
 		return FALSE;
 	}
+	PASSIM_TRACE2(avahi__commit, g_strv_length(keys), g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "avahi-commit", NULL);
 
 	/* success */
 	return TRUE;
 }
 
+gboolean
+passim_avahi_register(PassimAvahi *self, gchar **keys, GError **error)
+{
+	gint64 start = g_get_monotonic_time();
+	gint64 duration;
+
+	g_return_val_if_fail(PASSIM_IS_AVAHI(self), FALSE);
+	g_return_val_if_fail(keys != NULL, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+	g_return_val_if_fail(self->proxy != NULL, FALSE);
+
+	if (!passim_avahi_register_keys(self, keys, error)) {
+		if (self->metrics != NULL) {
+			passim_metrics_counter_add(self->metrics,
+						   PASSIM_METRICS_COUNTER_AVAHI_REGISTER_FAILED,
+						   1);
+		}
+		return FALSE;
+	}
+	duration = passim_avahi_observe(self, PASSIM_METRICS_HISTOGRAM_AVAHI_REGISTER, start);
+	PASSIM_TRACE2(avahi__register, g_strv_length(keys), duration);
+	passim_trace_mark(start, "avahi-register", NULL);
+	return TRUE;
+}
+
 typedef struct {
 	GDBusProxy *proxy;
 	gchar *object_path;
 	gchar *hash;
 	gulong signal_id;
+	gint64 start; /* monotonic, µs */
 	GPtrArray *items;     /* of PassimAvahiService */
 	GPtrArray *addresses; /* of utf-8 */
 } PassimAvahiFindHelper;
@@ -248,12 +295,18 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimAvahiFindHelper, passim_avahi_find_helper_fr
 static void
 passim_avahi_service_resolve_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 {
+	gint64 duration;
 	g_autofree gchar *address = NULL;
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GTask) task = G_TASK(user_data);
+	PassimAvahi *self = PASSIM_AVAHI(g_task_get_source_object(task));
 	PassimAvahiFindHelper *helper = g_task_get_task_data(task);
 
 	address = passim_avahi_service_resolver_finish(res, &error);
+	duration =
+	    passim_avahi_observe(self, PASSIM_METRICS_HISTOGRAM_LOOKUP_RESOLVE, helper->start);
+	PASSIM_TRACE3(lookup__resolve, helper->hash, address != NULL, duration);
+	passim_trace_mark(helper->start, "avahi-resolve", helper->hash);
 	if (address == NULL) {
 		g_task_return_error(task, g_steal_pointer(&error));
 		return;
@@ -271,6 +324,7 @@ static void
 passim_avahi_service_resolve_item(GTask *task, PassimAvahiService *item)
 {
 	PassimAvahi *self = PASSIM_AVAHI(g_task_get_source_object(task));
+	PassimAvahiFindHelper *helper = g_task_get_task_data(task);
 
 	g_debug(
 	    "ServiceResolverPrepare{ iface:%i, proto:%i, name:%s, type:%s, domain:%s, flags:%u }",
@@ -280,6 +334,7 @@ passim_avahi_service_resolve_item(GTask *task, PassimAvahiService *item)
 	    item->type,
 	    item->domain,
 	    item->flags);
+	helper->start = g_get_monotonic_time();
 	passim_avahi_service_resolver_async(self->proxy,
 					    item,
 					    g_task_get_cancellable(task),
@@ -314,11 +369,20 @@ passim_avahi_service_resolve_next(GTask *task)
 static void
 passim_avahi_service_browser_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 {
+	gint64 duration;
 	g_autoptr(GTask) task = G_TASK(user_data);
 	g_autoptr(GError) error = NULL;
+	PassimAvahi *self = PASSIM_AVAHI(g_task_get_source_object(task));
 	PassimAvahiFindHelper *helper = g_task_get_task_data(task);
 
 	helper->items = passim_avahi_service_browser_finish(res, &error);
+	duration =
+	    passim_avahi_observe(self, PASSIM_METRICS_HISTOGRAM_LOOKUP_BROWSE, helper->start);
+	PASSIM_TRACE3(lookup__browse,
+		      helper->hash,
+		      helper->items != NULL ? helper->items->len : 0,
+		      duration);
+	passim_trace_mark(helper->start, "avahi-browse", helper->hash);
 	if (helper->items == NULL) {
 		g_task_return_error(task, g_steal_pointer(&error));
 		return;
@@ -330,6 +394,27 @@ passim_avahi_service_browser_cb(GObject *source, GAsyncResult *res, gpointer use
 	passim_avahi_service_resolve_next(g_steal_pointer(&task));
 }
 
+static void
+passim_avahi_find_start(GTask *task)
+{
+	PassimAvahi *self = PASSIM_AVAHI(g_task_get_source_object(task));
+	PassimAvahiFindHelper *helper = g_task_get_task_data(task);
+	g_autofree gchar *truncated_hash = passim_avahi_truncate_hash(helper->hash);
+
+	passim_avahi_service_browser_async(self->proxy,
+					   truncated_hash,
+					   g_task_get_cancellable(task),
+					   passim_avahi_service_browser_cb,
+					   task);
+}
+
+static gboolean
+passim_avahi_find_delay_cb(gpointer user_data)
+{
+	passim_avahi_find_start(G_TASK(user_data));
+	return G_SOURCE_REMOVE;
+}
+
 void
 passim_avahi_find_async(PassimAvahi *self,
 			const gchar *hash,
@@ -337,8 +422,9 @@ passim_avahi_find_async(PassimAvahi *self,
 			GAsyncReadyCallback callback,
 			gpointer callback_data)
 {
+	guint delay_ms = 0;
+	g_autoptr(GError) error = NULL;
 	g_autoptr(GTask) task = NULL;
-	g_autofree gchar *truncated_hash = passim_avahi_truncate_hash(hash);
 	g_autoptr(PassimAvahiFindHelper) helper = g_new0(PassimAvahiFindHelper, 1);
 
 	g_return_if_fail(PASSIM_IS_AVAHI(self));
@@ -347,17 +433,24 @@ passim_avahi_find_async(PassimAvahi *self,
 	g_return_if_fail(self->proxy != NULL);
 
 	helper->hash = g_strdup(hash);
+	helper->start = g_get_monotonic_time();
 	helper->addresses = g_ptr_array_new_with_free_func(g_free);
 
 	task = g_task_new(self, cancellable, callback, callback_data);
 	g_task_set_task_data(task,
 			     g_steal_pointer(&helper),
 			     (GDestroyNotify)passim_avahi_find_helper_free);
-	passim_avahi_service_browser_async(self->proxy,
-					   truncated_hash,
-					   cancellable,
-					   passim_avahi_service_browser_cb,
-					   g_steal_pointer(&task));
+
+	/* a stalled or failing Avahi, when testing */
+	if (!passim_fault_roll(PASSIM_FAULT_POINT_AVAHI_CALL, &delay_ms, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	if (delay_ms > 0) {
+		g_timeout_add(delay_ms, passim_avahi_find_delay_cb, g_steal_pointer(&task));
+		return;
+	}
+	passim_avahi_find_start(g_steal_pointer(&task));
 }
 
 /* element-type utf-8 */
@@ -387,6 +480,8 @@ passim_avahi_finalize(GObject *obj)
 		g_object_unref(self->proxy);
 	if (self->proxy_eg != NULL)
 		g_object_unref(self->proxy_eg);
+	if (self->metrics != NULL)
+		g_object_unref(self->metrics);
 	G_OBJECT_CLASS(passim_avahi_parent_class)->finalize(obj);
 }
 
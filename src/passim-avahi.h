@@ -7,6 +7,7 @@
 #pragma once
 
 #include "passim-common.h"
+#include "passim-metrics.h"
 
 #define PASSIM_TYPE_AVAHI (passim_avahi_get_type())
 G_DECLARE_FINAL_TYPE(PassimAvahi, passim_avahi, PASSIM, AVAHI, GObject)
@@ -47,6 +48,8 @@ gboolean
 passim_avahi_register(PassimAvahi *self, gchar **keys, GError **error);
 const gchar *
 passim_avahi_get_name(PassimAvahi *self);
+void
+passim_avahi_set_metrics(PassimAvahi *self, PassimMetrics *metrics);
 gchar *
 passim_avahi_build_subtype_for_hash(const gchar *hash);
 
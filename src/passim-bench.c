@@ -0,0 +1,670 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <libsoup/soup.h>
+#include <passim.h>
+#include <unistd.h>
+
+#include "passim-common.h"
+#include "passim-metrics.h"
+
+#define PASSIM_BENCH_READ_SIZE (64 * 1024)
+
+typedef struct {
+	guint64 size;
+	guint weight;
+} PassimBenchSize;
+
+typedef struct {
+	guint64 cpu_ticks;
+	guint64 rss_kb;
+	guint64 hwm_kb;
+} PassimBenchProc;
+
+typedef struct {
+	PassimClient *client;
+	SoupSession *session;
+	GMainLoop *loop;
+	GPtrArray *catalog;	/* of PassimItem */
+	GArray *sizes;		/* of PassimBenchSize */
+	GArray *latencies;	/* of gint64, µs */
+	GArray *first_bytes;	/* of gint64, µs */
+	gchar *faults;
+	guint64 outcomes[PASSIM_METRICS_OUTCOME_LAST];
+	guint64 bytes;
+	guint errors;
+	guint requests;
+	guint requests_started;
+	guint requests_done;
+	guint clients;
+	guint items;
+	guint lookup_ratio;
+	guint share_limit;
+	guint16 port;
+	gboolean keepalive;
+	gboolean existing;
+} PassimBench;
+
+typedef struct {
+	PassimBench *self;
+	SoupMessage *msg;
+	GInputStream *stream;
+	gint64 start_time; /* monotonic, µs */
+	guint8 *buf;
+} PassimBenchRequest;
+
+static void
+passim_bench_free(PassimBench *self)
+{
+	if (self->client != NULL)
+		g_object_unref(self->client);
+	if (self->session != NULL)
+		g_object_unref(self->session);
+	if (self->loop != NULL)
+		g_main_loop_unref(self->loop);
+	if (self->catalog != NULL)
+		g_ptr_array_unref(self->catalog);
+	if (self->sizes != NULL)
+		g_array_unref(self->sizes);
+	if (self->latencies != NULL)
+		g_array_unref(self->latencies);
+	if (self->first_bytes != NULL)
+		g_array_unref(self->first_bytes);
+	g_free(self->faults);
+	g_free(self);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimBench, passim_bench_free)
+#pragma clang diagnostic pop
+
+static void
+passim_bench_request_free(PassimBenchRequest *req)
+{
+	if (req->msg != NULL)
+		g_object_unref(req->msg);
+	if (req->stream != NULL)
+		g_object_unref(req->stream);
+	g_free(req->buf);
+	g_free(req);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimBenchRequest, passim_bench_request_free)
+#pragma clang diagnostic pop
+
+/* in the format SIZE:WEIGHT,SIZE:WEIGHT */
+static gboolean
+passim_bench_parse_sizes(PassimBench *self, const gchar *value, GError **error)
+{
+	g_auto(GStrv) sections = g_strsplit(value, ",", -1);
+
+	for (guint i = 0; sections[i] != NULL; i++) {
+		PassimBenchSize size = {.weight = 1};
+		guint64 tmp = 0;
+		g_auto(GStrv) kv = g_strsplit(sections[i], ":", 2);
+
+		if (!g_ascii_string_to_unsigned(kv[0], 10, 1, G_MAXUINT64, &size.size, error))
+			return FALSE;
+		if (kv[1] != NULL) {
+			if (!g_ascii_string_to_unsigned(kv[1], 10, 1, 1000, &tmp, error))
+				return FALSE;
+			size.weight = tmp;
+		}
+		g_array_append_val(self->sizes, size);
+	}
+	return TRUE;
+}
+
+static guint64
+passim_bench_pick_size(PassimBench *self)
+{
+	guint total = 0;
+	guint value;
+
+	for (guint i = 0; i < self->sizes->len; i++)
+		total += g_array_index(self->sizes, PassimBenchSize, i).weight;
+	value = g_random_int_range(0, total);
+	for (guint i = 0; i < self->sizes->len; i++) {
+		PassimBenchSize *size = &g_array_index(self->sizes, PassimBenchSize, i);
+		if (value < size->weight)
+			return size->size;
+		value -= size->weight;
+	}
+	return g_array_index(self->sizes, PassimBenchSize, 0).size;
+}
+
+static GBytes *
+passim_bench_random_bytes(guint64 size)
+{
+	guint32 *buf = g_new(guint32, (size + sizeof(guint32) - 1) / sizeof(guint32));
+	for (guint64 i = 0; i < (size + sizeof(guint32) - 1) / sizeof(guint32); i++)
+		buf[i] = g_random_int();
+	return g_bytes_new_take(buf, size);
+}
+
+/* every fourth item is published with a share limit, if set */
+static gboolean
+passim_bench_publish_catalog(PassimBench *self, GError **error)
+{
+	for (guint i = 0; i < self->items; i++) {
+		guint64 size = passim_bench_pick_size(self);
+		g_autofree gchar *basename = g_strdup_printf("passim-bench-%u.bin", i);
+		g_autoptr(GBytes) blob = passim_bench_random_bytes(size);
+		g_autoptr(PassimItem) item = passim_item_new();
+
+		passim_item_set_basename(item, basename);
+		passim_item_set_bytes(item, blob);
+		if (self->share_limit > 0 && i % 4 == 0)
+			passim_item_set_share_limit(item, self->share_limit);
+		if (!passim_client_publish(self->client, item, error)) {
+			g_prefix_error(error, "failed to publish %s: ", basename);
+			return FALSE;
+		}
+		g_ptr_array_add(self->catalog, g_steal_pointer(&item));
+	}
+	return TRUE;
+}
+
+static void
+passim_bench_unpublish_catalog(PassimBench *self)
+{
+	for (guint i = 0; i < self->catalog->len; i++) {
+		PassimItem *item = g_ptr_array_index(self->catalog, i);
+		g_autoptr(GError) error = NULL;
+
+		/* share-limited items may have already been deleted */
+		if (!passim_client_unpublish(self->client, passim_item_get_hash(item), &error))
+			g_debug("failed to unpublish: %s", error->message);
+	}
+}
+
+static gboolean
+passim_bench_load_catalog(PassimBench *self, GError **error)
+{
+	g_autoptr(GPtrArray) items = passim_client_get_items(self->client, error);
+	if (items == NULL)
+		return FALSE;
+	if (items->len == 0) {
+		g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no items published");
+		return FALSE;
+	}
+	for (guint i = 0; i < items->len; i++)
+		g_ptr_array_add(self->catalog, g_object_ref(g_ptr_array_index(items, i)));
+	return TRUE;
+}
+
+static guint32
+passim_bench_get_daemon_pid(GError **error)
+{
+	guint32 pid = 0;
+	g_autoptr(GDBusConnection) connection = NULL;
+	g_autoptr(GVariant) val = NULL;
+
+	connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, error);
+	if (connection == NULL)
+		return 0;
+	val = g_dbus_connection_call_sync(connection,
+					  "org.freedesktop.DBus",
+					  "/org/freedesktop/DBus",
+					  "org.freedesktop.DBus",
+					  "GetConnectionUnixProcessID",
+					  g_variant_new("(s)", PASSIM_DBUS_SERVICE),
+					  G_VARIANT_TYPE("(u)"),
+					  G_DBUS_CALL_FLAGS_NONE,
+					  1500,
+					  NULL,
+					  error);
+	if (val == NULL)
+		return 0;
+	g_variant_get(val, "(u)", &pid);
+	return pid;
+}
+
+/* only supported when the daemon was built with -Dfault_injection=true */
+static gboolean
+passim_bench_set_faults(const gchar *faults, GError **error)
+{
+	g_autoptr(GDBusConnection) connection = NULL;
+	g_autoptr(GVariant) val = NULL;
+
+	connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, error);
+	if (connection == NULL)
+		return FALSE;
+	val = g_dbus_connection_call_sync(connection,
+					  PASSIM_DBUS_SERVICE,
+					  PASSIM_DBUS_PATH,
+					  PASSIM_DBUS_INTERFACE,
+					  "SetFaults",
+					  g_variant_new("(s)", faults),
+					  NULL,
+					  G_DBUS_CALL_FLAGS_NONE,
+					  1500,
+					  NULL,
+					  error);
+	return val != NULL;
+}
+
+static guint64
+passim_bench_proc_status_kb(const gchar *status, const gchar *key)
+{
+	const gchar *tmp = g_strstr_len(status, -1, key);
+	if (tmp == NULL)
+		return 0;
+	return g_ascii_strtoull(tmp + strlen(key), NULL, 10);
+}
+
+static gboolean
+passim_bench_proc_read(guint32 pid, PassimBenchProc *proc, GError **error)
+{
+	const gchar *tmp;
+	g_autofree gchar *stat = NULL;
+	g_autofree gchar *status = NULL;
+	g_autofree gchar *stat_fn = g_strdup_printf("/proc/%u/stat", pid);
+	g_autofree gchar *status_fn = g_strdup_printf("/proc/%u/status", pid);
+	g_auto(GStrv) fields = NULL;
+
+	if (!g_file_get_contents(stat_fn, &stat, NULL, error))
+		return FALSE;
+	if (!g_file_get_contents(status_fn, &status, NULL, error))
+		return FALSE;
+
+	/* skip past the comm, which may contain spaces; utime and stime are then 12 and 13 */
+	tmp = g_strrstr(stat, ")");
+	if (tmp == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "invalid %s", stat_fn);
+		return FALSE;
+	}
+	fields = g_strsplit(tmp + 2, " ", -1);
+	if (g_strv_length(fields) < 13) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "invalid %s", stat_fn);
+		return FALSE;
+	}
+	proc->cpu_ticks = g_ascii_strtoull(fields[11], NULL, 10) +
+			  g_ascii_strtoull(fields[12], NULL, 10);
+	proc->rss_kb = passim_bench_proc_status_kb(status, "VmRSS:");
+	proc->hwm_kb = passim_bench_proc_status_kb(status, "VmHWM:");
+	return TRUE;
+}
+
+static gchar *
+passim_bench_random_hash(void)
+{
+	GString *str = g_string_new(NULL);
+	for (guint i = 0; i < 8; i++)
+		g_string_append_printf(str, "%08x", g_random_int());
+	return g_string_free(str, FALSE);
+}
+
+static gboolean
+passim_bench_accept_certificate_cb(SoupMessage *msg,
+				   GTlsCertificate *cert,
+				   GTlsCertificateFlags errors,
+				   gpointer user_data)
+{
+	/* passimd always uses a self-signed certificate */
+	return TRUE;
+}
+
+static void
+passim_bench_request_start(PassimBench *self);
+
+static void
+passim_bench_request_done(PassimBenchRequest *req, GError *error)
+{
+	PassimBench *self = req->self;
+	gint64 duration = g_get_monotonic_time() - req->start_time;
+
+	if (error != NULL) {
+		g_debug("request failed: %s", error->message);
+		self->errors++;
+	} else {
+		guint status_code = soup_message_get_status(req->msg);
+		self->outcomes[passim_metrics_outcome_from_status(status_code)]++;
+		g_array_append_val(self->latencies, duration);
+	}
+	passim_bench_request_free(req);
+
+	self->requests_done++;
+	if (self->requests_done == self->requests) {
+		g_main_loop_quit(self->loop);
+		return;
+	}
+	passim_bench_request_start(self);
+}
+
+static void
+passim_bench_read_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	PassimBenchRequest *req = (PassimBenchRequest *)user_data;
+	gssize len;
+	g_autoptr(GError) error = NULL;
+
+	len = g_input_stream_read_finish(G_INPUT_STREAM(source_object), res, &error);
+	if (len < 0) {
+		passim_bench_request_done(req, error);
+		return;
+	}
+	if (len == 0) {
+		passim_bench_request_done(req, NULL);
+		return;
+	}
+	req->self->bytes += len;
+	g_input_stream_read_async(req->stream,
+				  req->buf,
+				  PASSIM_BENCH_READ_SIZE,
+				  G_PRIORITY_DEFAULT,
+				  NULL,
+				  passim_bench_read_cb,
+				  req);
+}
+
+static void
+passim_bench_send_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	PassimBenchRequest *req = (PassimBenchRequest *)user_data;
+	gint64 duration;
+	g_autoptr(GError) error = NULL;
+
+	req->stream = soup_session_send_finish(SOUP_SESSION(source_object), res, &error);
+	if (req->stream == NULL) {
+		passim_bench_request_done(req, error);
+		return;
+	}
+	duration = g_get_monotonic_time() - req->start_time;
+	g_array_append_val(req->self->first_bytes, duration);
+	req->buf = g_malloc(PASSIM_BENCH_READ_SIZE);
+	g_input_stream_read_async(req->stream,
+				  req->buf,
+				  PASSIM_BENCH_READ_SIZE,
+				  G_PRIORITY_DEFAULT,
+				  NULL,
+				  passim_bench_read_cb,
+				  req);
+}
+
+static void
+passim_bench_request_start(PassimBench *self)
+{
+	g_autofree gchar *uri = NULL;
+	g_autoptr(PassimBenchRequest) req = g_new0(PassimBenchRequest, 1);
+
+	if (self->requests_started >= self->requests)
+		return;
+	self->requests_started++;
+
+	/* either a random hash which needs a loopback lookup, or something we have */
+	if ((guint)g_random_int_range(0, 100) < self->lookup_ratio) {
+		g_autofree gchar *hash = passim_bench_random_hash();
+		uri = g_strdup_printf("https://localhost:%u/missing.bin?sha256=%s",
+				      self->port,
+				      hash);
+	} else {
+		PassimItem *item =
+		    g_ptr_array_index(self->catalog, g_random_int_range(0, self->catalog->len));
+		g_autofree gchar *basename =
+		    g_uri_escape_string(passim_item_get_basename(item), NULL, TRUE);
+		uri = g_strdup_printf("https://localhost:%u/%s?sha256=%s",
+				      self->port,
+				      basename,
+				      passim_item_get_hash(item));
+	}
+
+	req->self = self;
+	req->msg = soup_message_new(SOUP_METHOD_GET, uri);
+	soup_message_add_flags(req->msg, SOUP_MESSAGE_NO_REDIRECT);
+	if (!self->keepalive) {
+		soup_message_add_flags(req->msg, SOUP_MESSAGE_NEW_CONNECTION);
+		soup_message_headers_replace(soup_message_get_request_headers(req->msg),
+					     "Connection",
+					     "close");
+	}
+	g_signal_connect(req->msg,
+			 "accept-certificate",
+			 G_CALLBACK(passim_bench_accept_certificate_cb),
+			 NULL);
+	req->start_time = g_get_monotonic_time();
+	soup_session_send_async(self->session,
+				req->msg,
+				G_PRIORITY_DEFAULT,
+				NULL,
+				passim_bench_send_cb,
+				g_steal_pointer(&req));
+}
+
+static gint
+passim_bench_sort_cb(gconstpointer a, gconstpointer b)
+{
+	gint64 val_a = *((const gint64 *)a);
+	gint64 val_b = *((const gint64 *)b);
+	if (val_a < val_b)
+		return -1;
+	if (val_a > val_b)
+		return 1;
+	return 0;
+}
+
+static void
+passim_bench_print_percentiles(const gchar *title, GArray *values)
+{
+	const gdouble percentiles[] = {50, 90, 99, 99.9};
+
+	if (values->len == 0)
+		return;
+	g_array_sort(values, passim_bench_sort_cb);
+	g_print("%s:\n", title);
+	for (guint i = 0; i < G_N_ELEMENTS(percentiles); i++) {
+		guint idx = MIN((guint)((percentiles[i] / 100.f) * values->len), values->len - 1);
+		g_print("  p%-6g %10.3f ms\n",
+			percentiles[i],
+			(gdouble)g_array_index(values, gint64, idx) / 1000.f);
+	}
+	g_print("  max     %10.3f ms\n",
+		(gdouble)g_array_index(values, gint64, values->len - 1) / 1000.f);
+}
+
+static void
+passim_bench_print_results(PassimBench *self,
+			   gint64 duration,
+			   PassimBenchProc *proc_start,
+			   PassimBenchProc *proc_end)
+{
+	gdouble secs = (gdouble)duration / G_USEC_PER_SEC;
+
+	g_print("Clients:       %u (keep-alive %s)\n",
+		self->clients,
+		self->keepalive ? "on" : "off");
+	g_print("Catalog:       %u items\n", self->catalog->len);
+	if (self->faults != NULL)
+		g_print("Faults:        %s\n", self->faults);
+	g_print("Requests:      %u in %.2fs, %u errors\n", self->requests_done, secs, self->errors);
+	for (guint i = 0; i < PASSIM_METRICS_OUTCOME_LAST; i++) {
+		if (self->outcomes[i] == 0)
+			continue;
+		g_print("  %-12s %" G_GUINT64_FORMAT "\n",
+			passim_metrics_outcome_to_string(i),
+			self->outcomes[i]);
+	}
+	g_print("Throughput:    %.1f req/s, %.3f Gb/s\n",
+		self->requests_done / secs,
+		(self->bytes * 8.f) / (secs * 1000 * 1000 * 1000));
+	passim_bench_print_percentiles("Time to first byte", self->first_bytes);
+	passim_bench_print_percentiles("Latency", self->latencies);
+	if (proc_start != NULL && proc_end != NULL) {
+		gdouble cpu = (gdouble)(proc_end->cpu_ticks - proc_start->cpu_ticks) /
+			      sysconf(_SC_CLK_TCK);
+		g_print("Daemon CPU:    %.2fs (%.1f%%)\n", cpu, 100.f * cpu / secs);
+		g_print("Daemon RSS:    %" G_GUINT64_FORMAT " kB (peak %" G_GUINT64_FORMAT " kB)\n",
+			proc_end->rss_kb,
+			proc_end->hwm_kb);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	gboolean ret;
+	gboolean no_keepalive = FALSE;
+	gint64 start_time;
+	guint32 pid = 0;
+	gint port = 27500;
+	gint clients = 8;
+	gint items = 20;
+	gint requests = 1000;
+	gint lookup_ratio = 0;
+	gint share_limit = 0;
+	g_autofree gchar *sizes = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GOptionContext) context = g_option_context_new(NULL);
+	g_autoptr(PassimBench) self = g_new0(PassimBench, 1);
+	PassimBenchProc proc_start = {0};
+	PassimBenchProc proc_end = {0};
+	const GOptionEntry options[] = {
+	    {"port", '\0', 0, G_OPTION_ARG_INT, &port, "Port of the local daemon", "PORT"},
+	    {"clients", 'c', 0, G_OPTION_ARG_INT, &clients, "Concurrent clients", "COUNT"},
+	    {"requests", 'n', 0, G_OPTION_ARG_INT, &requests, "Total requests", "COUNT"},
+	    {"no-keepalive",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_NONE,
+	     &no_keepalive,
+	     "Use a new connection for every request",
+	     NULL},
+	    {"items", '\0', 0, G_OPTION_ARG_INT, &items, "Items to publish", "COUNT"},
+	    {"sizes",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_STRING,
+	     &sizes,
+	     "Item size distribution, e.g. 4096:60,65536:30,1048576:10",
+	     "SIZE:WEIGHT,..."},
+	    {"share-limit",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_INT,
+	     &share_limit,
+	     "Share limit for every fourth published item",
+	     "COUNT"},
+	    {"lookup-ratio",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_INT,
+	     &lookup_ratio,
+	     "Percentage of requests for unknown hashes",
+	     "PERCENT"},
+	    {"faults",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_STRING,
+	     &self->faults,
+	     "Faults to inject into the daemon while running, e.g. file-map:delay=200:rate=1",
+	     "POINT:KEY=VALUE,..."},
+	    {"existing",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_NONE,
+	     &self->existing,
+	     "Use the already published items rather than a synthetic catalog",
+	     NULL},
+	    {NULL}};
+
+	g_option_context_add_main_entries(context, options, NULL);
+	g_option_context_set_summary(context, "Measure the throughput of the local daemon.");
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("Failed to parse arguments: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	if (port <= 0 || port > G_MAXUINT16 || clients <= 0 || requests <= 0 || items <= 0 ||
+	    lookup_ratio < 0 || lookup_ratio > 100 || share_limit < 0) {
+		g_printerr("Invalid arguments\n");
+		return EXIT_FAILURE;
+	}
+	self->port = port;
+	self->clients = clients;
+	self->requests = requests;
+	self->items = items;
+	self->lookup_ratio = lookup_ratio;
+	self->share_limit = share_limit;
+	self->keepalive = !no_keepalive;
+	self->loop = g_main_loop_new(NULL, FALSE);
+	self->catalog = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
+	self->sizes = g_array_new(FALSE, FALSE, sizeof(PassimBenchSize));
+	self->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+	self->first_bytes = g_array_new(FALSE, FALSE, sizeof(gint64));
+	if (!passim_bench_parse_sizes(self,
+				      sizes != NULL ? sizes : "4096:60,65536:30,1048576:10",
+				      &error)) {
+		g_printerr("Failed to parse sizes: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	/* connect to the daemon */
+	self->client = passim_client_new();
+	if (!passim_client_load(self->client, &error)) {
+		g_printerr("Failed to connect to daemon: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	if (self->existing) {
+		ret = passim_bench_load_catalog(self, &error);
+	} else {
+		ret = passim_bench_publish_catalog(self, &error);
+	}
+	if (!ret) {
+		g_printerr("Failed to set up catalog: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	if (self->faults != NULL && !passim_bench_set_faults(self->faults, &error)) {
+		g_printerr("Failed to set faults: %s\n", error->message);
+		if (!self->existing)
+			passim_bench_unpublish_catalog(self);
+		return EXIT_FAILURE;
+	}
+	pid = passim_bench_get_daemon_pid(&error);
+	if (pid == 0) {
+		g_printerr("Failed to get daemon PID, not measuring CPU: %s\n", error->message);
+		g_clear_error(&error);
+	}
+
+	/* the session caps the number of parallel connections */
+	self->session = soup_session_new_with_options("max-conns",
+						      self->clients,
+						      "max-conns-per-host",
+						      self->clients,
+						      "user-agent",
+						      "passim-bench",
+						      NULL);
+	if (pid != 0 && !passim_bench_proc_read(pid, &proc_start, &error)) {
+		g_printerr("Failed to read daemon stats: %s\n", error->message);
+		g_clear_error(&error);
+		pid = 0;
+	}
+	start_time = g_get_monotonic_time();
+	for (guint i = 0; i < self->clients; i++)
+		passim_bench_request_start(self);
+	g_main_loop_run(self->loop);
+	if (pid != 0 && !passim_bench_proc_read(pid, &proc_end, &error)) {
+		g_printerr("Failed to read daemon stats: %s\n", error->message);
+		g_clear_error(&error);
+		pid = 0;
+	}
+	passim_bench_print_results(self,
+				   g_get_monotonic_time() - start_time,
+				   pid != 0 ? &proc_start : NULL,
+				   pid != 0 ? &proc_end : NULL);
+
+	/* clean up */
+	if (self->faults != NULL && !passim_bench_set_faults("", &error)) {
+		g_printerr("Failed to clear faults: %s\n", error->message);
+		g_clear_error(&error);
+	}
+	if (!self->existing)
+		passim_bench_unpublish_catalog(self);
+	return EXIT_SUCCESS;
+}
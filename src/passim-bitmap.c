@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include "passim-bitmap.h"
+
+/* one bit per block, where the first block is the most significant bit as in BitTorrent */
+struct PassimBitmap {
+	guint n_bits;
+	guint8 *data;
+};
+
+void
+passim_bitmap_free(PassimBitmap *bitmap)
+{
+	g_free(bitmap->data);
+	g_free(bitmap);
+}
+
+static gsize
+passim_bitmap_get_data_size(guint n_bits)
+{
+	return ((gsize)n_bits + 7) / 8;
+}
+
+PassimBitmap *
+passim_bitmap_new(guint n_bits)
+{
+	PassimBitmap *bitmap = g_new0(PassimBitmap, 1);
+	bitmap->n_bits = n_bits;
+	bitmap->data = g_malloc0(MAX(passim_bitmap_get_data_size(n_bits), 1));
+	return bitmap;
+}
+
+guint
+passim_bitmap_get_size(PassimBitmap *bitmap)
+{
+	g_return_val_if_fail(bitmap != NULL, 0);
+	return bitmap->n_bits;
+}
+
+void
+passim_bitmap_set(PassimBitmap *bitmap, guint idx)
+{
+	g_return_if_fail(bitmap != NULL);
+	g_return_if_fail(idx < bitmap->n_bits);
+	bitmap->data[idx / 8] |= 0x80 >> (idx % 8);
+}
+
+gboolean
+passim_bitmap_get(PassimBitmap *bitmap, guint idx)
+{
+	g_return_val_if_fail(bitmap != NULL, FALSE);
+	if (idx >= bitmap->n_bits)
+		return FALSE;
+	return (bitmap->data[idx / 8] & (0x80 >> (idx % 8))) != 0;
+}
+
+/* inclusive, so that a byte range can be checked using the blocks at each end */
+gboolean
+passim_bitmap_get_range(PassimBitmap *bitmap, guint idx_first, guint idx_last)
+{
+	g_return_val_if_fail(bitmap != NULL, FALSE);
+	if (idx_first > idx_last)
+		return FALSE;
+	for (guint i = idx_first; i <= idx_last; i++) {
+		if (!passim_bitmap_get(bitmap, i))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+guint
+passim_bitmap_count(PassimBitmap *bitmap)
+{
+	guint cnt = 0;
+	g_return_val_if_fail(bitmap != NULL, 0);
+	for (guint i = 0; i < bitmap->n_bits; i++) {
+		if (passim_bitmap_get(bitmap, i))
+			cnt++;
+	}
+	return cnt;
+}
+
+/* "{n-bits} {hex}", where the hex is empty when there are no bits */
+gchar *
+passim_bitmap_to_string(PassimBitmap *bitmap)
+{
+	gsize data_size;
+	GString *str = g_string_new(NULL);
+
+	g_return_val_if_fail(bitmap != NULL, NULL);
+
+	data_size = passim_bitmap_get_data_size(bitmap->n_bits);
+	g_string_append_printf(str, "%u ", bitmap->n_bits);
+	for (gsize i = 0; i < data_size; i++)
+		g_string_append_printf(str, "%02x", bitmap->data[i]);
+	return g_string_free(str, FALSE);
+}
+
+/* from a peer, so the spare bits at the end have to be clear */
+PassimBitmap *
+passim_bitmap_from_string(const gchar *str, GError **error)
+{
+	const gchar *hex;
+	guint64 n_bits = 0;
+	g_autofree gchar *n_bits_str = NULL;
+	g_autoptr(PassimBitmap) bitmap = NULL;
+
+	g_return_val_if_fail(str != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	hex = strchr(str, ' ');
+	if (hex == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "expected {n-bits} {hex}");
+		return NULL;
+	}
+	n_bits_str = g_strndup(str, hex - str);
+	if (!g_ascii_string_to_unsigned(n_bits_str, 10, 0, G_MAXUINT32, &n_bits, error))
+		return NULL;
+	hex++;
+	if (strlen(hex) != passim_bitmap_get_data_size(n_bits) * 2) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "expected %u hex digits for %u bits",
+			    (guint)passim_bitmap_get_data_size(n_bits) * 2,
+			    (guint)n_bits);
+		return NULL;
+	}
+	bitmap = passim_bitmap_new(n_bits);
+	for (gsize i = 0; i < passim_bitmap_get_data_size(n_bits); i++) {
+		gint hi = g_ascii_xdigit_value(hex[i * 2]);
+		gint lo = g_ascii_xdigit_value(hex[i * 2 + 1]);
+		if (hi < 0 || lo < 0) {
+			g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "invalid hex");
+			return NULL;
+		}
+		bitmap->data[i] = (hi << 4) | lo;
+	}
+	if (n_bits % 8 != 0 && (bitmap->data[n_bits / 8] & (0xff >> (n_bits % 8))) != 0) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "spare bits are set");
+		return NULL;
+	}
+	return g_steal_pointer(&bitmap);
+}
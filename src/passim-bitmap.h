@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+typedef struct PassimBitmap PassimBitmap;
+
+void
+passim_bitmap_free(PassimBitmap *bitmap);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimBitmap, passim_bitmap_free)
+
+PassimBitmap *
+passim_bitmap_new(guint n_bits);
+guint
+passim_bitmap_get_size(PassimBitmap *bitmap);
+void
+passim_bitmap_set(PassimBitmap *bitmap, guint idx);
+gboolean
+passim_bitmap_get(PassimBitmap *bitmap, guint idx);
+gboolean
+passim_bitmap_get_range(PassimBitmap *bitmap, guint idx_first, guint idx_last);
+guint
+passim_bitmap_count(PassimBitmap *bitmap);
+gchar *
+passim_bitmap_to_string(PassimBitmap *bitmap);
+PassimBitmap *
+passim_bitmap_from_string(const gchar *str, GError **error);
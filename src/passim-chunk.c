@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include "passim-chunk.h"
+
+/*
+ * FastCDC, see "FastCDC: a Fast and Efficient Content-Defined Chunking Approach for Data
+ * Deduplication" by Xia et al. -- the boundaries have to be the same on every machine, so none of
+ * these can ever change without also changing every chunk
+ */
+#define PASSIM_CHUNK_SIZE_MIN  (16 * 1024)
+#define PASSIM_CHUNK_SIZE_AVG  (64 * 1024)
+#define PASSIM_CHUNK_SIZE_MAX  (256 * 1024)
+#define PASSIM_CHUNK_GEAR_SEED 0x70617373696d0000ull
+
+/* normalized chunking: harder to cut before the average size, and easier after */
+#define PASSIM_CHUNK_MASK_S (G_MAXUINT64 << (64 - 18))
+#define PASSIM_CHUNK_MASK_L (G_MAXUINT64 << (64 - 14))
+
+static guint64 passim_chunk_gear[256] = {0};
+
+void
+passim_chunk_free(PassimChunk *chunk)
+{
+	g_free(chunk->checksum);
+	g_free(chunk);
+}
+
+/* also used as a filename, so this has to be checked carefully */
+gboolean
+passim_chunk_checksum_valid(const gchar *checksum)
+{
+	if (checksum == NULL || strlen(checksum) != 64)
+		return FALSE;
+	for (guint i = 0; checksum[i] != '\0'; i++) {
+		if (!g_ascii_isxdigit(checksum[i]) || g_ascii_isupper(checksum[i]))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* splitmix64, so that the table does not need to be included here */
+static void
+passim_chunk_gear_init(void)
+{
+	static gsize done = 0;
+
+	if (g_once_init_enter(&done)) {
+		guint64 seed = PASSIM_CHUNK_GEAR_SEED;
+		for (guint i = 0; i < G_N_ELEMENTS(passim_chunk_gear); i++) {
+			guint64 z = (seed += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			passim_chunk_gear[i] = z ^ (z >> 31);
+		}
+		g_once_init_leave(&done, 1);
+	}
+}
+
+/* the size of the chunk at the start of @buf */
+static gsize
+passim_chunk_cut(const guint8 *buf, gsize bufsz)
+{
+	guint64 fp = 0;
+	gsize idx = PASSIM_CHUNK_SIZE_MIN;
+	gsize normal = PASSIM_CHUNK_SIZE_AVG;
+
+	if (bufsz <= PASSIM_CHUNK_SIZE_MIN)
+		return bufsz;
+	bufsz = MIN(bufsz, PASSIM_CHUNK_SIZE_MAX);
+	normal = MIN(normal, bufsz);
+	for (; idx < normal; idx++) {
+		fp = (fp << 1) + passim_chunk_gear[buf[idx]];
+		if ((fp & PASSIM_CHUNK_MASK_S) == 0)
+			return idx + 1;
+	}
+	for (; idx < bufsz; idx++) {
+		fp = (fp << 1) + passim_chunk_gear[buf[idx]];
+		if ((fp & PASSIM_CHUNK_MASK_L) == 0)
+			return idx + 1;
+	}
+	return bufsz;
+}
+
+/* returns (element-type PassimChunk) */
+GPtrArray *
+passim_chunk_split(GBytes *blob)
+{
+	gsize size = 0;
+	const guint8 *data = g_bytes_get_data(blob, &size);
+	GPtrArray *chunks = g_ptr_array_new_with_free_func((GDestroyNotify)passim_chunk_free);
+
+	g_return_val_if_fail(blob != NULL, NULL);
+
+	passim_chunk_gear_init();
+	for (gsize offset = 0; offset < size;) {
+		PassimChunk *chunk = g_new0(PassimChunk, 1);
+		chunk->offset = offset;
+		chunk->size = passim_chunk_cut(data + offset, size - offset);
+		chunk->checksum =
+		    g_compute_checksum_for_data(G_CHECKSUM_SHA256, data + offset, chunk->size);
+		g_ptr_array_add(chunks, chunk);
+		offset += chunk->size;
+	}
+	return chunks;
+}
+
+/* one line of "{sha256} {size}" per chunk, in order */
+gchar *
+passim_chunk_list_to_string(GPtrArray *chunks)
+{
+	GString *str = g_string_new(NULL);
+
+	g_return_val_if_fail(chunks != NULL, NULL);
+
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		g_string_append_printf(str, "%s %u\n", chunk->checksum, chunk->size);
+	}
+	return g_string_free(str, FALSE);
+}
+
+/* returns (element-type PassimChunk) */
+GPtrArray *
+passim_chunk_list_from_string(const gchar *str, GError **error)
+{
+	guint64 offset = 0;
+	g_auto(GStrv) lines = NULL;
+	g_autoptr(GPtrArray) chunks =
+	    g_ptr_array_new_with_free_func((GDestroyNotify)passim_chunk_free);
+
+	g_return_val_if_fail(str != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	lines = g_strsplit(str, "\n", -1);
+	for (guint i = 0; lines[i] != NULL; i++) {
+		guint64 size = 0;
+		g_autoptr(PassimChunk) chunk = NULL;
+		g_auto(GStrv) kv = NULL;
+
+		if (lines[i][0] == '\0')
+			continue;
+		kv = g_strsplit(lines[i], " ", -1);
+		if (g_strv_length(kv) != 2 || !passim_chunk_checksum_valid(kv[0])) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "invalid chunk on line %u",
+				    i + 1);
+			return NULL;
+		}
+		if (!g_ascii_string_to_unsigned(kv[1],
+						10,
+						1,
+						PASSIM_CHUNK_SIZE_MAX,
+						&size,
+						error)) {
+			g_prefix_error(error, "invalid chunk size on line %u: ", i + 1);
+			return NULL;
+		}
+		chunk = g_new0(PassimChunk, 1);
+		chunk->checksum = g_strdup(kv[0]);
+		chunk->offset = offset;
+		chunk->size = size;
+		offset += size;
+		g_ptr_array_add(chunks, g_steal_pointer(&chunk));
+	}
+	return g_steal_pointer(&chunks);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+/* a content-defined region of an item, stored once however many items include it */
+typedef struct {
+	gchar *checksum; /* SHA-256 */
+	guint64 offset;
+	guint32 size;
+} PassimChunk;
+
+void
+passim_chunk_free(PassimChunk *chunk);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimChunk, passim_chunk_free)
+
+gboolean
+passim_chunk_checksum_valid(const gchar *checksum);
+GPtrArray *
+passim_chunk_split(GBytes *blob);
+gchar *
+passim_chunk_list_to_string(GPtrArray *chunks);
+GPtrArray *
+passim_chunk_list_from_string(const gchar *str, GError **error);
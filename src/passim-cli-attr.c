@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "passim-cli-attr.h"
+
+void
+passim_item_attr_free(PassimItemAttr *attr)
+{
+	g_free(attr->value);
+	g_free(attr);
+}
+
+/* only included in the statistics, for items compressed at rest, chunked or with a delta */
+void
+passim_cli_item_stats_to_attrs(PassimItem *item, GVariant *data, GPtrArray *array)
+{
+	const gchar *hash_old = NULL;
+	guint32 value_u32 = 0;
+	guint64 value = 0;
+	g_autoptr(GVariant) digests = NULL;
+	g_autoptr(GVariantDict) dict = g_variant_dict_new(data);
+
+	if (g_variant_dict_lookup(dict, "stored-size", "t", &value) &&
+	    passim_item_get_size(item) > 0) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		g_autofree gchar *size = g_format_size(value);
+		/* TRANSLATORS: size of the compressed item on disk */
+		attr->key = _("Stored");
+		attr->value = g_strdup_printf("%s (%.0f%%)",
+					      size,
+					      100.f * value / passim_item_get_size(item));
+		g_ptr_array_add(array, attr);
+	}
+	if (g_variant_dict_lookup(dict, "compress-time", "t", &value)) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		/* TRANSLATORS: CPU time spent compressing the item */
+		attr->key = _("Compress Time");
+		attr->value = g_strdup_printf("%.1fms", value / 1000.f);
+		g_ptr_array_add(array, attr);
+	}
+	if (g_variant_dict_lookup(dict, "decompress-time", "t", &value)) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		/* TRANSLATORS: CPU time spent decompressing the item for clients */
+		attr->key = _("Decompress Time");
+		attr->value = g_strdup_printf("%.1fms", value / 1000.f);
+		g_ptr_array_add(array, attr);
+	}
+	if (g_variant_dict_lookup(dict, "delta-size", "t", &value) &&
+	    g_variant_dict_lookup(dict, "delta-from", "&s", &hash_old)) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		g_autofree gchar *size = g_format_size(value);
+		/* TRANSLATORS: a patch from the previous version of the item is available */
+		attr->key = _("Delta");
+		attr->value = g_strdup_printf("%s from %.8s", size, hash_old);
+		g_ptr_array_add(array, attr);
+	}
+	if (g_variant_dict_lookup(dict, "chunks", "u", &value_u32)) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		/* TRANSLATORS: number of parts in the chunk store, shared with other items */
+		attr->key = _("Chunks");
+		attr->value = g_strdup_printf("%u", value_u32);
+		g_ptr_array_add(array, attr);
+	}
+	digests = g_variant_dict_lookup_value(dict, "digests", G_VARIANT_TYPE("a{ss}"));
+	if (digests != NULL) {
+		GVariantIter iter;
+		const gchar *kind = NULL;
+		const gchar *digest = NULL;
+		g_variant_iter_init(&iter, digests);
+		while (g_variant_iter_next(&iter, "{&s&s}", &kind, &digest)) {
+			PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+			g_autofree gchar *kind_up = g_ascii_strup(kind, -1);
+			attr->key = g_intern_string(kind_up);
+			attr->value = g_strdup(digest);
+			g_ptr_array_add(array, attr);
+		}
+	}
+}
@@ -0,0 +1,19 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include "passim-common.h"
+
+typedef struct {
+	const gchar *key;
+	gchar *value;
+} PassimItemAttr;
+
+void
+passim_item_attr_free(PassimItemAttr *attr);
+void
+passim_cli_item_stats_to_attrs(PassimItem *item, GVariant *data, GPtrArray *array);
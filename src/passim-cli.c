@@ -11,11 +11,14 @@
 #include <locale.h>
 #include <passim.h>
 
+#include "passim-cli-attr.h"
 #include "passim-common.h"
 
 typedef struct {
 	PassimClient *client;
 	gboolean next_reboot;
+	gchar *uri;
+	gchar *etag;
 } PassimCli;
 
 typedef gboolean (*PassimCliCmdFunc)(PassimCli *util, gchar **values, GError **error);
@@ -40,6 +43,8 @@ passim_cli_private_free(PassimCli *self)
 {
 	if (self->client != NULL)
 		g_object_unref(self->client);
+	g_free(self->uri);
+	g_free(self->etag);
 	g_free(self);
 }
 
@@ -163,11 +168,6 @@ passim_cli_cmd_array_to_string(GPtrArray *array)
 	return g_string_free(string, FALSE);
 }
 
-typedef struct {
-	const gchar *key;
-	gchar *value;
-} PassimItemAttr;
-
 static gchar *
 passim_cli_item_flag_to_string(PassimItemFlags flags)
 {
@@ -182,13 +182,17 @@ passim_cli_item_flag_to_string(PassimItemFlags flags)
 		/* TRANSLATORS: only begin sharing the item after the next restart */
 		strv[i++] = _("Next Reboot");
 	}
+	if (flags & PASSIM_ITEM_FLAG_REPLICATING) {
+		/* TRANSLATORS: kept until enough other computers have a copy */
+		strv[i++] = _("Replicating");
+	}
 	return g_strjoinv(", ", (gchar **)strv);
 }
 
 static GPtrArray *
 passim_cli_item_to_attrs(PassimItem *item)
 {
-	GPtrArray *array = g_ptr_array_new_with_free_func(g_free);
+	GPtrArray *array = g_ptr_array_new_with_free_func((GDestroyNotify)passim_item_attr_free);
 
 	if (passim_item_get_basename(item) != NULL) {
 		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
@@ -211,6 +215,13 @@ passim_cli_item_to_attrs(PassimItem *item)
 		attr->value = g_strdup(passim_item_get_cmdline(item));
 		g_ptr_array_add(array, attr);
 	}
+	if (passim_item_get_uri(item) != NULL) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		/* TRANSLATORS: where the item was originally downloaded from */
+		attr->key = _("Origin");
+		attr->value = g_strdup(passim_item_get_uri(item));
+		g_ptr_array_add(array, attr);
+	}
 	if (passim_item_get_max_age(item) != G_MAXUINT32) {
 		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
 		/* TRANSLATORS: age of the published item */
@@ -229,6 +240,15 @@ passim_cli_item_to_attrs(PassimItem *item)
 					      passim_item_get_share_limit(item));
 		g_ptr_array_add(array, attr);
 	}
+	if (passim_item_get_share_limit_effective(item) != 0) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		/* TRANSLATORS: share limit adjusted by the daemon for how rare the item is */
+		attr->key = _("Effective Share Limit");
+		attr->value = g_strdup_printf("%u/%u",
+					      passim_item_get_share_count(item),
+					      passim_item_get_share_limit_effective(item));
+		g_ptr_array_add(array, attr);
+	}
 	if (passim_item_get_size(item) != 0) {
 		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
 		/* TRANSLATORS: size of the published item */
@@ -236,6 +256,21 @@ passim_cli_item_to_attrs(PassimItem *item)
 		attr->value = g_format_size(passim_item_get_size(item));
 		g_ptr_array_add(array, attr);
 	}
+	if (passim_item_get_served_size(item) != 0) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		/* TRANSLATORS: total amount of data sent to other machines */
+		attr->key = _("Served");
+		attr->value = g_format_size(passim_item_get_served_size(item));
+		g_ptr_array_add(array, attr);
+	}
+	if (passim_item_get_atime(item) != NULL) {
+		PassimItemAttr *attr = g_new0(PassimItemAttr, 1);
+		g_autoptr(GDateTime) atime = g_date_time_to_local(passim_item_get_atime(item));
+		/* TRANSLATORS: when the item was last requested by another machine */
+		attr->key = _("Last Access");
+		attr->value = g_date_time_format(atime, "%F %T");
+		g_ptr_array_add(array, attr);
+	}
 	return array;
 }
 
@@ -253,6 +288,23 @@ passim_cli_align_indent(const gchar *key, const gchar *value, guint indent)
 
 #define PASSIM_CLI_VALIGN 20
 
+static void
+passim_cli_print_item(PassimItem *item, GVariant *data)
+{
+	g_autoptr(GPtrArray) attrs = passim_cli_item_to_attrs(item);
+
+	if (data != NULL)
+		passim_cli_item_stats_to_attrs(item, data, attrs);
+
+	g_print("\n%s\n", passim_item_get_hash(item));
+	for (guint j = 0; j < attrs->len; j++) {
+		PassimItemAttr *attr = g_ptr_array_index(attrs, j);
+		g_autofree gchar *str =
+		    passim_cli_align_indent(attr->key, attr->value, PASSIM_CLI_VALIGN - 2);
+		g_print("%s %s\n", j < attrs->len - 1 ? "├" : "└", str);
+	}
+}
+
 static gboolean
 passim_cli_status(PassimCli *self, gchar **values, GError **error)
 {
@@ -293,14 +345,143 @@ passim_cli_status(PassimCli *self, gchar **values, GError **error)
 		return FALSE;
 	for (guint i = 0; i < items->len; i++) {
 		PassimItem *item = g_ptr_array_index(items, i);
-		g_autoptr(GPtrArray) attrs = passim_cli_item_to_attrs(item);
-
-		g_print("\n%s\n", passim_item_get_hash(item));
-		for (guint j = 0; j < attrs->len; j++) {
-			PassimItemAttr *attr = g_ptr_array_index(attrs, j);
-			g_autofree gchar *str =
-			    passim_cli_align_indent(attr->key, attr->value, PASSIM_CLI_VALIGN - 2);
-			g_print("%s %s\n", j < attrs->len - 1 ? "├" : "└", str);
+		passim_cli_print_item(item, NULL);
+	}
+
+	/* success */
+	return TRUE;
+}
+
+static void
+passim_cli_print_attr(const gchar *key, const gchar *value)
+{
+	g_autofree gchar *str = passim_cli_align_indent(key, value, PASSIM_CLI_VALIGN);
+	g_print("%s\n", str);
+}
+
+static gchar *
+passim_cli_format_duration(guint64 secs)
+{
+	if (secs >= 60 * 60 * 24) {
+		return g_strdup_printf("%ud %uh",
+				       (guint)(secs / (60 * 60 * 24)),
+				       (guint)((secs / (60 * 60)) % 24));
+	}
+	if (secs >= 60 * 60) {
+		return g_strdup_printf("%uh %um",
+				       (guint)(secs / (60 * 60)),
+				       (guint)((secs / 60) % 60));
+	}
+	if (secs >= 60)
+		return g_strdup_printf("%um %us", (guint)(secs / 60), (guint)(secs % 60));
+	return g_strdup_printf("%us", (guint)secs);
+}
+
+static gboolean
+passim_cli_stats(PassimCli *self, gchar **values, GError **error)
+{
+	gdouble value_d = 0;
+	guint32 value_u32 = 0;
+	guint64 value_u64 = 0;
+	guint64 item_size = 0;
+	g_autoptr(GVariant) items_variant = NULL;
+	g_autoptr(GVariant) stats = NULL;
+	g_autoptr(GVariantDict) dict = NULL;
+	struct {
+		const gchar *key;
+		const gchar *title;
+	} requests[] = {
+	    /* TRANSLATORS: number of files sent to other machines */
+	    {"requests-served", N_("Served")},
+	    /* TRANSLATORS: number of requests sent on to another machine */
+	    {"requests-redirect", N_("Redirected")},
+	    /* TRANSLATORS: number of requests for files nobody had */
+	    {"requests-not-found", N_("Not Found")},
+	    /* TRANSLATORS: number of requests that were not allowed */
+	    {"requests-forbidden", N_("Forbidden")},
+	    /* TRANSLATORS: number of requests for items not yet enabled */
+	    {"requests-locked", N_("Locked")},
+	    {NULL, NULL},
+	};
+
+	stats = passim_client_get_statistics(self->client, error);
+	if (stats == NULL)
+		return FALSE;
+	dict = g_variant_dict_new(stats);
+
+	if (g_variant_dict_lookup(dict, "uptime", "t", &value_u64)) {
+		g_autofree gchar *str = passim_cli_format_duration(value_u64);
+		/* TRANSLATORS: how long the daemon has been running */
+		passim_cli_print_attr(_("Uptime"), str);
+	}
+	if (g_variant_dict_lookup(dict, "requests", "t", &value_u64)) {
+		g_autofree gchar *str = g_strdup_printf("%" G_GUINT64_FORMAT, value_u64);
+		/* TRANSLATORS: total number of HTTP requests */
+		passim_cli_print_attr(_("Requests"), str);
+	}
+	for (guint i = 0; requests[i].key != NULL; i++) {
+		g_autofree gchar *str = NULL;
+		g_autofree gchar *title = NULL;
+		if (!g_variant_dict_lookup(dict, requests[i].key, "t", &value_u64))
+			continue;
+		str = g_strdup_printf("%" G_GUINT64_FORMAT, value_u64);
+		title = g_strdup_printf("  %s", _(requests[i].title));
+		passim_cli_print_attr(title, str);
+	}
+	if (g_variant_dict_lookup(dict, "served-size", "t", &value_u64)) {
+		g_autofree gchar *str = g_format_size(value_u64);
+		/* TRANSLATORS: total amount of data sent to other machines */
+		passim_cli_print_attr(_("Served"), str);
+	}
+	if (g_variant_dict_lookup(dict, "request-rate", "d", &value_d)) {
+		g_autofree gchar *str = g_strdup_printf("%.2f/s", value_d);
+		/* TRANSLATORS: number of requests per second */
+		passim_cli_print_attr(_("Request Rate"), str);
+	}
+	if (g_variant_dict_lookup(dict, "served-rate", "d", &value_d)) {
+		g_autofree gchar *size = g_format_size((guint64)value_d);
+		g_autofree gchar *str = g_strdup_printf("%s/s", size);
+		/* TRANSLATORS: amount of data being sent per second */
+		passim_cli_print_attr(_("Transfer Rate"), str);
+	}
+	if (g_variant_dict_lookup(dict, "item-count", "u", &value_u32) &&
+	    g_variant_dict_lookup(dict, "item-size", "t", &item_size)) {
+		g_autofree gchar *size = g_format_size(item_size);
+		g_autofree gchar *str = g_strdup_printf("%u (%s)", value_u32, size);
+		/* TRANSLATORS: number of files in the cache */
+		passim_cli_print_attr(_("Items"), str);
+	}
+	if (g_variant_dict_lookup(dict, "chunk-count", "u", &value_u32) &&
+	    g_variant_dict_lookup(dict, "chunk-size", "t", &item_size)) {
+		g_autofree gchar *size = g_format_size(item_size);
+		g_autofree gchar *str = g_strdup_printf("%u (%s)", value_u32, size);
+		/* TRANSLATORS: number of unique parts of files in the chunk store */
+		passim_cli_print_attr(_("Chunks"), str);
+	}
+	if (g_variant_dict_lookup(dict, "evictions", "t", &value_u64)) {
+		g_autofree gchar *str = g_strdup_printf("%" G_GUINT64_FORMAT, value_u64);
+		/* TRANSLATORS: number of files deleted as they were too old */
+		passim_cli_print_attr(_("Expired"), str);
+	}
+	if (g_variant_dict_lookup(dict, "share-limit-deletions", "t", &value_u64)) {
+		g_autofree gchar *str = g_strdup_printf("%" G_GUINT64_FORMAT, value_u64);
+		/* TRANSLATORS: number of files deleted as they were shared enough */
+		passim_cli_print_attr(_("Share Limit Reached"), str);
+	}
+	if (g_variant_dict_lookup(dict, "compression-saved", "t", &value_u64) && value_u64 > 0) {
+		g_autofree gchar *str = g_format_size(value_u64);
+		/* TRANSLATORS: bytes not sent as a compressed copy of the file was used */
+		passim_cli_print_attr(_("Saved By Compression"), str);
+	}
+
+	/* per-item */
+	items_variant = g_variant_dict_lookup_value(dict, "items", G_VARIANT_TYPE("aa{sv}"));
+	if (items_variant != NULL) {
+		gsize sz = g_variant_n_children(items_variant);
+		for (gsize i = 0; i < sz; i++) {
+			g_autoptr(GVariant) data = g_variant_get_child_value(items_variant, i);
+			g_autoptr(PassimItem) item = passim_item_from_variant(data);
+			passim_cli_print_item(item, data);
 		}
 	}
 
@@ -331,6 +512,8 @@ passim_cli_publish(PassimCli *self, gchar **values, GError **error)
 		passim_item_set_share_count(item, g_ascii_strtoull(values[2], NULL, 10));
 	if (self->next_reboot)
 		passim_item_add_flag(item, PASSIM_ITEM_FLAG_NEXT_REBOOT);
+	passim_item_set_uri(item, self->uri);
+	passim_item_set_etag(item, self->etag);
 	if (!passim_client_publish(self->client, item, error))
 		return FALSE;
 
@@ -381,6 +564,10 @@ main(int argc, char *argv[])
 	     &self->next_reboot,
 	     N_("Next reboot"),
 	     NULL},
+	    /* TRANSLATORS: where the published file was downloaded from */
+	    {"uri", '\0', 0, G_OPTION_ARG_STRING, &self->uri, N_("Origin URI"), NULL},
+	    /* TRANSLATORS: the ETag the origin server sent with the file */
+	    {"etag", '\0', 0, G_OPTION_ARG_STRING, &self->etag, N_("Origin ETag"), NULL},
 	    {NULL},
 	};
 
@@ -403,6 +590,12 @@ main(int argc, char *argv[])
 				 /* TRANSLATORS: CLI action description */
 				 _("Publish an additional file"),
 				 passim_cli_publish);
+	passim_cli_cmd_array_add(cmd_array,
+				 "stats",
+				 NULL,
+				 /* TRANSLATORS: CLI action description */
+				 _("Show serving statistics"),
+				 passim_cli_stats);
 	passim_cli_cmd_array_add(cmd_array,
 				 "unpublish",
 				 /* TRANSLATORS: CLI option example */
@@ -9,11 +9,28 @@
 #include <sys/xattr.h>
 
 #include "passim-common.h"
+#include "passim-fault.h"
 
-#define PASSIM_CONFIG_GROUP	    "daemon"
-#define PASSIM_CONFIG_PORT	    "Port"
-#define PASSIM_CONFIG_PATH	    "Path"
-#define PASSIM_CONFIG_MAX_ITEM_SIZE "MaxItemSize"
+#define PASSIM_CONFIG_GROUP		"daemon"
+#define PASSIM_CONFIG_PORT		"Port"
+#define PASSIM_CONFIG_PATH		"Path"
+#define PASSIM_CONFIG_MAX_ITEM_SIZE	"MaxItemSize"
+#define PASSIM_CONFIG_METRICS_REMOTE	"MetricsAllowRemote"
+#define PASSIM_CONFIG_ACCESS_LOG	"AccessLog"
+#define PASSIM_CONFIG_COMPRESS_MIN_SIZE	"CompressMinSize"
+#define PASSIM_CONFIG_COMPRESS_AT_REST	"CompressAtRest"
+#define PASSIM_CONFIG_COMPRESS_DELTAS	"CompressDeltas"
+#define PASSIM_CONFIG_CHUNK_STORE	"ChunkStore"
+#define PASSIM_CONFIG_DIGESTS		"Digests"
+#define PASSIM_CONFIG_OCI_REGISTRY	"OciRegistry"
+#define PASSIM_CONFIG_BY_HASH_MIRROR	"ByHashMirror"
+#define PASSIM_CONFIG_PREFETCH		"Prefetch"
+#define PASSIM_CONFIG_PREFETCH_MAX_SIZE	"PrefetchMaxSize"
+#define PASSIM_CONFIG_PREFETCH_RATE	"PrefetchRate"
+#define PASSIM_CONFIG_PREFETCH_HOURS	"PrefetchHours"
+#define PASSIM_CONFIG_REPLICATION_TARGET "ReplicationTarget"
+#define PASSIM_CONFIG_REPLICATION_SECRET "ReplicationSecret"
+#define PASSIM_CONFIG_ADAPTIVE_SHARE_LIMIT "AdaptiveShareLimit"
 
 const gchar *
 passim_status_to_string(PassimStatus status)
@@ -29,11 +46,33 @@ passim_status_to_string(PassimStatus status)
 	return NULL;
 }
 
+/* the environment variables allow running an uninstalled daemon against a temporary tree */
+gchar *
+passim_path_from_kind(PassimPathKind kind)
+{
+	const gchar *tmp;
+
+	if (kind == PASSIM_PATH_KIND_SYSCONFDIR) {
+		tmp = g_getenv("PASSIM_SYSCONFDIR");
+		return g_strdup(tmp != NULL ? tmp : PACKAGE_SYSCONFDIR);
+	}
+	if (kind == PASSIM_PATH_KIND_LOCALSTATEDIR) {
+		tmp = g_getenv("PASSIM_LOCALSTATEDIR");
+		return g_strdup(tmp != NULL ? tmp : PACKAGE_LOCALSTATEDIR);
+	}
+	if (kind == PASSIM_PATH_KIND_DATADIR) {
+		tmp = g_getenv("PASSIM_DATADIR");
+		return g_strdup(tmp != NULL ? tmp : PACKAGE_DATADIR);
+	}
+	return NULL;
+}
+
 GKeyFile *
 passim_config_load(GError **error)
 {
 	g_autoptr(GKeyFile) kf = g_key_file_new();
-	g_autofree gchar *fn = g_build_filename(PACKAGE_SYSCONFDIR, "passim.conf", NULL);
+	g_autofree gchar *sysconfdir = passim_path_from_kind(PASSIM_PATH_KIND_SYSCONFDIR);
+	g_autofree gchar *fn = g_build_filename(sysconfdir, "passim.conf", NULL);
 
 	if (g_file_test(fn, G_FILE_TEST_EXISTS)) {
 		if (!g_key_file_load_from_file(kf, fn, G_KEY_FILE_NONE, error))
@@ -51,10 +90,77 @@ passim_config_load(GError **error)
 				      100 * 1024 * 1024);
 	}
 	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PATH, NULL)) {
+		g_autofree gchar *localstatedir =
+		    passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
 		g_autofree gchar *path =
-		    g_build_filename(PACKAGE_LOCALSTATEDIR, "lib", PACKAGE_NAME, "data", NULL);
+		    g_build_filename(localstatedir, "lib", PACKAGE_NAME, "data", NULL);
 		g_key_file_set_string(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PATH, path);
 	}
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_METRICS_REMOTE, NULL)) {
+		g_key_file_set_boolean(kf,
+				       PASSIM_CONFIG_GROUP,
+				       PASSIM_CONFIG_METRICS_REMOTE,
+				       FALSE);
+	}
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_COMPRESS_MIN_SIZE, NULL))
+		g_key_file_set_uint64(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_COMPRESS_MIN_SIZE, 0);
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_COMPRESS_AT_REST, NULL)) {
+		g_key_file_set_boolean(kf,
+				       PASSIM_CONFIG_GROUP,
+				       PASSIM_CONFIG_COMPRESS_AT_REST,
+				       FALSE);
+	}
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_COMPRESS_DELTAS, NULL)) {
+		g_key_file_set_boolean(kf,
+				       PASSIM_CONFIG_GROUP,
+				       PASSIM_CONFIG_COMPRESS_DELTAS,
+				       FALSE);
+	}
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_CHUNK_STORE, NULL))
+		g_key_file_set_boolean(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_CHUNK_STORE, FALSE);
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_DIGESTS, NULL))
+		g_key_file_set_string(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_DIGESTS, "");
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_OCI_REGISTRY, NULL))
+		g_key_file_set_boolean(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_OCI_REGISTRY, FALSE);
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_BY_HASH_MIRROR, NULL))
+		g_key_file_set_string(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_BY_HASH_MIRROR, "");
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH, NULL))
+		g_key_file_set_boolean(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH, FALSE);
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH_MAX_SIZE, NULL)) {
+		g_key_file_set_uint64(kf,
+				      PASSIM_CONFIG_GROUP,
+				      PASSIM_CONFIG_PREFETCH_MAX_SIZE,
+				      1024 * 1024 * 1024);
+	}
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH_RATE, NULL)) {
+		g_key_file_set_uint64(kf,
+				      PASSIM_CONFIG_GROUP,
+				      PASSIM_CONFIG_PREFETCH_RATE,
+				      1024 * 1024);
+	}
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH_HOURS, NULL))
+		g_key_file_set_string(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH_HOURS, "");
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_REPLICATION_TARGET, NULL)) {
+		g_key_file_set_integer(kf,
+				       PASSIM_CONFIG_GROUP,
+				       PASSIM_CONFIG_REPLICATION_TARGET,
+				       0);
+	}
+	if (!g_key_file_has_key(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_REPLICATION_SECRET, NULL)) {
+		g_key_file_set_string(kf,
+				      PASSIM_CONFIG_GROUP,
+				      PASSIM_CONFIG_REPLICATION_SECRET,
+				      "");
+	}
+	if (!g_key_file_has_key(kf,
+				PASSIM_CONFIG_GROUP,
+				PASSIM_CONFIG_ADAPTIVE_SHARE_LIMIT,
+				NULL)) {
+		g_key_file_set_boolean(kf,
+				       PASSIM_CONFIG_GROUP,
+				       PASSIM_CONFIG_ADAPTIVE_SHARE_LIMIT,
+				       FALSE);
+	}
 
 	return g_steal_pointer(&kf);
 }
@@ -78,12 +184,171 @@ passim_config_get_path(GKeyFile *kf)
 }
 
 gboolean
-passim_xattr_set_string(const gchar *filename,
-			const gchar *name,
-			const gchar *value,
-			GError **error)
+passim_config_get_metrics_allow_remote(GKeyFile *kf)
+{
+	return g_key_file_get_boolean(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_METRICS_REMOTE, NULL);
+}
+
+/* either "journal", a filename, or NULL if disabled */
+gchar *
+passim_config_get_access_log(GKeyFile *kf)
+{
+	g_autofree gchar *value =
+	    g_key_file_get_string(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_ACCESS_LOG, NULL);
+	if (value == NULL || value[0] == '\0')
+		return NULL;
+	return g_steal_pointer(&value);
+}
+
+/* items smaller than this are never compressed, where 0 disables building variants */
+guint64
+passim_config_get_compress_min_size(GKeyFile *kf)
+{
+	return g_key_file_get_uint64(kf,
+				     PASSIM_CONFIG_GROUP,
+				     PASSIM_CONFIG_COMPRESS_MIN_SIZE,
+				     NULL);
+}
+
+/* store published items as seekable zstd, which is ignored if built without zstd support */
+gboolean
+passim_config_get_compress_at_rest(GKeyFile *kf)
+{
+	return g_key_file_get_boolean(kf,
+				      PASSIM_CONFIG_GROUP,
+				      PASSIM_CONFIG_COMPRESS_AT_REST,
+				      NULL);
+}
+
+/* build a delta from the previous version of each published item, which also needs zstd */
+gboolean
+passim_config_get_compress_deltas(GKeyFile *kf)
+{
+	return g_key_file_get_boolean(kf,
+				      PASSIM_CONFIG_GROUP,
+				      PASSIM_CONFIG_COMPRESS_DELTAS,
+				      NULL);
+}
+
+/* split published items into chunks that are stored once, however many items include them */
+gboolean
+passim_config_get_chunk_store(GKeyFile *kf)
+{
+	return g_key_file_get_boolean(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_CHUNK_STORE, NULL);
+}
+
+/* extra digests to compute for each item, e.g. "blake3;sha512", or none by default */
+gchar **
+passim_config_get_digests(GKeyFile *kf)
+{
+	return g_key_file_get_string_list(kf,
+					  PASSIM_CONFIG_GROUP,
+					  PASSIM_CONFIG_DIGESTS,
+					  NULL,
+					  NULL);
+}
+
+/* serve items as OCI blobs, so that container runtimes can use the daemon as a mirror */
+gboolean
+passim_config_get_oci_registry(GKeyFile *kf)
+{
+	return g_key_file_get_boolean(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_OCI_REGISTRY, NULL);
+}
+
+/* download popular items from other machines when idle */
+gboolean
+passim_config_get_prefetch(GKeyFile *kf)
+{
+	return g_key_file_get_boolean(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH, NULL);
+}
+
+/* the total size of all the items that were prefetched, in bytes */
+guint64
+passim_config_get_prefetch_max_size(GKeyFile *kf)
+{
+	return g_key_file_get_uint64(kf,
+				     PASSIM_CONFIG_GROUP,
+				     PASSIM_CONFIG_PREFETCH_MAX_SIZE,
+				     NULL);
+}
+
+/* in bytes per second, or 0 for no limit */
+guint64
+passim_config_get_prefetch_rate(GKeyFile *kf)
+{
+	return g_key_file_get_uint64(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH_RATE, NULL);
+}
+
+/* e.g. "1-6" for between 01:00 and 05:59 local time, or NULL for any time */
+gchar *
+passim_config_get_prefetch_hours(GKeyFile *kf)
+{
+	g_autofree gchar *hours =
+	    g_key_file_get_string(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_PREFETCH_HOURS, NULL);
+	if (hours == NULL || hours[0] == '\0')
+		return NULL;
+	return g_steal_pointer(&hours);
+}
+
+/* the number of other machines that have to have an item before it can be deleted, or 0 */
+guint
+passim_config_get_replication_target(GKeyFile *kf)
+{
+	gint target = g_key_file_get_integer(kf,
+					     PASSIM_CONFIG_GROUP,
+					     PASSIM_CONFIG_REPLICATION_TARGET,
+					     NULL);
+	return MAX(target, 0);
+}
+
+/* the share limit of each item is changed depending on how many other machines have it */
+gboolean
+passim_config_get_adaptive_share_limit(GKeyFile *kf)
+{
+	return g_key_file_get_boolean(kf,
+				      PASSIM_CONFIG_GROUP,
+				      PASSIM_CONFIG_ADAPTIVE_SHARE_LIMIT,
+				      NULL);
+}
+
+/* shared by all the machines that are allowed to ask each other to copy items, or NULL */
+gchar *
+passim_config_get_replication_secret(GKeyFile *kf)
+{
+	g_autofree gchar *secret = g_key_file_get_string(kf,
+							 PASSIM_CONFIG_GROUP,
+							 PASSIM_CONFIG_REPLICATION_SECRET,
+							 NULL);
+	if (secret == NULL || secret[0] == '\0')
+		return NULL;
+	return g_steal_pointer(&secret);
+}
+
+/* the upstream repository URI, e.g. "http://deb.debian.org", or NULL if not a mirror */
+gchar *
+passim_config_get_by_hash_mirror(GKeyFile *kf)
 {
-	ssize_t rc = setxattr(filename, name, value, strlen(value), XATTR_CREATE);
+	g_autofree gchar *uri =
+	    g_key_file_get_string(kf, PASSIM_CONFIG_GROUP, PASSIM_CONFIG_BY_HASH_MIRROR, NULL);
+	if (uri == NULL || uri[0] == '\0')
+		return NULL;
+	return g_steal_pointer(&uri);
+}
+
+/* @flags is XATTR_CREATE to fail if already set, or 0 to replace any existing value */
+static gboolean
+passim_xattr_set_data(const gchar *filename,
+		      const gchar *name,
+		      gconstpointer value,
+		      gsize valuesz,
+		      gint flags,
+		      GError **error)
+{
+	ssize_t rc;
+
+	if (!passim_fault_check(PASSIM_FAULT_POINT_XATTR, error))
+		return FALSE;
+	rc = setxattr(filename, name, value, valuesz, flags);
 	if (rc < 0) {
 		g_set_error(error,
 			    G_IO_ERROR,
@@ -96,12 +361,33 @@ passim_xattr_set_string(const gchar *filename,
 	return TRUE;
 }
 
+gboolean
+passim_xattr_set_string(const gchar *filename,
+			const gchar *name,
+			const gchar *value,
+			GError **error)
+{
+	return passim_xattr_set_data(filename, name, value, strlen(value), XATTR_CREATE, error);
+}
+
+/* for values that change after the item has been published */
+gboolean
+passim_xattr_replace_string(const gchar *filename,
+			    const gchar *name,
+			    const gchar *value,
+			    GError **error)
+{
+	return passim_xattr_set_data(filename, name, value, strlen(value), 0, error);
+}
+
 gchar *
 passim_xattr_get_string(const gchar *filename, const gchar *name, GError **error)
 {
 	ssize_t rc;
 	g_autofree gchar *buf = NULL;
 
+	if (!passim_fault_check(PASSIM_FAULT_POINT_XATTR, error))
+		return NULL;
 	rc = getxattr(filename, name, NULL, 0);
 	if (rc < 0) {
 		if (errno == ENODATA)
@@ -141,17 +427,16 @@ passim_xattr_get_string(const gchar *filename, const gchar *name, GError **error
 gboolean
 passim_xattr_set_uint32(const gchar *filename, const gchar *name, guint32 value, GError **error)
 {
-	ssize_t rc = setxattr(filename, name, &value, sizeof(value), XATTR_CREATE);
-	if (rc < 0) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    g_io_error_from_errno(errno),
-			    "failed to set %s: %s",
-			    name,
-			    strerror(errno));
-		return FALSE;
-	}
-	return TRUE;
+	return passim_xattr_set_data(filename, name, &value, sizeof(value), XATTR_CREATE, error);
+}
+
+gboolean
+passim_xattr_replace_uint32(const gchar *filename,
+			    const gchar *name,
+			    guint32 value,
+			    GError **error)
+{
+	return passim_xattr_set_data(filename, name, &value, sizeof(value), 0, error);
 }
 
 guint32
@@ -161,7 +446,11 @@ passim_xattr_get_uint32(const gchar *filename,
 			GError **error)
 {
 	guint32 value = 0;
-	ssize_t rc = getxattr(filename, name, &value, sizeof(value));
+	ssize_t rc;
+
+	if (!passim_fault_check(PASSIM_FAULT_POINT_XATTR, error))
+		return G_MAXUINT32;
+	rc = getxattr(filename, name, &value, sizeof(value));
 	if (rc < 0) {
 		if (errno == ENODATA) {
 			g_debug("using fallback %s=%u for %s",
@@ -189,6 +478,56 @@ passim_xattr_get_uint32(const gchar *filename,
 	return value;
 }
 
+/* copies all the user attributes, which must not already be set on @dest */
+gboolean
+passim_xattr_copy(const gchar *src, const gchar *dest, GError **error)
+{
+	ssize_t rc;
+	g_autofree gchar *names = NULL;
+
+	if (!passim_fault_check(PASSIM_FAULT_POINT_XATTR, error))
+		return FALSE;
+	rc = listxattr(src, NULL, 0);
+	if (rc > 0) {
+		names = g_new0(gchar, rc);
+		rc = listxattr(src, names, rc);
+	}
+	if (rc < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to list attributes of %s: %s",
+			    src,
+			    strerror(errno));
+		return FALSE;
+	}
+	for (ssize_t i = 0; i < rc; i += strlen(names + i) + 1) {
+		const gchar *name = names + i;
+		ssize_t valuesz;
+		g_autofree guint8 *value = NULL;
+
+		if (!g_str_has_prefix(name, "user."))
+			continue;
+		valuesz = getxattr(src, name, NULL, 0);
+		if (valuesz > 0) {
+			value = g_malloc(valuesz);
+			valuesz = getxattr(src, name, value, valuesz);
+		}
+		if (valuesz < 0) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    g_io_error_from_errno(errno),
+				    "failed to get %s: %s",
+				    name,
+				    strerror(errno));
+			return FALSE;
+		}
+		if (!passim_xattr_set_data(dest, name, value, valuesz, XATTR_CREATE, error))
+			return FALSE;
+	}
+	return TRUE;
+}
+
 gboolean
 passim_mkdir(const gchar *dirname, GError **error)
 {
@@ -306,3 +645,54 @@ passim_file_get_contents(const gchar *filename, GError **error)
 	g_debug("reading %s with %" G_GSIZE_FORMAT " bytes", filename, len);
 	return g_bytes_new_take(data, len);
 }
+
+/* returns the value of @key in a query like "basename&sha256=hash", or %NULL if not found */
+gchar *
+passim_query_get_value(const gchar *query, const gchar *key)
+{
+	g_auto(GStrv) sections = NULL;
+
+	if (query == NULL)
+		return NULL;
+	sections = g_strsplit(query, "&", -1);
+	for (guint i = 0; sections[i] != NULL; i++) {
+		g_auto(GStrv) kv = g_strsplit(sections[i], "=", -1);
+		if (g_strv_length(kv) != 2)
+			continue;
+		if (g_strcmp0(kv[0], key) == 0)
+			return g_strdup(kv[1]);
+	}
+	return NULL;
+}
+
+/* the response to a /uri lookup: the item hash, and then each machine that has it */
+gchar *
+passim_uri_lookup_to_string(const gchar *hash, GPtrArray *addresses)
+{
+	GString *str;
+
+	g_return_val_if_fail(hash != NULL, NULL);
+	g_return_val_if_fail(addresses != NULL, NULL);
+
+	str = g_string_new(hash);
+	g_string_append_c(str, '\n');
+	for (guint i = 0; i < addresses->len; i++) {
+		const gchar *address = g_ptr_array_index(addresses, i);
+		g_string_append_printf(str, "%s\n", address);
+	}
+	return g_string_free(str, FALSE);
+}
+
+/* returns the item hash from the first line of a /uri lookup response, or %NULL if empty */
+gchar *
+passim_uri_lookup_get_hash(const gchar *str)
+{
+	gsize len;
+
+	g_return_val_if_fail(str != NULL, NULL);
+
+	len = strcspn(str, "\n");
+	if (len == 0)
+		return NULL;
+	return g_strndup(str, len);
+}
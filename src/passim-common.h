@@ -8,8 +8,17 @@
 
 #include <passim.h>
 
+typedef enum {
+	PASSIM_PATH_KIND_SYSCONFDIR,
+	PASSIM_PATH_KIND_LOCALSTATEDIR,
+	PASSIM_PATH_KIND_DATADIR,
+	PASSIM_PATH_KIND_LAST
+} PassimPathKind;
+
 const gchar *
 passim_status_to_string(PassimStatus status);
+gchar *
+passim_path_from_kind(PassimPathKind kind);
 GKeyFile *
 passim_config_load(GError **error);
 guint16
@@ -19,6 +28,38 @@ passim_config_get_max_item_size(GKeyFile *kf);
 gchar *
 passim_config_get_path(GKeyFile *kf);
 gboolean
+passim_config_get_metrics_allow_remote(GKeyFile *kf);
+gchar *
+passim_config_get_access_log(GKeyFile *kf);
+guint64
+passim_config_get_compress_min_size(GKeyFile *kf);
+gboolean
+passim_config_get_compress_at_rest(GKeyFile *kf);
+gboolean
+passim_config_get_compress_deltas(GKeyFile *kf);
+gboolean
+passim_config_get_chunk_store(GKeyFile *kf);
+gchar **
+passim_config_get_digests(GKeyFile *kf);
+gboolean
+passim_config_get_oci_registry(GKeyFile *kf);
+gchar *
+passim_config_get_by_hash_mirror(GKeyFile *kf);
+gboolean
+passim_config_get_prefetch(GKeyFile *kf);
+guint64
+passim_config_get_prefetch_max_size(GKeyFile *kf);
+guint64
+passim_config_get_prefetch_rate(GKeyFile *kf);
+gchar *
+passim_config_get_prefetch_hours(GKeyFile *kf);
+guint
+passim_config_get_replication_target(GKeyFile *kf);
+gchar *
+passim_config_get_replication_secret(GKeyFile *kf);
+gboolean
+passim_config_get_adaptive_share_limit(GKeyFile *kf);
+gboolean
 passim_xattr_set_uint32(const gchar *filename, const gchar *name, guint32 value, GError **error);
 guint32
 passim_xattr_get_uint32(const gchar *filename,
@@ -33,6 +74,18 @@ passim_xattr_set_string(const gchar *filename,
 gchar *
 passim_xattr_get_string(const gchar *filename, const gchar *name, GError **error);
 gboolean
+passim_xattr_replace_uint32(const gchar *filename,
+			    const gchar *name,
+			    guint32 value,
+			    GError **error);
+gboolean
+passim_xattr_replace_string(const gchar *filename,
+			    const gchar *name,
+			    const gchar *value,
+			    GError **error);
+gboolean
+passim_xattr_copy(const gchar *src, const gchar *dest, GError **error);
+gboolean
 passim_mkdir(const gchar *dirname, GError **error);
 gboolean
 passim_mkdir_parent(const gchar *filename, GError **error);
@@ -44,3 +97,9 @@ gboolean
 passim_file_set_contents(const gchar *filename, GBytes *bytes, GError **error);
 GBytes *
 passim_file_get_contents(const gchar *filename, GError **error);
+gchar *
+passim_query_get_value(const gchar *query, const gchar *key);
+gchar *
+passim_uri_lookup_to_string(const gchar *hash, GPtrArray *addresses);
+gchar *
+passim_uri_lookup_get_hash(const gchar *str);
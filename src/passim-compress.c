@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <libsoup/soup.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "passim-common.h"
+#include "passim-compress.h"
+
+/* variants are only built once, in a thread, so favor size over speed */
+#define PASSIM_COMPRESS_GZIP_LEVEL 9
+#define PASSIM_COMPRESS_ZSTD_LEVEL 15
+
+/* the sample used to decide if building variants is worth the CPU time */
+#define PASSIM_COMPRESS_SAMPLE_SIZE (64 * 1024)
+
+/* the zstd seekable format, from contrib/seekable_format in the zstd sources */
+#define PASSIM_COMPRESS_FRAME_SIZE	     (1024 * 1024)
+#define PASSIM_COMPRESS_SKIPPABLE_MAGIC	     0x184D2A5E
+#define PASSIM_COMPRESS_SEEKABLE_MAGIC	     0x8F92EAB1
+#define PASSIM_COMPRESS_SEEKABLE_HEADER_SIZE 8
+#define PASSIM_COMPRESS_SEEKABLE_FOOTER_SIZE 9
+
+/* the window has to cover the old contents for them to be referenced by the delta */
+#define PASSIM_COMPRESS_DELTA_WINDOW_LOG_MAX 30
+
+const gchar *
+passim_encoding_to_string(PassimEncoding encoding)
+{
+	if (encoding == PASSIM_ENCODING_IDENTITY)
+		return "identity";
+	if (encoding == PASSIM_ENCODING_GZIP)
+		return "gzip";
+	if (encoding == PASSIM_ENCODING_ZSTD)
+		return "zstd";
+	return NULL;
+}
+
+const gchar *
+passim_encoding_to_suffix(PassimEncoding encoding)
+{
+	if (encoding == PASSIM_ENCODING_GZIP)
+		return ".gz";
+	if (encoding == PASSIM_ENCODING_ZSTD)
+		return ".zst";
+	return NULL;
+}
+
+gboolean
+passim_encoding_is_supported(PassimEncoding encoding)
+{
+	if (encoding == PASSIM_ENCODING_GZIP)
+		return TRUE;
+#ifdef HAVE_ZSTD
+	if (encoding == PASSIM_ENCODING_ZSTD)
+		return TRUE;
+#endif
+	return FALSE;
+}
+
+/*
+ * @sizes is indexed by PassimEncoding, where 0 means not available -- the smallest acceptable
+ * encoding is preferred rather than the order in the header, as clients list codings with equal
+ * quality anyway
+ */
+PassimEncoding
+passim_encoding_negotiate(const gchar *accept_encoding, const guint64 *sizes)
+{
+	PassimEncoding encoding = PASSIM_ENCODING_IDENTITY;
+	gboolean acceptable[PASSIM_ENCODING_LAST] = {FALSE};
+	GSList *codings;
+
+	if (accept_encoding == NULL)
+		return PASSIM_ENCODING_IDENTITY;
+	codings = soup_header_parse_quality_list(accept_encoding, NULL);
+	for (GSList *l = codings; l != NULL; l = l->next) {
+		const gchar *coding = l->data;
+		if (g_strcmp0(coding, "*") == 0) {
+			for (guint i = 0; i < PASSIM_ENCODING_LAST; i++)
+				acceptable[i] = TRUE;
+			continue;
+		}
+		if (g_ascii_strcasecmp(coding, "x-gzip") == 0) {
+			acceptable[PASSIM_ENCODING_GZIP] = TRUE;
+			continue;
+		}
+		for (guint i = 0; i < PASSIM_ENCODING_LAST; i++) {
+			if (g_ascii_strcasecmp(coding, passim_encoding_to_string(i)) == 0)
+				acceptable[i] = TRUE;
+		}
+	}
+	soup_header_free_list(codings);
+
+	for (guint i = PASSIM_ENCODING_IDENTITY + 1; i < PASSIM_ENCODING_LAST; i++) {
+		if (!acceptable[i] || sizes[i] == 0)
+			continue;
+		if (encoding == PASSIM_ENCODING_IDENTITY || sizes[i] < sizes[encoding])
+			encoding = i;
+	}
+	return encoding;
+}
+
+static GBytes *
+passim_compress_convert(GBytes *blob, GConverter *converter, gsize max_size, GError **error)
+{
+	g_autoptr(GInputStream) istream1 = g_memory_input_stream_new_from_bytes(blob);
+	g_autoptr(GInputStream) istream2 = g_converter_input_stream_new(istream1, converter);
+	return passim_load_input_stream(istream2, max_size, error);
+}
+
+GBytes *
+passim_compress_bytes(GBytes *blob, PassimEncoding encoding, GError **error)
+{
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (encoding == PASSIM_ENCODING_GZIP) {
+		g_autoptr(GZlibCompressor) compressor =
+		    g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP,
+					  PASSIM_COMPRESS_GZIP_LEVEL);
+		return passim_compress_convert(blob, G_CONVERTER(compressor), G_MAXSIZE, error);
+	}
+#ifdef HAVE_ZSTD
+	if (encoding == PASSIM_ENCODING_ZSTD) {
+		gsize bufsz = ZSTD_compressBound(g_bytes_get_size(blob));
+		gsize rc;
+		g_autofree guint8 *buf = g_malloc(bufsz);
+
+		rc = ZSTD_compress(buf,
+				   bufsz,
+				   g_bytes_get_data(blob, NULL),
+				   g_bytes_get_size(blob),
+				   PASSIM_COMPRESS_ZSTD_LEVEL);
+		if (ZSTD_isError(rc)) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_FAILED,
+				    "failed to compress: %s",
+				    ZSTD_getErrorName(rc));
+			return NULL;
+		}
+		return g_bytes_new_take(g_realloc(g_steal_pointer(&buf), rc), rc);
+	}
+#endif
+	g_set_error(error,
+		    G_IO_ERROR,
+		    G_IO_ERROR_NOT_SUPPORTED,
+		    "%s not supported",
+		    passim_encoding_to_string(encoding));
+	return NULL;
+}
+
+/* the output is limited to @max_size so that a small variant cannot use all the memory */
+GBytes *
+passim_decompress_bytes(GBytes *blob, PassimEncoding encoding, gsize max_size, GError **error)
+{
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (encoding == PASSIM_ENCODING_GZIP) {
+		g_autoptr(GZlibDecompressor) decompressor =
+		    g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+		return passim_compress_convert(blob, G_CONVERTER(decompressor), max_size, error);
+	}
+#ifdef HAVE_ZSTD
+	if (encoding == PASSIM_ENCODING_ZSTD) {
+		gsize rc;
+		unsigned long long bufsz =
+		    ZSTD_findDecompressedSize(g_bytes_get_data(blob, NULL), g_bytes_get_size(blob));
+		g_autofree guint8 *buf = NULL;
+
+		if (bufsz == ZSTD_CONTENTSIZE_UNKNOWN || bufsz == ZSTD_CONTENTSIZE_ERROR) {
+			g_set_error_literal(error,
+					    G_IO_ERROR,
+					    G_IO_ERROR_INVALID_DATA,
+					    "no zstd content size");
+			return NULL;
+		}
+		if (bufsz > max_size) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_NO_SPACE,
+				    "decompressed size 0x%llx > 0x%x",
+				    bufsz,
+				    (guint)max_size);
+			return NULL;
+		}
+		buf = g_malloc(MAX(bufsz, 1));
+		rc = ZSTD_decompress(buf,
+				     bufsz,
+				     g_bytes_get_data(blob, NULL),
+				     g_bytes_get_size(blob));
+		if (ZSTD_isError(rc)) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "failed to decompress: %s",
+				    ZSTD_getErrorName(rc));
+			return NULL;
+		}
+		return g_bytes_new_take(g_steal_pointer(&buf), rc);
+	}
+#endif
+	g_set_error(error,
+		    G_IO_ERROR,
+		    G_IO_ERROR_NOT_SUPPORTED,
+		    "%s not supported",
+		    passim_encoding_to_string(encoding));
+	return NULL;
+}
+
+/* a fast gzip of the start of the blob has to save at least 10% */
+gboolean
+passim_compress_is_worthwhile(GBytes *blob)
+{
+	g_autoptr(GBytes) sample = NULL;
+	g_autoptr(GBytes) sample_gz = NULL;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GZlibCompressor) compressor =
+	    g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1);
+
+	g_return_val_if_fail(blob != NULL, FALSE);
+
+	if (g_bytes_get_size(blob) == 0)
+		return FALSE;
+	sample = g_bytes_new_from_bytes(blob,
+					0,
+					MIN(g_bytes_get_size(blob), PASSIM_COMPRESS_SAMPLE_SIZE));
+	sample_gz =
+	    passim_compress_convert(sample, G_CONVERTER(compressor), G_MAXSIZE, &error_local);
+	if (sample_gz == NULL) {
+		g_debug("failed to sample: %s", error_local->message);
+		return FALSE;
+	}
+	return g_bytes_get_size(sample_gz) * 10 < g_bytes_get_size(sample) * 9;
+}
+
+#ifdef HAVE_ZSTD
+static void
+passim_compress_append_uint32(GByteArray *buf, guint32 value)
+{
+	guint32 tmp = GUINT32_TO_LE(value);
+	g_byte_array_append(buf, (const guint8 *)&tmp, sizeof(tmp));
+}
+#endif
+
+static guint32
+passim_compress_read_uint32(const guint8 *buf)
+{
+	guint32 tmp = 0;
+	memcpy(&tmp, buf, sizeof(tmp));
+	return GUINT32_FROM_LE(tmp);
+}
+
+/*
+ * compress into independent frames followed by a seek table in a skippable frame, so that any
+ * range can be decompressed without reading from the start -- this is still a valid zstd stream
+ */
+GBytes *
+passim_compress_seekable(GBytes *blob, GError **error)
+{
+#ifdef HAVE_ZSTD
+	const guint8 *data;
+	gsize size;
+	gsize offset = 0;
+	guint32 n_frames = 0;
+	ZSTD_CCtx *cctx;
+	g_autoptr(GByteArray) buf = NULL;
+	g_autoptr(GByteArray) table = NULL;
+
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	data = g_bytes_get_data(blob, &size);
+	buf = g_byte_array_new();
+	table = g_byte_array_new();
+	cctx = ZSTD_createCCtx();
+	do {
+		gsize chunk = MIN(size - offset, PASSIM_COMPRESS_FRAME_SIZE);
+		gsize bound = ZSTD_compressBound(chunk);
+		guint oldlen = buf->len;
+		gsize rc;
+
+		g_byte_array_set_size(buf, oldlen + bound);
+		rc = ZSTD_compressCCtx(cctx,
+				       buf->data + oldlen,
+				       bound,
+				       data + offset,
+				       chunk,
+				       PASSIM_COMPRESS_ZSTD_LEVEL);
+		if (ZSTD_isError(rc)) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_FAILED,
+				    "failed to compress: %s",
+				    ZSTD_getErrorName(rc));
+			ZSTD_freeCCtx(cctx);
+			return NULL;
+		}
+		g_byte_array_set_size(buf, oldlen + rc);
+		passim_compress_append_uint32(table, rc);
+		passim_compress_append_uint32(table, chunk);
+		offset += chunk;
+		n_frames++;
+	} while (offset < size);
+	ZSTD_freeCCtx(cctx);
+
+	/* seek table, without checksums as the item hash is checked by the client */
+	passim_compress_append_uint32(buf, PASSIM_COMPRESS_SKIPPABLE_MAGIC);
+	passim_compress_append_uint32(buf, table->len + PASSIM_COMPRESS_SEEKABLE_FOOTER_SIZE);
+	g_byte_array_append(buf, table->data, table->len);
+	passim_compress_append_uint32(buf, n_frames);
+	g_byte_array_append(buf, (const guint8 *)"\0", 1);
+	passim_compress_append_uint32(buf, PASSIM_COMPRESS_SEEKABLE_MAGIC);
+	return g_byte_array_free_to_bytes(g_steal_pointer(&buf));
+#else
+	g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "zstd not supported");
+	return NULL;
+#endif
+}
+
+/* returns (element-type PassimCompressFrame) */
+GArray *
+passim_compress_seekable_parse(GBytes *blob, GError **error)
+{
+	const guint8 *data;
+	gsize size = 0;
+	gsize entry_size;
+	gsize table_offset;
+	guint8 descriptor;
+	guint32 n_frames;
+	guint64 offset = 0;
+	guint64 raw_offset = 0;
+	g_autoptr(GArray) frames = g_array_new(FALSE, FALSE, sizeof(PassimCompressFrame));
+
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	data = g_bytes_get_data(blob, &size);
+	if (size < PASSIM_COMPRESS_SEEKABLE_HEADER_SIZE + PASSIM_COMPRESS_SEEKABLE_FOOTER_SIZE ||
+	    passim_compress_read_uint32(data + size - 4) != PASSIM_COMPRESS_SEEKABLE_MAGIC) {
+		g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "no seek table");
+		return NULL;
+	}
+	n_frames = passim_compress_read_uint32(data + size - PASSIM_COMPRESS_SEEKABLE_FOOTER_SIZE);
+	descriptor = data[size - 5];
+	if ((descriptor & 0x7C) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "invalid seek table descriptor 0x%02x",
+			    descriptor);
+		return NULL;
+	}
+	entry_size = (descriptor & 0x80) != 0 ? 12 : 8;
+	if (n_frames > (size - PASSIM_COMPRESS_SEEKABLE_HEADER_SIZE -
+			PASSIM_COMPRESS_SEEKABLE_FOOTER_SIZE) /
+			   entry_size) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "seek table has too many frames: %u",
+			    n_frames);
+		return NULL;
+	}
+	table_offset = size - PASSIM_COMPRESS_SEEKABLE_FOOTER_SIZE - n_frames * entry_size;
+	if (passim_compress_read_uint32(data + table_offset - 8) !=
+		PASSIM_COMPRESS_SKIPPABLE_MAGIC ||
+	    passim_compress_read_uint32(data + table_offset - 4) !=
+		n_frames * entry_size + PASSIM_COMPRESS_SEEKABLE_FOOTER_SIZE) {
+		g_set_error_literal(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "invalid seek table header");
+		return NULL;
+	}
+	for (guint32 i = 0; i < n_frames; i++) {
+		const guint8 *entry = data + table_offset + i * entry_size;
+		PassimCompressFrame frame = {
+		    .offset = offset,
+		    .size = passim_compress_read_uint32(entry),
+		    .raw_offset = raw_offset,
+		    .raw_size = passim_compress_read_uint32(entry + 4),
+		};
+		offset += frame.size;
+		raw_offset += frame.raw_size;
+		g_array_append_val(frames, frame);
+	}
+	if (offset != table_offset - PASSIM_COMPRESS_SEEKABLE_HEADER_SIZE) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "seek table covers 0x%x bytes of 0x%x",
+			    (guint)offset,
+			    (guint)(table_offset - PASSIM_COMPRESS_SEEKABLE_HEADER_SIZE));
+		return NULL;
+	}
+	return g_steal_pointer(&frames);
+}
+
+GBytes *
+passim_compress_seekable_get_frame(GBytes *blob, const PassimCompressFrame *frame, GError **error)
+{
+	g_autoptr(GBytes) chunk = NULL;
+	g_autoptr(GBytes) raw = NULL;
+
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(frame != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (frame->offset + frame->size > g_bytes_get_size(blob)) {
+		g_set_error_literal(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "frame outside of data");
+		return NULL;
+	}
+	chunk = g_bytes_new_from_bytes(blob, frame->offset, frame->size);
+	raw = passim_decompress_bytes(chunk, PASSIM_ENCODING_ZSTD, frame->raw_size, error);
+	if (raw == NULL)
+		return NULL;
+	if (g_bytes_get_size(raw) != frame->raw_size) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "frame decompressed to 0x%x bytes, expected 0x%x",
+			    (guint)g_bytes_get_size(raw),
+			    frame->raw_size);
+		return NULL;
+	}
+	return g_steal_pointer(&raw);
+}
+
+#ifdef HAVE_ZSTD
+static gint
+passim_compress_delta_window_log(gsize size)
+{
+	gint window_log = 10;
+	while (window_log < PASSIM_COMPRESS_DELTA_WINDOW_LOG_MAX && ((gsize)1 << window_log) < size)
+		window_log++;
+	return window_log;
+}
+#endif
+
+/* compatible with `zstd --patch-from=OLD`, so clients can also apply it using the zstd tool */
+GBytes *
+passim_delta_create(GBytes *blob_old, GBytes *blob, GError **error)
+{
+#ifdef HAVE_ZSTD
+	gsize bound;
+	gsize rc;
+	gsize size = g_bytes_get_size(blob);
+	gsize size_old = g_bytes_get_size(blob_old);
+	ZSTD_CCtx *cctx;
+	g_autofree guint8 *buf = NULL;
+
+	g_return_val_if_fail(blob_old != NULL, NULL);
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	if (size_old + size > (gsize)1 << PASSIM_COMPRESS_DELTA_WINDOW_LOG_MAX) {
+		g_set_error_literal(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_NOT_SUPPORTED,
+				    "too large for a delta");
+		return NULL;
+	}
+	bound = ZSTD_compressBound(size);
+	buf = g_malloc(bound);
+	cctx = ZSTD_createCCtx();
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, PASSIM_COMPRESS_ZSTD_LEVEL);
+	ZSTD_CCtx_setParameter(cctx,
+			       ZSTD_c_windowLog,
+			       passim_compress_delta_window_log(size_old + size));
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+	ZSTD_CCtx_refPrefix(cctx, g_bytes_get_data(blob_old, NULL), size_old);
+	rc = ZSTD_compress2(cctx, buf, bound, g_bytes_get_data(blob, NULL), size);
+	ZSTD_freeCCtx(cctx);
+	if (ZSTD_isError(rc)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "failed to create delta: %s",
+			    ZSTD_getErrorName(rc));
+		return NULL;
+	}
+	return g_bytes_new(buf, rc);
+#else
+	g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "zstd not supported");
+	return NULL;
+#endif
+}
+
+/* the result is only returned if it has the SHA-256 @checksum, when set */
+GBytes *
+passim_delta_apply(GBytes *blob_old,
+		   GBytes *patch,
+		   const gchar *checksum,
+		   gsize max_size,
+		   GError **error)
+{
+#ifdef HAVE_ZSTD
+	gsize rc;
+	ZSTD_DCtx *dctx;
+	unsigned long long bufsz;
+	g_autofree gchar *checksum_new = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autofree guint8 *buf = NULL;
+
+	g_return_val_if_fail(blob_old != NULL, NULL);
+	g_return_val_if_fail(patch != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	bufsz = ZSTD_getFrameContentSize(g_bytes_get_data(patch, NULL), g_bytes_get_size(patch));
+	if (bufsz == ZSTD_CONTENTSIZE_UNKNOWN || bufsz == ZSTD_CONTENTSIZE_ERROR) {
+		g_set_error_literal(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "no zstd content size");
+		return NULL;
+	}
+	if (bufsz > max_size) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_NO_SPACE,
+			    "patched size 0x%llx > 0x%x",
+			    bufsz,
+			    (guint)max_size);
+		return NULL;
+	}
+	buf = g_malloc(MAX(bufsz, 1));
+	dctx = ZSTD_createDCtx();
+	ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, PASSIM_COMPRESS_DELTA_WINDOW_LOG_MAX);
+	ZSTD_DCtx_refPrefix(dctx, g_bytes_get_data(blob_old, NULL), g_bytes_get_size(blob_old));
+	rc = ZSTD_decompressDCtx(dctx,
+				 buf,
+				 bufsz,
+				 g_bytes_get_data(patch, NULL),
+				 g_bytes_get_size(patch));
+	ZSTD_freeDCtx(dctx);
+	if (ZSTD_isError(rc)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "failed to apply delta: %s",
+			    ZSTD_getErrorName(rc));
+		return NULL;
+	}
+	blob = g_bytes_new_take(g_steal_pointer(&buf), rc);
+
+	/* the wrong old version, or a corrupt patch */
+	if (checksum != NULL) {
+		checksum_new = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, blob);
+		if (g_strcmp0(checksum, checksum_new) != 0) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "patched checksum was %s, expected %s",
+				    checksum_new,
+				    checksum);
+			return NULL;
+		}
+	}
+	return g_steal_pointer(&blob);
+#else
+	g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "zstd not supported");
+	return NULL;
+#endif
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+typedef enum {
+	PASSIM_ENCODING_IDENTITY,
+	PASSIM_ENCODING_GZIP,
+	PASSIM_ENCODING_ZSTD,
+	PASSIM_ENCODING_LAST
+} PassimEncoding;
+
+/* one independently compressed frame of a seekable zstd file */
+typedef struct {
+	guint64 offset; /* of the compressed frame */
+	guint32 size;
+	guint64 raw_offset;
+	guint32 raw_size;
+} PassimCompressFrame;
+
+const gchar *
+passim_encoding_to_string(PassimEncoding encoding);
+const gchar *
+passim_encoding_to_suffix(PassimEncoding encoding);
+gboolean
+passim_encoding_is_supported(PassimEncoding encoding);
+PassimEncoding
+passim_encoding_negotiate(const gchar *accept_encoding, const guint64 *sizes);
+
+GBytes *
+passim_compress_bytes(GBytes *blob, PassimEncoding encoding, GError **error);
+GBytes *
+passim_decompress_bytes(GBytes *blob, PassimEncoding encoding, gsize max_size, GError **error);
+gboolean
+passim_compress_is_worthwhile(GBytes *blob);
+GBytes *
+passim_compress_seekable(GBytes *blob, GError **error);
+GArray *
+passim_compress_seekable_parse(GBytes *blob, GError **error);
+GBytes *
+passim_compress_seekable_get_frame(GBytes *blob, const PassimCompressFrame *frame, GError **error);
+GBytes *
+passim_delta_create(GBytes *blob_old, GBytes *blob, GError **error);
+GBytes *
+passim_delta_apply(GBytes *blob_old,
+		   GBytes *patch,
+		   const gchar *checksum,
+		   gsize max_size,
+		   GError **error);
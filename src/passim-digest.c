@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#ifdef HAVE_BLAKE3
+#include <blake3.h>
+#endif
+
+#include "passim-digest.h"
+
+/* smaller blocks are quicker to hash than it takes to start a thread */
+#define PASSIM_DIGEST_THREAD_MIN_SIZE (1024 * 1024)
+
+/* large enough for BLAKE3 to use threads, and small enough to still be in the cache */
+#define PASSIM_DIGEST_BLOCK_SIZE (1024 * 1024)
+
+const gchar *
+passim_digest_kind_to_string(PassimDigestKind kind)
+{
+	if (kind == PASSIM_DIGEST_KIND_SHA256)
+		return "sha256";
+	if (kind == PASSIM_DIGEST_KIND_BLAKE3)
+		return "blake3";
+	if (kind == PASSIM_DIGEST_KIND_SHA1)
+		return "sha1";
+	if (kind == PASSIM_DIGEST_KIND_SHA384)
+		return "sha384";
+	if (kind == PASSIM_DIGEST_KIND_SHA512)
+		return "sha512";
+	return NULL;
+}
+
+/* only for the digests that GLib can compute */
+static gboolean
+passim_digest_kind_to_checksum_type(PassimDigestKind kind, GChecksumType *checksum_type)
+{
+	if (kind == PASSIM_DIGEST_KIND_SHA256) {
+		*checksum_type = G_CHECKSUM_SHA256;
+		return TRUE;
+	}
+	if (kind == PASSIM_DIGEST_KIND_SHA1) {
+		*checksum_type = G_CHECKSUM_SHA1;
+		return TRUE;
+	}
+	if (kind == PASSIM_DIGEST_KIND_SHA384) {
+		*checksum_type = G_CHECKSUM_SHA384;
+		return TRUE;
+	}
+	if (kind == PASSIM_DIGEST_KIND_SHA512) {
+		*checksum_type = G_CHECKSUM_SHA512;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+PassimDigestKind
+passim_digest_kind_from_string(const gchar *kind)
+{
+	for (guint i = 0; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		if (g_strcmp0(kind, passim_digest_kind_to_string(i)) == 0)
+			return i;
+	}
+	return PASSIM_DIGEST_KIND_LAST;
+}
+
+gboolean
+passim_digest_kind_is_supported(PassimDigestKind kind)
+{
+	GChecksumType checksum_type;
+#ifdef HAVE_BLAKE3
+	if (kind == PASSIM_DIGEST_KIND_BLAKE3)
+		return TRUE;
+#endif
+	return passim_digest_kind_to_checksum_type(kind, &checksum_type);
+}
+
+static guint
+passim_digest_kind_get_length(PassimDigestKind kind)
+{
+	GChecksumType checksum_type;
+	if (kind == PASSIM_DIGEST_KIND_BLAKE3)
+		return 64;
+	if (passim_digest_kind_to_checksum_type(kind, &checksum_type))
+		return g_checksum_type_get_length(checksum_type) * 2;
+	return 0;
+}
+
+/* the value is used in URIs and as an mDNS label, so this has to be checked carefully */
+gboolean
+passim_digest_kind_is_valid(PassimDigestKind kind, const gchar *value)
+{
+	if (value == NULL || strlen(value) != passim_digest_kind_get_length(kind))
+		return FALSE;
+	for (guint i = 0; value[i] != '\0'; i++) {
+		if (!g_ascii_isxdigit(value[i]) || g_ascii_isupper(value[i]))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* the SHA-256 hash is used as-is for compatibility, and everything else has a prefix */
+gchar *
+passim_digest_build_key(PassimDigestKind kind, const gchar *value)
+{
+	if (kind == PASSIM_DIGEST_KIND_SHA256)
+		return g_strdup(value);
+	return g_strdup_printf("%s-%s", passim_digest_kind_to_string(kind), value);
+}
+
+/* the origin URI is hashed to fit in an mDNS label, optionally with the ETag as a validator */
+gchar *
+passim_digest_build_uri_key(const gchar *uri, const gchar *etag)
+{
+	g_autoptr(GChecksum) csum = g_checksum_new(G_CHECKSUM_SHA256);
+
+	g_return_val_if_fail(uri != NULL, NULL);
+
+	g_checksum_update(csum, (const guchar *)uri, -1);
+	if (etag != NULL) {
+		g_checksum_update(csum, (const guchar *)"\n", 1);
+		g_checksum_update(csum, (const guchar *)etag, -1);
+	}
+	return g_strdup_printf("uri-%s", g_checksum_get_string(csum));
+}
+
+/*
+ * APT uses .../by-hash/SHA256/{digest} and DNF uses .../repodata/{digest}-{name}, where both
+ * digests are of the file itself
+ */
+gboolean
+passim_digest_parse_path(const gchar *path, PassimDigestKind *kind, gchar **value)
+{
+	const gchar *dash;
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *dirname = NULL;
+	g_autofree gchar *dirname_parent = NULL;
+	g_autofree gchar *parent = NULL;
+	g_autofree gchar *grandparent = NULL;
+
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(kind != NULL, FALSE);
+	g_return_val_if_fail(value != NULL, FALSE);
+
+	basename = g_path_get_basename(path);
+	dirname = g_path_get_dirname(path);
+	parent = g_path_get_basename(dirname);
+	dirname_parent = g_path_get_dirname(dirname);
+	grandparent = g_path_get_basename(dirname_parent);
+
+	/* APT, e.g. SHA256 or SHA512 -- MD5Sum is not supported */
+	if (g_strcmp0(grandparent, "by-hash") == 0) {
+		g_autofree gchar *kind_str = g_ascii_strdown(parent, -1);
+		PassimDigestKind kind_tmp = passim_digest_kind_from_string(kind_str);
+		g_autofree gchar *value_tmp = g_ascii_strdown(basename, -1);
+		if (kind_tmp == PASSIM_DIGEST_KIND_LAST ||
+		    !passim_digest_kind_is_valid(kind_tmp, value_tmp))
+			return FALSE;
+		*kind = kind_tmp;
+		*value = g_steal_pointer(&value_tmp);
+		return TRUE;
+	}
+
+	/* DNF, only when the repo was created with unique filenames of SHA-256 */
+	dash = strchr(basename, '-');
+	if (g_strcmp0(parent, "repodata") == 0 && dash != NULL) {
+		g_autofree gchar *value_tmp = g_ascii_strdown(basename, dash - basename);
+		if (!passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA256, value_tmp))
+			return FALSE;
+		*kind = PASSIM_DIGEST_KIND_SHA256;
+		*value = g_steal_pointer(&value_tmp);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* an HMAC of the request, so that only machines with the secret can ask for an item to be copied */
+gchar *
+passim_digest_sign_replicate(const gchar *secret,
+			     const gchar *hash,
+			     const gchar *basename,
+			     guint16 port,
+			     gint64 timestamp)
+{
+	g_autofree gchar *str = NULL;
+
+	g_return_val_if_fail(secret != NULL, NULL);
+	g_return_val_if_fail(hash != NULL, NULL);
+	g_return_val_if_fail(basename != NULL, NULL);
+
+	str = g_strdup_printf("%s\n%s\n%u\n%" G_GINT64_FORMAT, hash, basename, port, timestamp);
+	return g_compute_hmac_for_string(G_CHECKSUM_SHA256,
+					 (const guchar *)secret,
+					 strlen(secret),
+					 str,
+					 -1);
+}
+
+/* compared in constant time so that the signature cannot be guessed a byte at a time */
+gboolean
+passim_digest_verify_replicate(const gchar *secret,
+			       const gchar *hash,
+			       const gchar *basename,
+			       guint16 port,
+			       gint64 timestamp,
+			       const gchar *signature)
+{
+	guint8 diff = 0;
+	g_autofree gchar *expected = NULL;
+
+	g_return_val_if_fail(signature != NULL, FALSE);
+
+	expected = passim_digest_sign_replicate(secret, hash, basename, port, timestamp);
+	if (strlen(signature) != strlen(expected))
+		return FALSE;
+	for (guint i = 0; expected[i] != '\0'; i++)
+		diff |= expected[i] ^ signature[i];
+	return diff == 0;
+}
+
+void
+passim_digests_free(PassimDigests *digests)
+{
+	for (guint i = 0; i < PASSIM_DIGEST_KIND_LAST; i++)
+		g_free(digests->values[i]);
+	g_free(digests);
+}
+
+#ifdef HAVE_BLAKE3
+static void
+passim_digest_blake3_update(blake3_hasher *hasher, const guint8 *buf, gsize bufsz)
+{
+	/* the SIMD implementation is chosen at runtime */
+#ifdef HAVE_BLAKE3_TBB
+	if (bufsz >= PASSIM_DIGEST_THREAD_MIN_SIZE) {
+		blake3_hasher_update_tbb(hasher, buf, bufsz);
+		return;
+	}
+#endif
+	blake3_hasher_update(hasher, buf, bufsz);
+}
+
+static gchar *
+passim_digest_blake3_finalize(blake3_hasher *hasher)
+{
+	guint8 digest[BLAKE3_OUT_LEN] = {0};
+	GString *str = g_string_sized_new(2 * BLAKE3_OUT_LEN);
+
+	blake3_hasher_finalize(hasher, digest, sizeof(digest));
+	for (guint i = 0; i < sizeof(digest); i++)
+		g_string_append_printf(str, "%02x", digest[i]);
+	return g_string_free(str, FALSE);
+}
+#endif
+
+/*
+ * every digest in @mask is updated from the same block before moving on to the next, so the blob
+ * is only read once -- unsupported kinds in @mask are ignored, and @func is called for each block
+ * so that other hashes of fixed-size blocks can be built in the same pass
+ */
+PassimDigests *
+passim_digests_new_full(GBytes *blob,
+			guint mask,
+			gsize block_size,
+			PassimDigestsBlockFunc func,
+			gpointer user_data)
+{
+	const guint8 *data;
+	gsize offset = 0;
+	gsize size = 0;
+	GChecksum *checksums[PASSIM_DIGEST_KIND_LAST] = {NULL};
+	PassimDigests *digests;
+#ifdef HAVE_BLAKE3
+	blake3_hasher hasher;
+	gboolean use_blake3 = (mask & (1u << PASSIM_DIGEST_KIND_BLAKE3)) > 0;
+#endif
+
+	g_return_val_if_fail(blob != NULL, NULL);
+	g_return_val_if_fail(block_size > 0, NULL);
+
+	data = g_bytes_get_data(blob, &size);
+	for (guint i = 0; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		GChecksumType checksum_type;
+		if ((mask & (1u << i)) == 0)
+			continue;
+		if (passim_digest_kind_to_checksum_type(i, &checksum_type))
+			checksums[i] = g_checksum_new(checksum_type);
+	}
+#ifdef HAVE_BLAKE3
+	if (use_blake3)
+		blake3_hasher_init(&hasher);
+#endif
+
+	/* an empty blob is still one empty block */
+	do {
+		gsize chunk = MIN(size - offset, block_size);
+		for (guint i = 0; i < PASSIM_DIGEST_KIND_LAST; i++) {
+			if (checksums[i] != NULL)
+				g_checksum_update(checksums[i], data + offset, chunk);
+		}
+#ifdef HAVE_BLAKE3
+		if (use_blake3)
+			passim_digest_blake3_update(&hasher, data + offset, chunk);
+#endif
+		if (func != NULL)
+			func(data + offset, chunk, user_data);
+		offset += chunk;
+	} while (offset < size);
+
+	digests = g_new0(PassimDigests, 1);
+	for (guint i = 0; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		if (checksums[i] == NULL)
+			continue;
+		digests->values[i] = g_strdup(g_checksum_get_string(checksums[i]));
+		g_checksum_free(checksums[i]);
+	}
+#ifdef HAVE_BLAKE3
+	if (use_blake3)
+		digests->values[PASSIM_DIGEST_KIND_BLAKE3] = passim_digest_blake3_finalize(&hasher);
+#endif
+	return digests;
+}
+
+PassimDigests *
+passim_digests_new(GBytes *blob, guint mask)
+{
+	return passim_digests_new_full(blob, mask, PASSIM_DIGEST_BLOCK_SIZE, NULL, NULL);
+}
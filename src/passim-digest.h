@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+/* SHA-256 is always the item hash, and the others are aliases for it */
+typedef enum {
+	PASSIM_DIGEST_KIND_SHA256,
+	PASSIM_DIGEST_KIND_BLAKE3,
+	PASSIM_DIGEST_KIND_SHA1,
+	PASSIM_DIGEST_KIND_SHA384,
+	PASSIM_DIGEST_KIND_SHA512,
+	PASSIM_DIGEST_KIND_LAST
+} PassimDigestKind;
+
+typedef struct {
+	gchar *values[PASSIM_DIGEST_KIND_LAST]; /* lowercase hex, or NULL if not computed */
+} PassimDigests;
+
+const gchar *
+passim_digest_kind_to_string(PassimDigestKind kind);
+PassimDigestKind
+passim_digest_kind_from_string(const gchar *kind);
+gboolean
+passim_digest_kind_is_supported(PassimDigestKind kind);
+gboolean
+passim_digest_kind_is_valid(PassimDigestKind kind, const gchar *value);
+gchar *
+passim_digest_build_key(PassimDigestKind kind, const gchar *value);
+gchar *
+passim_digest_build_uri_key(const gchar *uri, const gchar *etag);
+gboolean
+passim_digest_parse_path(const gchar *path, PassimDigestKind *kind, gchar **value);
+gchar *
+passim_digest_sign_replicate(const gchar *secret,
+			     const gchar *hash,
+			     const gchar *basename,
+			     guint16 port,
+			     gint64 timestamp);
+gboolean
+passim_digest_verify_replicate(const gchar *secret,
+			       const gchar *hash,
+			       const gchar *basename,
+			       guint16 port,
+			       gint64 timestamp,
+			       const gchar *signature);
+
+void
+passim_digests_free(PassimDigests *digests);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimDigests, passim_digests_free)
+
+typedef void (*PassimDigestsBlockFunc)(const guint8 *buf, gsize bufsz, gpointer user_data);
+
+PassimDigests *
+passim_digests_new(GBytes *blob, guint mask);
+PassimDigests *
+passim_digests_new_full(GBytes *blob,
+			guint mask,
+			gsize block_size,
+			PassimDigestsBlockFunc func,
+			gpointer user_data);
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "passim-fault.h"
+
+typedef struct {
+	guint delay_ms;
+	guint rate;  /* percentage of calls that are delayed */
+	guint error; /* percentage of calls that fail */
+} PassimFault;
+
+/* the daemon is single threaded, and this is never built for production */
+static PassimFault passim_faults[PASSIM_FAULT_POINT_LAST] = {0};
+
+const gchar *
+passim_fault_point_to_string(PassimFaultPoint point)
+{
+	if (point == PASSIM_FAULT_POINT_FILE_MAP)
+		return "file-map";
+	if (point == PASSIM_FAULT_POINT_XATTR)
+		return "xattr";
+	if (point == PASSIM_FAULT_POINT_AVAHI_CALL)
+		return "avahi-call";
+	if (point == PASSIM_FAULT_POINT_RESOLVER_SIGNAL)
+		return "resolver-signal";
+	if (point == PASSIM_FAULT_POINT_TLS_WRITE)
+		return "tls-write";
+	return NULL;
+}
+
+static PassimFaultPoint
+passim_fault_point_from_string(const gchar *point)
+{
+	for (guint i = 0; i < PASSIM_FAULT_POINT_LAST; i++) {
+		if (g_strcmp0(point, passim_fault_point_to_string(i)) == 0)
+			return i;
+	}
+	return PASSIM_FAULT_POINT_LAST;
+}
+
+static gboolean
+passim_fault_parse_value(PassimFault *fault, const gchar *value, GError **error)
+{
+	guint64 tmp = 0;
+	g_auto(GStrv) kv = g_strsplit(value, "=", 2);
+
+	if (kv[1] == NULL) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_ARGUMENT,
+			    "invalid fault %s, expected KEY=VALUE",
+			    value);
+		return FALSE;
+	}
+	if (g_strcmp0(kv[0], "delay") == 0) {
+		if (!g_ascii_string_to_unsigned(kv[1], 10, 0, G_MAXUINT, &tmp, error))
+			return FALSE;
+		fault->delay_ms = tmp;
+		return TRUE;
+	}
+	if (g_strcmp0(kv[0], "rate") == 0) {
+		if (!g_ascii_string_to_unsigned(kv[1], 10, 0, 100, &tmp, error))
+			return FALSE;
+		fault->rate = tmp;
+		return TRUE;
+	}
+	if (g_strcmp0(kv[0], "error") == 0) {
+		if (!g_ascii_string_to_unsigned(kv[1], 10, 0, 100, &tmp, error))
+			return FALSE;
+		fault->error = tmp;
+		return TRUE;
+	}
+	g_set_error(error,
+		    G_IO_ERROR,
+		    G_IO_ERROR_INVALID_ARGUMENT,
+		    "unknown fault key %s, expected delay, rate or error",
+		    kv[0]);
+	return FALSE;
+}
+
+/*
+ * in the format POINT:KEY=VALUE[:KEY=VALUE],... where delay is in ms, and rate and error are the
+ * percentage of calls that are delayed and that fail -- an empty spec clears all faults
+ */
+gboolean
+passim_fault_setup(const gchar *spec, GError **error)
+{
+	PassimFault faults[PASSIM_FAULT_POINT_LAST] = {0};
+	g_auto(GStrv) sections = NULL;
+
+	if (spec != NULL && spec[0] != '\0')
+		sections = g_strsplit(spec, ",", -1);
+	for (guint i = 0; sections != NULL && sections[i] != NULL; i++) {
+		PassimFaultPoint point;
+		g_auto(GStrv) parts = g_strsplit(sections[i], ":", -1);
+
+		point = passim_fault_point_from_string(parts[0]);
+		if (point == PASSIM_FAULT_POINT_LAST) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_ARGUMENT,
+				    "unknown fault point %s",
+				    parts[0]);
+			return FALSE;
+		}
+		faults[point].rate = 100;
+		for (guint j = 1; parts[j] != NULL; j++) {
+			if (!passim_fault_parse_value(&faults[point], parts[j], error)) {
+				g_prefix_error(error, "%s: ", parts[0]);
+				return FALSE;
+			}
+		}
+	}
+
+	/* only replace the old faults if everything was valid */
+	memcpy(passim_faults, faults, sizeof(faults));
+	return TRUE;
+}
+
+gchar *
+passim_fault_to_string(void)
+{
+	GString *str = g_string_new(NULL);
+
+	for (guint i = 0; i < PASSIM_FAULT_POINT_LAST; i++) {
+		PassimFault *fault = &passim_faults[i];
+		if (fault->delay_ms == 0 && fault->error == 0)
+			continue;
+		if (str->len > 0)
+			g_string_append(str, ",");
+		g_string_append_printf(str,
+				       "%s:delay=%u:rate=%u:error=%u",
+				       passim_fault_point_to_string(i),
+				       fault->delay_ms,
+				       fault->rate,
+				       fault->error);
+	}
+	return g_string_free(str, FALSE);
+}
+
+/* decide what happens to this call, without sleeping, for callers that are asynchronous */
+gboolean
+passim_fault_roll(PassimFaultPoint point, guint *delay_ms, GError **error)
+{
+	PassimFault *fault;
+
+	g_return_val_if_fail(point < PASSIM_FAULT_POINT_LAST, FALSE);
+
+	fault = &passim_faults[point];
+	if (delay_ms != NULL) {
+		*delay_ms = 0;
+		if (fault->delay_ms > 0 && (guint)g_random_int_range(0, 100) < fault->rate)
+			*delay_ms = fault->delay_ms;
+	}
+	if (fault->error > 0 && (guint)g_random_int_range(0, 100) < fault->error) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "injected fault at %s",
+			    passim_fault_point_to_string(point));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* for callers that are already blocking, e.g. file and xattr I/O, or synchronous D-Bus calls */
+gboolean
+passim_fault_check(PassimFaultPoint point, GError **error)
+{
+	guint delay_ms = 0;
+	gboolean ret = passim_fault_roll(point, &delay_ms, error);
+
+	if (delay_ms > 0) {
+		g_debug("injecting %ums delay at %s",
+			delay_ms,
+			passim_fault_point_to_string(point));
+		g_usleep(delay_ms * 1000);
+	}
+	return ret;
+}
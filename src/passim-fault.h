@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+typedef enum {
+	PASSIM_FAULT_POINT_FILE_MAP,
+	PASSIM_FAULT_POINT_XATTR,
+	PASSIM_FAULT_POINT_AVAHI_CALL,
+	PASSIM_FAULT_POINT_RESOLVER_SIGNAL,
+	PASSIM_FAULT_POINT_TLS_WRITE,
+	PASSIM_FAULT_POINT_LAST
+} PassimFaultPoint;
+
+/*
+ * Latency and error injection for testing the daemon under failure, only built with
+ * -Dfault_injection=true. Otherwise these are no-ops that never delay and never fail.
+ */
+#ifdef HAVE_FAULT_INJECTION
+const gchar *
+passim_fault_point_to_string(PassimFaultPoint point);
+gboolean
+passim_fault_setup(const gchar *spec, GError **error);
+gchar *
+passim_fault_to_string(void);
+gboolean
+passim_fault_roll(PassimFaultPoint point, guint *delay_ms, GError **error);
+gboolean
+passim_fault_check(PassimFaultPoint point, GError **error);
+#else
+static inline gboolean
+passim_fault_roll(PassimFaultPoint point, guint *delay_ms, GError **error)
+{
+	if (delay_ms != NULL)
+		*delay_ms = 0;
+	return TRUE;
+}
+static inline gboolean
+passim_fault_check(PassimFaultPoint point, GError **error)
+{
+	return TRUE;
+}
+#endif
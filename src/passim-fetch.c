@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <libsoup/soup.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "passim-fetch.h"
+
+#define PASSIM_FETCH_BLOCK_SIZE 0x10000
+#define PASSIM_FETCH_TIMEOUT	60 /* s */
+
+/* from linux/ioprio.h, which is not always installed */
+#define PASSIM_IOPRIO_WHO_PROCESS 1
+#define PASSIM_IOPRIO_CLASS_IDLE  3
+#define PASSIM_IOPRIO_CLASS_SHIFT 13
+
+/* on Linux both of these only apply to the calling thread, and so this is only used in workers */
+void
+passim_fetch_lower_priority(void)
+{
+	pid_t tid = syscall(SYS_gettid);
+
+	if (setpriority(PRIO_PROCESS, tid, 19) != 0)
+		g_debug("failed to set CPU priority: %s", g_strerror(errno));
+#ifdef SYS_ioprio_set
+	if (syscall(SYS_ioprio_set,
+		    PASSIM_IOPRIO_WHO_PROCESS,
+		    tid,
+		    PASSIM_IOPRIO_CLASS_IDLE << PASSIM_IOPRIO_CLASS_SHIFT) != 0)
+		g_debug("failed to set IO priority: %s", g_strerror(errno));
+#endif
+}
+
+static gboolean
+passim_fetch_accept_certificate_cb(SoupMessage *msg,
+				   GTlsCertificate *cert,
+				   GTlsCertificateFlags errors,
+				   gpointer user_data)
+{
+	/* passimd always uses a self-signed certificate, and the content is checked instead */
+	return TRUE;
+}
+
+/* so that many requests to the same peer can reuse the connection */
+SoupSession *
+passim_fetch_session_new(void)
+{
+	return soup_session_new_with_options("user-agent",
+					     PACKAGE_NAME "/" VERSION,
+					     "timeout",
+					     PASSIM_FETCH_TIMEOUT,
+					     NULL);
+}
+
+/*
+ * synchronous, and so only to be used from a worker thread -- @checksum is the SHA-256 hash of the
+ * contents, which is nullable only for files that are just hints, and @rate is in bytes per second
+ * or 0 for no limit
+ */
+GBytes *
+passim_fetch_bytes(const gchar *uri,
+		   const gchar *checksum,
+		   gsize max_size,
+		   guint64 rate,
+		   GCancellable *cancellable,
+		   GError **error)
+{
+	gint64 start_time = g_get_monotonic_time();
+	guint status_code;
+	g_autofree guint8 *buf = g_malloc0(PASSIM_FETCH_BLOCK_SIZE);
+	g_autoptr(GByteArray) array = g_byte_array_new();
+	g_autoptr(GChecksum) csum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(SoupMessage) msg = NULL;
+	g_autoptr(SoupSession) session = NULL;
+
+	g_return_val_if_fail(uri != NULL, NULL);
+	g_return_val_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable), NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	msg = soup_message_new(SOUP_METHOD_GET, uri);
+	if (msg == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "invalid URI %s", uri);
+		return NULL;
+	}
+	g_signal_connect(msg,
+			 "accept-certificate",
+			 G_CALLBACK(passim_fetch_accept_certificate_cb),
+			 NULL);
+	session = passim_fetch_session_new();
+	stream = soup_session_send(session, msg, cancellable, error);
+	if (stream == NULL) {
+		g_prefix_error(error, "failed to download %s: ", uri);
+		return NULL;
+	}
+	status_code = soup_message_get_status(msg);
+	if (status_code != SOUP_STATUS_OK) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "failed to download %s: %u %s",
+			    uri,
+			    status_code,
+			    soup_status_get_phrase(status_code));
+		return NULL;
+	}
+
+	/* the peer is not trusted to send what was asked for */
+	while (TRUE) {
+		gssize len;
+		gint64 elapsed;
+		gint64 expected;
+
+		len = g_input_stream_read(stream, buf, PASSIM_FETCH_BLOCK_SIZE, cancellable, error);
+		if (len < 0) {
+			g_prefix_error(error, "failed to read %s: ", uri);
+			return NULL;
+		}
+		if (len == 0)
+			break;
+		if (array->len + len > max_size) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "%s is larger than 0x%x bytes",
+				    uri,
+				    (guint)max_size);
+			return NULL;
+		}
+		g_byte_array_append(array, buf, len);
+		g_checksum_update(csum, buf, len);
+
+		/* sleep until the average is below the limit */
+		if (rate == 0)
+			continue;
+		elapsed = g_get_monotonic_time() - start_time;
+		expected = (gint64)((guint64)array->len * G_USEC_PER_SEC / rate);
+		if (expected > elapsed)
+			g_usleep(expected - elapsed);
+	}
+	if (checksum != NULL && g_strcmp0(g_checksum_get_string(csum), checksum) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s checksum was %s, expected %s",
+			    uri,
+			    g_checksum_get_string(csum),
+			    checksum);
+		return NULL;
+	}
+	return g_byte_array_free_to_bytes(g_steal_pointer(&array));
+}
+
+/* synchronous, and all the arguments are in the query as the peer only has to accept or refuse */
+gboolean
+passim_fetch_post(const gchar *uri, GCancellable *cancellable, GError **error)
+{
+	guint status_code;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(SoupMessage) msg = NULL;
+	g_autoptr(SoupSession) session = NULL;
+
+	g_return_val_if_fail(uri != NULL, FALSE);
+	g_return_val_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable), FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	msg = soup_message_new(SOUP_METHOD_POST, uri);
+	if (msg == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "invalid URI %s", uri);
+		return FALSE;
+	}
+	g_signal_connect(msg,
+			 "accept-certificate",
+			 G_CALLBACK(passim_fetch_accept_certificate_cb),
+			 NULL);
+	session = passim_fetch_session_new();
+	blob = soup_session_send_and_read(session, msg, cancellable, error);
+	if (blob == NULL) {
+		g_prefix_error(error, "failed to send to %s: ", uri);
+		return FALSE;
+	}
+	status_code = soup_message_get_status(msg);
+	if (!SOUP_STATUS_IS_SUCCESSFUL(status_code)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "failed to send to %s: %u %s",
+			    uri,
+			    status_code,
+			    soup_status_get_phrase(status_code));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* synchronous, where the peer has to send exactly the @size bytes at @offset */
+GBytes *
+passim_fetch_range(SoupSession *session,
+		   const gchar *uri,
+		   guint64 offset,
+		   gsize size,
+		   GCancellable *cancellable,
+		   GError **error)
+{
+	guint status_code;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(SoupMessage) msg = NULL;
+
+	g_return_val_if_fail(SOUP_IS_SESSION(session), NULL);
+	g_return_val_if_fail(uri != NULL, NULL);
+	g_return_val_if_fail(size > 0, NULL);
+	g_return_val_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable), NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	msg = soup_message_new(SOUP_METHOD_GET, uri);
+	if (msg == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "invalid URI %s", uri);
+		return NULL;
+	}
+	g_signal_connect(msg,
+			 "accept-certificate",
+			 G_CALLBACK(passim_fetch_accept_certificate_cb),
+			 NULL);
+	soup_message_headers_set_range(soup_message_get_request_headers(msg),
+				       offset,
+				       offset + size - 1);
+
+	/* the range has to be of the uncompressed contents */
+	soup_message_disable_feature(msg, SOUP_TYPE_CONTENT_DECODER);
+	soup_message_headers_replace(soup_message_get_request_headers(msg),
+				     "Accept-Encoding",
+				     "identity");
+	blob = soup_session_send_and_read(session, msg, cancellable, error);
+	if (blob == NULL) {
+		g_prefix_error(error, "failed to download %s: ", uri);
+		return NULL;
+	}
+	status_code = soup_message_get_status(msg);
+	if (status_code != SOUP_STATUS_PARTIAL_CONTENT) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "failed to download range of %s: %u %s",
+			    uri,
+			    status_code,
+			    soup_status_get_phrase(status_code));
+		return NULL;
+	}
+	if (g_bytes_get_size(blob) != size) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s range was 0x%x bytes, expected 0x%x",
+			    uri,
+			    (guint)g_bytes_get_size(blob),
+			    (guint)size);
+		return NULL;
+	}
+	return g_steal_pointer(&blob);
+}
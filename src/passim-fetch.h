@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+void
+passim_fetch_lower_priority(void);
+SoupSession *
+passim_fetch_session_new(void);
+GBytes *
+passim_fetch_bytes(const gchar *uri,
+		   const gchar *checksum,
+		   gsize max_size,
+		   guint64 rate,
+		   GCancellable *cancellable,
+		   GError **error);
+gboolean
+passim_fetch_post(const gchar *uri, GCancellable *cancellable, GError **error);
+GBytes *
+passim_fetch_range(SoupSession *session,
+		   const gchar *uri,
+		   guint64 offset,
+		   gsize size,
+		   GCancellable *cancellable,
+		   GError **error);
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include "passim-index.h"
+
+/* the value returned from GetItems */
+GVariant *
+passim_index_to_variant(GHashTable *items)
+{
+	GVariantBuilder builder;
+	g_autoptr(GList) values = g_hash_table_get_values(items);
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+	for (GList *l = values; l != NULL; l = l->next) {
+		PassimItem *item = PASSIM_ITEM(l->data);
+		g_variant_builder_add_value(&builder, passim_item_to_variant(item));
+	}
+	return g_variant_builder_end(&builder);
+}
+
+/* the HTML page shown on https://localhost:27500/ */
+gchar *
+passim_index_to_html(GHashTable *items, const gchar *title, guint16 port, PassimStatus status)
+{
+	GString *html = g_string_new(NULL);
+	g_autoptr(GList) keys = g_hash_table_get_keys(items);
+
+	g_string_append(html, "<html>\n");
+	g_string_append(html, "<head>\n");
+	g_string_append(html, "<meta charset=\"utf-8\" />\n");
+	g_string_append(
+	    html,
+	    "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />\n");
+	g_string_append_printf(html, "<title>%s</title>\n", title);
+	g_string_append(html, "<link href=\"style.css\" rel=\"stylesheet\" />\n");
+	g_string_append(html, "</head>");
+	g_string_append(html, "<body>");
+	g_string_append_printf(html, "<h1>%s</h1>\n", title);
+	g_string_append_printf(
+	    html,
+	    "<p>A <a href=\"https://github.com/hughsie/%s\">local caching server</a>, "
+	    "version <code>%s</code> with status <code>%s</code>.</p>\n",
+	    PACKAGE_NAME,
+	    VERSION,
+	    passim_status_to_string(status));
+	if (keys == NULL) {
+		g_string_append(html, "<em>There are no shared files on this computer.</em>\n");
+	} else {
+		g_string_append(html, "<h2>Shared Files:</h2>\n");
+		g_string_append(html, "<table>\n");
+		g_string_append(html, "<tr>\n");
+		g_string_append(html, "<th>Filename</th>\n");
+		g_string_append(html, "<th>Hash</th>\n");
+		g_string_append(html, "<th>Binary</th>\n");
+		g_string_append(html, "<th>Age</th>\n");
+		g_string_append(html, "<th>Shared</th>\n");
+		g_string_append(html, "<th>Size</th>\n");
+		g_string_append(html, "<th>Flags</th>\n");
+		g_string_append(html, "</tr>\n");
+		for (GList *l = keys; l != NULL; l = l->next) {
+			const gchar *hash = l->data;
+			PassimItem *item = g_hash_table_lookup(items, hash);
+			g_autofree gchar *flags = passim_item_get_flags_as_string(item);
+			g_autofree gchar *url = g_strdup_printf("https://localhost:%u/%s?sha256=%s",
+								port,
+								passim_item_get_basename(item),
+								hash);
+			g_string_append(html, "<tr>\n");
+			g_string_append_printf(html,
+					       "<td><a href=\"%s\">%s</a></td>\n",
+					       url,
+					       passim_item_get_basename(item));
+			g_string_append_printf(html,
+					       "<td><code>%s</code></td>\n",
+					       passim_item_get_hash(item));
+			if (passim_item_get_cmdline(item) == NULL) {
+				g_string_append_printf(html, "<td><code>n/a</code></td>\n");
+			} else {
+				g_string_append_printf(html,
+						       "<td><code>%s</code></td>\n",
+						       passim_item_get_cmdline(item));
+			}
+			if (passim_item_get_max_age(item) == G_MAXUINT32) {
+				g_string_append_printf(html,
+						       "<td>%u/∞h</td>\n",
+						       passim_item_get_age(item) / 3600u);
+			} else {
+				g_string_append_printf(html,
+						       "<td>%u/%uh</td>\n",
+						       passim_item_get_age(item) / 3600u,
+						       passim_item_get_max_age(item) / 3600u);
+			}
+			if (passim_item_get_share_limit(item) == G_MAXUINT32) {
+				g_string_append_printf(html,
+						       "<td>%u/∞</td>\n",
+						       passim_item_get_share_count(item));
+			} else if (passim_item_get_share_limit_effective(item) != 0) {
+				g_string_append_printf(html,
+						       "<td>%u/%u (adaptive, requested %u)</td>\n",
+						       passim_item_get_share_count(item),
+						       passim_item_get_share_limit_effective(item),
+						       passim_item_get_share_limit(item));
+			} else {
+				g_string_append_printf(html,
+						       "<td>%u/%u</td>\n",
+						       passim_item_get_share_count(item),
+						       passim_item_get_share_limit(item));
+			}
+			if (passim_item_get_size(item) == 0) {
+				g_string_append(html, "<td>?</td>\n");
+			} else {
+				g_autofree gchar *size = g_format_size(passim_item_get_size(item));
+				g_string_append_printf(html, "<td>%s</td>\n", size);
+			}
+			g_string_append_printf(html, "<td><code>%s</code></td>\n", flags);
+			g_string_append(html, "</tr>");
+		}
+		g_string_append(html, "</table>\n");
+	}
+	g_string_append(html, "</body>\n");
+	g_string_append(html, "</html>\n");
+	return g_string_free(html, FALSE);
+}
+
+static gint
+passim_index_sort_by_share_count_cb(gconstpointer a, gconstpointer b)
+{
+	PassimItem *item1 = *((PassimItem **)a);
+	PassimItem *item2 = *((PassimItem **)b);
+	if (passim_item_get_share_count(item1) > passim_item_get_share_count(item2))
+		return -1;
+	if (passim_item_get_share_count(item1) < passim_item_get_share_count(item2))
+		return 1;
+	return g_strcmp0(passim_item_get_hash(item1), passim_item_get_hash(item2));
+}
+
+/* a "{hash} {share-count} {size} {basename}" line for each of the @limit most shared items */
+gchar *
+passim_index_to_catalog(GHashTable *items, guint limit)
+{
+	GString *str = g_string_new(NULL);
+	g_autoptr(GList) values = g_hash_table_get_values(items);
+	g_autoptr(GPtrArray) array = g_ptr_array_new();
+
+	for (GList *l = values; l != NULL; l = l->next) {
+		PassimItem *item = PASSIM_ITEM(l->data);
+		if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED))
+			continue;
+		g_ptr_array_add(array, item);
+	}
+	g_ptr_array_sort(array, passim_index_sort_by_share_count_cb);
+	for (guint i = 0; i < MIN(array->len, limit); i++) {
+		PassimItem *item = g_ptr_array_index(array, i);
+		g_string_append_printf(str,
+				       "%s %u %" G_GUINT64_FORMAT " %s\n",
+				       passim_item_get_hash(item),
+				       passim_item_get_share_count(item),
+				       passim_item_get_size(item),
+				       passim_item_get_basename(item));
+	}
+	return g_string_free(str, FALSE);
+}
+
+static gboolean
+passim_index_hash_valid(const gchar *hash)
+{
+	if (strlen(hash) != 64)
+		return FALSE;
+	for (guint i = 0; hash[i] != '\0'; i++) {
+		if (!g_ascii_isxdigit(hash[i]) || g_ascii_isupper(hash[i]))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* the catalog comes from another machine, so the basename is checked as it is used in the path */
+GPtrArray *
+passim_index_catalog_parse(const gchar *str, GError **error)
+{
+	g_autoptr(GPtrArray) array = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
+	g_auto(GStrv) lines = NULL;
+
+	g_return_val_if_fail(str != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	lines = g_strsplit(str, "\n", -1);
+	for (guint i = 0; lines[i] != NULL; i++) {
+		guint64 share_count = 0;
+		guint64 size = 0;
+		g_auto(GStrv) sections = NULL;
+		g_autoptr(PassimItem) item = passim_item_new();
+
+		if (lines[i][0] == '\0')
+			continue;
+		sections = g_strsplit(lines[i], " ", 4);
+		if (g_strv_length(sections) != 4) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "expected {hash} {share-count} {size} {basename} on line %u",
+				    i + 1);
+			return NULL;
+		}
+		if (!passim_index_hash_valid(sections[0])) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "invalid hash on line %u",
+				    i + 1);
+			return NULL;
+		}
+		if (!g_ascii_string_to_unsigned(sections[1],
+						10,
+						0,
+						G_MAXUINT32,
+						&share_count,
+						error))
+			return NULL;
+		if (!g_ascii_string_to_unsigned(sections[2], 10, 0, G_MAXUINT64, &size, error))
+			return NULL;
+		if (sections[3][0] == '\0' || sections[3][0] == '.' ||
+		    strchr(sections[3], '/') != NULL || !g_utf8_validate(sections[3], -1, NULL)) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "invalid basename on line %u",
+				    i + 1);
+			return NULL;
+		}
+		passim_item_set_hash(item, sections[0]);
+		passim_item_set_share_count(item, share_count);
+		passim_item_set_size(item, size);
+		passim_item_set_basename(item, sections[3]);
+		g_ptr_array_add(array, g_steal_pointer(&item));
+	}
+	return g_steal_pointer(&array);
+}
@@ -0,0 +1,18 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include "passim-common.h"
+
+GVariant *
+passim_index_to_variant(GHashTable *items);
+gchar *
+passim_index_to_html(GHashTable *items, const gchar *title, guint16 port, PassimStatus status);
+gchar *
+passim_index_to_catalog(GHashTable *items, guint limit);
+GPtrArray *
+passim_index_catalog_parse(const gchar *str, GError **error);
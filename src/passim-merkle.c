@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include "passim-merkle.h"
+
+#define PASSIM_MERKLE_DIGEST_SIZE 32
+
+/*
+ * a binary tree of SHA-256 hashes of fixed-size blocks, where leaves and nodes use different
+ * prefixes as in RFC 6962 so that one cannot be passed off as the other, and an odd node at the
+ * end of a level is promoted unchanged
+ */
+struct PassimMerkle {
+	guint32 block_size;
+	guint64 size;
+	GByteArray *leaves; /* of PASSIM_MERKLE_DIGEST_SIZE each */
+	gchar *root;
+};
+
+void
+passim_merkle_free(PassimMerkle *merkle)
+{
+	if (merkle->leaves != NULL)
+		g_byte_array_unref(merkle->leaves);
+	g_free(merkle->root);
+	g_free(merkle);
+}
+
+static void
+passim_merkle_hash(guint8 prefix,
+		   const guint8 *buf1,
+		   gsize bufsz1,
+		   const guint8 *buf2,
+		   gsize bufsz2,
+		   guint8 *digest)
+{
+	gsize digestsz = PASSIM_MERKLE_DIGEST_SIZE;
+	g_autoptr(GChecksum) csum = g_checksum_new(G_CHECKSUM_SHA256);
+
+	g_checksum_update(csum, &prefix, 1);
+	g_checksum_update(csum, buf1, bufsz1);
+	if (buf2 != NULL)
+		g_checksum_update(csum, buf2, bufsz2);
+	g_checksum_get_digest(csum, digest, &digestsz);
+}
+
+static gchar *
+passim_merkle_digest_to_string(const guint8 *digest)
+{
+	GString *str = g_string_sized_new(PASSIM_MERKLE_DIGEST_SIZE * 2);
+	for (guint i = 0; i < PASSIM_MERKLE_DIGEST_SIZE; i++)
+		g_string_append_printf(str, "%02x", digest[i]);
+	return g_string_free(str, FALSE);
+}
+
+static gboolean
+passim_merkle_digest_from_string(const gchar *str, guint8 *digest)
+{
+	if (strlen(str) != PASSIM_MERKLE_DIGEST_SIZE * 2)
+		return FALSE;
+	for (guint i = 0; i < PASSIM_MERKLE_DIGEST_SIZE; i++) {
+		gint hi = g_ascii_xdigit_value(str[i * 2]);
+		gint lo = g_ascii_xdigit_value(str[i * 2 + 1]);
+		if (hi < 0 || lo < 0)
+			return FALSE;
+		digest[i] = (hi << 4) | lo;
+	}
+	return TRUE;
+}
+
+static gchar *
+passim_merkle_compute_root(GByteArray *leaves)
+{
+	g_autoptr(GByteArray) level = g_byte_array_new();
+
+	g_byte_array_append(level, leaves->data, leaves->len);
+	while (level->len > PASSIM_MERKLE_DIGEST_SIZE) {
+		guint n_nodes = level->len / PASSIM_MERKLE_DIGEST_SIZE;
+		g_autoptr(GByteArray) parent = g_byte_array_new();
+		for (guint i = 0; i < n_nodes; i += 2) {
+			const guint8 *left = level->data + i * PASSIM_MERKLE_DIGEST_SIZE;
+			guint8 digest[PASSIM_MERKLE_DIGEST_SIZE] = {0};
+			if (i + 1 == n_nodes) {
+				g_byte_array_append(parent, left, PASSIM_MERKLE_DIGEST_SIZE);
+				continue;
+			}
+			passim_merkle_hash(0x01,
+					   left,
+					   PASSIM_MERKLE_DIGEST_SIZE,
+					   left + PASSIM_MERKLE_DIGEST_SIZE,
+					   PASSIM_MERKLE_DIGEST_SIZE,
+					   digest);
+			g_byte_array_append(parent, digest, sizeof(digest));
+		}
+		g_byte_array_unref(level);
+		level = g_steal_pointer(&parent);
+	}
+	return passim_merkle_digest_to_string(level->data);
+}
+
+static guint
+passim_merkle_count_blocks(guint64 size, guint32 block_size)
+{
+	/* an empty file still has one empty block */
+	if (size == 0)
+		return 1;
+	return (size + block_size - 1) / block_size;
+}
+
+/* for passim_merkle_add_block(), so the leaves can be hashed while reading the blob for others */
+PassimMerkle *
+passim_merkle_new_empty(guint32 block_size)
+{
+	PassimMerkle *merkle;
+
+	g_return_val_if_fail(block_size > 0, NULL);
+
+	merkle = g_new0(PassimMerkle, 1);
+	merkle->block_size = block_size;
+	merkle->leaves = g_byte_array_new();
+	return merkle;
+}
+
+/* every block apart from the last has to be @block_size */
+void
+passim_merkle_add_block(PassimMerkle *merkle, const guint8 *buf, gsize bufsz)
+{
+	guint8 digest[PASSIM_MERKLE_DIGEST_SIZE] = {0};
+
+	g_return_if_fail(merkle != NULL);
+	g_return_if_fail(bufsz <= merkle->block_size);
+
+	passim_merkle_hash(0x00, buf, bufsz, NULL, 0, digest);
+	g_byte_array_append(merkle->leaves, digest, sizeof(digest));
+	merkle->size += bufsz;
+	g_clear_pointer(&merkle->root, g_free);
+}
+
+PassimMerkle *
+passim_merkle_new(GBytes *blob, guint32 block_size)
+{
+	gsize offset = 0;
+	gsize size = 0;
+	const guint8 *data = g_bytes_get_data(blob, &size);
+	PassimMerkle *merkle;
+
+	g_return_val_if_fail(block_size > 0, NULL);
+
+	/* an empty file still has one empty block */
+	merkle = passim_merkle_new_empty(block_size);
+	do {
+		gsize chunk = MIN(block_size, size - offset);
+		passim_merkle_add_block(merkle, data + offset, chunk);
+		offset += chunk;
+	} while (offset < size);
+	return merkle;
+}
+
+const gchar *
+passim_merkle_get_root(PassimMerkle *merkle)
+{
+	g_return_val_if_fail(merkle != NULL, NULL);
+	g_return_val_if_fail(merkle->leaves->len > 0, NULL);
+	if (merkle->root == NULL)
+		merkle->root = passim_merkle_compute_root(merkle->leaves);
+	return merkle->root;
+}
+
+guint32
+passim_merkle_get_block_size(PassimMerkle *merkle)
+{
+	g_return_val_if_fail(merkle != NULL, 0);
+	return merkle->block_size;
+}
+
+guint64
+passim_merkle_get_size(PassimMerkle *merkle)
+{
+	g_return_val_if_fail(merkle != NULL, 0);
+	return merkle->size;
+}
+
+guint
+passim_merkle_get_n_blocks(PassimMerkle *merkle)
+{
+	g_return_val_if_fail(merkle != NULL, 0);
+	return merkle->leaves->len / PASSIM_MERKLE_DIGEST_SIZE;
+}
+
+/* so that a bad block can be discarded as soon as it arrives, and the peer not used again */
+gboolean
+passim_merkle_verify_block(PassimMerkle *merkle, guint idx, GBytes *block, GError **error)
+{
+	guint64 offset;
+	guint8 digest[PASSIM_MERKLE_DIGEST_SIZE] = {0};
+
+	g_return_val_if_fail(merkle != NULL, FALSE);
+	g_return_val_if_fail(block != NULL, FALSE);
+	g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+	if (idx >= passim_merkle_get_n_blocks(merkle)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_ARGUMENT,
+			    "block %u out of range, only %u blocks",
+			    idx,
+			    passim_merkle_get_n_blocks(merkle));
+		return FALSE;
+	}
+	offset = (guint64)idx * merkle->block_size;
+	if (g_bytes_get_size(block) != MIN(merkle->block_size, merkle->size - offset)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "block %u is 0x%x bytes, expected 0x%x",
+			    idx,
+			    (guint)g_bytes_get_size(block),
+			    (guint)MIN(merkle->block_size, merkle->size - offset));
+		return FALSE;
+	}
+	passim_merkle_hash(0x00,
+			   g_bytes_get_data(block, NULL),
+			   g_bytes_get_size(block),
+			   NULL,
+			   0,
+			   digest);
+	if (memcmp(digest,
+		   merkle->leaves->data + idx * PASSIM_MERKLE_DIGEST_SIZE,
+		   sizeof(digest)) != 0) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "block %u is corrupt", idx);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* a "{root} {block-size} {size}" line, and then one line per block hash */
+gchar *
+passim_merkle_to_string(PassimMerkle *merkle)
+{
+	GString *str = g_string_new(NULL);
+
+	g_return_val_if_fail(merkle != NULL, NULL);
+
+	g_string_append_printf(str,
+			       "%s %u %" G_GUINT64_FORMAT "\n",
+			       passim_merkle_get_root(merkle),
+			       merkle->block_size,
+			       merkle->size);
+	for (guint i = 0; i < passim_merkle_get_n_blocks(merkle); i++) {
+		g_autofree gchar *leaf =
+		    passim_merkle_digest_to_string(merkle->leaves->data +
+						   i * PASSIM_MERKLE_DIGEST_SIZE);
+		g_string_append_printf(str, "%s\n", leaf);
+	}
+	return g_string_free(str, FALSE);
+}
+
+/* the block hashes have to match the root, but the root is only as trusted as the peer */
+PassimMerkle *
+passim_merkle_from_string(const gchar *str, GError **error)
+{
+	guint64 block_size = 0;
+	guint64 size = 0;
+	guint n_blocks;
+	g_auto(GStrv) header = NULL;
+	g_auto(GStrv) lines = NULL;
+	g_autoptr(PassimMerkle) merkle = g_new0(PassimMerkle, 1);
+
+	g_return_val_if_fail(str != NULL, NULL);
+	g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+	merkle->leaves = g_byte_array_new();
+	lines = g_strsplit(str, "\n", -1);
+	header = g_strsplit(lines[0] != NULL ? lines[0] : "", " ", -1);
+	if (g_strv_length(header) != 3 || strlen(header[0]) != PASSIM_MERKLE_DIGEST_SIZE * 2) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "expected {root} {block-size} {size}");
+		return NULL;
+	}
+	if (!g_ascii_string_to_unsigned(header[1], 10, 1, G_MAXUINT32, &block_size, error))
+		return NULL;
+	if (!g_ascii_string_to_unsigned(header[2], 10, 0, G_MAXUINT64, &size, error))
+		return NULL;
+	n_blocks = passim_merkle_count_blocks(size, block_size);
+	for (guint i = 1; lines[i] != NULL; i++) {
+		guint8 digest[PASSIM_MERKLE_DIGEST_SIZE] = {0};
+		if (lines[i][0] == '\0')
+			continue;
+		if (!passim_merkle_digest_from_string(lines[i], digest)) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "invalid block hash on line %u",
+				    i + 1);
+			return NULL;
+		}
+		g_byte_array_append(merkle->leaves, digest, sizeof(digest));
+	}
+	merkle->block_size = block_size;
+	merkle->size = size;
+	if (passim_merkle_get_n_blocks(merkle) != n_blocks) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "expected %u block hashes, got %u",
+			    n_blocks,
+			    passim_merkle_get_n_blocks(merkle));
+		return NULL;
+	}
+	merkle->root = passim_merkle_compute_root(merkle->leaves);
+	if (g_ascii_strcasecmp(merkle->root, header[0]) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "block hashes do not match root %s",
+			    header[0]);
+		return NULL;
+	}
+	return g_steal_pointer(&merkle);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define PASSIM_MERKLE_BLOCK_SIZE (256 * 1024)
+
+typedef struct PassimMerkle PassimMerkle;
+
+void
+passim_merkle_free(PassimMerkle *merkle);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimMerkle, passim_merkle_free)
+
+PassimMerkle *
+passim_merkle_new(GBytes *blob, guint32 block_size);
+PassimMerkle *
+passim_merkle_new_empty(guint32 block_size);
+void
+passim_merkle_add_block(PassimMerkle *merkle, const guint8 *buf, gsize bufsz);
+const gchar *
+passim_merkle_get_root(PassimMerkle *merkle);
+guint32
+passim_merkle_get_block_size(PassimMerkle *merkle);
+guint64
+passim_merkle_get_size(PassimMerkle *merkle);
+guint
+passim_merkle_get_n_blocks(PassimMerkle *merkle);
+gboolean
+passim_merkle_verify_block(PassimMerkle *merkle, guint idx, GBytes *block, GError **error);
+gchar *
+passim_merkle_to_string(PassimMerkle *merkle);
+PassimMerkle *
+passim_merkle_from_string(const gchar *str, GError **error);
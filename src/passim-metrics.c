@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <libsoup/soup.h>
+#include <stdatomic.h>
+
+#include "passim-metrics.h"
+
+/* upper bounds of each bucket, the implicit last bucket is +Inf */
+static const gint64 passim_metrics_bucket_us[] =
+    {1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000};
+static const gchar *passim_metrics_bucket_le[] =
+    {"0.001", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5"};
+
+#define PASSIM_METRICS_BUCKETS G_N_ELEMENTS(passim_metrics_bucket_us)
+
+typedef struct {
+	_Atomic guint64 buckets[PASSIM_METRICS_BUCKETS];
+	_Atomic guint64 count;
+	_Atomic guint64 sum_us;
+} PassimMetricsHistogramData;
+
+struct _PassimMetrics {
+	GObject parent_instance;
+	_Atomic guint64 outcomes[PASSIM_METRICS_OUTCOME_LAST];
+	_Atomic guint64 counters[PASSIM_METRICS_COUNTER_LAST];
+	_Atomic gint64 gauges[PASSIM_METRICS_GAUGE_LAST];
+	PassimMetricsHistogramData histograms[PASSIM_METRICS_HISTOGRAM_LAST];
+};
+
+G_DEFINE_TYPE(PassimMetrics, passim_metrics, G_TYPE_OBJECT)
+
+const gchar *
+passim_metrics_outcome_to_string(PassimMetricsOutcome outcome)
+{
+	if (outcome == PASSIM_METRICS_OUTCOME_SERVED)
+		return "served";
+	if (outcome == PASSIM_METRICS_OUTCOME_REDIRECT)
+		return "redirect";
+	if (outcome == PASSIM_METRICS_OUTCOME_NOT_FOUND)
+		return "not-found";
+	if (outcome == PASSIM_METRICS_OUTCOME_FORBIDDEN)
+		return "forbidden";
+	if (outcome == PASSIM_METRICS_OUTCOME_LOCKED)
+		return "locked";
+	if (outcome == PASSIM_METRICS_OUTCOME_OTHER)
+		return "other";
+	return NULL;
+}
+
+PassimMetricsOutcome
+passim_metrics_outcome_from_status(guint status_code)
+{
+	if (status_code == SOUP_STATUS_OK || status_code == SOUP_STATUS_PARTIAL_CONTENT)
+		return PASSIM_METRICS_OUTCOME_SERVED;
+	if (status_code == SOUP_STATUS_MOVED_TEMPORARILY)
+		return PASSIM_METRICS_OUTCOME_REDIRECT;
+	if (status_code == SOUP_STATUS_NOT_FOUND)
+		return PASSIM_METRICS_OUTCOME_NOT_FOUND;
+	if (status_code == SOUP_STATUS_FORBIDDEN)
+		return PASSIM_METRICS_OUTCOME_FORBIDDEN;
+	if (status_code == SOUP_STATUS_LOCKED)
+		return PASSIM_METRICS_OUTCOME_LOCKED;
+	return PASSIM_METRICS_OUTCOME_OTHER;
+}
+
+void
+passim_metrics_add_outcome(PassimMetrics *self, PassimMetricsOutcome outcome)
+{
+	g_return_if_fail(PASSIM_IS_METRICS(self));
+	g_return_if_fail(outcome < PASSIM_METRICS_OUTCOME_LAST);
+	atomic_fetch_add_explicit(&self->outcomes[outcome], 1, memory_order_relaxed);
+}
+
+guint64
+passim_metrics_get_outcome(PassimMetrics *self, PassimMetricsOutcome outcome)
+{
+	g_return_val_if_fail(PASSIM_IS_METRICS(self), 0);
+	g_return_val_if_fail(outcome < PASSIM_METRICS_OUTCOME_LAST, 0);
+	return atomic_load_explicit(&self->outcomes[outcome], memory_order_relaxed);
+}
+
+guint64
+passim_metrics_get_counter(PassimMetrics *self, PassimMetricsCounter counter)
+{
+	g_return_val_if_fail(PASSIM_IS_METRICS(self), 0);
+	g_return_val_if_fail(counter < PASSIM_METRICS_COUNTER_LAST, 0);
+	return atomic_load_explicit(&self->counters[counter], memory_order_relaxed);
+}
+
+void
+passim_metrics_counter_add(PassimMetrics *self, PassimMetricsCounter counter, guint64 value)
+{
+	g_return_if_fail(PASSIM_IS_METRICS(self));
+	g_return_if_fail(counter < PASSIM_METRICS_COUNTER_LAST);
+	atomic_fetch_add_explicit(&self->counters[counter], value, memory_order_relaxed);
+}
+
+void
+passim_metrics_gauge_add(PassimMetrics *self, PassimMetricsGauge gauge, gint64 value)
+{
+	g_return_if_fail(PASSIM_IS_METRICS(self));
+	g_return_if_fail(gauge < PASSIM_METRICS_GAUGE_LAST);
+	atomic_fetch_add_explicit(&self->gauges[gauge], value, memory_order_relaxed);
+}
+
+void
+passim_metrics_gauge_set(PassimMetrics *self, PassimMetricsGauge gauge, gint64 value)
+{
+	g_return_if_fail(PASSIM_IS_METRICS(self));
+	g_return_if_fail(gauge < PASSIM_METRICS_GAUGE_LAST);
+	atomic_store_explicit(&self->gauges[gauge], value, memory_order_relaxed);
+}
+
+void
+passim_metrics_histogram_observe(PassimMetrics *self,
+				 PassimMetricsHistogram histogram,
+				 gint64 duration_us)
+{
+	PassimMetricsHistogramData *data;
+
+	g_return_if_fail(PASSIM_IS_METRICS(self));
+	g_return_if_fail(histogram < PASSIM_METRICS_HISTOGRAM_LAST);
+
+	/* clock went backwards */
+	if (duration_us < 0)
+		duration_us = 0;
+
+	data = &self->histograms[histogram];
+	for (guint i = 0; i < PASSIM_METRICS_BUCKETS; i++) {
+		if (duration_us <= passim_metrics_bucket_us[i]) {
+			atomic_fetch_add_explicit(&data->buckets[i], 1, memory_order_relaxed);
+			break;
+		}
+	}
+	atomic_fetch_add_explicit(&data->sum_us, (guint64)duration_us, memory_order_relaxed);
+	atomic_fetch_add_explicit(&data->count, 1, memory_order_relaxed);
+}
+
+static void
+passim_metrics_add_header(GString *str, const gchar *name, const gchar *type, const gchar *help)
+{
+	g_string_append_printf(str, "# TYPE %s %s\n", name, type);
+	g_string_append_printf(str, "# HELP %s %s\n", name, help);
+}
+
+static void
+passim_metrics_add_counter(GString *str, const gchar *name, const gchar *help, guint64 value)
+{
+	passim_metrics_add_header(str, name, "counter", help);
+	g_string_append_printf(str, "%s_total %" G_GUINT64_FORMAT "\n", name, value);
+}
+
+static void
+passim_metrics_add_gauge(GString *str, const gchar *name, const gchar *help, gint64 value)
+{
+	passim_metrics_add_header(str, name, "gauge", help);
+	g_string_append_printf(str, "%s %" G_GINT64_FORMAT "\n", name, value);
+}
+
+static void
+passim_metrics_add_histogram(GString *str,
+			     const gchar *name,
+			     const gchar *labels,
+			     PassimMetricsHistogramData *data)
+{
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE] = {0};
+	guint64 count = atomic_load_explicit(&data->count, memory_order_relaxed);
+	guint64 cumulative = 0;
+	const gchar *sep = labels != NULL ? "," : "";
+	g_autofree gchar *labelset = NULL;
+
+	if (labels != NULL) {
+		labelset = g_strdup_printf("{%s}", labels);
+	} else {
+		labelset = g_strdup("");
+		labels = "";
+	}
+	for (guint i = 0; i < PASSIM_METRICS_BUCKETS; i++) {
+		cumulative += atomic_load_explicit(&data->buckets[i], memory_order_relaxed);
+		g_string_append_printf(str,
+				       "%s_bucket{%s%sle=\"%s\"} %" G_GUINT64_FORMAT "\n",
+				       name,
+				       labels,
+				       sep,
+				       passim_metrics_bucket_le[i],
+				       cumulative);
+	}
+
+	/* the observations are not taken under a lock, so never go backwards */
+	count = MAX(count, cumulative);
+	g_string_append_printf(str,
+			       "%s_bucket{%s%sle=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+			       name,
+			       labels,
+			       sep,
+			       count);
+	g_string_append_printf(str, "%s_count%s %" G_GUINT64_FORMAT "\n", name, labelset, count);
+	g_ascii_formatd(buf,
+			sizeof(buf),
+			"%.6f",
+			(gdouble)atomic_load_explicit(&data->sum_us, memory_order_relaxed) /
+			    G_USEC_PER_SEC);
+	g_string_append_printf(str, "%s_sum%s %s\n", name, labelset, buf);
+}
+
+/* in OpenMetrics text format */
+gchar *
+passim_metrics_to_string(PassimMetrics *self)
+{
+	GString *str = g_string_new(NULL);
+
+	g_return_val_if_fail(PASSIM_IS_METRICS(self), NULL);
+
+	passim_metrics_add_header(str, "passim_requests", "counter", "HTTP requests by outcome.");
+	for (guint i = 0; i < PASSIM_METRICS_OUTCOME_LAST; i++) {
+		g_string_append_printf(
+		    str,
+		    "passim_requests_total{outcome=\"%s\"} %" G_GUINT64_FORMAT "\n",
+		    passim_metrics_outcome_to_string(i),
+		    atomic_load_explicit(&self->outcomes[i], memory_order_relaxed));
+	}
+	passim_metrics_add_counter(
+	    str,
+	    "passim_served_bytes",
+	    "Bytes of item payload written to clients.",
+	    atomic_load_explicit(&self->counters[PASSIM_METRICS_COUNTER_BYTES_SERVED],
+				 memory_order_relaxed));
+	passim_metrics_add_gauge(
+	    str,
+	    "passim_active_transfers",
+	    "Items currently being sent to clients.",
+	    atomic_load_explicit(&self->gauges[PASSIM_METRICS_GAUGE_ACTIVE_TRANSFERS],
+				 memory_order_relaxed));
+
+	passim_metrics_add_header(str,
+				  "passim_lookup_duration_seconds",
+				  "histogram",
+				  "Time taken to find a hash on the local network.");
+	passim_metrics_add_histogram(
+	    str,
+	    "passim_lookup_duration_seconds",
+	    "stage=\"browse\"",
+	    &self->histograms[PASSIM_METRICS_HISTOGRAM_LOOKUP_BROWSE]);
+	passim_metrics_add_histogram(
+	    str,
+	    "passim_lookup_duration_seconds",
+	    "stage=\"resolve\"",
+	    &self->histograms[PASSIM_METRICS_HISTOGRAM_LOOKUP_RESOLVE]);
+
+	passim_metrics_add_header(str,
+				  "passim_avahi_register_duration_seconds",
+				  "histogram",
+				  "Time taken to register all items with Avahi.");
+	passim_metrics_add_histogram(str,
+				     "passim_avahi_register_duration_seconds",
+				     NULL,
+				     &self->histograms[PASSIM_METRICS_HISTOGRAM_AVAHI_REGISTER]);
+	passim_metrics_add_counter(
+	    str,
+	    "passim_avahi_register_failures",
+	    "Avahi registrations that failed.",
+	    atomic_load_explicit(&self->counters[PASSIM_METRICS_COUNTER_AVAHI_REGISTER_FAILED],
+				 memory_order_relaxed));
+
+	passim_metrics_add_gauge(
+	    str,
+	    "passim_items",
+	    "Items in the cache.",
+	    atomic_load_explicit(&self->gauges[PASSIM_METRICS_GAUGE_ITEMS], memory_order_relaxed));
+	passim_metrics_add_gauge(
+	    str,
+	    "passim_items_bytes",
+	    "Total size of the items in the cache.",
+	    atomic_load_explicit(&self->gauges[PASSIM_METRICS_GAUGE_ITEMS_BYTES],
+				 memory_order_relaxed));
+	passim_metrics_add_counter(
+	    str,
+	    "passim_evictions",
+	    "Items deleted as the max-age was reached.",
+	    atomic_load_explicit(&self->counters[PASSIM_METRICS_COUNTER_EVICTIONS],
+				 memory_order_relaxed));
+	passim_metrics_add_counter(
+	    str,
+	    "passim_share_limit_deletions",
+	    "Items deleted as the share-limit was reached.",
+	    atomic_load_explicit(&self->counters[PASSIM_METRICS_COUNTER_SHARE_LIMIT_DELETIONS],
+				 memory_order_relaxed));
+	passim_metrics_add_counter(
+	    str,
+	    "passim_access_log_dropped",
+	    "Access log entries dropped as the writer could not keep up.",
+	    atomic_load_explicit(&self->counters[PASSIM_METRICS_COUNTER_ACCESS_LOG_DROPPED],
+				 memory_order_relaxed));
+	passim_metrics_add_counter(
+	    str,
+	    "passim_compression_saved_bytes",
+	    "Bytes not sent as a compressed variant was served instead.",
+	    atomic_load_explicit(&self->counters[PASSIM_METRICS_COUNTER_COMPRESSION_SAVED],
+				 memory_order_relaxed));
+	passim_metrics_add_counter(
+	    str,
+	    "passim_prefetch_bytes",
+	    "Bytes downloaded from other machines ahead of time.",
+	    atomic_load_explicit(&self->counters[PASSIM_METRICS_COUNTER_PREFETCH_BYTES],
+				 memory_order_relaxed));
+
+	g_string_append(str, "# EOF\n");
+	return g_string_free(str, FALSE);
+}
+
+static void
+passim_metrics_init(PassimMetrics *self)
+{
+}
+
+static void
+passim_metrics_class_init(PassimMetricsClass *klass)
+{
+}
+
+PassimMetrics *
+passim_metrics_new(void)
+{
+	PassimMetrics *self;
+	self = g_object_new(PASSIM_TYPE_METRICS, NULL);
+	return PASSIM_METRICS(self);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include "passim-common.h"
+
+#define PASSIM_TYPE_METRICS (passim_metrics_get_type())
+G_DECLARE_FINAL_TYPE(PassimMetrics, passim_metrics, PASSIM, METRICS, GObject)
+
+#define PASSIM_METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+typedef enum {
+	PASSIM_METRICS_OUTCOME_SERVED,
+	PASSIM_METRICS_OUTCOME_REDIRECT,
+	PASSIM_METRICS_OUTCOME_NOT_FOUND,
+	PASSIM_METRICS_OUTCOME_FORBIDDEN,
+	PASSIM_METRICS_OUTCOME_LOCKED,
+	PASSIM_METRICS_OUTCOME_OTHER,
+	PASSIM_METRICS_OUTCOME_LAST
+} PassimMetricsOutcome;
+
+typedef enum {
+	PASSIM_METRICS_COUNTER_BYTES_SERVED,
+	PASSIM_METRICS_COUNTER_AVAHI_REGISTER_FAILED,
+	PASSIM_METRICS_COUNTER_EVICTIONS,
+	PASSIM_METRICS_COUNTER_SHARE_LIMIT_DELETIONS,
+	PASSIM_METRICS_COUNTER_ACCESS_LOG_DROPPED,
+	PASSIM_METRICS_COUNTER_COMPRESSION_SAVED,
+	PASSIM_METRICS_COUNTER_PREFETCH_BYTES,
+	PASSIM_METRICS_COUNTER_LAST
+} PassimMetricsCounter;
+
+typedef enum {
+	PASSIM_METRICS_GAUGE_ACTIVE_TRANSFERS,
+	PASSIM_METRICS_GAUGE_ITEMS,
+	PASSIM_METRICS_GAUGE_ITEMS_BYTES,
+	PASSIM_METRICS_GAUGE_LAST
+} PassimMetricsGauge;
+
+typedef enum {
+	PASSIM_METRICS_HISTOGRAM_LOOKUP_BROWSE,
+	PASSIM_METRICS_HISTOGRAM_LOOKUP_RESOLVE,
+	PASSIM_METRICS_HISTOGRAM_AVAHI_REGISTER,
+	PASSIM_METRICS_HISTOGRAM_LAST
+} PassimMetricsHistogram;
+
+PassimMetrics *
+passim_metrics_new(void);
+const gchar *
+passim_metrics_outcome_to_string(PassimMetricsOutcome outcome);
+PassimMetricsOutcome
+passim_metrics_outcome_from_status(guint status_code);
+void
+passim_metrics_add_outcome(PassimMetrics *self, PassimMetricsOutcome outcome);
+guint64
+passim_metrics_get_outcome(PassimMetrics *self, PassimMetricsOutcome outcome);
+guint64
+passim_metrics_get_counter(PassimMetrics *self, PassimMetricsCounter counter);
+void
+passim_metrics_counter_add(PassimMetrics *self, PassimMetricsCounter counter, guint64 value);
+void
+passim_metrics_gauge_add(PassimMetrics *self, PassimMetricsGauge gauge, gint64 value);
+void
+passim_metrics_gauge_set(PassimMetrics *self, PassimMetricsGauge gauge, gint64 value);
+void
+passim_metrics_histogram_observe(PassimMetrics *self,
+				 PassimMetricsHistogram histogram,
+				 gint64 duration_us);
+gchar *
+passim_metrics_to_string(PassimMetrics *self);
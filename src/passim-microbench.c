@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <gnutls/crypto.h>
+#include <passim.h>
+
+#include "passim-avahi.h"
+#include "passim-common.h"
+#include "passim-index.h"
+
+/* each benchmark runs for at least this long, and at least this many times */
+#define PASSIM_MICROBENCH_MIN_DURATION_US (200 * 1000)
+#define PASSIM_MICROBENCH_MIN_ITERATIONS  3
+
+typedef void (*PassimMicrobenchFunc)(gpointer user_data);
+
+typedef struct {
+	GHashTable *items;
+	GBytes *blob;
+	PassimItem *item;
+	const gchar *query;
+} PassimMicrobenchHelper;
+
+/*
+ * Writes one JSON object per line so that results can be collected from the meson benchmark log
+ * and compared over time.
+ */
+static void
+passim_microbench_run(const gchar *name,
+		      guint items,
+		      gsize bytes,
+		      PassimMicrobenchFunc func,
+		      gpointer user_data)
+{
+	guint iterations = 0;
+	gint64 elapsed;
+	gint64 start;
+	gdouble ns_per_op;
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE] = {0};
+	g_autoptr(GString) str = g_string_new(NULL);
+
+	/* warm up */
+	func(user_data);
+
+	start = g_get_monotonic_time();
+	do {
+		func(user_data);
+		iterations++;
+		elapsed = g_get_monotonic_time() - start;
+	} while (elapsed < PASSIM_MICROBENCH_MIN_DURATION_US ||
+		 iterations < PASSIM_MICROBENCH_MIN_ITERATIONS);
+	ns_per_op = (gdouble)elapsed * 1000.f / iterations;
+
+	g_string_append_printf(str, "{\"name\":\"%s\"", name);
+	if (items > 0)
+		g_string_append_printf(str, ",\"items\":%u", items);
+	if (bytes > 0)
+		g_string_append_printf(str, ",\"bytes\":%" G_GSIZE_FORMAT, bytes);
+	g_string_append_printf(str, ",\"iterations\":%u", iterations);
+	g_ascii_formatd(buf, sizeof(buf), "%.1f", ns_per_op);
+	g_string_append_printf(str, ",\"ns_per_op\":%s", buf);
+	if (bytes > 0) {
+		g_ascii_formatd(buf, sizeof(buf), "%.1f", (gdouble)bytes * 1000.f / ns_per_op);
+		g_string_append_printf(str, ",\"mb_per_s\":%s", buf);
+	}
+	g_string_append(str, "}\n");
+	g_print("%s", str->str);
+}
+
+static gchar *
+passim_microbench_random_hash(void)
+{
+	GString *str = g_string_new(NULL);
+	for (guint i = 0; i < 8; i++)
+		g_string_append_printf(str, "%08x", g_random_int());
+	return g_string_free(str, FALSE);
+}
+
+static PassimItem *
+passim_microbench_item_new(guint idx)
+{
+	g_autofree gchar *basename = g_strdup_printf("firmware-%05u.cab", idx);
+	g_autofree gchar *hash = passim_microbench_random_hash();
+	g_autoptr(GDateTime) dt = g_date_time_new_now_utc();
+	PassimItem *item = passim_item_new();
+
+	passim_item_set_hash(item, hash);
+	passim_item_set_basename(item, basename);
+	passim_item_set_cmdline(item, "fwupd");
+	passim_item_set_max_age(item, 24 * 60 * 60);
+	passim_item_set_share_limit(item, 5);
+	passim_item_set_size(item, 1024 * 1024);
+	passim_item_set_ctime(item, dt);
+	return item;
+}
+
+static GHashTable *
+passim_microbench_items_new(guint count)
+{
+	GHashTable *items =
+	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_object_unref);
+	for (guint i = 0; i < count; i++) {
+		PassimItem *item = passim_microbench_item_new(i);
+		g_hash_table_insert(items, g_strdup(passim_item_get_hash(item)), item);
+	}
+	return items;
+}
+
+static void
+passim_microbench_item_variant_cb(gpointer user_data)
+{
+	PassimMicrobenchHelper *helper = (PassimMicrobenchHelper *)user_data;
+	g_autoptr(GVariant) value = g_variant_ref_sink(passim_item_to_variant(helper->item));
+	g_autoptr(PassimItem) item = passim_item_from_variant(value);
+	g_assert_nonnull(item);
+}
+
+static void
+passim_microbench_get_items_cb(gpointer user_data)
+{
+	PassimMicrobenchHelper *helper = (PassimMicrobenchHelper *)user_data;
+	g_autoptr(GVariant) value = g_variant_ref_sink(passim_index_to_variant(helper->items));
+	g_assert_nonnull(value);
+}
+
+static void
+passim_microbench_index_html_cb(gpointer user_data)
+{
+	PassimMicrobenchHelper *helper = (PassimMicrobenchHelper *)user_data;
+	g_autofree gchar *html =
+	    passim_index_to_html(helper->items, "Passim-1234", 27500, PASSIM_STATUS_RUNNING);
+	g_assert_nonnull(html);
+}
+
+static void
+passim_microbench_sha256_glib_cb(gpointer user_data)
+{
+	PassimMicrobenchHelper *helper = (PassimMicrobenchHelper *)user_data;
+	g_autofree gchar *hash = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, helper->blob);
+	g_assert_nonnull(hash);
+}
+
+static void
+passim_microbench_sha256_gnutls_cb(gpointer user_data)
+{
+	PassimMicrobenchHelper *helper = (PassimMicrobenchHelper *)user_data;
+	guint8 digest[32] = {0};
+	gsize bufsz = 0;
+	const guint8 *buf = g_bytes_get_data(helper->blob, &bufsz);
+	gint rc = gnutls_hash_fast(GNUTLS_DIG_SHA256, buf, bufsz, digest);
+	g_assert_cmpint(rc, ==, 0);
+}
+
+static void
+passim_microbench_query_cb(gpointer user_data)
+{
+	PassimMicrobenchHelper *helper = (PassimMicrobenchHelper *)user_data;
+	g_autofree gchar *hash = passim_query_get_value(helper->query, "sha256");
+	g_assert_nonnull(hash);
+}
+
+static void
+passim_microbench_subtype_cb(gpointer user_data)
+{
+	PassimMicrobenchHelper *helper = (PassimMicrobenchHelper *)user_data;
+	g_autofree gchar *subtype =
+	    passim_avahi_build_subtype_for_hash(passim_item_get_hash(helper->item));
+	g_assert_nonnull(subtype);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const guint item_counts[] = {1000, 10000, 100000};
+	const gsize blob_sizes[] = {4096, 1024 * 1024, 64 * 1024 * 1024};
+	g_autofree gchar *query = NULL;
+	g_autoptr(PassimItem) item = passim_microbench_item_new(0);
+	PassimMicrobenchHelper helper = {.item = item};
+
+	passim_microbench_run("item-variant-roundtrip",
+			      0,
+			      0,
+			      passim_microbench_item_variant_cb,
+			      &helper);
+	for (guint i = 0; i < G_N_ELEMENTS(item_counts); i++) {
+		g_autoptr(GHashTable) items = passim_microbench_items_new(item_counts[i]);
+		helper.items = items;
+		passim_microbench_run("get-items",
+				      item_counts[i],
+				      0,
+				      passim_microbench_get_items_cb,
+				      &helper);
+		passim_microbench_run("index-html",
+				      item_counts[i],
+				      0,
+				      passim_microbench_index_html_cb,
+				      &helper);
+		helper.items = NULL;
+	}
+	for (guint i = 0; i < G_N_ELEMENTS(blob_sizes); i++) {
+		g_autofree guint8 *buf = g_malloc(blob_sizes[i]);
+		g_autoptr(GBytes) blob = NULL;
+
+		for (gsize j = 0; j < blob_sizes[i]; j++)
+			buf[j] = j & 0xff;
+		blob = g_bytes_new_take(g_steal_pointer(&buf), blob_sizes[i]);
+		helper.blob = blob;
+		passim_microbench_run("sha256-glib",
+				      0,
+				      blob_sizes[i],
+				      passim_microbench_sha256_glib_cb,
+				      &helper);
+		passim_microbench_run("sha256-gnutls",
+				      0,
+				      blob_sizes[i],
+				      passim_microbench_sha256_gnutls_cb,
+				      &helper);
+		helper.blob = NULL;
+	}
+	query = g_strdup_printf("firmware.cab&foo=bar&sha256=%s", passim_item_get_hash(item));
+	helper.query = query;
+	passim_microbench_run("query-parse", 0, 0, passim_microbench_query_cb, &helper);
+	passim_microbench_run("avahi-subtype", 0, 0, passim_microbench_subtype_cb, &helper);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <libsoup/soup.h>
+
+#include "passim-digest.h"
+#include "passim-oci.h"
+
+void
+passim_oci_route_free(PassimOciRoute *route)
+{
+	g_free(route->digest);
+	g_free(route);
+}
+
+static PassimOciRoute *
+passim_oci_route_error(PassimOciRoute *route,
+		       guint status_code,
+		       const gchar *code,
+		       const gchar *message)
+{
+	route->action = PASSIM_OCI_ACTION_ERROR;
+	route->status_code = status_code;
+	route->code = code;
+	route->message = message;
+	return route;
+}
+
+/*
+ * decides how to answer a request for @path below /v2, where @items is the table of items by
+ * hash -- only blobs are supported, as manifests are mutable and not addressed by the item hash
+ */
+PassimOciRoute *
+passim_oci_route_new(GHashTable *items,
+		     const gchar *method,
+		     const gchar *path,
+		     gboolean is_loopback)
+{
+	PassimOciRoute *route;
+	const gchar *digest;
+
+	g_return_val_if_fail(items != NULL, NULL);
+	g_return_val_if_fail(method != NULL, NULL);
+	g_return_val_if_fail(path != NULL, NULL);
+
+	route = g_new0(PassimOciRoute, 1);
+
+	/* the version check, which needs no auth */
+	if (g_strcmp0(path, "/v2") == 0 || g_strcmp0(path, "/v2/") == 0) {
+		route->action = PASSIM_OCI_ACTION_VERSION;
+		return route;
+	}
+
+	/* /v2/<name>/blobs/sha256:<digest>, where the name can contain slashes */
+	digest = g_strrstr(path, "/blobs/");
+	if (digest == NULL || digest == path + strlen("/v2")) {
+		return passim_oci_route_error(route,
+					      SOUP_STATUS_NOT_FOUND,
+					      "UNSUPPORTED",
+					      "only blobs are supported");
+	}
+	digest += strlen("/blobs/");
+	if (!g_str_has_prefix(digest, "sha256:") ||
+	    !passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA256, digest + strlen("sha256:"))) {
+		return passim_oci_route_error(route,
+					      SOUP_STATUS_BAD_REQUEST,
+					      "DIGEST_INVALID",
+					      "only sha256 digests are supported");
+	}
+	route->digest = g_strdup(digest + strlen("sha256:"));
+
+	/* already exists locally */
+	route->item = g_hash_table_lookup(items, route->digest);
+	if (route->item != NULL) {
+		if (passim_item_has_flag(route->item, PASSIM_ITEM_FLAG_DISABLED)) {
+			return passim_oci_route_error(route,
+						      SOUP_STATUS_NOT_FOUND,
+						      "BLOB_UNKNOWN",
+						      "blob is disabled");
+		}
+
+		/* runtimes check the blob exists first, which is not a share */
+		if (g_strcmp0(method, SOUP_METHOD_HEAD) == 0)
+			route->action = PASSIM_OCI_ACTION_HEAD;
+		else
+			route->action = PASSIM_OCI_ACTION_BLOB;
+		return route;
+	}
+
+	/* the runtime pulls from the upstream registry instead */
+	if (!is_loopback) {
+		return passim_oci_route_error(route,
+					      SOUP_STATUS_NOT_FOUND,
+					      "BLOB_UNKNOWN",
+					      "blob unknown to registry");
+	}
+	route->action = PASSIM_OCI_ACTION_FIND;
+	return route;
+}
+
+/* in the format of the OCI distribution specification, so that the runtime can fall back */
+gchar *
+passim_oci_error_to_json(const gchar *code, const gchar *message)
+{
+	g_return_val_if_fail(code != NULL, NULL);
+	g_return_val_if_fail(message != NULL, NULL);
+	return g_strdup_printf("{\"errors\":[{\"code\":\"%s\",\"message\":\"%s\"}]}\n",
+			       code,
+			       message);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include "passim-common.h"
+
+typedef enum {
+	PASSIM_OCI_ACTION_ERROR,
+	PASSIM_OCI_ACTION_VERSION,
+	PASSIM_OCI_ACTION_BLOB,
+	PASSIM_OCI_ACTION_HEAD,
+	PASSIM_OCI_ACTION_FIND,
+} PassimOciAction;
+
+typedef struct {
+	PassimOciAction action;
+	guint status_code;    /* for PASSIM_OCI_ACTION_ERROR */
+	const gchar *code;    /* for PASSIM_OCI_ACTION_ERROR */
+	const gchar *message; /* for PASSIM_OCI_ACTION_ERROR */
+	gchar *digest;	      /* sha256 hex, or NULL if not a valid blob request */
+	PassimItem *item;     /* borrowed, for PASSIM_OCI_ACTION_BLOB and PASSIM_OCI_ACTION_HEAD */
+} PassimOciRoute;
+
+void
+passim_oci_route_free(PassimOciRoute *route);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimOciRoute, passim_oci_route_free)
+
+PassimOciRoute *
+passim_oci_route_new(GHashTable *items,
+		     const gchar *method,
+		     const gchar *path,
+		     gboolean is_loopback);
+gchar *
+passim_oci_error_to_json(const gchar *code, const gchar *message);
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include "passim-policy.h"
+
+/*
+ * These are the decisions the daemon makes about which peer to use and when to delete an item.
+ * They are kept free of any I/O, and take the current time as an argument, so that the same code
+ * can be used by passim-sim with a virtual clock.
+ */
+
+/* chose a peer from those found by Avahi; rand is nullable, in which case use g_random */
+guint
+passim_policy_select_peer(guint n_peers, GRand *rand)
+{
+	g_return_val_if_fail(n_peers > 0, 0);
+	if (rand != NULL)
+		return g_rand_int_range(rand, 0, n_peers);
+	return g_random_int_range(0, n_peers);
+}
+
+/* called each time the item has been sent to a client */
+void
+passim_policy_item_shared(PassimItem *item, GDateTime *dt_now)
+{
+	g_return_if_fail(PASSIM_IS_ITEM(item));
+	g_return_if_fail(dt_now != NULL);
+	passim_item_set_share_count(item, passim_item_get_share_count(item) + 1);
+	passim_item_set_atime(item, dt_now);
+}
+
+/* we've shared this enough now, unless there are not yet enough copies on the LAN */
+gboolean
+passim_policy_item_share_limit_reached(PassimItem *item)
+{
+	g_return_val_if_fail(PASSIM_IS_ITEM(item), FALSE);
+	if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_REPLICATING))
+		return FALSE;
+	if (passim_item_get_share_limit_effective(item) > 0)
+		return passim_item_get_share_count(item) >=
+		       passim_item_get_share_limit_effective(item);
+	return passim_item_get_share_limit(item) > 0 &&
+	       passim_item_get_share_count(item) >= passim_item_get_share_limit(item);
+}
+
+/*
+ * rare items are kept for longer as nobody else can serve them, and common items are deleted
+ * sooner, especially when this machine is busy -- @replicas is the number of other machines
+ * advertising the item, and @load is the load average divided by the number of CPUs
+ */
+guint32
+passim_policy_item_share_limit_adapt(PassimItem *item, guint replicas, gdouble load)
+{
+	guint64 limit;
+
+	g_return_val_if_fail(PASSIM_IS_ITEM(item), 0);
+
+	/* unlimited */
+	limit = passim_item_get_share_limit(item);
+	if (limit == 0 || limit == G_MAXUINT32)
+		return 0;
+	if (replicas == 0)
+		limit *= 4;
+	else if (replicas == 1)
+		limit *= 2;
+	else if (replicas >= 8)
+		limit /= 2;
+	if (replicas > 0 && load > 1.0)
+		limit /= 2;
+	return CLAMP(limit, 1, G_MAXUINT32 - 1);
+}
+
+/* items from passim.d have no maximum age, and replicating items are kept regardless */
+gboolean
+passim_policy_item_expired(PassimItem *item, GDateTime *dt_now)
+{
+	GDateTime *ctime;
+
+	g_return_val_if_fail(PASSIM_IS_ITEM(item), FALSE);
+	g_return_val_if_fail(dt_now != NULL, FALSE);
+
+	if (passim_item_get_max_age(item) == G_MAXUINT32)
+		return FALSE;
+	if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_REPLICATING))
+		return FALSE;
+	ctime = passim_item_get_ctime(item);
+	if (ctime == NULL)
+		return FALSE;
+	return g_date_time_difference(dt_now, ctime) / G_TIME_SPAN_SECOND >
+	       passim_item_get_max_age(item);
+}
+
+/* @hours is nullable, or a range of hours like "1-6", or "22-4" for one that crosses midnight */
+gboolean
+passim_policy_prefetch_hour_allowed(const gchar *hours, GDateTime *dt_now)
+{
+	gint hour;
+	guint64 start = 0;
+	guint64 end = 0;
+	g_auto(GStrv) split = NULL;
+
+	g_return_val_if_fail(dt_now != NULL, FALSE);
+
+	if (hours == NULL)
+		return TRUE;
+	split = g_strsplit(hours, "-", 2);
+	if (g_strv_length(split) != 2 ||
+	    !g_ascii_string_to_unsigned(split[0], 10, 0, 23, &start, NULL) ||
+	    !g_ascii_string_to_unsigned(split[1], 10, 0, 24, &end, NULL)) {
+		g_warning("invalid hours %s, expected something like 1-6", hours);
+		return FALSE;
+	}
+	hour = g_date_time_get_hour(dt_now);
+	if (start <= end)
+		return hour >= (gint)start && hour < (gint)end;
+	return hour >= (gint)start || hour < (gint)end;
+}
+
+/* the most popular candidate that is not already here, and that fits in what is left of @budget */
+PassimItem *
+passim_policy_prefetch_select(GPtrArray *candidates, GHashTable *items, guint64 budget)
+{
+	PassimItem *item_best = NULL;
+
+	g_return_val_if_fail(candidates != NULL, NULL);
+	g_return_val_if_fail(items != NULL, NULL);
+
+	for (guint i = 0; i < candidates->len; i++) {
+		PassimItem *item = g_ptr_array_index(candidates, i);
+		if (passim_item_get_share_count(item) == 0)
+			continue;
+		if (passim_item_get_size(item) == 0 || passim_item_get_size(item) > budget)
+			continue;
+		if (g_hash_table_contains(items, passim_item_get_hash(item)))
+			continue;
+		if (item_best == NULL ||
+		    passim_item_get_share_count(item) > passim_item_get_share_count(item_best))
+			item_best = item;
+	}
+	return item_best;
+}
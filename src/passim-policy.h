@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include "passim-common.h"
+
+guint
+passim_policy_select_peer(guint n_peers, GRand *rand);
+void
+passim_policy_item_shared(PassimItem *item, GDateTime *dt_now);
+gboolean
+passim_policy_item_share_limit_reached(PassimItem *item);
+guint32
+passim_policy_item_share_limit_adapt(PassimItem *item, guint replicas, gdouble load);
+gboolean
+passim_policy_item_expired(PassimItem *item, GDateTime *dt_now);
+gboolean
+passim_policy_prefetch_hour_allowed(const gchar *hours, GDateTime *dt_now);
+PassimItem *
+passim_policy_prefetch_select(GPtrArray *candidates, GHashTable *items, guint64 budget);
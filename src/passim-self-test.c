@@ -9,7 +9,19 @@
 #include <glib/gstdio.h>
 #include <passim.h>
 
+#include "passim-access-log.h"
+#include "passim-bitmap.h"
+#include "passim-chunk.h"
+#include "passim-cli-attr.h"
 #include "passim-common.h"
+#include "passim-compress.h"
+#include "passim-digest.h"
+#include "passim-fault.h"
+#include "passim-index.h"
+#include "passim-merkle.h"
+#include "passim-metrics.h"
+#include "passim-oci.h"
+#include "passim-policy.h"
 
 #if 0
 static GMainLoop *_test_loop = NULL;
@@ -56,6 +68,8 @@ passim_common_func(void)
 	g_autofree gchar *boot_time = NULL;
 	g_autofree gchar *value_str1 = NULL;
 	g_autofree gchar *value_str2 = NULL;
+	g_autofree gchar *value_str3 = NULL;
+	g_autofree gchar *xargs_copy_fn = NULL;
 	g_autofree gchar *xargs_fn = NULL;
 	g_autofree gchar *xargs_path = NULL;
 	g_autoptr(GError) error = NULL;
@@ -66,6 +80,7 @@ passim_common_func(void)
 
 	/* create dir for next step */
 	xargs_fn = g_test_build_filename(G_TEST_BUILT, "tests", "test.conf", NULL);
+	xargs_copy_fn = g_test_build_filename(G_TEST_BUILT, "tests", "test-copy.conf", NULL);
 	xargs_path = g_path_get_dirname(xargs_fn);
 	ret = passim_mkdir(xargs_path, &error);
 	g_assert_no_error(error);
@@ -101,8 +116,884 @@ passim_common_func(void)
 	value_str2 = passim_xattr_get_string(xargs_fn, "user.test_MISSING", &error);
 	g_assert_no_error(error);
 	g_assert_cmpstr(value_str2, ==, "");
+
+	/* all attributes are copied */
+	(void)g_unlink(xargs_copy_fn);
+	ret = g_file_set_contents(xargs_copy_fn, "[daemon]", -1, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	ret = passim_xattr_copy(xargs_fn, xargs_copy_fn, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	value_u32 = passim_xattr_get_uint32(xargs_copy_fn, "user.test_u32", 456, &error);
+	g_assert_no_error(error);
+	g_assert_cmpint(value_u32, ==, 123);
+	value_str3 = passim_xattr_get_string(xargs_copy_fn, "user.test_str", &error);
+	g_assert_no_error(error);
+	g_assert_cmpstr(value_str3, ==, "hey");
+}
+
+static void
+passim_uri_lookup_func(void)
+{
+	const gchar *hash = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+	g_autofree gchar *hash_parsed = NULL;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GPtrArray) addresses = g_ptr_array_new_with_free_func(g_free);
+
+	/* the hash, and then every machine that has it */
+	g_ptr_array_add(addresses, g_strdup("192.168.1.2:27500"));
+	g_ptr_array_add(addresses, g_strdup("[fe80::1]:27500"));
+	str = passim_uri_lookup_to_string(hash, addresses);
+	g_assert_cmpstr(str,
+			==,
+			"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855\n"
+			"192.168.1.2:27500\n"
+			"[fe80::1]:27500\n");
+	hash_parsed = passim_uri_lookup_get_hash(str);
+	g_assert_cmpstr(hash_parsed, ==, hash);
+	g_assert_null(passim_uri_lookup_get_hash(""));
+	g_assert_null(passim_uri_lookup_get_hash("\n192.168.1.2:27500\n"));
+}
+
+static void
+passim_metrics_func(void)
+{
+	g_autofree gchar *str = NULL;
+	g_autoptr(PassimMetrics) metrics = passim_metrics_new();
+
+	passim_metrics_add_outcome(metrics, passim_metrics_outcome_from_status(200));
+	passim_metrics_add_outcome(metrics, passim_metrics_outcome_from_status(206));
+	passim_metrics_add_outcome(metrics, passim_metrics_outcome_from_status(423));
+	passim_metrics_add_outcome(metrics, passim_metrics_outcome_from_status(423));
+	passim_metrics_counter_add(metrics, PASSIM_METRICS_COUNTER_BYTES_SERVED, 1024);
+	passim_metrics_gauge_add(metrics, PASSIM_METRICS_GAUGE_ACTIVE_TRANSFERS, 1);
+	passim_metrics_histogram_observe(metrics, PASSIM_METRICS_HISTOGRAM_LOOKUP_BROWSE, 3000);
+	passim_metrics_histogram_observe(metrics, PASSIM_METRICS_HISTOGRAM_LOOKUP_BROWSE, 9000000);
+
+	str = passim_metrics_to_string(metrics);
+	g_assert_nonnull(g_strstr_len(str, -1, "passim_requests_total{outcome=\"served\"} 2\n"));
+	g_assert_nonnull(g_strstr_len(str, -1, "passim_requests_total{outcome=\"locked\"} 2\n"));
+	g_assert_nonnull(g_strstr_len(str, -1, "passim_served_bytes_total 1024\n"));
+	g_assert_nonnull(g_strstr_len(str, -1, "passim_active_transfers 1\n"));
+	g_assert_nonnull(g_strstr_len(
+	    str,
+	    -1,
+	    "passim_lookup_duration_seconds_bucket{stage=\"browse\",le=\"0.001\"} 0\n"));
+	g_assert_nonnull(g_strstr_len(
+	    str,
+	    -1,
+	    "passim_lookup_duration_seconds_bucket{stage=\"browse\",le=\"0.005\"} 1\n"));
+	g_assert_nonnull(g_strstr_len(
+	    str,
+	    -1,
+	    "passim_lookup_duration_seconds_bucket{stage=\"browse\",le=\"+Inf\"} 2\n"));
+	g_assert_nonnull(g_strstr_len(str, -1, "seconds_sum{stage=\"browse\"} 9.003000\n"));
+	g_assert_true(g_str_has_suffix(str, "# EOF\n"));
+}
+
+static void
+passim_access_log_func(void)
+{
+	const gchar *sha512_key =
+	    "sha512-cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+	    "47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e";
+	gboolean ret;
+	g_autofree gchar *sha512_json = g_strdup_printf("\"hash\":\"%s\"", sha512_key);
+	g_autofree gchar *fn = g_test_build_filename(G_TEST_BUILT, "tests", "access.log", NULL);
+	g_autofree gchar *str = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(PassimAccessLog) access_log = passim_access_log_new();
+	PassimAccessLogEntry entry = {
+	    .request_id = 1,
+	    .timestamp = 1700000000123456,
+	    .client = "192.168.122.39",
+	    .hash = "a948904f2f0f479b8f8197694b30184b0d2ed1c1cd2a1ec0fb85d299a192a447",
+	    .status_code = 200,
+	    .bytes = 1024,
+	    .lookup_us = -1,
+	    .first_byte_us = 250,
+	    .total_us = 1000,
+	};
+
+	ret = passim_mkdir_parent(fn, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	(void)g_unlink(fn);
+	ret = passim_access_log_open(access_log, fn, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_true(passim_access_log_push(access_log, &entry));
+	entry.request_id = 2;
+	entry.status_code = 302;
+	entry.bytes = 0;
+	entry.lookup_us = 5000;
+	g_assert_true(passim_access_log_push(access_log, &entry));
+	entry.request_id = 3;
+	g_strlcpy(entry.hash, sha512_key, sizeof(entry.hash));
+	g_assert_true(passim_access_log_push(access_log, &entry));
+
+	/* flushes and joins the writer thread */
+	g_clear_object(&access_log);
+	ret = g_file_get_contents(fn, &str, NULL, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_nonnull(g_strstr_len(str, -1, "{\"request_id\":1,"));
+	g_assert_nonnull(g_strstr_len(str, -1, "\"timestamp\":\"2023-11-14T22:13:20.123456Z\""));
+	g_assert_nonnull(g_strstr_len(str, -1, "\"client\":\"192.168.122.39\""));
+	g_assert_nonnull(g_strstr_len(str, -1, "\"outcome\":\"served\",\"bytes\":1024,"));
+	g_assert_nonnull(g_strstr_len(str, -1, "\"first_byte_us\":250,\"total_us\":1000}\n"));
+	g_assert_nonnull(g_strstr_len(str, -1, "\"outcome\":\"redirect\""));
+	g_assert_nonnull(g_strstr_len(str, -1, "\"lookup_us\":5000,"));
+	g_assert_nonnull(g_strstr_len(str, -1, sha512_json));
+}
+
+static void
+passim_policy_func(void)
+{
+	g_autoptr(GDateTime) dt_ctime = g_date_time_new_from_unix_utc(1700000000);
+	g_autoptr(GDateTime) dt_now = g_date_time_add_hours(dt_ctime, 2);
+	g_autoptr(GRand) rand = g_rand_new_with_seed(0);
+	g_autoptr(PassimItem) item = passim_item_new();
+
+	/* peer selection is always in range */
+	for (guint i = 0; i < 100; i++)
+		g_assert_cmpint(passim_policy_select_peer(3, rand), <, 3);
+	g_assert_cmpint(passim_policy_select_peer(1, NULL), ==, 0);
+
+	/* share limit */
+	passim_item_set_share_limit(item, 2);
+	passim_policy_item_shared(item, dt_now);
+	g_assert_false(passim_policy_item_share_limit_reached(item));
+	passim_policy_item_shared(item, dt_now);
+	g_assert_true(passim_policy_item_share_limit_reached(item));
+	g_assert_cmpint(passim_item_get_share_count(item), ==, 2);
+	g_assert_true(g_date_time_equal(passim_item_get_atime(item), dt_now));
+
+	/* kept until there are enough copies on the LAN */
+	passim_item_add_flag(item, PASSIM_ITEM_FLAG_REPLICATING);
+	g_assert_false(passim_policy_item_share_limit_reached(item));
+	passim_item_remove_flag(item, PASSIM_ITEM_FLAG_REPLICATING);
+	g_assert_true(passim_policy_item_share_limit_reached(item));
+
+	/* adaptive share limit, where rare items are kept longer */
+	g_assert_cmpint(passim_policy_item_share_limit_adapt(item, 0, 0.0), ==, 8);
+	g_assert_cmpint(passim_policy_item_share_limit_adapt(item, 0, 4.0), ==, 8);
+	g_assert_cmpint(passim_policy_item_share_limit_adapt(item, 1, 0.0), ==, 4);
+	g_assert_cmpint(passim_policy_item_share_limit_adapt(item, 3, 0.0), ==, 2);
+	g_assert_cmpint(passim_policy_item_share_limit_adapt(item, 3, 2.0), ==, 1);
+	g_assert_cmpint(passim_policy_item_share_limit_adapt(item, 20, 2.0), ==, 1);
+	passim_item_set_share_limit_effective(item, 8);
+	g_assert_false(passim_policy_item_share_limit_reached(item));
+	passim_item_set_share_limit_effective(item, 0);
+	passim_item_set_share_limit(item, 0);
+	g_assert_cmpint(passim_policy_item_share_limit_adapt(item, 0, 0.0), ==, 0);
+	g_assert_false(passim_policy_item_share_limit_reached(item));
+
+	/* max-age */
+	passim_item_set_ctime(item, dt_ctime);
+	passim_item_set_max_age(item, 3 * 60 * 60);
+	g_assert_false(passim_policy_item_expired(item, dt_now));
+	passim_item_set_max_age(item, 60 * 60);
+	g_assert_true(passim_policy_item_expired(item, dt_now));
+	passim_item_set_max_age(item, G_MAXUINT32);
+	g_assert_false(passim_policy_item_expired(item, dt_now));
+
+	/* prefetch hours, where dt_now is 00:13 UTC */
+	g_assert_true(passim_policy_prefetch_hour_allowed(NULL, dt_now));
+	g_assert_true(passim_policy_prefetch_hour_allowed("0-6", dt_now));
+	g_assert_true(passim_policy_prefetch_hour_allowed("22-4", dt_now));
+	g_assert_false(passim_policy_prefetch_hour_allowed("1-6", dt_now));
+	g_assert_false(passim_policy_prefetch_hour_allowed("12-23", dt_now));
+}
+
+static void
+passim_index_catalog_func(void)
+{
+	PassimItem *item_best;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) items =
+	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_object_unref);
+	g_autoptr(GHashTable) items_local = g_hash_table_new(g_str_hash, g_str_equal);
+	g_autoptr(GPtrArray) candidates = NULL;
+	g_autoptr(GPtrArray) candidates_bad = NULL;
+
+	/* the most shared items come first */
+	for (guint i = 0; i < 3; i++) {
+		g_autoptr(PassimItem) item = passim_item_new();
+		g_autofree gchar *basename = g_strdup_printf("file%u.bin", i);
+		g_autofree gchar *hash = NULL;
+
+		hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, basename, -1);
+		passim_item_set_hash(item, hash);
+		passim_item_set_basename(item, basename);
+		passim_item_set_share_count(item, i);
+		passim_item_set_size(item, 1000 * (i + 1));
+		g_hash_table_insert(items, g_strdup(hash), g_steal_pointer(&item));
+	}
+	str = passim_index_to_catalog(items, 2);
+	candidates = passim_index_catalog_parse(str, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(candidates);
+	g_assert_cmpint(candidates->len, ==, 2);
+	item_best = g_ptr_array_index(candidates, 0);
+	g_assert_cmpstr(passim_item_get_basename(item_best), ==, "file2.bin");
+	g_assert_cmpint(passim_item_get_size(item_best), ==, 3000);
+
+	/* only what fits, and is not already here */
+	item_best = passim_policy_prefetch_select(candidates, items_local, G_MAXUINT64);
+	g_assert_nonnull(item_best);
+	g_assert_cmpstr(passim_item_get_basename(item_best), ==, "file2.bin");
+	item_best = passim_policy_prefetch_select(candidates, items_local, 2500);
+	g_assert_nonnull(item_best);
+	g_assert_cmpstr(passim_item_get_basename(item_best), ==, "file1.bin");
+	g_hash_table_insert(items_local, (gpointer)passim_item_get_hash(item_best), item_best);
+	g_assert_null(passim_policy_prefetch_select(candidates, items_local, 2500));
+
+	/* the basename is used as a path */
+	candidates_bad = passim_index_catalog_parse(
+	    "6a2a3c15a51d3ba0d0a2d0e4e41bb3f1e0e27f3fe3f3cbe0ec5e5e9ec1b6bc15 1 1 ../etc/passwd\n",
+	    &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(candidates_bad);
+	g_clear_error(&error);
+
+	/* the hash is used as a key and in the path */
+	candidates_bad = passim_index_catalog_parse(
+	    "6A2A3C15A51D3BA0D0A2D0E4E41BB3F1E0E27F3FE3F3CBE0EC5E5E9EC1B6BC15 1 1 file.bin\n",
+	    &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(candidates_bad);
+}
+
+static void
+passim_compress_func(void)
+{
+	guint64 available[PASSIM_ENCODING_LAST] = {0, 200, 100};
+	guint64 available_gzip[PASSIM_ENCODING_LAST] = {0, 200, 0};
+	guint64 available_none[PASSIM_ENCODING_LAST] = {0};
+	guint64 gzip_smaller[PASSIM_ENCODING_LAST] = {0, 100, 200};
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GBytes) blob_gz = NULL;
+	g_autoptr(GBytes) blob_random = NULL;
+	g_autoptr(GBytes) blob_raw = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GString) xml = g_string_new("<components>");
+	guint32 random_buf[1024];
+
+	/* prefer the smallest the client accepts */
+	g_assert_cmpint(passim_encoding_negotiate(NULL, available), ==, PASSIM_ENCODING_IDENTITY);
+	g_assert_cmpint(passim_encoding_negotiate("gzip, deflate, br, zstd", available),
+			==,
+			PASSIM_ENCODING_ZSTD);
+	g_assert_cmpint(passim_encoding_negotiate("gzip, zstd;q=0", available),
+			==,
+			PASSIM_ENCODING_GZIP);
+	g_assert_cmpint(passim_encoding_negotiate("x-gzip", available), ==, PASSIM_ENCODING_GZIP);
+	g_assert_cmpint(passim_encoding_negotiate("*", available_gzip), ==, PASSIM_ENCODING_GZIP);
+	g_assert_cmpint(passim_encoding_negotiate("br", available), ==, PASSIM_ENCODING_IDENTITY);
+	g_assert_cmpint(passim_encoding_negotiate("zstd", available_none),
+			==,
+			PASSIM_ENCODING_IDENTITY);
+	g_assert_cmpint(passim_encoding_negotiate("gzip, zstd", gzip_smaller),
+			==,
+			PASSIM_ENCODING_GZIP);
+	g_assert_cmpint(passim_encoding_negotiate("zstd", gzip_smaller), ==, PASSIM_ENCODING_ZSTD);
+
+	/* metadata compresses well */
+	for (guint i = 0; i < 1000; i++)
+		g_string_append_printf(xml, "<component><id>org.example.App%u</id></component>", i);
+	g_string_append(xml, "</components>");
+	blob = g_bytes_new(xml->str, xml->len);
+	g_assert_true(passim_compress_is_worthwhile(blob));
+	blob_gz = passim_compress_bytes(blob, PASSIM_ENCODING_GZIP, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(blob_gz);
+	g_assert_cmpint(g_bytes_get_size(blob_gz) * 5, <, g_bytes_get_size(blob));
+	blob_raw = passim_decompress_bytes(blob_gz, PASSIM_ENCODING_GZIP, G_MAXSIZE, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(blob_raw);
+	g_assert_true(g_bytes_equal(blob, blob_raw));
+	g_clear_pointer(&blob_raw, g_bytes_unref);
+
+	/* limited */
+	blob_raw = passim_decompress_bytes(blob_gz, PASSIM_ENCODING_GZIP, 1024, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE);
+	g_assert_null(blob_raw);
+	g_clear_error(&error);
+
+	/* already compressed */
+	for (guint i = 0; i < G_N_ELEMENTS(random_buf); i++)
+		random_buf[i] = g_random_int();
+	blob_random = g_bytes_new(random_buf, sizeof(random_buf));
+	g_assert_false(passim_compress_is_worthwhile(blob_random));
+}
+
+#ifdef HAVE_ZSTD
+static void
+passim_compress_seekable_func(void)
+{
+	guint64 raw_offset = 0;
+	g_autoptr(GArray) frames = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GBytes) blob_raw = NULL;
+	g_autoptr(GBytes) blob_zst = NULL;
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GString) str = g_string_new(NULL);
+
+	/* spans more than one frame */
+	for (guint i = 0; str->len < 3 * 1024 * 1024; i++)
+		g_string_append_printf(str, "line %u of a log file\n", i);
+	blob = g_bytes_new(str->str, str->len);
+	blob_zst = passim_compress_seekable(blob, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(blob_zst);
+	g_assert_cmpint(g_bytes_get_size(blob_zst) * 2, <, g_bytes_get_size(blob));
+
+	/* still a valid zstd stream */
+	blob_raw = passim_decompress_bytes(blob_zst, PASSIM_ENCODING_ZSTD, G_MAXSIZE, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(blob_raw);
+	g_assert_true(g_bytes_equal(blob, blob_raw));
+	g_clear_pointer(&blob_raw, g_bytes_unref);
+
+	/* each frame decompresses on its own */
+	frames = passim_compress_seekable_parse(blob_zst, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(frames);
+	g_assert_cmpint(frames->len, ==, 4);
+	for (guint i = 0; i < frames->len; i++) {
+		PassimCompressFrame *frame = &g_array_index(frames, PassimCompressFrame, i);
+		g_assert_cmpint(frame->raw_offset, ==, raw_offset);
+		blob_raw = passim_compress_seekable_get_frame(blob_zst, frame, &error);
+		g_assert_no_error(error);
+		g_assert_nonnull(blob_raw);
+		g_byte_array_append(buf,
+				    g_bytes_get_data(blob_raw, NULL),
+				    g_bytes_get_size(blob_raw));
+		raw_offset += frame->raw_size;
+		g_clear_pointer(&blob_raw, g_bytes_unref);
+	}
+	g_assert_cmpint(buf->len, ==, g_bytes_get_size(blob));
+	g_assert_cmpint(memcmp(buf->data, str->str, str->len), ==, 0);
+	g_clear_pointer(&frames, g_array_unref);
+
+	/* no seek table */
+	g_clear_pointer(&blob_zst, g_bytes_unref);
+	blob_zst = passim_compress_bytes(blob, PASSIM_ENCODING_ZSTD, &error);
+	g_assert_no_error(error);
+	frames = passim_compress_seekable_parse(blob_zst, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(frames);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static void
+passim_compress_delta_func(void)
+{
+	g_autofree gchar *checksum = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GBytes) blob_old = NULL;
+	g_autoptr(GBytes) blob_new = NULL;
+	g_autoptr(GBytes) patch = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GString) xml = g_string_new("<components>");
+
+	/* yesterday */
+	for (guint i = 0; i < 10000; i++)
+		g_string_append_printf(xml, "<component><id>org.example.App%u</id></component>", i);
+	blob_old = g_bytes_new(xml->str, xml->len);
+
+	/* today */
+	g_string_append(xml, "<component><id>org.example.NewApp</id></component>");
+	blob = g_bytes_new(xml->str, xml->len);
+	checksum = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, blob);
+
+	patch = passim_delta_create(blob_old, blob, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(patch);
+	g_assert_cmpint(g_bytes_get_size(patch), <, 1024);
+	blob_new = passim_delta_apply(blob_old, patch, checksum, G_MAXSIZE, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(blob_new);
+	g_assert_true(g_bytes_equal(blob, blob_new));
+	g_clear_pointer(&blob_new, g_bytes_unref);
+
+	/* wrong old version */
+	blob_new = passim_delta_apply(blob, patch, checksum, G_MAXSIZE, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(blob_new);
+}
+#endif
+
+static void
+passim_chunk_func(void)
+{
+	guint shared = 0;
+	guint64 offset = 0;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GBytes) blob2 = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) checksums = g_hash_table_new(g_str_hash, g_str_equal);
+	g_autoptr(GPtrArray) chunks = NULL;
+	g_autoptr(GPtrArray) chunks2 = NULL;
+	g_autoptr(GPtrArray) chunks3 = NULL;
+	g_autoptr(GRand) rand = g_rand_new_with_seed(0);
+
+	/* contiguous, and within the size limits */
+	for (guint i = 0; i < 2 * 1024 * 1024; i++) {
+		guint8 tmp = g_rand_int(rand);
+		g_byte_array_append(buf, &tmp, 1);
+	}
+	blob = g_bytes_new(buf->data, buf->len);
+	chunks = passim_chunk_split(blob);
+	g_assert_cmpint(chunks->len, >, 8);
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		g_assert_cmpint(chunk->offset, ==, offset);
+		g_assert_cmpint(chunk->size, <=, 256 * 1024);
+		if (i < chunks->len - 1)
+			g_assert_cmpint(chunk->size, >=, 16 * 1024);
+		g_assert_true(passim_chunk_checksum_valid(chunk->checksum));
+		g_hash_table_add(checksums, chunk->checksum);
+		offset += chunk->size;
+	}
+	g_assert_cmpint(offset, ==, buf->len);
+
+	/* an insertion only changes the chunks around it */
+	g_byte_array_prepend(buf, (const guint8 *)"hello world", 11);
+	blob2 = g_bytes_new(buf->data, buf->len);
+	chunks2 = passim_chunk_split(blob2);
+	for (guint i = 0; i < chunks2->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks2, i);
+		if (g_hash_table_contains(checksums, chunk->checksum))
+			shared++;
+	}
+	g_assert_cmpint(shared, >=, chunks->len - 2);
+
+	/* round trip */
+	str = passim_chunk_list_to_string(chunks);
+	chunks3 = passim_chunk_list_from_string(str, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(chunks3);
+	g_assert_cmpint(chunks3->len, ==, chunks->len);
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		PassimChunk *chunk3 = g_ptr_array_index(chunks3, i);
+		g_assert_cmpstr(chunk->checksum, ==, chunk3->checksum);
+		g_assert_cmpint(chunk->offset, ==, chunk3->offset);
+		g_assert_cmpint(chunk->size, ==, chunk3->size);
+	}
+	g_clear_pointer(&chunks3, g_ptr_array_unref);
+
+	/* used as a filename */
+	g_assert_false(passim_chunk_checksum_valid("../../../../etc/passwd"));
+	g_assert_false(passim_chunk_checksum_valid(
+	    "ABCDEF0123456789abcdef0123456789abcdef0123456789abcdef0123456789"));
+	chunks3 = passim_chunk_list_from_string("deadbeef 1234\n", &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(chunks3);
+}
+
+static void
+passim_merkle_func(void)
+{
+	guint8 buf[10000] = {0};
+	g_autofree gchar *str = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GBytes) block = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(PassimMerkle) merkle = NULL;
+	g_autoptr(PassimMerkle) merkle2 = NULL;
+
+	for (guint i = 0; i < sizeof(buf); i++)
+		buf[i] = i % 251;
+	blob = g_bytes_new(buf, sizeof(buf));
+	merkle = passim_merkle_new(blob, 1024);
+	g_assert_cmpint(passim_merkle_get_n_blocks(merkle), ==, 10);
+	g_assert_cmpint(passim_merkle_get_block_size(merkle), ==, 1024);
+	g_assert_cmpint(passim_merkle_get_size(merkle), ==, sizeof(buf));
+
+	/* round trip */
+	str = passim_merkle_to_string(merkle);
+	merkle2 = passim_merkle_from_string(str, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(merkle2);
+	g_assert_cmpstr(passim_merkle_get_root(merkle), ==, passim_merkle_get_root(merkle2));
+
+	/* the last block is short */
+	block = g_bytes_new_from_bytes(blob, 9 * 1024, sizeof(buf) - 9 * 1024);
+	g_assert_true(passim_merkle_verify_block(merkle2, 9, block, &error));
+	g_assert_no_error(error);
+	g_clear_pointer(&block, g_bytes_unref);
+
+	/* corrupt */
+	buf[2048] ^= 0xff;
+	block = g_bytes_new(buf + 2048, 1024);
+	g_assert_false(passim_merkle_verify_block(merkle2, 2, block, &error));
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_clear_error(&error);
+	g_clear_pointer(&merkle2, passim_merkle_free);
+
+	/* block hashes that do not match the root */
+	str[100] = str[100] == '0' ? '1' : '0';
+	merkle2 = passim_merkle_from_string(str, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(merkle2);
 }
 
+static void
+passim_bitmap_func(void)
+{
+	g_autofree gchar *str = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(PassimBitmap) bitmap = passim_bitmap_new(10);
+	g_autoptr(PassimBitmap) bitmap2 = NULL;
+
+	g_assert_cmpint(passim_bitmap_get_size(bitmap), ==, 10);
+	g_assert_cmpint(passim_bitmap_count(bitmap), ==, 0);
+	passim_bitmap_set(bitmap, 0);
+	passim_bitmap_set(bitmap, 1);
+	passim_bitmap_set(bitmap, 2);
+	passim_bitmap_set(bitmap, 9);
+	g_assert_cmpint(passim_bitmap_count(bitmap), ==, 4);
+	g_assert_true(passim_bitmap_get(bitmap, 9));
+	g_assert_false(passim_bitmap_get(bitmap, 8));
+	g_assert_false(passim_bitmap_get(bitmap, 10));
+	g_assert_true(passim_bitmap_get_range(bitmap, 0, 2));
+	g_assert_false(passim_bitmap_get_range(bitmap, 2, 3));
+
+	/* round trip */
+	str = passim_bitmap_to_string(bitmap);
+	g_assert_cmpstr(str, ==, "10 e040");
+	bitmap2 = passim_bitmap_from_string(str, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(bitmap2);
+	g_assert_cmpint(passim_bitmap_count(bitmap2), ==, 4);
+	g_assert_true(passim_bitmap_get(bitmap2, 9));
+	g_clear_pointer(&bitmap2, passim_bitmap_free);
+
+	/* blocks that do not exist */
+	bitmap2 = passim_bitmap_from_string("10 e060", &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(bitmap2);
+	g_clear_error(&error);
+	bitmap2 = passim_bitmap_from_string("10 e0", &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_null(bitmap2);
+}
+
+static void
+passim_digest_merkle_block_cb(const guint8 *buf, gsize bufsz, gpointer user_data)
+{
+	PassimMerkle *merkle = (PassimMerkle *)user_data;
+	passim_merkle_add_block(merkle, buf, bufsz);
+}
+
+static void
+passim_digest_func(void)
+{
+	guint mask;
+	PassimDigestKind kind = PASSIM_DIGEST_KIND_LAST;
+	g_autofree gchar *checksum = NULL;
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *key_etag = NULL;
+	g_autofree gchar *signature = NULL;
+	g_autofree gchar *value = NULL;
+	g_autofree guint8 *buf = g_malloc0(2 * 1024 * 1024);
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(PassimDigests) digests = NULL;
+	g_autoptr(PassimDigests) digests_blocks = NULL;
+	g_autoptr(PassimMerkle) merkle = NULL;
+	g_autoptr(PassimMerkle) merkle_blocks = NULL;
+
+	g_assert_cmpint(passim_digest_kind_from_string("blake3"), ==, PASSIM_DIGEST_KIND_BLAKE3);
+	g_assert_cmpint(passim_digest_kind_from_string("md5"), ==, PASSIM_DIGEST_KIND_LAST);
+	g_assert_true(passim_digest_kind_is_valid(
+	    PASSIM_DIGEST_KIND_SHA256,
+	    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+	g_assert_false(passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA256, "e3b0c442"));
+	g_assert_false(passim_digest_kind_is_valid(
+	    PASSIM_DIGEST_KIND_SHA256,
+	    "E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855"));
+	g_assert_false(passim_digest_kind_is_valid(
+	    PASSIM_DIGEST_KIND_BLAKE3,
+	    "../../b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+	key = passim_digest_build_key(PASSIM_DIGEST_KIND_BLAKE3, "af1349b9");
+	g_assert_cmpstr(key, ==, "blake3-af1349b9");
+	g_clear_pointer(&key, g_free);
+
+	/* origin URIs, where the ETag is optional */
+	key = passim_digest_build_uri_key("https://example.com/firmware.cab", NULL);
+	g_assert_true(g_str_has_prefix(key, "uri-"));
+	g_assert_cmpint(strlen(key), ==, 68);
+	key_etag = passim_digest_build_uri_key("https://example.com/firmware.cab", "\"abc\"");
+	g_assert_cmpstr(key, !=, key_etag);
+
+	/* APT and DNF repository layouts */
+	g_assert_true(passim_digest_parse_path(
+	    "/debian/dists/sid/main/binary-amd64/by-hash/SHA256/"
+	    "E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855",
+	    &kind,
+	    &value));
+	g_assert_cmpint(kind, ==, PASSIM_DIGEST_KIND_SHA256);
+	g_assert_cmpstr(value,
+			==,
+			"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	g_clear_pointer(&value, g_free);
+	g_assert_true(passim_digest_parse_path(
+	    "/fedora/repodata/"
+	    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855-primary.xml.zst",
+	    &kind,
+	    &value));
+	g_assert_cmpint(kind, ==, PASSIM_DIGEST_KIND_SHA256);
+	g_clear_pointer(&value, g_free);
+	g_assert_false(
+	    passim_digest_parse_path("/debian/by-hash/MD5Sum/d41d8cd98f00b204e9800998ecf8427e",
+				     &kind,
+				     &value));
+	g_assert_false(passim_digest_parse_path("/debian/by-hash/SHA256/e3b0c442", &kind, &value));
+	g_assert_false(passim_digest_parse_path("/fedora/repodata/repomd.xml", &kind, &value));
+	g_assert_false(passim_digest_parse_path("/HELLO.md", &kind, &value));
+
+	/* replication requests are only accepted with the same secret */
+	signature = passim_digest_sign_replicate("secret", "abc", "HELLO.md", 27500, 1700000000);
+	g_assert_cmpint(strlen(signature), ==, 64);
+	g_assert_true(passim_digest_verify_replicate("secret",
+						     "abc",
+						     "HELLO.md",
+						     27500,
+						     1700000000,
+						     signature));
+	g_assert_false(passim_digest_verify_replicate("wrong",
+						      "abc",
+						      "HELLO.md",
+						      27500,
+						      1700000000,
+						      signature));
+	g_assert_false(passim_digest_verify_replicate("secret",
+						      "abc",
+						      "HELLO.md",
+						      27500,
+						      1700000001,
+						      signature));
+	g_assert_false(
+	    passim_digest_verify_replicate("secret", "abc", "HELLO.md", 27500, 1700000000, "00"));
+
+	/* more than one block */
+	blob = g_bytes_new_static(buf, 2 * 1024 * 1024);
+	checksum = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, blob);
+	digests = passim_digests_new(blob, (1u << PASSIM_DIGEST_KIND_LAST) - 1);
+	g_assert_cmpstr(digests->values[PASSIM_DIGEST_KIND_SHA256], ==, checksum);
+
+	/* the block hashes are built in the same pass */
+	merkle_blocks = passim_merkle_new_empty(PASSIM_MERKLE_BLOCK_SIZE);
+	digests_blocks = passim_digests_new_full(blob,
+						 1u << PASSIM_DIGEST_KIND_SHA256,
+						 PASSIM_MERKLE_BLOCK_SIZE,
+						 passim_digest_merkle_block_cb,
+						 merkle_blocks);
+	g_assert_cmpstr(digests_blocks->values[PASSIM_DIGEST_KIND_SHA256], ==, checksum);
+	merkle = passim_merkle_new(blob, PASSIM_MERKLE_BLOCK_SIZE);
+	g_assert_cmpint(passim_merkle_get_n_blocks(merkle_blocks), ==, 8);
+	g_assert_cmpint(passim_merkle_get_size(merkle_blocks), ==, 2 * 1024 * 1024);
+	g_assert_cmpstr(passim_merkle_get_root(merkle_blocks), ==, passim_merkle_get_root(merkle));
+#ifdef HAVE_BLAKE3
+	g_assert_nonnull(digests->values[PASSIM_DIGEST_KIND_BLAKE3]);
+	g_clear_pointer(&digests, passim_digests_free);
+	g_clear_pointer(&blob, g_bytes_unref);
+
+	/* from the BLAKE3 test vectors */
+	blob = g_bytes_new_static(NULL, 0);
+	digests = passim_digests_new(blob, 1u << PASSIM_DIGEST_KIND_BLAKE3);
+	g_assert_null(digests->values[PASSIM_DIGEST_KIND_SHA256]);
+	g_assert_cmpstr(digests->values[PASSIM_DIGEST_KIND_BLAKE3],
+			==,
+			"af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+#else
+	g_assert_null(digests->values[PASSIM_DIGEST_KIND_BLAKE3]);
+#endif
+	g_clear_pointer(&digests, passim_digests_free);
+	g_clear_pointer(&blob, g_bytes_unref);
+
+	/* only the requested digests */
+	blob = g_bytes_new_static("hello", 5);
+	mask = 1u << PASSIM_DIGEST_KIND_SHA1 | 1u << PASSIM_DIGEST_KIND_SHA512;
+	digests = passim_digests_new(blob, mask);
+	g_assert_null(digests->values[PASSIM_DIGEST_KIND_SHA256]);
+	g_assert_cmpstr(digests->values[PASSIM_DIGEST_KIND_SHA1],
+			==,
+			"aaf4c61ddcc5e8a2dabede0f3b482cd9aea9434d");
+	g_assert_true(passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA512,
+						  digests->values[PASSIM_DIGEST_KIND_SHA512]));
+	g_assert_false(passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA384,
+						   digests->values[PASSIM_DIGEST_KIND_SHA512]));
+}
+
+static void
+passim_oci_func(void)
+{
+	const gchar *hash = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+	g_autofree gchar *json = NULL;
+	g_autofree gchar *path = g_strdup_printf("/v2/library/debian/blobs/sha256:%s", hash);
+	g_autoptr(GHashTable) items =
+	    g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_object_unref);
+	g_autoptr(PassimItem) item = passim_item_new();
+	g_autoptr(PassimOciRoute) route = NULL;
+
+	passim_item_set_hash(item, hash);
+	g_hash_table_insert(items, (gpointer)hash, g_object_ref(item));
+
+	/* version check */
+	route = passim_oci_route_new(items, "GET", "/v2/", FALSE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_VERSION);
+	g_clear_pointer(&route, passim_oci_route_free);
+
+	/* blob, and checking it exists, which are both uncompressed */
+	route = passim_oci_route_new(items, "GET", path, FALSE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_BLOB);
+	g_assert_cmpstr(route->digest, ==, hash);
+	g_assert_true(route->item == item);
+	g_clear_pointer(&route, passim_oci_route_free);
+	route = passim_oci_route_new(items, "HEAD", path, FALSE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_HEAD);
+	g_assert_true(route->item == item);
+	g_clear_pointer(&route, passim_oci_route_free);
+
+	/* disabled */
+	passim_item_add_flag(item, PASSIM_ITEM_FLAG_DISABLED);
+	route = passim_oci_route_new(items, "GET", path, FALSE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_ERROR);
+	g_assert_cmpint(route->status_code, ==, 404);
+	g_assert_cmpstr(route->code, ==, "BLOB_UNKNOWN");
+	g_clear_pointer(&route, passim_oci_route_free);
+
+	/* miss, where only localhost can ask the peers */
+	g_hash_table_remove_all(items);
+	route = passim_oci_route_new(items, "GET", path, FALSE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_ERROR);
+	g_assert_cmpint(route->status_code, ==, 404);
+	g_assert_cmpstr(route->code, ==, "BLOB_UNKNOWN");
+	g_clear_pointer(&route, passim_oci_route_free);
+	route = passim_oci_route_new(items, "HEAD", path, TRUE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_FIND);
+	g_assert_cmpstr(route->digest, ==, hash);
+	g_clear_pointer(&route, passim_oci_route_free);
+
+	/* manifests and other digests */
+	route = passim_oci_route_new(items, "GET", "/v2/library/debian/manifests/latest", TRUE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_ERROR);
+	g_assert_cmpstr(route->code, ==, "UNSUPPORTED");
+	g_assert_null(route->digest);
+	g_clear_pointer(&route, passim_oci_route_free);
+	route = passim_oci_route_new(items, "GET", "/v2/library/debian/blobs/sha512:abcd", TRUE);
+	g_assert_cmpint(route->action, ==, PASSIM_OCI_ACTION_ERROR);
+	g_assert_cmpint(route->status_code, ==, 400);
+	g_assert_cmpstr(route->code, ==, "DIGEST_INVALID");
+	g_clear_pointer(&route, passim_oci_route_free);
+
+	json = passim_oci_error_to_json("BLOB_UNKNOWN", "blob unknown to registry");
+	g_assert_cmpstr(json,
+			==,
+			"{\"errors\":[{\"code\":\"BLOB_UNKNOWN\","
+			"\"message\":\"blob unknown to registry\"}]}\n");
+}
+
+static void
+passim_cli_attr_func(void)
+{
+	PassimItemAttr *attr;
+	GVariantBuilder builder;
+	GVariantBuilder digests;
+	g_autoptr(GPtrArray) attrs =
+	    g_ptr_array_new_with_free_func((GDestroyNotify)passim_item_attr_free);
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(PassimItem) item = passim_item_new();
+
+	/* only the values in the stats are shown */
+	passim_item_set_size(item, 1000);
+	g_variant_builder_init(&digests, G_VARIANT_TYPE("a{ss}"));
+	g_variant_builder_add(&digests, "{ss}", "blake3", "abcd");
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&builder, "{sv}", "stored-size", g_variant_new_uint64(250));
+	g_variant_builder_add(&builder, "{sv}", "compress-time", g_variant_new_uint64(1500));
+	g_variant_builder_add(&builder, "{sv}", "chunks", g_variant_new_uint32(3));
+	g_variant_builder_add(&builder, "{sv}", "digests", g_variant_builder_end(&digests));
+	data = g_variant_ref_sink(g_variant_builder_end(&builder));
+	passim_cli_item_stats_to_attrs(item, data, attrs);
+	g_assert_cmpint(attrs->len, ==, 4);
+	attr = g_ptr_array_index(attrs, 0);
+	g_assert_cmpstr(attr->key, ==, "Stored");
+	g_assert_cmpstr(attr->value, ==, "250 bytes (25%)");
+	attr = g_ptr_array_index(attrs, 1);
+	g_assert_cmpstr(attr->key, ==, "Compress Time");
+	g_assert_cmpstr(attr->value, ==, "1.5ms");
+	attr = g_ptr_array_index(attrs, 2);
+	g_assert_cmpstr(attr->key, ==, "Chunks");
+	g_assert_cmpstr(attr->value, ==, "3");
+	attr = g_ptr_array_index(attrs, 3);
+	g_assert_cmpstr(attr->key, ==, "BLAKE3");
+	g_assert_cmpstr(attr->value, ==, "abcd");
+}
+
+#ifdef HAVE_FAULT_INJECTION
+static void
+passim_fault_func(void)
+{
+	gboolean ret;
+	guint delay_ms = 0;
+	g_autofree gchar *str = NULL;
+	g_autofree gchar *value = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* invalid specs do not replace the current faults */
+	ret = passim_fault_setup("file-map:delay=10:rate=50,tls-write:error=100", &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	ret = passim_fault_setup("disk:delay=10", &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+	g_assert_false(ret);
+	g_clear_error(&error);
+	ret = passim_fault_setup("xattr:error=101", &error);
+	g_assert_nonnull(error);
+	g_assert_false(ret);
+	g_clear_error(&error);
+	str = passim_fault_to_string();
+	g_assert_cmpstr(str,
+			==,
+			"file-map:delay=10:rate=50:error=0,tls-write:delay=0:rate=100:error=100");
+
+	/* always fails */
+	ret = passim_fault_roll(PASSIM_FAULT_POINT_TLS_WRITE, &delay_ms, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert_false(ret);
+	g_assert_cmpint(delay_ms, ==, 0);
+	g_clear_error(&error);
+
+	/* used by the xattr helpers */
+	ret = passim_fault_setup("xattr:error=100", &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	value = passim_xattr_get_string("/dev/null", "user.test_str", &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert_null(value);
+	g_clear_error(&error);
+
+	/* clear */
+	ret = passim_fault_setup("", &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	ret = passim_fault_roll(PASSIM_FAULT_POINT_XATTR, &delay_ms, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+}
+#endif
+
 int
 main(int argc, char **argv)
 {
@@ -115,5 +1006,24 @@ main(int argc, char **argv)
 	(void)g_setenv("G_MESSAGES_DEBUG", "all", TRUE);
 
 	g_test_add_func("/passim/common", passim_common_func);
+	g_test_add_func("/passim/uri-lookup", passim_uri_lookup_func);
+	g_test_add_func("/passim/metrics", passim_metrics_func);
+	g_test_add_func("/passim/access-log", passim_access_log_func);
+	g_test_add_func("/passim/policy", passim_policy_func);
+	g_test_add_func("/passim/index{catalog}", passim_index_catalog_func);
+	g_test_add_func("/passim/compress", passim_compress_func);
+	g_test_add_func("/passim/chunk", passim_chunk_func);
+	g_test_add_func("/passim/merkle", passim_merkle_func);
+	g_test_add_func("/passim/bitmap", passim_bitmap_func);
+	g_test_add_func("/passim/digest", passim_digest_func);
+	g_test_add_func("/passim/oci", passim_oci_func);
+	g_test_add_func("/passim/cli-attr", passim_cli_attr_func);
+#ifdef HAVE_ZSTD
+	g_test_add_func("/passim/compress{seekable}", passim_compress_seekable_func);
+	g_test_add_func("/passim/compress{delta}", passim_compress_delta_func);
+#endif
+#ifdef HAVE_FAULT_INJECTION
+	g_test_add_func("/passim/fault", passim_fault_func);
+#endif
 	return g_test_run();
 }
@@ -6,6 +6,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <gio/gunixfdlist.h>
 #include <gio/gunixinputstream.h>
 #include <glib-unix.h>
@@ -13,26 +14,137 @@
 #include <libsoup/soup.h>
 #include <passim.h>
 
+#include "passim-access-log.h"
 #include "passim-avahi.h"
+#include "passim-bitmap.h"
+#include "passim-chunk.h"
 #include "passim-common.h"
+#include "passim-compress.h"
+#include "passim-digest.h"
+#include "passim-fault.h"
+#include "passim-fetch.h"
 #include "passim-gnutls.h"
+#include "passim-index.h"
+#include "passim-merkle.h"
+#include "passim-metrics.h"
+#include "passim-oci.h"
+#include "passim-policy.h"
+#include "passim-trace.h"
+
+/* used as the cmdline of items downloaded ahead of time, so they can be counted */
+#define PASSIM_SERVER_PREFETCH_CMDLINE "passimd-prefetch"
+
+/* used as the cmdline of items copied here when asked by the machine that published them */
+#define PASSIM_SERVER_REPLICATE_CMDLINE "passimd-replicate"
+
+/* how old a signed replication request can be before it is refused, in seconds */
+#define PASSIM_SERVER_REPLICATE_MAX_SKEW 300
+
+/* the most shared items sent to peers, and the most we accept from them */
+#define PASSIM_SERVER_CATALOG_LIMIT    1000
+#define PASSIM_SERVER_CATALOG_MAX_SIZE (1024 * 1024)
+
+/* items larger than this are downloaded a block at a time, and shared before they are complete */
+#define PASSIM_SERVER_SWARM_MIN_SIZE (4 * PASSIM_MERKLE_BLOCK_SIZE)
+
+/* how many blocks are downloaded before asking the other machines what they have now */
+#define PASSIM_SERVER_SWARM_REFRESH 16
+
+/* how many items have their copies counted at once, as each is an mDNS browse and resolve */
+#define PASSIM_SERVER_REPLICAS_MAX_FINDS 4
+
+typedef struct {
+	gint64 timestamp; /* monotonic, µs */
+	guint64 requests;
+	guint64 bytes_served;
+} PassimServerSample;
+
+/* compressed copies of an item, where a size of 0 means not available */
+typedef struct {
+	guint64 size[PASSIM_ENCODING_LAST];
+} PassimServerVariants;
+
+/* items kept as seekable zstd in the data directory */
+typedef struct {
+	guint64 size;	       /* on disk */
+	guint64 compress_us;   /* when published */
+	guint64 decompress_us; /* total, since the daemon was started */
+} PassimServerStored;
+
+/* shared by every item in the chunk store that includes it */
+typedef struct {
+	guint refcount;
+	guint32 size;
+} PassimServerChunk;
+
+/* a patch from an older item with the same basename and cmdline */
+typedef struct {
+	gchar *hash_old;
+	guint64 size;
+} PassimServerDelta;
+
+/* an item still being downloaded, where only the blocks set in the bitmap can be shared */
+typedef struct {
+	PassimMerkle *merkle;
+	PassimBitmap *bitmap;
+	gchar *filename;
+} PassimServerPartial;
+
+/* attached to each SoupServerMessage */
+typedef struct {
+	guint64 id;
+	gint64 start_time;    /* monotonic, µs */
+	gint64 lookup_us;     /* or -1 if not required */
+	gint64 first_byte_us; /* or -1 if nothing written yet */
+	guint64 bytes;
+	gchar *client;
+	gchar *hash;
+} PassimServerRequest;
 
 typedef struct {
 	GDBusConnection *connection;
 	GDBusNodeInfo *introspection_daemon;
 	GDBusProxy *proxy_uid;
-	GHashTable *items; /* utf-8:PassimItem */
+	GHashTable *items;    /* utf-8:PassimItem */
+	GHashTable *variants; /* utf-8:PassimServerVariants */
+	GHashTable *stored;   /* utf-8:PassimServerStored */
+	GHashTable *deltas;   /* utf-8:PassimServerDelta */
+	GHashTable *chunks;   /* utf-8:PassimServerChunk */
+	GHashTable *chunked;  /* utf-8:GPtrArray of PassimChunk */
+	GHashTable *digests;  /* utf-8:PassimDigests */
+	GHashTable *aliases;  /* utf-8:utf-8, from {kind}-{digest} to the item hash */
+	GHashTable *replicas; /* utf-8:guint, the number of other machines with the item */
+	GHashTable *fetching; /* utf-8, hashes being copied from another machine */
+	GHashTable *hmacs;    /* utf-8:gint64, of replication requests already seen */
+	GHashTable *saved;    /* utf-8:guint64, the served size last written to the item */
+	GHashTable *partials; /* utf-8:PassimServerPartial */
+	GQueue *counting;     /* utf-8, items waiting to have their copies counted */
+	guint n_counting;     /* items having their copies counted now */
+	guint digests_mask;   /* of PassimDigestKind */
 	GFileMonitor *sysconfpkg_monitor;
 	guint sysconfpkg_rescan_id;
 	GKeyFile *kf;
 	GMainLoop *loop;
 	PassimAvahi *avahi;
+	PassimMetrics *metrics;
+	PassimAccessLog *access_log;
+	guint64 request_id;
 	GNetworkMonitor *network_monitor;
 	gchar *root;
 	guint16 port;
 	guint owner_id;
 	guint poll_item_age_id;
 	guint timed_exit_id;
+	guint sample_id;
+	guint prefetch_id;
+	gboolean prefetch_busy;
+	guint replication_id;
+	guint adapt_id;
+	guint save_id;
+	gdouble load; /* 1-minute load average per CPU */
+	gint64 start_time; /* monotonic, µs */
+	PassimServerSample sample_prev;
+	PassimServerSample sample_cur;
 	PassimStatus status;
 } PassimServer;
 
@@ -45,14 +157,54 @@ passim_server_free(PassimServer *self)
 		g_source_remove(self->poll_item_age_id);
 	if (self->timed_exit_id != 0)
 		g_source_remove(self->timed_exit_id);
+	if (self->sample_id != 0)
+		g_source_remove(self->sample_id);
+	if (self->prefetch_id != 0)
+		g_source_remove(self->prefetch_id);
+	if (self->replication_id != 0)
+		g_source_remove(self->replication_id);
+	if (self->adapt_id != 0)
+		g_source_remove(self->adapt_id);
+	if (self->save_id != 0)
+		g_source_remove(self->save_id);
 	if (self->loop != NULL)
 		g_main_loop_unref(self->loop);
 	if (self->avahi != NULL)
 		g_object_unref(self->avahi);
+	if (self->metrics != NULL)
+		g_object_unref(self->metrics);
+	if (self->access_log != NULL)
+		g_object_unref(self->access_log);
 	if (self->sysconfpkg_monitor != NULL)
 		g_object_unref(self->sysconfpkg_monitor);
 	if (self->items != NULL)
 		g_hash_table_unref(self->items);
+	if (self->variants != NULL)
+		g_hash_table_unref(self->variants);
+	if (self->stored != NULL)
+		g_hash_table_unref(self->stored);
+	if (self->deltas != NULL)
+		g_hash_table_unref(self->deltas);
+	if (self->chunks != NULL)
+		g_hash_table_unref(self->chunks);
+	if (self->chunked != NULL)
+		g_hash_table_unref(self->chunked);
+	if (self->digests != NULL)
+		g_hash_table_unref(self->digests);
+	if (self->aliases != NULL)
+		g_hash_table_unref(self->aliases);
+	if (self->replicas != NULL)
+		g_hash_table_unref(self->replicas);
+	if (self->fetching != NULL)
+		g_hash_table_unref(self->fetching);
+	if (self->hmacs != NULL)
+		g_hash_table_unref(self->hmacs);
+	if (self->saved != NULL)
+		g_hash_table_unref(self->saved);
+	if (self->partials != NULL)
+		g_hash_table_unref(self->partials);
+	if (self->counting != NULL)
+		g_queue_free_full(self->counting, g_free);
 	if (self->kf != NULL)
 		g_key_file_unref(self->kf);
 	if (self->proxy_uid != NULL)
@@ -127,9 +279,10 @@ passim_server_set_status(PassimServer *self, PassimStatus status)
 static gboolean
 passim_server_avahi_register(PassimServer *self, GError **error)
 {
-	guint keyidx = 0;
-	g_autofree const gchar **keys = NULL;
+	g_autofree gchar *replication_secret = passim_config_get_replication_secret(self->kf);
 	g_autoptr(GList) items = NULL;
+	g_autoptr(GList) partials = NULL;
+	g_autoptr(GPtrArray) keys = g_ptr_array_new_with_free_func(g_free);
 
 	/* sanity check */
 	if (self->status == PASSIM_STATUS_STARTING) {
@@ -147,16 +300,42 @@ passim_server_avahi_register(PassimServer *self, GError **error)
 		return passim_avahi_unregister(self->avahi, error);
 	}
 
-	/* build a GStrv of hashes */
+	/* build a GStrv of hashes, and the origin URIs and extra digests in their own namespace */
 	items = g_hash_table_get_values(self->items);
-	keys = g_new0(const gchar *, g_list_length(items) + 1);
 	for (GList *l = items; l != NULL; l = l->next) {
 		PassimItem *item = PASSIM_ITEM(l->data);
+		PassimDigests *digests;
+		const gchar *uri = passim_item_get_uri(item);
+		const gchar *etag = passim_item_get_etag(item);
 		if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED))
 			continue;
-		keys[keyidx++] = passim_item_get_hash(item);
+		g_ptr_array_add(keys, g_strdup(passim_item_get_hash(item)));
+		if (uri != NULL)
+			g_ptr_array_add(keys, passim_digest_build_uri_key(uri, NULL));
+		if (uri != NULL && etag != NULL)
+			g_ptr_array_add(keys, passim_digest_build_uri_key(uri, etag));
+		digests = g_hash_table_lookup(self->digests, passim_item_get_hash(item));
+		if (digests == NULL)
+			continue;
+		for (guint i = PASSIM_DIGEST_KIND_SHA256 + 1; i < PASSIM_DIGEST_KIND_LAST; i++) {
+			const gchar *value = digests->values[i];
+			if (value != NULL)
+				g_ptr_array_add(keys, passim_digest_build_key(i, value));
+		}
 	}
-	if (!passim_avahi_register(self->avahi, (gchar **)keys, error))
+
+	/* so that other machines downloading the same item can have the blocks as they arrive */
+	partials = g_hash_table_get_keys(self->partials);
+	for (GList *l = partials; l != NULL; l = l->next)
+		g_ptr_array_add(keys, g_strdup_printf("partial-%s", (const gchar *)l->data));
+
+	/* so that peers can find what is popular here, and who will accept copies */
+	if (passim_config_get_prefetch(self->kf))
+		g_ptr_array_add(keys, g_strdup("catalog"));
+	if (replication_secret != NULL)
+		g_ptr_array_add(keys, g_strdup("replicate"));
+	g_ptr_array_add(keys, NULL);
+	if (!passim_avahi_register(self->avahi, (gchar **)keys->pdata, error))
 		return FALSE;
 
 	/* success */
@@ -164,6 +343,46 @@ passim_server_avahi_register(PassimServer *self, GError **error)
 	return TRUE;
 }
 
+/* the item can be found by origin URI with or without the ETag, as the client may not know it */
+static void
+passim_server_uris_add(PassimServer *self, PassimItem *item)
+{
+	const gchar *uri = passim_item_get_uri(item);
+	const gchar *etag = passim_item_get_etag(item);
+
+	if (uri == NULL)
+		return;
+	g_hash_table_insert(self->aliases,
+			    passim_digest_build_uri_key(uri, NULL),
+			    g_strdup(passim_item_get_hash(item)));
+	if (etag != NULL) {
+		g_hash_table_insert(self->aliases,
+				    passim_digest_build_uri_key(uri, etag),
+				    g_strdup(passim_item_get_hash(item)));
+	}
+}
+
+/* a newer item may have been published with the same origin URI */
+static void
+passim_server_uris_remove(PassimServer *self, PassimItem *item)
+{
+	const gchar *hash_item;
+	const gchar *uri = passim_item_get_uri(item);
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *key_etag = NULL;
+
+	if (uri == NULL)
+		return;
+	key = passim_digest_build_uri_key(uri, NULL);
+	hash_item = g_hash_table_lookup(self->aliases, key);
+	if (g_strcmp0(hash_item, passim_item_get_hash(item)) == 0)
+		g_hash_table_remove(self->aliases, key);
+	if (passim_item_get_etag(item) == NULL)
+		return;
+	key_etag = passim_digest_build_uri_key(uri, passim_item_get_etag(item));
+	g_hash_table_remove(self->aliases, key_etag);
+}
+
 static gboolean
 passim_server_add_item(PassimServer *self, PassimItem *item, GError **error)
 {
@@ -172,767 +391,4562 @@ passim_server_add_item(PassimServer *self, PassimItem *item, GError **error)
 		passim_item_get_basename(item),
 		passim_item_get_hash(item));
 	g_hash_table_insert(self->items, g_strdup(passim_item_get_hash(item)), g_object_ref(item));
+	passim_server_uris_add(self, item);
 	return TRUE;
 }
 
-static gboolean
-passim_item_load_bytes_nofollow(PassimItem *item, const gchar *filename, GError **error)
+static gchar *
+passim_server_variant_filename(const gchar *hash, PassimEncoding encoding)
 {
-	gint fd;
-	g_autoptr(GBytes) bytes = NULL;
-	g_autoptr(GInputStream) istream = NULL;
-	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	g_autofree gchar *basename =
+	    g_strdup_printf("%s%s", hash, passim_encoding_to_suffix(encoding));
+	return g_build_filename(localstatedir, "lib", PACKAGE_NAME, "variants", basename, NULL);
+}
 
-	/* load bytes from the fd to avoid TOCTOU */
-	fd = g_open(filename, O_NOFOLLOW, S_IRUSR);
-	if (fd < 0) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    G_IO_ERROR_PERMISSION_DENIED,
-			    "skipping symlink %s",
-			    filename);
-		return FALSE;
-	}
-	istream = g_unix_input_stream_new(fd, TRUE);
-	if (istream == NULL) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    G_IO_ERROR_FAILED,
-			    "no stream to read from %s",
-			    filename);
-		return FALSE;
+static guint
+passim_server_variants_get_mask(PassimServerVariants *variants)
+{
+	guint mask = 0;
+	for (guint i = PASSIM_ENCODING_IDENTITY + 1; i < PASSIM_ENCODING_LAST; i++) {
+		if (variants->size[i] > 0)
+			mask |= 1u << i;
 	}
-	mapped_file = g_mapped_file_new_from_fd(fd, FALSE, error);
-	if (mapped_file == NULL)
-		return FALSE;
-	bytes = g_mapped_file_get_bytes(mapped_file);
-	passim_item_set_bytes(item, bytes);
-	return TRUE;
+	return mask;
 }
 
-static gboolean
-passim_server_libdir_add(PassimServer *self, const gchar *filename, GError **error)
+/* pick up any variants built before the daemon was restarted */
+static void
+passim_server_variants_load(PassimServer *self, const gchar *hash)
 {
-	guint32 value;
-	g_autofree gchar *basename = g_path_get_basename(filename);
-	g_autofree gchar *boot_time = NULL;
-	g_autofree gchar *cmdline = NULL;
-	g_auto(GStrv) split = g_strsplit(basename, "-", 2);
-	g_autoptr(PassimItem) item = passim_item_new();
+	PassimServerVariants variants = {0};
 
-	/* this doesn't have to be a sha256 hash, but it has to be *something* */
-	if (g_strv_length(split) != 2) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    G_IO_ERROR_INVALID_FILENAME,
-			    "expected {hash}-{filename} and got %s",
-			    basename);
-		return FALSE;
+	for (guint i = PASSIM_ENCODING_IDENTITY + 1; i < PASSIM_ENCODING_LAST; i++) {
+		GStatBuf st = {0};
+		g_autofree gchar *fn = passim_server_variant_filename(hash, i);
+		if (g_stat(fn, &st) == 0)
+			variants.size[i] = st.st_size;
 	}
+	if (passim_server_variants_get_mask(&variants) == 0)
+		return;
+	g_hash_table_insert(self->variants,
+			    g_strdup(hash),
+			    g_memdup2(&variants, sizeof(PassimServerVariants)));
+}
 
-	/* create new item */
-	passim_item_set_basename(item, split[1]);
-	if (!passim_item_load_bytes_nofollow(item, filename, error))
-		return FALSE;
-	if (!passim_item_load_filename(item, filename, error))
-		return FALSE;
+static void
+passim_server_variants_delete(PassimServer *self, const gchar *hash)
+{
+	for (guint i = PASSIM_ENCODING_IDENTITY + 1; i < PASSIM_ENCODING_LAST; i++) {
+		g_autofree gchar *fn = passim_server_variant_filename(hash, i);
+		if (g_unlink(fn) != 0 && errno != ENOENT)
+			g_warning("failed to delete %s: %s", fn, g_strerror(errno));
+	}
+	g_hash_table_remove(self->variants, hash);
+}
 
-	/* not required now */
-	passim_item_set_bytes(item, NULL);
+typedef struct {
+	gchar *hash;
+	GBytes *blob;
+	gboolean at_rest; /* already stored as zstd */
+	PassimServerVariants variants;
+} PassimServerCompressHelper;
 
-	/* get optional attributes */
-	value = passim_xattr_get_uint32(filename, "user.max_age", 24 * 60 * 60, error);
-	if (value == G_MAXUINT32)
-		return FALSE;
-	passim_item_set_max_age(item, value);
-	value = passim_xattr_get_uint32(filename, "user.share_limit", 5, error);
-	if (value == G_MAXUINT32)
-		return FALSE;
-	passim_item_set_share_limit(item, value);
-	cmdline = passim_xattr_get_string(filename, "user.cmdline", error);
-	if (cmdline == NULL)
-		return FALSE;
-	passim_item_set_cmdline(item, cmdline);
+static void
+passim_server_compress_helper_free(PassimServerCompressHelper *helper)
+{
+	g_bytes_unref(helper->blob);
+	g_free(helper->hash);
+	g_free(helper);
+}
 
-	/* only allowed when rebooted */
-	boot_time = passim_xattr_get_string(filename, "user.boot_time", NULL);
-	if (boot_time != NULL) {
-		g_autofree gchar *boot_time_now = passim_get_boot_time();
-		if (g_strcmp0(boot_time_now, boot_time) == 0) {
-			passim_item_add_flag(item, PASSIM_ITEM_FLAG_NEXT_REBOOT);
-			passim_item_add_flag(item, PASSIM_ITEM_FLAG_DISABLED);
+static void
+passim_server_compress_thread_cb(GTask *task,
+				 gpointer source_object,
+				 gpointer task_data,
+				 GCancellable *cancellable)
+{
+	PassimServerCompressHelper *helper = (PassimServerCompressHelper *)task_data;
+	gsize size = g_bytes_get_size(helper->blob);
+
+	if (!passim_compress_is_worthwhile(helper->blob)) {
+		g_debug("not compressing %s as sample did not compress", helper->hash);
+		g_task_return_boolean(task, TRUE);
+		return;
+	}
+	for (guint i = PASSIM_ENCODING_IDENTITY + 1; i < PASSIM_ENCODING_LAST; i++) {
+		g_autofree gchar *fn = NULL;
+		g_autoptr(GBytes) blob = NULL;
+		g_autoptr(GError) error = NULL;
+
+		if (!passim_encoding_is_supported(i))
+			continue;
+		if (i == PASSIM_ENCODING_ZSTD && helper->at_rest)
+			continue;
+		blob = passim_compress_bytes(helper->blob, i, &error);
+		if (blob == NULL) {
+			g_task_return_error(task, g_steal_pointer(&error));
+			return;
+		}
+
+		/* not worth the extra disk space */
+		if (g_bytes_get_size(blob) * 10 >= size * 9) {
+			g_debug("not keeping %s variant of %s as only %" G_GSIZE_FORMAT
+				" bytes smaller",
+				passim_encoding_to_string(i),
+				helper->hash,
+				size - MIN(size, g_bytes_get_size(blob)));
+			continue;
+		}
+		fn = passim_server_variant_filename(helper->hash, i);
+		if (!passim_mkdir_parent(fn, &error)) {
+			g_task_return_error(task, g_steal_pointer(&error));
+			return;
+		}
+		if (!passim_file_set_contents(fn, blob, &error)) {
+			g_task_return_error(task, g_steal_pointer(&error));
+			return;
 		}
+		helper->variants.size[i] = g_bytes_get_size(blob);
 	}
-	return passim_server_add_item(self, item, error);
+	g_task_return_boolean(task, TRUE);
 }
 
-static gboolean
-passim_server_libdir_scan(PassimServer *self, GError **error)
+static void
+passim_server_compress_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 {
-	g_autoptr(GDir) dir = NULL;
-	const gchar *fn;
+	PassimServer *self = (PassimServer *)user_data;
+	PassimServerCompressHelper *helper = g_task_get_task_data(G_TASK(res));
+	g_autoptr(GError) error = NULL;
 
-	/* sanity check */
-	if (!g_file_test(self->root, G_FILE_TEST_EXISTS)) {
-		g_debug("not loading resources from %s as it does not exist", self->root);
-		return TRUE;
+	if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+		g_warning("failed to compress %s: %s", helper->hash, error->message);
+		passim_server_variants_delete(self, helper->hash);
+		return;
 	}
 
-	g_debug("loading resources from %s", self->root);
-	dir = g_dir_open(self->root, 0, error);
-	if (dir == NULL)
-		return FALSE;
-	while ((fn = g_dir_read_name(dir)) != NULL) {
-		g_autofree gchar *path = g_build_filename(self->root, fn, NULL);
-		if (!passim_server_libdir_add(self, path, error))
-			return FALSE;
+	/* unpublished while we were compressing */
+	if (!g_hash_table_contains(self->items, helper->hash)) {
+		passim_server_variants_delete(self, helper->hash);
+		return;
 	}
-	passim_server_engine_changed(self);
-	return TRUE;
+	if (passim_server_variants_get_mask(&helper->variants) == 0)
+		return;
+	for (guint i = PASSIM_ENCODING_IDENTITY + 1; i < PASSIM_ENCODING_LAST; i++) {
+		if (helper->variants.size[i] == 0)
+			continue;
+		g_debug("added %s variant of %s: %" G_GUINT64_FORMAT " bytes",
+			passim_encoding_to_string(i),
+			helper->hash,
+			helper->variants.size[i]);
+	}
+	g_hash_table_insert(self->variants,
+			    g_strdup(helper->hash),
+			    g_memdup2(&helper->variants, sizeof(PassimServerVariants)));
 }
 
-static gboolean
-passim_server_sysconfpkgdir_add(PassimServer *self, const gchar *filename, GError **error)
+/* the item is served as-is until the variants have been written */
+static void
+passim_server_compress_async(PassimServer *self, const gchar *hash, GBytes *blob)
 {
-	g_autofree gchar *hash = NULL;
-	g_autoptr(PassimItem) item = passim_item_new();
+	PassimServerCompressHelper *helper = g_new0(PassimServerCompressHelper, 1);
+	g_autoptr(GTask) task = g_task_new(NULL, NULL, passim_server_compress_cb, self);
+
+	helper->hash = g_strdup(hash);
+	helper->blob = g_bytes_ref(blob);
+	helper->at_rest = g_hash_table_contains(self->stored, hash);
+	g_task_set_task_data(task, helper, (GDestroyNotify)passim_server_compress_helper_free);
+	g_task_run_in_thread(task, passim_server_compress_thread_cb);
+}
 
-	/* get optional attributes */
-	hash = passim_xattr_get_string(filename, "user.checksum.sha256", NULL);
-	if (hash != NULL && g_strcmp0(hash, "") != 0)
-		passim_item_set_hash(item, hash);
-	if (!passim_item_load_bytes_nofollow(item, filename, error))
-		return FALSE;
-	if (!passim_item_load_filename(item, filename, error))
-		return FALSE;
+static void
+passim_server_variants_build(PassimServer *self, const gchar *hash, GBytes *blob)
+{
+	if (passim_config_get_compress_min_size(self->kf) > 0 &&
+	    g_bytes_get_size(blob) >= passim_config_get_compress_min_size(self->kf))
+		passim_server_compress_async(self, hash, blob);
+}
 
-	/* not required now */
-	passim_item_set_bytes(item, NULL);
+typedef struct {
+	PassimItem *item;
+	GBytes *blob;
+	gchar *filename;
+	gchar *filename_tmp;
+	gint64 start_time;
+	PassimServerStored stored;
+} PassimServerStoreHelper;
 
-	/* never delete these */
-	passim_item_set_max_age(item, G_MAXUINT32);
-	passim_item_set_share_limit(item, G_MAXUINT32);
+static void
+passim_server_store_helper_free(PassimServerStoreHelper *helper)
+{
+	g_object_unref(helper->item);
+	g_bytes_unref(helper->blob);
+	g_free(helper->filename);
+	g_free(helper->filename_tmp);
+	g_free(helper);
+}
 
-	/* save this for next time */
-	if (hash == NULL || g_strcmp0(hash, "") == 0) {
-		passim_xattr_set_string(filename,
-					"user.checksum.sha256",
-					passim_item_get_hash(item),
-					NULL);
-	}
-	return passim_server_add_item(self, item, error);
+static gchar *
+passim_server_store_filename(const gchar *basename)
+{
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	return g_build_filename(localstatedir, "lib", PACKAGE_NAME, "compress", basename, NULL);
 }
 
-static gboolean
-passim_server_sysconfpkgdir_scan_path(PassimServer *self, const gchar *path, GError **error)
+static void
+passim_server_store_thread_cb(GTask *task,
+			      gpointer source_object,
+			      gpointer task_data,
+			      GCancellable *cancellable)
 {
-	g_autoptr(GDir) dir = NULL;
-	const gchar *fn;
+	PassimServerStoreHelper *helper = (PassimServerStoreHelper *)task_data;
+	gsize size = g_bytes_get_size(helper->blob);
+	g_autoptr(GBytes) blob_stored = NULL;
+	g_autoptr(GError) error = NULL;
 
-	/* sanity check */
-	if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
-		g_debug("not loading resources from %s as it does not exist", path);
-		return TRUE;
+	helper->start_time = g_get_monotonic_time();
+	blob_stored = passim_compress_seekable(helper->blob, &error);
+	if (blob_stored == NULL) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
 	}
-
-	g_debug("scanning %s", path);
-	dir = g_dir_open(path, 0, error);
-	if (dir == NULL)
-		return FALSE;
-	while ((fn = g_dir_read_name(dir)) != NULL) {
-		g_autofree gchar *fn_tmp = g_build_filename(path, fn, NULL);
-		g_autoptr(GError) error_local = NULL;
-		if (!passim_server_sysconfpkgdir_add(self, fn_tmp, &error_local)) {
-			if (g_error_matches(error_local,
-					    G_IO_ERROR,
-					    G_IO_ERROR_PERMISSION_DENIED)) {
-				g_info("skipping %s as EPERM", fn_tmp);
-				continue;
-			}
-			g_propagate_error(error, g_steal_pointer(&error_local));
-			return FALSE;
-		}
+	helper->stored.compress_us = g_get_monotonic_time() - helper->start_time;
+	helper->stored.size = g_bytes_get_size(blob_stored);
+	if (helper->stored.size * 10 >= size * 9) {
+		g_debug("not compressing %s at rest as only %" G_GUINT64_FORMAT " bytes smaller",
+			passim_item_get_hash(helper->item),
+			size - MIN(size, helper->stored.size));
+		helper->stored.size = 0;
+		g_task_return_boolean(task, TRUE);
+		return;
 	}
-	return TRUE;
+	if (!passim_mkdir_parent(helper->filename_tmp, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	if (!g_file_set_contents(helper->filename_tmp,
+				 g_bytes_get_data(blob_stored, NULL),
+				 g_bytes_get_size(blob_stored),
+				 &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	g_task_return_boolean(task, TRUE);
 }
 
+/* the attributes are copied here so that any set while compressing are not lost */
 static gboolean
-passim_server_sysconfpkgdir_scan_keyfile(PassimServer *self, const gchar *filename, GError **error)
+passim_server_store_swap(PassimServerStoreHelper *helper, GError **error)
 {
-	g_autofree gchar *path = NULL;
-	g_autoptr(GKeyFile) kf = g_key_file_new();
+	g_autofree gchar *size =
+	    g_strdup_printf("%" G_GSIZE_FORMAT, g_bytes_get_size(helper->blob));
 
-	if (!g_key_file_load_from_file(kf, filename, G_KEY_FILE_NONE, error))
+	if (!passim_xattr_copy(helper->filename, helper->filename_tmp, error))
 		return FALSE;
-	path = g_key_file_get_string(kf, "passim", "Path", error);
-	if (path == NULL)
+	if (!passim_xattr_set_string(helper->filename_tmp,
+				     "user.encoding",
+				     passim_encoding_to_string(PASSIM_ENCODING_ZSTD),
+				     error))
 		return FALSE;
-	return passim_server_sysconfpkgdir_scan_path(self, path, error);
-}
-
-static gboolean
-passim_server_sysconfpkgdir_scan(PassimServer *self, GError **error);
-
-static gboolean
-passim_server_sysconfpkgdir_timeout_cb(gpointer user_data)
+	if (!passim_xattr_set_string(helper->filename_tmp, "user.size", size, error))
+		return FALSE;
+	if (!passim_xattr_set_uint32(helper->filename_tmp,
+				     "user.compress_us",
+				     MIN(helper->stored.compress_us, G_MAXUINT32 - 1),
+				     error))
+		return FALSE;
+	if (g_rename(helper->filename_tmp, helper->filename) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to rename %s: %s",
+			    helper->filename_tmp,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+passim_server_store_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 {
 	PassimServer *self = (PassimServer *)user_data;
-	g_autoptr(GError) error_local1 = NULL;
-	g_autoptr(GError) error_local2 = NULL;
+	PassimServerStoreHelper *helper = g_task_get_task_data(G_TASK(res));
+	const gchar *hash = passim_item_get_hash(helper->item);
+	g_autoptr(GError) error = NULL;
 
-	/* done */
-	self->sysconfpkg_rescan_id = 0;
+	if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+		g_warning("failed to compress %s at rest: %s", hash, error->message);
+		(void)g_unlink(helper->filename_tmp);
+		return;
+	}
 
-	/* rescan and re-register */
-	if (!passim_server_sysconfpkgdir_scan(self, &error_local1))
-		g_printerr("failed to scan sysconfpkg directory: %s\n", error_local1->message);
-	if (!passim_server_avahi_register(self, &error_local2))
-		g_warning("failed to register: %s", error_local2->message);
-	return G_SOURCE_REMOVE;
+	/* unpublished while we were compressing */
+	if (g_hash_table_lookup(self->items, hash) != helper->item) {
+		(void)g_unlink(helper->filename_tmp);
+		return;
+	}
+	if (helper->stored.size > 0) {
+		PASSIM_TRACE2(publish__stage, "compress", helper->stored.compress_us);
+		passim_trace_mark(helper->start_time, "publish-compress", hash);
+		if (!passim_server_store_swap(helper, &error)) {
+			g_warning("failed to compress %s at rest: %s", hash, error->message);
+			(void)g_unlink(helper->filename_tmp);
+			return;
+		}
+		g_hash_table_insert(self->stored,
+				    g_strdup(hash),
+				    g_memdup2(&helper->stored, sizeof(PassimServerStored)));
+	}
+	passim_server_variants_build(self, hash, helper->blob);
 }
 
+/* the item is served from the uncompressed file until the compressed one replaces it */
 static void
-passim_server_sysconfpkgdir_changed_cb(GFileMonitor *monitor,
-				       GFile *file,
-				       GFile *other_file,
-				       GFileMonitorEvent event_type,
-				       gpointer user_data)
+passim_server_store_async(PassimServer *self, PassimItem *item, GBytes *blob)
 {
-	PassimServer *self = (PassimServer *)user_data;
+	PassimServerStoreHelper *helper = g_new0(PassimServerStoreHelper, 1);
+	g_autofree gchar *basename = NULL;
+	g_autoptr(GTask) task = g_task_new(NULL, NULL, passim_server_store_cb, self);
+
+	helper->item = g_object_ref(item);
+	helper->blob = g_bytes_ref(blob);
+	helper->filename = g_file_get_path(passim_item_get_file(item));
+	basename = g_path_get_basename(helper->filename);
+	helper->filename_tmp = passim_server_store_filename(basename);
+	g_task_set_task_data(task, helper, (GDestroyNotify)passim_server_store_helper_free);
+	g_task_run_in_thread(task, passim_server_store_thread_cb);
+}
 
-	/* rate limit */
-	if (self->sysconfpkg_rescan_id != 0)
-		g_source_remove(self->sysconfpkg_rescan_id);
-	self->sysconfpkg_rescan_id =
-	    g_timeout_add(500, passim_server_sysconfpkgdir_timeout_cb, self);
+static void
+passim_server_delta_free(PassimServerDelta *delta)
+{
+	g_free(delta->hash_old);
+	g_free(delta);
+}
+
+static gchar *
+passim_server_delta_filename(const gchar *hash)
+{
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	g_autofree gchar *basename = g_strdup_printf("%s.patch", hash);
+	return g_build_filename(localstatedir, "lib", PACKAGE_NAME, "deltas", basename, NULL);
+}
+
+static gchar *
+passim_server_merkle_filename(const gchar *hash)
+{
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	g_autofree gchar *basename = g_strdup_printf("%s.merkle", hash);
+	return g_build_filename(localstatedir, "lib", PACKAGE_NAME, "merkle", basename, NULL);
 }
 
+/* block hashes are cheap enough to always build, and let receivers verify a block at a time */
 static gboolean
-passim_server_sysconfpkgdir_watch(PassimServer *self, GError **error)
+passim_server_merkle_write(const gchar *hash, PassimMerkle *merkle, GError **error)
 {
-	g_autofree gchar *sysconfpkgdir = g_build_filename(PACKAGE_SYSCONFDIR, "passim.d", NULL);
-	g_autoptr(GFile) file = g_file_new_for_path(sysconfpkgdir);
+	gchar *str;
+	g_autofree gchar *fn = passim_server_merkle_filename(hash);
+	g_autoptr(GBytes) blob_merkle = NULL;
 
-	self->sysconfpkg_monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, error);
-	if (self->sysconfpkg_monitor == NULL)
+	if (!passim_mkdir_parent(fn, error))
 		return FALSE;
-	g_signal_connect(self->sysconfpkg_monitor,
-			 "changed",
-			 G_CALLBACK(passim_server_sysconfpkgdir_changed_cb),
-			 self);
-	return TRUE;
+	str = passim_merkle_to_string(merkle);
+	blob_merkle = g_bytes_new_take(str, strlen(str));
+	return passim_file_set_contents(fn, blob_merkle, error);
+}
+
+static void
+passim_server_merkle_block_cb(const guint8 *buf, gsize bufsz, gpointer user_data)
+{
+	PassimMerkle *merkle = (PassimMerkle *)user_data;
+	passim_merkle_add_block(merkle, buf, bufsz);
 }
 
+static void
+passim_server_merkle_delete(const gchar *hash)
+{
+	g_autofree gchar *fn = passim_server_merkle_filename(hash);
+	if (g_unlink(fn) != 0 && errno != ENOENT)
+		g_warning("failed to delete %s: %s", fn, g_strerror(errno));
+}
+
+static gchar *
+passim_server_partial_filename(const gchar *hash)
+{
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	return g_build_filename(localstatedir, "lib", PACKAGE_NAME, "partial", hash, NULL);
+}
+
+static void
+passim_server_partial_free(PassimServerPartial *partial)
+{
+	if (partial->merkle != NULL)
+		passim_merkle_free(partial->merkle);
+	if (partial->bitmap != NULL)
+		passim_bitmap_free(partial->bitmap);
+	g_free(partial->filename);
+	g_free(partial);
+}
+
+/* left behind if the daemon was stopped while downloading or compressing */
 static gboolean
-passim_server_sysconfpkgdir_scan(PassimServer *self, GError **error)
+passim_server_partials_prune(const gchar *name, GError **error)
 {
 	const gchar *fn;
-	g_autofree gchar *sysconfpkgdir = g_build_filename(PACKAGE_SYSCONFDIR, "passim.d", NULL);
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	g_autofree gchar *path = g_build_filename(localstatedir, "lib", PACKAGE_NAME, name, NULL);
 	g_autoptr(GDir) dir = NULL;
-	g_autoptr(GList) items = g_hash_table_get_values(self->items);
-
-	/* remove all existing sysconfpkgdir items */
-	for (GList *l = items; l != NULL; l = l->next) {
-		PassimItem *item = PASSIM_ITEM(l->data);
-		if (passim_item_get_cmdline(item) == NULL &&
-		    passim_item_get_max_age(item) == G_MAXUINT32 &&
-		    passim_item_get_share_limit(item) == G_MAXUINT32) {
-			g_debug("removing %s due to rescan", passim_item_get_hash(item));
-			g_hash_table_remove(self->items, passim_item_get_hash(item));
-		}
-	}
 
-	/* sanity check */
-	if (!g_file_test(sysconfpkgdir, G_FILE_TEST_EXISTS)) {
-		g_debug("not loading resources from %s as it does not exist", sysconfpkgdir);
+	if (!g_file_test(path, G_FILE_TEST_IS_DIR))
 		return TRUE;
-	}
-
-	g_debug("loading sysconfpkgdir config from %s", sysconfpkgdir);
-	dir = g_dir_open(sysconfpkgdir, 0, error);
+	dir = g_dir_open(path, 0, error);
 	if (dir == NULL)
 		return FALSE;
 	while ((fn = g_dir_read_name(dir)) != NULL) {
-		g_autofree gchar *fn_tmp = g_build_filename(sysconfpkgdir, fn, NULL);
-		if (!g_str_has_suffix(fn_tmp, ".conf"))
-			continue;
-		if (!passim_server_sysconfpkgdir_scan_keyfile(self, fn_tmp, error))
-			return FALSE;
+		g_autofree gchar *path_partial = g_build_filename(path, fn, NULL);
+		g_debug("deleting partial file %s", path_partial);
+		if (g_unlink(path_partial) != 0)
+			g_warning("failed to delete %s: %s", path_partial, g_strerror(errno));
 	}
-	passim_server_engine_changed(self);
 	return TRUE;
 }
 
-typedef struct {
-	PassimServer *self;
-	SoupServerMessage *msg;
-	gchar *hash;
-	gchar *basename;
-} PassimServerContext;
-
-static void
-passim_server_context_free(PassimServerContext *ctx)
+static gchar *
+passim_server_chunk_filename(const gchar *checksum)
 {
-	if (ctx->msg != NULL)
-		g_object_unref(ctx->msg);
-	g_free(ctx->hash);
-	g_free(ctx->basename);
-	g_free(ctx);
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	g_autofree gchar *prefix = g_strndup(checksum, 2);
+	return g_build_filename(localstatedir,
+				"lib",
+				PACKAGE_NAME,
+				"chunks",
+				prefix,
+				checksum,
+				NULL);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimServerContext, passim_server_context_free)
+/* this is also called from threads, so does not use any server state */
+static GBytes *
+passim_server_chunk_load(PassimChunk *chunk, GError **error)
+{
+	g_autofree gchar *fn = passim_server_chunk_filename(chunk->checksum);
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GMappedFile) mapping = NULL;
 
-static void
-passim_server_msg_send_error(PassimServer *self,
-			     SoupServerMessage *msg,
-			     guint status_code,
-			     const gchar *reason)
+	if (!passim_fault_check(PASSIM_FAULT_POINT_FILE_MAP, error))
+		return NULL;
+	mapping = g_mapped_file_new(fn, FALSE, error);
+	if (mapping == NULL)
+		return NULL;
+	blob = g_mapped_file_get_bytes(mapping);
+	if (g_bytes_get_size(blob) != chunk->size) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "chunk %s is 0x%x bytes, expected 0x%x",
+			    chunk->checksum,
+			    (guint)g_bytes_get_size(blob),
+			    chunk->size);
+		return NULL;
+	}
+	return g_steal_pointer(&blob);
+}
+
+/* reassemble the whole item, which is only needed when building a delta */
+static GBytes *
+passim_server_chunks_load(GPtrArray *chunks, GError **error)
 {
-	g_autoptr(GString) html = g_string_new(NULL);
-	const gchar *reason_fallback = reason ? reason : soup_status_get_phrase(status_code);
-	g_string_append_printf(html,
-			       "<html><head><title>%u %s</title></head>"
-			       "<body>%s</body></html>",
-			       status_code,
-			       soup_status_get_phrase(status_code),
-			       reason_fallback);
-	soup_server_message_set_status(msg, status_code, NULL);
-	soup_server_message_set_response(msg, "text/html", SOUP_MEMORY_COPY, html->str, html->len);
-	soup_server_message_unpause(msg);
+	g_autoptr(GByteArray) buf = g_byte_array_new();
+
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		g_autoptr(GBytes) blob = passim_server_chunk_load(chunk, error);
+		if (blob == NULL)
+			return NULL;
+		g_byte_array_append(buf, g_bytes_get_data(blob, NULL), g_bytes_get_size(blob));
+	}
+	return g_byte_array_free_to_bytes(g_steal_pointer(&buf));
 }
 
-static void
-passim_server_context_send_redirect(PassimServerContext *ctx, const gchar *location)
+/* chunks already in the store are not written again */
+static gboolean
+passim_server_chunks_write(PassimServer *self, GBytes *blob, GPtrArray *chunks, GError **error)
 {
-	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(ctx->msg);
-	g_autoptr(GString) html = g_string_new(NULL);
-	g_autofree gchar *uri =
-	    g_strdup_printf("https://%s/%s?sha256=%s", location, ctx->basename, ctx->hash);
-	g_string_append_printf(html,
-			       "<html><body><a href=\"%s\">Redirecting</a>...</body></html>",
-			       uri);
-	soup_message_headers_append(hdrs, "Location", uri);
-	soup_server_message_set_status(ctx->msg, SOUP_STATUS_MOVED_TEMPORARILY, NULL);
-	soup_server_message_set_response(ctx->msg,
-					 "text/html",
-					 SOUP_MEMORY_COPY,
-					 html->str,
-					 html->len);
-	soup_server_message_unpause(ctx->msg);
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		g_autofree gchar *fn = NULL;
+		g_autoptr(GBytes) blob_chunk = NULL;
+
+		if (g_hash_table_contains(self->chunks, chunk->checksum))
+			continue;
+		fn = passim_server_chunk_filename(chunk->checksum);
+		if (g_file_test(fn, G_FILE_TEST_EXISTS))
+			continue;
+		if (!passim_mkdir_parent(fn, error))
+			return FALSE;
+		blob_chunk = g_bytes_new_from_bytes(blob, chunk->offset, chunk->size);
+		if (!passim_file_set_contents(fn, blob_chunk, error))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 static void
-passim_server_send_index(PassimServer *self, SoupServerMessage *msg)
+passim_server_chunks_ref(PassimServer *self, const gchar *hash, GPtrArray *chunks)
 {
-	g_autoptr(GString) html = g_string_new(NULL);
-	g_autoptr(GList) keys = g_hash_table_get_keys(self->items);
-
-	g_string_append(html, "<html>\n");
-	g_string_append(html, "<head>\n");
-	g_string_append(html, "<meta charset=\"utf-8\" />\n");
-	g_string_append(
-	    html,
-	    "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\" />\n");
-	g_string_append_printf(html, "<title>%s</title>\n", passim_avahi_get_name(self->avahi));
-	g_string_append(html, "<link href=\"style.css\" rel=\"stylesheet\" />\n");
-	g_string_append(html, "</head>");
-	g_string_append(html, "<body>");
-	g_string_append_printf(html, "<h1>%s</h1>\n", passim_avahi_get_name(self->avahi));
-	g_string_append_printf(
-	    html,
-	    "<p>A <a href=\"https://github.com/hughsie/%s\">local caching server</a>, "
-	    "version <code>%s</code> with status <code>%s</code>.</p>\n",
-	    PACKAGE_NAME,
-	    VERSION,
-	    passim_status_to_string(self->status));
-	if (keys == NULL) {
-		g_string_append(html, "<em>There are no shared files on this computer.</em>\n");
-	} else {
-		g_string_append(html, "<h2>Shared Files:</h2>\n");
-		g_string_append(html, "<table>\n");
-		g_string_append(html, "<tr>\n");
-		g_string_append(html, "<th>Filename</th>\n");
-		g_string_append(html, "<th>Hash</th>\n");
-		g_string_append(html, "<th>Binary</th>\n");
-		g_string_append(html, "<th>Age</th>\n");
-		g_string_append(html, "<th>Shared</th>\n");
-		g_string_append(html, "<th>Size</th>\n");
-		g_string_append(html, "<th>Flags</th>\n");
-		g_string_append(html, "</tr>\n");
-		for (GList *l = keys; l != NULL; l = l->next) {
-			const gchar *hash = l->data;
-			PassimItem *item = g_hash_table_lookup(self->items, hash);
-			g_autofree gchar *flags = passim_item_get_flags_as_string(item);
-			g_autofree gchar *url = g_strdup_printf("https://localhost:%u/%s?sha256=%s",
-								self->port,
-								passim_item_get_basename(item),
-								hash);
-			g_string_append(html, "<tr>\n");
-			g_string_append_printf(html,
-					       "<td><a href=\"%s\">%s</a></td>\n",
-					       url,
-					       passim_item_get_basename(item));
-			g_string_append_printf(html,
-					       "<td><code>%s</code></td>\n",
-					       passim_item_get_hash(item));
-			if (passim_item_get_cmdline(item) == NULL) {
-				g_string_append_printf(html, "<td><code>n/a</code></td>\n");
-			} else {
-				g_string_append_printf(html,
-						       "<td><code>%s</code></td>\n",
-						       passim_item_get_cmdline(item));
-			}
-			if (passim_item_get_max_age(item) == G_MAXUINT32) {
-				g_string_append_printf(html,
-						       "<td>%u/∞h</td>\n",
-						       passim_item_get_age(item) / 3600u);
-			} else {
-				g_string_append_printf(html,
-						       "<td>%u/%uh</td>\n",
-						       passim_item_get_age(item) / 3600u,
-						       passim_item_get_max_age(item) / 3600u);
-			}
-			if (passim_item_get_share_limit(item) == G_MAXUINT32) {
-				g_string_append_printf(html,
-						       "<td>%u/∞</td>\n",
-						       passim_item_get_share_count(item));
-			} else {
-				g_string_append_printf(html,
-						       "<td>%u/%u</td>\n",
-						       passim_item_get_share_count(item),
-						       passim_item_get_share_limit(item));
-			}
-			if (passim_item_get_size(item) == 0) {
-				g_string_append(html, "<td>?</td>\n");
-			} else {
-				g_autofree gchar *size = g_format_size(passim_item_get_size(item));
-				g_string_append_printf(html, "<td>%s</td>\n", size);
-			}
-			g_string_append_printf(html, "<td><code>%s</code></td>\n", flags);
-			g_string_append(html, "</tr>");
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		PassimServerChunk *chunk_srv = g_hash_table_lookup(self->chunks, chunk->checksum);
+		if (chunk_srv == NULL) {
+			chunk_srv = g_new0(PassimServerChunk, 1);
+			chunk_srv->size = chunk->size;
+			g_hash_table_insert(self->chunks, g_strdup(chunk->checksum), chunk_srv);
 		}
-		g_string_append(html, "</table>\n");
+		chunk_srv->refcount++;
 	}
-	g_string_append(html, "</body>\n");
-	g_string_append(html, "</html>\n");
-	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
-	soup_server_message_set_response(msg, "text/html", SOUP_MEMORY_COPY, html->str, html->len);
+	g_hash_table_insert(self->chunked, g_strdup(hash), g_ptr_array_ref(chunks));
 }
 
+/* chunks only used by this item are deleted */
 static void
-passim_server_msg_send_file(PassimServer *self, SoupServerMessage *msg, const gchar *path)
+passim_server_chunks_unref(PassimServer *self, const gchar *hash)
 {
-	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
-	GMappedFile *mapping;
-	g_autoptr(GBytes) bytes = NULL;
-	g_autoptr(GError) error = NULL;
-	g_autoptr(GFile) file = g_file_new_for_path(path);
-	g_autoptr(GFileInfo) info = NULL;
+	GPtrArray *chunks = g_hash_table_lookup(self->chunked, hash);
 
-	mapping = g_mapped_file_new(path, FALSE, &error);
-	if (mapping == NULL) {
-		soup_server_message_set_status(msg,
-					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
-					       error->message);
+	if (chunks == NULL)
 		return;
-	}
-	bytes = g_bytes_new_with_free_func(g_mapped_file_get_contents(mapping),
-					   g_mapped_file_get_length(mapping),
-					   (GDestroyNotify)g_mapped_file_unref,
-					   mapping);
-	if (g_bytes_get_size(bytes) > 0)
-		soup_message_body_append_bytes(soup_server_message_get_response_body(msg), bytes);
-	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		PassimServerChunk *chunk_srv = g_hash_table_lookup(self->chunks, chunk->checksum);
+		g_autofree gchar *fn = NULL;
 
-	info = g_file_query_info(file,
-				 G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
-				 G_FILE_QUERY_INFO_NONE,
-				 NULL,
-				 &error);
-	if (info == NULL) {
-		soup_server_message_set_status(msg,
-					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
-					       error->message);
-		return;
-	}
-	if (g_file_info_get_content_type(info) != NULL) {
-		g_autofree gchar *mime_type =
-		    g_content_type_get_mime_type(g_file_info_get_content_type(info));
-		if (mime_type != NULL)
-			soup_message_headers_append(hdrs, "Content-Type", mime_type);
+		if (chunk_srv == NULL || --chunk_srv->refcount > 0)
+			continue;
+		fn = passim_server_chunk_filename(chunk->checksum);
+		if (g_unlink(fn) != 0 && errno != ENOENT)
+			g_warning("failed to delete %s: %s", fn, g_strerror(errno));
+		g_hash_table_remove(self->chunks, chunk->checksum);
 	}
+	g_hash_table_remove(self->chunked, hash);
 }
 
+/* left behind if the daemon was stopped while publishing */
 static gboolean
-passim_server_delete_item(PassimServer *self, PassimItem *item, GError **error)
+passim_server_chunks_prune(PassimServer *self, GError **error)
 {
-	if (!g_file_delete(passim_item_get_file(item), NULL, error)) {
-		g_prefix_error(error, "failed to delete %s: ", passim_item_get_hash(item));
-		return FALSE;
-	}
-	g_hash_table_remove(self->items, passim_item_get_hash(item));
-	if (!passim_server_avahi_register(self, error)) {
-		g_prefix_error(error, "failed to register: ");
+	const gchar *prefix;
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	g_autofree gchar *path =
+	    g_build_filename(localstatedir, "lib", PACKAGE_NAME, "chunks", NULL);
+	g_autoptr(GDir) dir = NULL;
+
+	if (!g_file_test(path, G_FILE_TEST_IS_DIR))
+		return TRUE;
+	dir = g_dir_open(path, 0, error);
+	if (dir == NULL)
 		return FALSE;
+	while ((prefix = g_dir_read_name(dir)) != NULL) {
+		const gchar *fn;
+		g_autofree gchar *path_prefix = g_build_filename(path, prefix, NULL);
+		g_autoptr(GDir) dir_prefix = g_dir_open(path_prefix, 0, error);
+		if (dir_prefix == NULL)
+			return FALSE;
+		while ((fn = g_dir_read_name(dir_prefix)) != NULL) {
+			g_autofree gchar *path_chunk = NULL;
+			if (g_hash_table_contains(self->chunks, fn))
+				continue;
+			path_chunk = g_build_filename(path_prefix, fn, NULL);
+			g_debug("deleting unused chunk %s", path_chunk);
+			if (g_unlink(path_chunk) != 0)
+				g_warning("failed to delete %s: %s", path_chunk, g_strerror(errno));
+		}
 	}
 	return TRUE;
 }
 
+/* the old item does not have to still be published, as clients may still have it */
 static void
-passim_server_msg_send_item(PassimServer *self, SoupServerMessage *msg, PassimItem *item)
+passim_server_deltas_load(PassimServer *self, const gchar *hash)
 {
-	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
-	g_autofree gchar *content_disposition = NULL;
-	g_autofree gchar *filename = NULL;
-	g_autofree gchar *path = g_file_get_path(passim_item_get_file(item));
+	GStatBuf st = {0};
+	PassimServerDelta *delta;
+	g_autofree gchar *fn = passim_server_delta_filename(hash);
+	g_autofree gchar *hash_old = NULL;
 
-	filename = g_uri_escape_string(passim_item_get_basename(item), NULL, TRUE);
-	content_disposition = g_strdup_printf("attachment; filename=\"%s\"", filename);
-	soup_message_headers_append(hdrs, "Content-Disposition", content_disposition);
+	if (g_stat(fn, &st) != 0)
+		return;
+	hash_old = passim_xattr_get_string(fn, "user.delta_from", NULL);
+	if (hash_old == NULL || hash_old[0] == '\0')
+		return;
+	delta = g_new0(PassimServerDelta, 1);
+	delta->hash_old = g_steal_pointer(&hash_old);
+	delta->size = st.st_size;
+	g_hash_table_insert(self->deltas, g_strdup(hash), delta);
+}
+
+static void
+passim_server_deltas_delete(PassimServer *self, const gchar *hash)
+{
+	g_autofree gchar *fn = passim_server_delta_filename(hash);
+	if (g_unlink(fn) != 0 && errno != ENOENT)
+		g_warning("failed to delete %s: %s", fn, g_strerror(errno));
+	g_hash_table_remove(self->deltas, hash);
+}
+
+typedef struct {
+	gchar *hash;
+	gchar *hash_old;
+	gchar *filename_old;
+	gboolean at_rest_old;  /* stored as zstd */
+	GPtrArray *chunks_old; /* nullable, of PassimChunk */
+	GBytes *blob;
+	guint64 size;
+} PassimServerDeltaHelper;
+
+static void
+passim_server_delta_helper_free(PassimServerDeltaHelper *helper)
+{
+	if (helper->chunks_old != NULL)
+		g_ptr_array_unref(helper->chunks_old);
+	g_bytes_unref(helper->blob);
+	g_free(helper->hash);
+	g_free(helper->hash_old);
+	g_free(helper->filename_old);
+	g_free(helper);
+}
+
+static void
+passim_server_delta_thread_cb(GTask *task,
+			      gpointer source_object,
+			      gpointer task_data,
+			      GCancellable *cancellable)
+{
+	PassimServerDeltaHelper *helper = (PassimServerDeltaHelper *)task_data;
+	g_autofree gchar *fn = passim_server_delta_filename(helper->hash);
+	g_autoptr(GBytes) blob_old = NULL;
+	g_autoptr(GBytes) patch = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GMappedFile) mapping = NULL;
 
-	passim_server_msg_send_file(self, msg, path);
-	passim_item_set_share_count(item, passim_item_get_share_count(item) + 1);
+	/* the chunk files are never modified, only deleted */
+	if (helper->chunks_old != NULL) {
+		blob_old = passim_server_chunks_load(helper->chunks_old, &error);
+		if (blob_old == NULL) {
+			g_task_return_error(task, g_steal_pointer(&error));
+			return;
+		}
+	} else {
+		mapping = g_mapped_file_new(helper->filename_old, FALSE, &error);
+		if (mapping == NULL) {
+			g_task_return_error(task, g_steal_pointer(&error));
+			return;
+		}
+		blob_old = g_mapped_file_get_bytes(mapping);
+	}
+	if (helper->at_rest_old) {
+		g_autoptr(GBytes) blob_tmp =
+		    passim_decompress_bytes(blob_old, PASSIM_ENCODING_ZSTD, G_MAXSIZE, &error);
+		if (blob_tmp == NULL) {
+			g_task_return_error(task, g_steal_pointer(&error));
+			return;
+		}
+		g_bytes_unref(blob_old);
+		blob_old = g_steal_pointer(&blob_tmp);
+	}
+	patch = passim_delta_create(blob_old, helper->blob, &error);
+	if (patch == NULL) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+
+	/* not worth the extra disk space */
+	helper->size = g_bytes_get_size(patch);
+	if (helper->size * 10 >= g_bytes_get_size(helper->blob) * 9) {
+		g_debug("not keeping delta from %s to %s as %" G_GUINT64_FORMAT " bytes",
+			helper->hash_old,
+			helper->hash,
+			helper->size);
+		helper->size = 0;
+		g_task_return_boolean(task, TRUE);
+		return;
+	}
+	if (!passim_mkdir_parent(fn, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	if (!passim_file_set_contents(fn, patch, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	if (!passim_xattr_set_string(fn, "user.delta_from", helper->hash_old, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	g_task_return_boolean(task, TRUE);
+}
+
+static void
+passim_server_delta_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	PassimServerDeltaHelper *helper = g_task_get_task_data(G_TASK(res));
+	PassimServerDelta *delta;
+	g_autoptr(GError) error = NULL;
+
+	if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+		g_warning("failed to create delta for %s: %s", helper->hash, error->message);
+		passim_server_deltas_delete(self, helper->hash);
+		return;
+	}
+	if (helper->size == 0)
+		return;
+
+	/* unpublished while we were diffing */
+	if (!g_hash_table_contains(self->items, helper->hash)) {
+		passim_server_deltas_delete(self, helper->hash);
+		return;
+	}
+	g_debug("added delta from %s to %s: %" G_GUINT64_FORMAT " bytes",
+		helper->hash_old,
+		helper->hash,
+		helper->size);
+	delta = g_new0(PassimServerDelta, 1);
+	delta->hash_old = g_strdup(helper->hash_old);
+	delta->size = helper->size;
+	g_hash_table_insert(self->deltas, g_strdup(helper->hash), delta);
+}
+
+/* the most recently published other version of the same file from the same publisher */
+static PassimItem *
+passim_server_delta_find_source(PassimServer *self, PassimItem *item)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GDateTime *ctime_old = NULL;
+	PassimItem *item_old = NULL;
+	const gchar *basename = passim_item_get_basename(item);
+	const gchar *cmdline = passim_item_get_cmdline(item);
+
+	g_hash_table_iter_init(&iter, self->items);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		PassimItem *item_tmp = PASSIM_ITEM(value);
+		GDateTime *ctime = passim_item_get_ctime(item_tmp);
+
+		if (item_tmp == item || passim_item_get_file(item_tmp) == NULL)
+			continue;
+		if (g_strcmp0(passim_item_get_hash(item_tmp), passim_item_get_hash(item)) == 0)
+			continue;
+		if (g_strcmp0(passim_item_get_basename(item_tmp), basename) != 0)
+			continue;
+		if (g_strcmp0(passim_item_get_cmdline(item_tmp), cmdline) != 0)
+			continue;
+		if (item_old != NULL && ctime_old != NULL &&
+		    (ctime == NULL || g_date_time_compare(ctime, ctime_old) <= 0))
+			continue;
+		item_old = item_tmp;
+		ctime_old = ctime;
+	}
+	return item_old;
+}
+
+/* the item is sent in full until the delta has been written */
+static void
+passim_server_delta_async(PassimServer *self, PassimItem *item, GBytes *blob)
+{
+	PassimItem *item_old = passim_server_delta_find_source(self, item);
+	PassimServerDeltaHelper *helper;
+	g_autoptr(GTask) task = NULL;
+
+	if (item_old == NULL)
+		return;
+	helper = g_new0(PassimServerDeltaHelper, 1);
+	helper->hash = g_strdup(passim_item_get_hash(item));
+	helper->hash_old = g_strdup(passim_item_get_hash(item_old));
+	helper->filename_old = g_file_get_path(passim_item_get_file(item_old));
+	helper->at_rest_old = g_hash_table_contains(self->stored, helper->hash_old);
+	helper->chunks_old = g_hash_table_lookup(self->chunked, helper->hash_old);
+	if (helper->chunks_old != NULL)
+		g_ptr_array_ref(helper->chunks_old);
+	helper->blob = g_bytes_ref(blob);
+	task = g_task_new(NULL, NULL, passim_server_delta_cb, self);
+	g_task_set_task_data(task, helper, (GDestroyNotify)passim_server_delta_helper_free);
+	g_task_run_in_thread(task, passim_server_delta_thread_cb);
+}
+
+/* the hash if not already set and the digests in @mask are computed in the same pass */
+static gboolean
+passim_item_load_bytes_nofollow(PassimItem *item,
+				const gchar *filename,
+				guint mask,
+				PassimDigests **digests,
+				GError **error)
+{
+	gint fd;
+	gint64 start_time;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GInputStream) istream = NULL;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+
+	/* load bytes from the fd to avoid TOCTOU */
+	fd = g_open(filename, O_NOFOLLOW, S_IRUSR);
+	if (fd < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_PERMISSION_DENIED,
+			    "skipping symlink %s",
+			    filename);
+		return FALSE;
+	}
+	istream = g_unix_input_stream_new(fd, TRUE);
+	if (istream == NULL) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "no stream to read from %s",
+			    filename);
+		return FALSE;
+	}
+	mapped_file = g_mapped_file_new_from_fd(fd, FALSE, error);
+	if (mapped_file == NULL)
+		return FALSE;
+	bytes = g_mapped_file_get_bytes(mapped_file);
+
+	start_time = g_get_monotonic_time();
+	if (passim_item_get_hash(item) == NULL)
+		mask |= 1u << PASSIM_DIGEST_KIND_SHA256;
+	if (mask != 0) {
+		g_autoptr(PassimDigests) digests_new = passim_digests_new(bytes, mask);
+		if (digests_new->values[PASSIM_DIGEST_KIND_SHA256] != NULL)
+			passim_item_set_hash(item, digests_new->values[PASSIM_DIGEST_KIND_SHA256]);
+		if (digests != NULL)
+			*digests = g_steal_pointer(&digests_new);
+	}
+	passim_item_set_bytes(item, bytes);
+	PASSIM_TRACE2(hash, g_bytes_get_size(bytes), g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "hash", filename);
+	return TRUE;
+}
+
+/* the item size is of the uncompressed contents */
+static gboolean
+passim_server_stored_load(PassimServerStored *stored,
+			  PassimItem *item,
+			  const gchar *filename,
+			  GError **error)
+{
+	guint64 size = 0;
+	guint32 value;
+	g_autofree gchar *size_str = NULL;
+
+	size_str = passim_xattr_get_string(filename, "user.size", error);
+	if (size_str == NULL)
+		return FALSE;
+	if (!g_ascii_string_to_unsigned(size_str, 10, 0, G_MAXUINT64, &size, error)) {
+		g_prefix_error(error, "invalid user.size for %s: ", filename);
+		return FALSE;
+	}
+	value = passim_xattr_get_uint32(filename, "user.compress_us", 0, error);
+	if (value == G_MAXUINT32)
+		return FALSE;
+	stored->size = passim_item_get_size(item);
+	stored->compress_us = value;
+	passim_item_set_size(item, size);
+	return TRUE;
+}
+
+/* the item hash is always computed, and extra digests that are not supported are ignored */
+static gboolean
+passim_server_digests_setup(PassimServer *self, GError **error)
+{
+	g_auto(GStrv) kinds = passim_config_get_digests(self->kf);
+
+	self->digests_mask = 1u << PASSIM_DIGEST_KIND_SHA256;
+	for (guint i = 0; kinds != NULL && kinds[i] != NULL; i++) {
+		PassimDigestKind kind = passim_digest_kind_from_string(kinds[i]);
+		if (kinds[i][0] == '\0')
+			continue;
+		if (kind == PASSIM_DIGEST_KIND_LAST) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_ARGUMENT,
+				    "unknown digest %s, expected blake3, sha1, sha384 or sha512",
+				    kinds[i]);
+			return FALSE;
+		}
+		if (!passim_digest_kind_is_supported(kind)) {
+			g_info("ignoring %s digest as not supported", kinds[i]);
+			continue;
+		}
+		self->digests_mask |= 1u << kind;
+	}
+	return TRUE;
+}
+
+static void
+passim_server_digests_add(PassimServer *self, const gchar *hash, PassimDigests *digests)
+{
+	for (guint i = PASSIM_DIGEST_KIND_SHA256 + 1; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		if (digests->values[i] == NULL)
+			continue;
+		g_hash_table_insert(self->aliases,
+				    passim_digest_build_key(i, digests->values[i]),
+				    g_strdup(hash));
+	}
+	g_hash_table_insert(self->digests, g_strdup(hash), digests);
+}
+
+static void
+passim_server_digests_remove(PassimServer *self, const gchar *hash)
+{
+	PassimDigests *digests = g_hash_table_lookup(self->digests, hash);
+
+	if (digests == NULL)
+		return;
+	for (guint i = PASSIM_DIGEST_KIND_SHA256 + 1; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		g_autofree gchar *key = NULL;
+		if (digests->values[i] == NULL)
+			continue;
+		key = passim_digest_build_key(i, digests->values[i]);
+		g_hash_table_remove(self->aliases, key);
+	}
+	g_hash_table_remove(self->digests, hash);
+}
+
+static gchar *
+passim_server_digest_xattr_name(PassimDigestKind kind)
+{
+	return g_strdup_printf("user.checksum.%s", passim_digest_kind_to_string(kind));
+}
+
+/* the saved digests, where @mask is set to the ones that are missing */
+static PassimDigests *
+passim_server_digests_read(PassimServer *self, const gchar *filename, guint *mask)
+{
+	PassimDigests *digests = g_new0(PassimDigests, 1);
+
+	*mask = 0;
+	for (guint i = PASSIM_DIGEST_KIND_SHA256 + 1; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		g_autofree gchar *name = NULL;
+		g_autofree gchar *value = NULL;
+		if ((self->digests_mask & (1u << i)) == 0)
+			continue;
+		name = passim_server_digest_xattr_name(i);
+		value = passim_xattr_get_string(filename, name, NULL);
+		if (passim_digest_kind_is_valid(i, value)) {
+			digests->values[i] = g_steal_pointer(&value);
+			continue;
+		}
+		*mask |= 1u << i;
+	}
+	return digests;
+}
+
+/*
+ * takes @digests, and any missing ones computed when the item was hashed are saved -- which is
+ * not possible for items stored compressed or in the chunk store
+ */
+static void
+passim_server_digests_load(PassimServer *self,
+			   const gchar *hash,
+			   const gchar *filename,
+			   PassimDigests *digests,
+			   PassimDigests *digests_new)
+{
+	for (guint i = PASSIM_DIGEST_KIND_SHA256 + 1; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		g_autofree gchar *name = NULL;
+		g_autoptr(GError) error_local = NULL;
+		if (digests_new == NULL || digests_new->values[i] == NULL ||
+		    digests->values[i] != NULL)
+			continue;
+		name = passim_server_digest_xattr_name(i);
+		if (!passim_xattr_set_string(filename, name, digests_new->values[i], &error_local))
+			g_debug("failed to save %s: %s", name, error_local->message);
+		digests->values[i] = g_steal_pointer(&digests_new->values[i]);
+	}
+	passim_server_digests_add(self, hash, digests);
+}
+
+/* the item size is the total of the chunks, which must all still exist */
+static GPtrArray *
+passim_server_chunked_load(PassimItem *item, const gchar *filename, GError **error)
+{
+	GBytes *blob = passim_item_get_bytes(item);
+	guint64 size = 0;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GPtrArray) chunks = NULL;
+
+	str = g_strndup(g_bytes_get_data(blob, NULL), g_bytes_get_size(blob));
+	chunks = passim_chunk_list_from_string(str, error);
+	if (chunks == NULL) {
+		g_prefix_error(error, "invalid chunk list %s: ", filename);
+		return NULL;
+	}
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		g_autofree gchar *fn = passim_server_chunk_filename(chunk->checksum);
+		if (!g_file_test(fn, G_FILE_TEST_EXISTS)) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_NOT_FOUND,
+				    "%s requires missing chunk %s",
+				    filename,
+				    chunk->checksum);
+			return NULL;
+		}
+		size += chunk->size;
+	}
+	passim_item_set_size(item, size);
+	return g_steal_pointer(&chunks);
+}
+
+/* only when changed, as items from the package dirs may be read-only */
+static void
+passim_server_item_save_counters(PassimServer *self, PassimItem *item)
+{
+	GDateTime *atime = passim_item_get_atime(item);
+	guint64 served_size = passim_item_get_served_size(item);
+	guint64 *served_size_saved = g_hash_table_lookup(self->saved, passim_item_get_hash(item));
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *served_size_str = NULL;
+	g_autoptr(GError) error = NULL;
+
+	if (served_size_saved != NULL ? *served_size_saved == served_size : served_size == 0)
+		return;
+	g_hash_table_insert(self->saved,
+			    g_strdup(passim_item_get_hash(item)),
+			    g_memdup2(&served_size, sizeof(served_size)));
+	if (passim_item_get_file(item) == NULL)
+		return;
+	filename = g_file_get_path(passim_item_get_file(item));
+	served_size_str = g_strdup_printf("%" G_GUINT64_FORMAT, served_size);
+	if (!passim_xattr_replace_string(filename, "user.served_size", served_size_str, &error)) {
+		g_debug("not saving served size: %s", error->message);
+		return;
+	}
+	if (atime != NULL) {
+		g_autofree gchar *atime_str =
+		    g_strdup_printf("%" G_GINT64_FORMAT, g_date_time_to_unix(atime));
+		if (!passim_xattr_replace_string(filename, "user.atime", atime_str, &error))
+			g_debug("not saving access time: %s", error->message);
+	}
+}
+
+static void
+passim_server_save_counters(PassimServer *self)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	if (self->items == NULL)
+		return;
+	g_hash_table_iter_init(&iter, self->items);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		passim_server_item_save_counters(self, PASSIM_ITEM(value));
+}
+
+static gboolean
+passim_server_save_counters_cb(gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	passim_server_save_counters(self);
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+passim_server_libdir_add(PassimServer *self, const gchar *filename, GError **error)
+{
+	guint32 value;
+	gboolean at_rest;
+	gboolean is_chunked;
+	PassimServerStored stored = {0};
+	g_autofree gchar *basename = g_path_get_basename(filename);
+	g_autofree gchar *atime = NULL;
+	g_autofree gchar *boot_time = NULL;
+	g_autofree gchar *cmdline = NULL;
+	g_autofree gchar *encoding = NULL;
+	g_autofree gchar *etag = NULL;
+	g_autofree gchar *served_size = NULL;
+	g_autofree gchar *uri = NULL;
+	g_auto(GStrv) split = g_strsplit(basename, "-", 2);
+	guint mask = 0;
+	g_autoptr(GPtrArray) chunks = NULL;
+	g_autoptr(PassimDigests) digests = NULL;
+	g_autoptr(PassimDigests) digests_new = NULL;
+	g_autoptr(PassimItem) item = passim_item_new();
+
+	/* this doesn't have to be a sha256 hash, but it has to be *something* */
+	if (g_strv_length(split) != 2) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_FILENAME,
+			    "expected {hash}-{filename} and got %s",
+			    basename);
+		return FALSE;
+	}
+
+	/* the contents are compressed, so trust the hash in the filename */
+	encoding = passim_xattr_get_string(filename, "user.encoding", error);
+	if (encoding == NULL)
+		return FALSE;
+	at_rest = g_strcmp0(encoding, passim_encoding_to_string(PASSIM_ENCODING_ZSTD)) == 0;
+	if (at_rest && !passim_encoding_is_supported(PASSIM_ENCODING_ZSTD)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_NOT_SUPPORTED,
+			    "%s is compressed but zstd is not supported",
+			    basename);
+		return FALSE;
+	}
+	is_chunked = g_strcmp0(encoding, "chunks") == 0;
+	digests = passim_server_digests_read(self, filename, &mask);
+	if (at_rest || is_chunked) {
+		passim_item_set_hash(item, split[0]);
+		mask = 0;
+	}
+
+	/* create new item */
+	passim_item_set_basename(item, split[1]);
+	if (!passim_item_load_bytes_nofollow(item, filename, mask, &digests_new, error))
+		return FALSE;
+	if (!passim_item_load_filename(item, filename, error))
+		return FALSE;
+	if (at_rest && !passim_server_stored_load(&stored, item, filename, error))
+		return FALSE;
+	if (is_chunked) {
+		chunks = passim_server_chunked_load(item, filename, error);
+		if (chunks == NULL)
+			return FALSE;
+	}
+
+	/* not required now */
+	passim_item_set_bytes(item, NULL);
+
+	/* get optional attributes */
+	value = passim_xattr_get_uint32(filename, "user.max_age", 24 * 60 * 60, error);
+	if (value == G_MAXUINT32)
+		return FALSE;
+	passim_item_set_max_age(item, value);
+	value = passim_xattr_get_uint32(filename, "user.share_limit", 5, error);
+	if (value == G_MAXUINT32)
+		return FALSE;
+	passim_item_set_share_limit(item, value);
+	value = passim_xattr_get_uint32(filename, "user.share_limit_effective", 0, error);
+	if (value == G_MAXUINT32)
+		return FALSE;
+	if (passim_config_get_adaptive_share_limit(self->kf))
+		passim_item_set_share_limit_effective(item, value);
+	cmdline = passim_xattr_get_string(filename, "user.cmdline", error);
+	if (cmdline == NULL)
+		return FALSE;
+	passim_item_set_cmdline(item, cmdline);
+	uri = passim_xattr_get_string(filename, "user.uri", NULL);
+	if (uri != NULL && uri[0] != '\0')
+		passim_item_set_uri(item, uri);
+	etag = passim_xattr_get_string(filename, "user.etag", NULL);
+	if (etag != NULL && etag[0] != '\0')
+		passim_item_set_etag(item, etag);
+	value = passim_xattr_get_uint32(filename, "user.replicating", 0, error);
+	if (value == G_MAXUINT32)
+		return FALSE;
+	if (value > 0 && passim_config_get_replication_target(self->kf) > 0)
+		passim_item_add_flag(item, PASSIM_ITEM_FLAG_REPLICATING);
+	served_size = passim_xattr_get_string(filename, "user.served_size", NULL);
+	if (served_size != NULL && served_size[0] != '\0') {
+		guint64 served_size_tmp = g_ascii_strtoull(served_size, NULL, 10);
+		passim_item_set_served_size(item, served_size_tmp);
+		g_hash_table_insert(self->saved,
+				    g_strdup(passim_item_get_hash(item)),
+				    g_memdup2(&served_size_tmp, sizeof(served_size_tmp)));
+	}
+	atime = passim_xattr_get_string(filename, "user.atime", NULL);
+	if (atime != NULL && atime[0] != '\0') {
+		g_autoptr(GDateTime) dt =
+		    g_date_time_new_from_unix_utc(g_ascii_strtoll(atime, NULL, 10));
+		passim_item_set_atime(item, dt);
+	}
+
+	/* only allowed when rebooted */
+	boot_time = passim_xattr_get_string(filename, "user.boot_time", NULL);
+	if (boot_time != NULL) {
+		g_autofree gchar *boot_time_now = passim_get_boot_time();
+		if (g_strcmp0(boot_time_now, boot_time) == 0) {
+			passim_item_add_flag(item, PASSIM_ITEM_FLAG_NEXT_REBOOT);
+			passim_item_add_flag(item, PASSIM_ITEM_FLAG_DISABLED);
+		}
+	}
+	if (!passim_server_add_item(self, item, error))
+		return FALSE;
+	if (at_rest) {
+		g_hash_table_insert(self->stored,
+				    g_strdup(passim_item_get_hash(item)),
+				    g_memdup2(&stored, sizeof(PassimServerStored)));
+	}
+	if (chunks != NULL)
+		passim_server_chunks_ref(self, passim_item_get_hash(item), chunks);
+	passim_server_digests_load(self,
+				   passim_item_get_hash(item),
+				   filename,
+				   g_steal_pointer(&digests),
+				   digests_new);
+	passim_server_variants_load(self, passim_item_get_hash(item));
+	passim_server_deltas_load(self, passim_item_get_hash(item));
+	return TRUE;
+}
+
+static gboolean
+passim_server_libdir_scan(PassimServer *self, GError **error)
+{
+	g_autoptr(GDir) dir = NULL;
+	const gchar *fn;
+
+	/* sanity check */
+	if (!g_file_test(self->root, G_FILE_TEST_EXISTS)) {
+		g_debug("not loading resources from %s as it does not exist", self->root);
+		return TRUE;
+	}
+
+	g_debug("loading resources from %s", self->root);
+	dir = g_dir_open(self->root, 0, error);
+	if (dir == NULL)
+		return FALSE;
+	while ((fn = g_dir_read_name(dir)) != NULL) {
+		g_autofree gchar *path = g_build_filename(self->root, fn, NULL);
+		if (!passim_server_libdir_add(self, path, error))
+			return FALSE;
+	}
+	if (!passim_server_chunks_prune(self, error))
+		return FALSE;
+	if (!passim_server_partials_prune("partial", error))
+		return FALSE;
+	if (!passim_server_partials_prune("compress", error))
+		return FALSE;
+	passim_server_engine_changed(self);
+	return TRUE;
+}
+
+static gboolean
+passim_server_sysconfpkgdir_add(PassimServer *self, const gchar *filename, GError **error)
+{
+	guint mask = 0;
+	g_autofree gchar *hash = NULL;
+	g_autoptr(PassimDigests) digests = NULL;
+	g_autoptr(PassimDigests) digests_new = NULL;
+	g_autoptr(PassimItem) item = passim_item_new();
+
+	/* get optional attributes */
+	hash = passim_xattr_get_string(filename, "user.checksum.sha256", NULL);
+	if (hash != NULL && g_strcmp0(hash, "") != 0)
+		passim_item_set_hash(item, hash);
+	digests = passim_server_digests_read(self, filename, &mask);
+	if (!passim_item_load_bytes_nofollow(item, filename, mask, &digests_new, error))
+		return FALSE;
+	if (!passim_item_load_filename(item, filename, error))
+		return FALSE;
+
+	/* not required now */
+	passim_item_set_bytes(item, NULL);
+
+	/* never delete these */
+	passim_item_set_max_age(item, G_MAXUINT32);
+	passim_item_set_share_limit(item, G_MAXUINT32);
+
+	/* save this for next time */
+	if (hash == NULL || g_strcmp0(hash, "") == 0) {
+		passim_xattr_set_string(filename,
+					"user.checksum.sha256",
+					passim_item_get_hash(item),
+					NULL);
+	}
+	if (!passim_server_add_item(self, item, error))
+		return FALSE;
+	passim_server_digests_load(self,
+				   passim_item_get_hash(item),
+				   filename,
+				   g_steal_pointer(&digests),
+				   digests_new);
+	return TRUE;
+}
+
+static gboolean
+passim_server_sysconfpkgdir_scan_path(PassimServer *self, const gchar *path, GError **error)
+{
+	g_autoptr(GDir) dir = NULL;
+	const gchar *fn;
+
+	/* sanity check */
+	if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+		g_debug("not loading resources from %s as it does not exist", path);
+		return TRUE;
+	}
+
+	g_debug("scanning %s", path);
+	dir = g_dir_open(path, 0, error);
+	if (dir == NULL)
+		return FALSE;
+	while ((fn = g_dir_read_name(dir)) != NULL) {
+		g_autofree gchar *fn_tmp = g_build_filename(path, fn, NULL);
+		g_autoptr(GError) error_local = NULL;
+		if (!passim_server_sysconfpkgdir_add(self, fn_tmp, &error_local)) {
+			if (g_error_matches(error_local,
+					    G_IO_ERROR,
+					    G_IO_ERROR_PERMISSION_DENIED)) {
+				g_info("skipping %s as EPERM", fn_tmp);
+				continue;
+			}
+			g_propagate_error(error, g_steal_pointer(&error_local));
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static gboolean
+passim_server_sysconfpkgdir_scan_keyfile(PassimServer *self, const gchar *filename, GError **error)
+{
+	g_autofree gchar *path = NULL;
+	g_autoptr(GKeyFile) kf = g_key_file_new();
+
+	if (!g_key_file_load_from_file(kf, filename, G_KEY_FILE_NONE, error))
+		return FALSE;
+	path = g_key_file_get_string(kf, "passim", "Path", error);
+	if (path == NULL)
+		return FALSE;
+	return passim_server_sysconfpkgdir_scan_path(self, path, error);
+}
+
+static gboolean
+passim_server_sysconfpkgdir_scan(PassimServer *self, GError **error);
+
+static gboolean
+passim_server_sysconfpkgdir_timeout_cb(gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	g_autoptr(GError) error_local1 = NULL;
+	g_autoptr(GError) error_local2 = NULL;
+
+	/* done */
+	self->sysconfpkg_rescan_id = 0;
+
+	/* rescan and re-register */
+	if (!passim_server_sysconfpkgdir_scan(self, &error_local1))
+		g_printerr("failed to scan sysconfpkg directory: %s\n", error_local1->message);
+	if (!passim_server_avahi_register(self, &error_local2))
+		g_warning("failed to register: %s", error_local2->message);
+	return G_SOURCE_REMOVE;
+}
+
+static void
+passim_server_sysconfpkgdir_changed_cb(GFileMonitor *monitor,
+				       GFile *file,
+				       GFile *other_file,
+				       GFileMonitorEvent event_type,
+				       gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+
+	/* rate limit */
+	if (self->sysconfpkg_rescan_id != 0)
+		g_source_remove(self->sysconfpkg_rescan_id);
+	self->sysconfpkg_rescan_id =
+	    g_timeout_add(500, passim_server_sysconfpkgdir_timeout_cb, self);
+}
+
+static gboolean
+passim_server_sysconfpkgdir_watch(PassimServer *self, GError **error)
+{
+	g_autofree gchar *sysconfdir = passim_path_from_kind(PASSIM_PATH_KIND_SYSCONFDIR);
+	g_autofree gchar *sysconfpkgdir = g_build_filename(sysconfdir, "passim.d", NULL);
+	g_autoptr(GFile) file = g_file_new_for_path(sysconfpkgdir);
+
+	self->sysconfpkg_monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, error);
+	if (self->sysconfpkg_monitor == NULL)
+		return FALSE;
+	g_signal_connect(self->sysconfpkg_monitor,
+			 "changed",
+			 G_CALLBACK(passim_server_sysconfpkgdir_changed_cb),
+			 self);
+	return TRUE;
+}
+
+static gboolean
+passim_server_sysconfpkgdir_scan(PassimServer *self, GError **error)
+{
+	const gchar *fn;
+	g_autofree gchar *sysconfdir = passim_path_from_kind(PASSIM_PATH_KIND_SYSCONFDIR);
+	g_autofree gchar *sysconfpkgdir = g_build_filename(sysconfdir, "passim.d", NULL);
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GList) items = g_hash_table_get_values(self->items);
+
+	/* remove all existing sysconfpkgdir items */
+	for (GList *l = items; l != NULL; l = l->next) {
+		PassimItem *item = PASSIM_ITEM(l->data);
+		if (passim_item_get_cmdline(item) == NULL &&
+		    passim_item_get_max_age(item) == G_MAXUINT32 &&
+		    passim_item_get_share_limit(item) == G_MAXUINT32) {
+			g_debug("removing %s due to rescan", passim_item_get_hash(item));
+			passim_server_item_save_counters(self, item);
+			g_hash_table_remove(self->saved, passim_item_get_hash(item));
+			g_hash_table_remove(self->replicas, passim_item_get_hash(item));
+			g_hash_table_remove(self->items, passim_item_get_hash(item));
+		}
+	}
+
+	/* sanity check */
+	if (!g_file_test(sysconfpkgdir, G_FILE_TEST_EXISTS)) {
+		g_debug("not loading resources from %s as it does not exist", sysconfpkgdir);
+		return TRUE;
+	}
+
+	g_debug("loading sysconfpkgdir config from %s", sysconfpkgdir);
+	dir = g_dir_open(sysconfpkgdir, 0, error);
+	if (dir == NULL)
+		return FALSE;
+	while ((fn = g_dir_read_name(dir)) != NULL) {
+		g_autofree gchar *fn_tmp = g_build_filename(sysconfpkgdir, fn, NULL);
+		if (!g_str_has_suffix(fn_tmp, ".conf"))
+			continue;
+		if (!passim_server_sysconfpkgdir_scan_keyfile(self, fn_tmp, error))
+			return FALSE;
+	}
+	passim_server_engine_changed(self);
+	return TRUE;
+}
+
+typedef struct {
+	PassimServer *self;
+	SoupServerMessage *msg;
+	gchar *key; /* as advertised over mDNS */
+	gchar *basename;
+	gchar *query; /* nullable, for the peer, e.g. sha256={hash} */
+	gchar *fallback; /* nullable, used if no peers have the item */
+	gint64 start_time; /* monotonic, µs */
+} PassimServerContext;
+
+static void
+passim_server_context_free(PassimServerContext *ctx)
+{
+	if (ctx->msg != NULL)
+		g_object_unref(ctx->msg);
+	g_free(ctx->key);
+	g_free(ctx->basename);
+	g_free(ctx->query);
+	g_free(ctx->fallback);
+	g_free(ctx);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimServerContext, passim_server_context_free)
+
+static void
+passim_server_msg_send_error(PassimServer *self,
+			     SoupServerMessage *msg,
+			     guint status_code,
+			     const gchar *reason)
+{
+	g_autoptr(GString) html = g_string_new(NULL);
+	const gchar *reason_fallback = reason ? reason : soup_status_get_phrase(status_code);
+	g_string_append_printf(html,
+			       "<html><head><title>%u %s</title></head>"
+			       "<body>%s</body></html>",
+			       status_code,
+			       soup_status_get_phrase(status_code),
+			       reason_fallback);
+	soup_server_message_set_status(msg, status_code, NULL);
+	soup_server_message_set_response(msg, "text/html", SOUP_MEMORY_COPY, html->str, html->len);
+	soup_server_message_unpause(msg);
+}
+
+static void
+passim_server_msg_send_redirect(SoupServerMessage *msg, const gchar *uri)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	g_autoptr(GString) html = g_string_new(NULL);
+
+	g_string_append_printf(html,
+			       "<html><body><a href=\"%s\">Redirecting</a>...</body></html>",
+			       uri);
+	soup_message_headers_append(hdrs, "Location", uri);
+	soup_server_message_set_status(msg, SOUP_STATUS_MOVED_TEMPORARILY, NULL);
+	soup_server_message_set_response(msg, "text/html", SOUP_MEMORY_COPY, html->str, html->len);
+	soup_server_message_unpause(msg);
+}
+
+static void
+passim_server_context_send_redirect(PassimServerContext *ctx, const gchar *location)
+{
+	g_autofree gchar *uri = NULL;
+
+	if (ctx->query == NULL)
+		uri = g_strdup_printf("https://%s/%s", location, ctx->basename);
+	else
+		uri = g_strdup_printf("https://%s/%s?%s", location, ctx->basename, ctx->query);
+	passim_server_msg_send_redirect(ctx->msg, uri);
+}
+
+static void
+passim_server_send_index(PassimServer *self, SoupServerMessage *msg)
+{
+	gsize len;
+	gchar *html = passim_index_to_html(self->items,
+					   passim_avahi_get_name(self->avahi),
+					   self->port,
+					   self->status);
+	len = strlen(html);
+	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response(msg, "text/html", SOUP_MEMORY_TAKE, html, len);
+}
+
+static void
+passim_server_send_metrics(PassimServer *self, SoupServerMessage *msg)
+{
+	GHashTableIter iter;
+	gpointer value;
+	guint64 total_size = 0;
+	gsize len;
+	gchar *str;
+
+	/* these are cheap enough to calculate at scrape time */
+	g_hash_table_iter_init(&iter, self->items);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		total_size += passim_item_get_size(PASSIM_ITEM(value));
+	passim_metrics_gauge_set(self->metrics,
+				 PASSIM_METRICS_GAUGE_ITEMS,
+				 g_hash_table_size(self->items));
+	passim_metrics_gauge_set(self->metrics, PASSIM_METRICS_GAUGE_ITEMS_BYTES, total_size);
+
+	str = passim_metrics_to_string(self->metrics);
+	len = strlen(str);
+	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response(msg,
+					 PASSIM_METRICS_CONTENT_TYPE,
+					 SOUP_MEMORY_TAKE,
+					 str,
+					 len);
+}
+
+static void
+passim_server_send_catalog(PassimServer *self, SoupServerMessage *msg)
+{
+	gchar *str = passim_index_to_catalog(self->items, PASSIM_SERVER_CATALOG_LIMIT);
+	gsize len = strlen(str);
+	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response(msg, "text/plain", SOUP_MEMORY_TAKE, str, len);
+}
+
+/* if set, @path_variant is a compressed copy of @path which is sent instead */
+static void
+passim_server_msg_send_file(PassimServer *self,
+			    SoupServerMessage *msg,
+			    const gchar *path,
+			    const gchar *path_variant)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	GMappedFile *mapping = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = g_file_new_for_path(path);
+	g_autoptr(GFileInfo) info = NULL;
+	gint64 start_time = g_get_monotonic_time();
+
+	if (passim_fault_check(PASSIM_FAULT_POINT_FILE_MAP, &error))
+		mapping =
+		    g_mapped_file_new(path_variant != NULL ? path_variant : path, FALSE, &error);
+	PASSIM_TRACE3(file__map,
+		      msg,
+		      mapping != NULL ? g_mapped_file_get_length(mapping) : 0,
+		      g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "file-map", path);
+	if (mapping == NULL) {
+		soup_server_message_set_status(msg,
+					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
+					       error->message);
+		return;
+	}
+	bytes = g_bytes_new_with_free_func(g_mapped_file_get_contents(mapping),
+					   g_mapped_file_get_length(mapping),
+					   (GDestroyNotify)g_mapped_file_unref,
+					   mapping);
+	if (g_bytes_get_size(bytes) > 0)
+		soup_message_body_append_bytes(soup_server_message_get_response_body(msg), bytes);
+	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+
+	info = g_file_query_info(file,
+				 G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+				 G_FILE_QUERY_INFO_NONE,
+				 NULL,
+				 &error);
+	if (info == NULL) {
+		soup_server_message_set_status(msg,
+					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
+					       error->message);
+		return;
+	}
+	if (g_file_info_get_content_type(info) != NULL) {
+		g_autofree gchar *mime_type =
+		    g_content_type_get_mime_type(g_file_info_get_content_type(info));
+		if (mime_type != NULL)
+			soup_message_headers_append(hdrs, "Content-Type", mime_type);
+	}
+}
+
+static gboolean
+passim_server_delete_item(PassimServer *self, PassimItem *item, GError **error)
+{
+	if (!g_file_delete(passim_item_get_file(item), NULL, error)) {
+		g_prefix_error(error, "failed to delete %s: ", passim_item_get_hash(item));
+		return FALSE;
+	}
+	passim_server_variants_delete(self, passim_item_get_hash(item));
+	passim_server_deltas_delete(self, passim_item_get_hash(item));
+	passim_server_chunks_unref(self, passim_item_get_hash(item));
+	passim_server_merkle_delete(passim_item_get_hash(item));
+	passim_server_digests_remove(self, passim_item_get_hash(item));
+	passim_server_uris_remove(self, item);
+	g_hash_table_remove(self->stored, passim_item_get_hash(item));
+	g_hash_table_remove(self->replicas, passim_item_get_hash(item));
+	g_hash_table_remove(self->saved, passim_item_get_hash(item));
+	g_hash_table_remove(self->items, passim_item_get_hash(item));
+	if (!passim_server_avahi_register(self, error)) {
+		g_prefix_error(error, "failed to register: ");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+passim_server_msg_wrote_body_data_cb(SoupServerMessage *msg, guint chunk_size, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	passim_metrics_counter_add(self->metrics, PASSIM_METRICS_COUNTER_BYTES_SERVED, chunk_size);
+}
+
+static void
+passim_server_msg_wrote_item_data_cb(SoupServerMessage *msg, guint chunk_size, gpointer user_data)
+{
+	PassimItem *item = PASSIM_ITEM(user_data);
+	passim_item_set_served_size(item, passim_item_get_served_size(item) + chunk_size);
+}
+
+#ifdef HAVE_FAULT_INJECTION
+static gboolean
+passim_server_msg_fault_unpause_cb(gpointer user_data)
+{
+	SoupServerMessage *msg = SOUP_SERVER_MESSAGE(user_data);
+	soup_server_message_unpause(msg);
+	return G_SOURCE_REMOVE;
+}
+
+/* either stall the transfer, or drop the connection as if the client had gone away */
+static void
+passim_server_msg_wrote_fault_cb(SoupServerMessage *msg, guint chunk_size, gpointer user_data)
+{
+	guint delay_ms = 0;
+	g_autoptr(GError) error = NULL;
+
+	if (!passim_fault_roll(PASSIM_FAULT_POINT_TLS_WRITE, &delay_ms, &error)) {
+		GSocket *socket = soup_server_message_get_socket(msg);
+		g_debug("%s, closing connection", error->message);
+		if (socket != NULL)
+			g_socket_shutdown(socket, FALSE, TRUE, NULL);
+		return;
+	}
+	if (delay_ms > 0) {
+		soup_server_message_pause(msg);
+		g_timeout_add_full(G_PRIORITY_DEFAULT,
+				   delay_ms,
+				   passim_server_msg_fault_unpause_cb,
+				   g_object_ref(msg),
+				   (GDestroyNotify)g_object_unref);
+	}
+}
+#endif
+
+static void
+passim_server_msg_transfer_finished_cb(SoupServerMessage *msg, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	passim_metrics_gauge_add(self->metrics, PASSIM_METRICS_GAUGE_ACTIVE_TRANSFERS, -1);
+}
+
+static gboolean
+passim_server_etag_matches(const gchar *if_none_match, const gchar *etag)
+{
+	g_auto(GStrv) etags = NULL;
+
+	if (if_none_match == NULL)
+		return FALSE;
+	etags = g_strsplit(if_none_match, ",", -1);
+	for (guint i = 0; etags[i] != NULL; i++) {
+		const gchar *tmp = g_strstrip(etags[i]);
+		if (g_str_has_prefix(tmp, "W/"))
+			tmp += 2;
+		if (g_strcmp0(tmp, "*") == 0 || g_strcmp0(tmp, etag) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * an item stored as seekable zstd, decompressed a frame at a time as the client reads it, or an
+ * item in the chunk store, where each frame is one chunk file
+ */
+typedef struct {
+	PassimServer *self; /* no-ref */
+	gchar *hash;
+	GBytes *blob;
+	GPtrArray *chunks; /* nullable, of PassimChunk */
+	GArray *frames;	   /* of PassimCompressFrame */
+	guint idx;
+	guint64 offset; /* uncompressed */
+	guint64 end;
+} PassimServerStream;
+
+static void
+passim_server_stream_free(PassimServerStream *stream)
+{
+	if (stream->blob != NULL)
+		g_bytes_unref(stream->blob);
+	if (stream->chunks != NULL)
+		g_ptr_array_unref(stream->chunks);
+	if (stream->frames != NULL)
+		g_array_unref(stream->frames);
+	g_free(stream->hash);
+	g_free(stream);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimServerStream, passim_server_stream_free)
+
+static gboolean
+passim_server_stream_next(PassimServerStream *stream, SoupServerMessage *msg, GError **error)
+{
+	SoupMessageBody *body = soup_server_message_get_response_body(msg);
+	PassimServerStored *stored;
+	const PassimCompressFrame *frame;
+	guint64 offset;
+	guint64 end;
+	gint64 start_time;
+	g_autoptr(GBytes) raw = NULL;
+	g_autoptr(GBytes) chunk = NULL;
+
+	if (stream->idx >= stream->frames->len || stream->offset >= stream->end) {
+		soup_message_body_complete(body);
+		return TRUE;
+	}
+	frame = &g_array_index(stream->frames, PassimCompressFrame, stream->idx);
+	if (stream->chunks != NULL) {
+		raw = passim_server_chunk_load(g_ptr_array_index(stream->chunks, stream->idx),
+					       error);
+		stream->idx++;
+		if (raw == NULL)
+			return FALSE;
+	} else {
+		stream->idx++;
+		start_time = g_get_monotonic_time();
+		raw = passim_compress_seekable_get_frame(stream->blob, frame, error);
+		if (raw == NULL)
+			return FALSE;
+
+		/* might have been deleted since the headers were sent */
+		stored = g_hash_table_lookup(stream->self->stored, stream->hash);
+		if (stored != NULL)
+			stored->decompress_us += g_get_monotonic_time() - start_time;
+	}
+
+	/* only the requested range */
+	offset = stream->offset - frame->raw_offset;
+	end = MIN(stream->end, frame->raw_offset + frame->raw_size) - frame->raw_offset;
+	chunk = g_bytes_new_from_bytes(raw, offset, end - offset);
+	stream->offset += end - offset;
+	soup_message_body_append_bytes(body, chunk);
+	return TRUE;
+}
+
+static void
+passim_server_stream_wrote_chunk_cb(SoupServerMessage *msg, gpointer user_data)
+{
+	PassimServerStream *stream = (PassimServerStream *)user_data;
+	g_autoptr(GError) error = NULL;
+
+	if (!passim_server_stream_next(stream, msg, &error)) {
+		GSocket *socket = soup_server_message_get_socket(msg);
+		g_warning("failed to stream %s: %s", stream->hash, error->message);
+
+		/* the headers have already been sent */
+		if (socket != NULL)
+			g_socket_shutdown(socket, FALSE, TRUE, NULL);
+		soup_message_body_complete(soup_server_message_get_response_body(msg));
+	}
+}
+
+/* a single range is built from just the frames covering it, anything else gets it all */
+static void
+passim_server_msg_send_stream(PassimServer *self,
+			      SoupServerMessage *msg,
+			      PassimItem *item,
+			      PassimServerStream *stream_owned)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	SoupMessageHeaders *hdrs_req = soup_server_message_get_request_headers(msg);
+	SoupMessageBody *body = soup_server_message_get_response_body(msg);
+	SoupRange *ranges = NULL;
+	const PassimCompressFrame *frame_last;
+	gint n_ranges = 0;
+	guint64 length;
+	guint64 size = 0;
+	guint status_code = SOUP_STATUS_OK;
+	g_autofree gchar *content_type = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(PassimServerStream) stream = stream_owned;
+
+	if (stream->frames->len > 0) {
+		frame_last =
+		    &g_array_index(stream->frames, PassimCompressFrame, stream->frames->len - 1);
+		size = frame_last->raw_offset + frame_last->raw_size;
+	}
+	stream->end = size;
+
+	/* multipart/byteranges is not worth the complexity */
+	soup_message_headers_append(hdrs, "Accept-Ranges", "bytes");
+	if (soup_message_headers_get_one(hdrs_req, "Range") != NULL) {
+		if (!soup_message_headers_get_ranges(hdrs_req, size, &ranges, &n_ranges)) {
+			g_autofree gchar *content_range =
+			    g_strdup_printf("bytes */%" G_GUINT64_FORMAT, size);
+			soup_message_headers_replace(hdrs, "Content-Range", content_range);
+			soup_server_message_set_status(msg,
+						       SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE,
+						       NULL);
+			return;
+		}
+		if (n_ranges == 1) {
+			stream->offset = ranges[0].start;
+			stream->end = ranges[0].end + 1;
+			soup_message_headers_set_content_range(hdrs,
+							       ranges[0].start,
+							       ranges[0].end,
+							       size);
+			status_code = SOUP_STATUS_PARTIAL_CONTENT;
+		}
+		soup_message_headers_free_ranges(hdrs_req, ranges);
+	}
+	while (stream->idx < stream->frames->len) {
+		const PassimCompressFrame *frame =
+		    &g_array_index(stream->frames, PassimCompressFrame, stream->idx);
+		if (frame->raw_offset + frame->raw_size > stream->offset)
+			break;
+		stream->idx++;
+	}
+
+	/* the first frame is loaded now so that errors can still be reported */
+	length = stream->end - stream->offset;
+	soup_message_body_set_accumulate(body, FALSE);
+	if (!passim_server_stream_next(stream, msg, &error)) {
+		soup_message_body_truncate(body);
+		soup_server_message_set_status(msg,
+					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
+					       error->message);
+		return;
+	}
+	soup_message_headers_set_content_length(hdrs, length);
+	soup_server_message_set_status(msg, status_code, NULL);
+	content_type = g_content_type_guess(passim_item_get_basename(item), NULL, 0, NULL);
+	if (content_type != NULL) {
+		g_autofree gchar *mime_type = g_content_type_get_mime_type(content_type);
+		if (mime_type != NULL)
+			soup_message_headers_append(hdrs, "Content-Type", mime_type);
+	}
+	g_signal_connect(msg,
+			 "wrote-chunk",
+			 G_CALLBACK(passim_server_stream_wrote_chunk_cb),
+			 stream);
+	g_object_set_data_full(G_OBJECT(msg),
+			       "passim-stream",
+			       g_steal_pointer(&stream),
+			       (GDestroyNotify)passim_server_stream_free);
+}
+
+static void
+passim_server_msg_send_stored(PassimServer *self,
+			      SoupServerMessage *msg,
+			      PassimItem *item,
+			      const gchar *path)
+{
+	gint64 start_time = g_get_monotonic_time();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GMappedFile) mapping = NULL;
+	g_autoptr(PassimServerStream) stream = g_new0(PassimServerStream, 1);
+
+	if (passim_fault_check(PASSIM_FAULT_POINT_FILE_MAP, &error))
+		mapping = g_mapped_file_new(path, FALSE, &error);
+	PASSIM_TRACE3(file__map,
+		      msg,
+		      mapping != NULL ? g_mapped_file_get_length(mapping) : 0,
+		      g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "file-map", path);
+	if (mapping == NULL) {
+		soup_server_message_set_status(msg,
+					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
+					       error->message);
+		return;
+	}
+	stream->self = self;
+	stream->hash = g_strdup(passim_item_get_hash(item));
+	stream->blob = g_mapped_file_get_bytes(mapping);
+	stream->frames = passim_compress_seekable_parse(stream->blob, &error);
+	if (stream->frames == NULL) {
+		soup_server_message_set_status(msg,
+					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
+					       error->message);
+		return;
+	}
+	passim_server_msg_send_stream(self, msg, item, g_steal_pointer(&stream));
+}
+
+/* the chunk files are never modified, so they are mapped as each is reached */
+static void
+passim_server_msg_send_chunked(PassimServer *self,
+			       SoupServerMessage *msg,
+			       PassimItem *item,
+			       GPtrArray *chunks)
+{
+	g_autoptr(PassimServerStream) stream = g_new0(PassimServerStream, 1);
+
+	stream->self = self;
+	stream->hash = g_strdup(passim_item_get_hash(item));
+	stream->chunks = g_ptr_array_ref(chunks);
+	stream->frames = g_array_sized_new(FALSE, TRUE, sizeof(PassimCompressFrame), chunks->len);
+	for (guint i = 0; i < chunks->len; i++) {
+		PassimChunk *chunk = g_ptr_array_index(chunks, i);
+		PassimCompressFrame frame = {
+		    .raw_offset = chunk->offset,
+		    .raw_size = chunk->size,
+		};
+		g_array_append_val(stream->frames, frame);
+	}
+	passim_server_msg_send_stream(self, msg, item, g_steal_pointer(&stream));
+}
+
+/* only once the number of other machines with the item is known */
+static void
+passim_server_item_adapt_share_limit(PassimServer *self, PassimItem *item)
+{
+	gpointer replicas = NULL;
+	guint32 share_limit;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GError) error = NULL;
+
+	if (!passim_config_get_adaptive_share_limit(self->kf))
+		return;
+	if (!g_hash_table_lookup_extended(self->replicas,
+					  passim_item_get_hash(item),
+					  NULL,
+					  &replicas))
+		return;
+	share_limit =
+	    passim_policy_item_share_limit_adapt(item, GPOINTER_TO_UINT(replicas), self->load);
+	if (share_limit == passim_item_get_share_limit_effective(item))
+		return;
+	g_debug("share limit of %s is now %u with %u replicas and load %.2f",
+		passim_item_get_hash(item),
+		share_limit,
+		GPOINTER_TO_UINT(replicas),
+		self->load);
+	passim_item_set_share_limit_effective(item, share_limit);
+
+	/* so that it is not reset to the configured limit when the daemon is restarted */
+	filename = g_file_get_path(passim_item_get_file(item));
+	if (!passim_xattr_replace_uint32(filename,
+					 "user.share_limit_effective",
+					 share_limit,
+					 &error))
+		g_debug("not saving share limit: %s", error->message);
+}
+
+static void
+passim_server_item_check_share_limit(PassimServer *self, PassimItem *item)
+{
+	g_autoptr(GError) error = NULL;
+
+	/* we've shared this enough now */
+	if (!passim_policy_item_share_limit_reached(item))
+		return;
+	g_debug("deleting %s as share limit reached", passim_item_get_hash(item));
+	passim_metrics_counter_add(self->metrics, PASSIM_METRICS_COUNTER_SHARE_LIMIT_DELETIONS, 1);
+	if (!passim_server_delete_item(self, item, &error))
+		g_warning("failed: %s", error->message);
+}
+
+/* a single range that stops before the last byte */
+static gboolean
+passim_server_msg_range_before_end(SoupServerMessage *msg, guint64 size)
+{
+	SoupMessageHeaders *hdrs_req = soup_server_message_get_request_headers(msg);
+	SoupRange *ranges = NULL;
+	gint n_ranges = 0;
+	gboolean ret = FALSE;
+
+	if (soup_message_headers_get_one(hdrs_req, "Range") == NULL)
+		return FALSE;
+	if (!soup_message_headers_get_ranges(hdrs_req, size, &ranges, &n_ranges))
+		return FALSE;
+	if (n_ranges == 1 && (guint64)ranges[0].end + 1 < size)
+		ret = TRUE;
+	soup_message_headers_free_ranges(hdrs_req, ranges);
+	return ret;
+}
+
+/* shares are counted by item, whichever variant or delta was sent */
+static void
+passim_server_item_shared(PassimServer *self, PassimItem *item)
+{
+	g_autoptr(GDateTime) dt_now = g_date_time_new_now_utc();
+
+	passim_policy_item_shared(item, dt_now);
+	passim_server_item_adapt_share_limit(self, item);
+	passim_server_item_check_share_limit(self, item);
+}
+
+static void
+passim_server_msg_connect_transfer(PassimServer *self, SoupServerMessage *msg, PassimItem *item)
+{
+	passim_metrics_gauge_add(self->metrics, PASSIM_METRICS_GAUGE_ACTIVE_TRANSFERS, 1);
+	g_signal_connect(msg,
+			 "wrote-body-data",
+			 G_CALLBACK(passim_server_msg_wrote_body_data_cb),
+			 self);
+	g_signal_connect_object(msg,
+				"wrote-body-data",
+				G_CALLBACK(passim_server_msg_wrote_item_data_cb),
+				item,
+				0);
+	g_signal_connect(msg,
+			 "finished",
+			 G_CALLBACK(passim_server_msg_transfer_finished_cb),
+			 self);
+#ifdef HAVE_FAULT_INJECTION
+	g_signal_connect(msg,
+			 "wrote-body-data",
+			 G_CALLBACK(passim_server_msg_wrote_fault_cb),
+			 NULL);
+#endif
+}
+
+/* the client verifies the patched result against the item hash */
+static void
+passim_server_msg_send_delta(PassimServer *self,
+			     SoupServerMessage *msg,
+			     PassimItem *item,
+			     PassimServerDelta *delta)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	SoupMessageHeaders *hdrs_req = soup_server_message_get_request_headers(msg);
+	const gchar *hash = passim_item_get_hash(item);
+	g_autofree gchar *etag = g_strdup_printf("\"%s-delta-%s\"", hash, delta->hash_old);
+	g_autofree gchar *path = g_file_get_path(passim_item_get_file(item));
+	g_autofree gchar *path_delta = passim_server_delta_filename(hash);
+
+	soup_message_headers_append(hdrs, "ETag", etag);
+	if (passim_server_etag_matches(soup_message_headers_get_list(hdrs_req, "If-None-Match"),
+				       etag)) {
+		soup_server_message_set_status(msg, SOUP_STATUS_NOT_MODIFIED, NULL);
+		return;
+	}
+	soup_message_headers_append(hdrs, "Passim-Delta-From", delta->hash_old);
+	passim_server_msg_connect_transfer(self, msg, item);
+	passim_server_msg_send_file(self, msg, path, path_delta);
+	if (soup_server_message_get_status(msg) != SOUP_STATUS_OK)
+		return;
+	soup_message_headers_replace(hdrs, "Content-Type", "application/octet-stream");
+	passim_metrics_counter_add(self->metrics,
+				   PASSIM_METRICS_COUNTER_COMPRESSION_SAVED,
+				   passim_item_get_size(item) -
+				       MIN(passim_item_get_size(item), delta->size));
+	passim_server_item_shared(self, item);
+}
+
+/* so that a peer can fetch only the chunks it does not already have */
+static void
+passim_server_msg_send_chunk_list(PassimServer *self, SoupServerMessage *msg, PassimItem *item)
+{
+	GPtrArray *chunks = g_hash_table_lookup(self->chunked, passim_item_get_hash(item));
+	gchar *str;
+
+	if (chunks == NULL) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_NOT_FOUND,
+					     "item is not chunked");
+		return;
+	}
+	str = passim_chunk_list_to_string(chunks);
+	soup_server_message_set_response(msg, "text/plain", SOUP_MEMORY_TAKE, str, strlen(str));
+	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+}
+
+/* only items published since block hashes were added have them */
+static void
+passim_server_msg_send_merkle(PassimServer *self, SoupServerMessage *msg, PassimItem *item)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	g_autofree gchar *fn = passim_server_merkle_filename(passim_item_get_hash(item));
+
+	if (!g_file_test(fn, G_FILE_TEST_EXISTS)) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_NOT_FOUND, "no block hashes");
+		return;
+	}
+	passim_server_msg_send_file(self, msg, fn, NULL);
+	if (soup_server_message_get_status(msg) != SOUP_STATUS_OK)
+		return;
+	soup_message_headers_replace(hdrs, "Content-Type", "text/plain");
+}
+
+/* still being downloaded, so only a range of blocks that have been written and verified */
+static void
+passim_server_msg_send_partial(PassimServer *self,
+			       SoupServerMessage *msg,
+			       PassimServerPartial *partial,
+			       gboolean want_merkle,
+			       gboolean want_bitmap)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	SoupMessageHeaders *hdrs_req = soup_server_message_get_request_headers(msg);
+	SoupRange *ranges = NULL;
+	GMappedFile *mapping;
+	gint n_ranges = 0;
+	guint32 block_size = passim_merkle_get_block_size(partial->merkle);
+	guint64 size = passim_merkle_get_size(partial->merkle);
+	guint64 start = 0;
+	guint64 end = 0;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GBytes) bytes_range = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* so that the peer knows what to ask for */
+	if (want_merkle || want_bitmap) {
+		g_autofree gchar *str = want_merkle ? passim_merkle_to_string(partial->merkle)
+						   : passim_bitmap_to_string(partial->bitmap);
+		soup_server_message_set_response(msg,
+						 "text/plain",
+						 SOUP_MEMORY_COPY,
+						 str,
+						 strlen(str));
+		soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+		return;
+	}
+
+	/* the whole item is not available yet */
+	if (soup_message_headers_get_one(hdrs_req, "Range") == NULL) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_NOT_FOUND,
+					     "still being downloaded");
+		return;
+	}
+
+	/* multipart/byteranges is not worth the complexity */
+	soup_message_headers_append(hdrs, "Accept-Ranges", "bytes");
+	if (soup_message_headers_get_ranges(hdrs_req, size, &ranges, &n_ranges)) {
+		if (n_ranges == 1) {
+			start = ranges[0].start;
+			end = ranges[0].end;
+		}
+		soup_message_headers_free_ranges(hdrs_req, ranges);
+	}
+	if (n_ranges != 1 ||
+	    !passim_bitmap_get_range(partial->bitmap, start / block_size, end / block_size)) {
+		g_autofree gchar *content_range =
+		    g_strdup_printf("bytes */%" G_GUINT64_FORMAT, size);
+		soup_message_headers_replace(hdrs, "Content-Range", content_range);
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE,
+					     "blocks not yet downloaded");
+		return;
+	}
+	mapping = g_mapped_file_new(partial->filename, FALSE, &error);
+	if (mapping == NULL) {
+		soup_server_message_set_status(msg,
+					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
+					       error->message);
+		return;
+	}
+	bytes = g_bytes_new_with_free_func(g_mapped_file_get_contents(mapping),
+					   g_mapped_file_get_length(mapping),
+					   (GDestroyNotify)g_mapped_file_unref,
+					   mapping);
+	if (g_bytes_get_size(bytes) != size) {
+		soup_server_message_set_status(msg,
+					       SOUP_STATUS_INTERNAL_SERVER_ERROR,
+					       "partial download is the wrong size");
+		return;
+	}
+	bytes_range = g_bytes_new_from_bytes(bytes, start, end - start + 1);
+	soup_message_body_append_bytes(soup_server_message_get_response_body(msg), bytes_range);
+	soup_message_headers_set_content_range(hdrs, start, end, size);
+	soup_message_headers_append(hdrs, "Content-Type", "application/octet-stream");
+	soup_server_message_set_status(msg, SOUP_STATUS_PARTIAL_CONTENT, NULL);
+}
+
+/* chunks are not items, so they do not count towards the share limit */
+static void
+passim_server_msg_send_chunk(PassimServer *self, SoupServerMessage *msg, const gchar *checksum)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	SoupMessageHeaders *hdrs_req = soup_server_message_get_request_headers(msg);
+	g_autofree gchar *etag = NULL;
+	g_autofree gchar *fn = NULL;
+
+	if (!passim_chunk_checksum_valid(checksum)) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_NOT_ACCEPTABLE,
+					     "chunk hash is malformed");
+		return;
+	}
+	if (!g_hash_table_contains(self->chunks, checksum)) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_NOT_FOUND, NULL);
+		return;
+	}
+	etag = g_strdup_printf("\"%s\"", checksum);
+	soup_message_headers_append(hdrs, "ETag", etag);
+	if (passim_server_etag_matches(soup_message_headers_get_list(hdrs_req, "If-None-Match"),
+				       etag)) {
+		soup_server_message_set_status(msg, SOUP_STATUS_NOT_MODIFIED, NULL);
+		return;
+	}
+	g_signal_connect(msg,
+			 "wrote-body-data",
+			 G_CALLBACK(passim_server_msg_wrote_body_data_cb),
+			 self);
+	fn = passim_server_chunk_filename(checksum);
+	passim_server_msg_send_file(self, msg, fn, NULL);
+	if (soup_server_message_get_status(msg) != SOUP_STATUS_OK)
+		return;
+	soup_message_headers_replace(hdrs, "Content-Type", "application/octet-stream");
+}
+
+/* if @hash_old is set and a delta from it exists, only the patch is sent */
+static void
+passim_server_msg_send_item(PassimServer *self,
+			    SoupServerMessage *msg,
+			    PassimItem *item,
+			    const gchar *hash_old)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	SoupMessageHeaders *hdrs_req = soup_server_message_get_request_headers(msg);
+	PassimEncoding encoding = PASSIM_ENCODING_IDENTITY;
+	PassimServerVariants *variants;
+	PassimServerVariants sizes = {0};
+	PassimServerStored *stored;
+	PassimServerDelta *delta;
+	GPtrArray *chunks;
+	const gchar *hash = passim_item_get_hash(item);
+	g_autofree gchar *content_disposition = NULL;
+	g_autofree gchar *etag = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *path = g_file_get_path(passim_item_get_file(item));
+	g_autofree gchar *path_variant = NULL;
+
+	/* the client already has the old version */
+	delta = g_hash_table_lookup(self->deltas, hash);
+	if (delta != NULL && g_strcmp0(delta->hash_old, hash_old) == 0) {
+		passim_server_msg_send_delta(self, msg, item, delta);
+		return;
+	}
+	if (delta != NULL)
+		soup_message_headers_append(hdrs, "Passim-Delta-Available", delta->hash_old);
+
+	/* the smallest variant the client accepts, each with a different ETag */
+	variants = g_hash_table_lookup(self->variants, hash);
+	if (variants != NULL)
+		sizes = *variants;
+	stored = g_hash_table_lookup(self->stored, hash);
+	if (stored != NULL)
+		sizes.size[PASSIM_ENCODING_ZSTD] = stored->size;
+
+	/* ranges are always of the uncompressed contents */
+	if (passim_server_variants_get_mask(&sizes) != 0 &&
+	    soup_message_headers_get_one(hdrs_req, "Range") == NULL) {
+		encoding =
+		    passim_encoding_negotiate(soup_message_headers_get_list(hdrs_req,
+									    "Accept-Encoding"),
+					      sizes.size);
+	}
+	if (encoding == PASSIM_ENCODING_IDENTITY) {
+		etag = g_strdup_printf("\"%s\"", hash);
+	} else {
+		etag = g_strdup_printf("\"%s-%s\"", hash, passim_encoding_to_string(encoding));
+		if (stored == NULL || encoding != PASSIM_ENCODING_ZSTD)
+			path_variant = passim_server_variant_filename(hash, encoding);
+	}
+	soup_message_headers_append(hdrs, "Vary", "Accept-Encoding");
+	soup_message_headers_append(hdrs, "ETag", etag);
+	if (passim_server_etag_matches(soup_message_headers_get_list(hdrs_req, "If-None-Match"),
+				       etag)) {
+		soup_server_message_set_status(msg, SOUP_STATUS_NOT_MODIFIED, NULL);
+		return;
+	}
+	if (encoding != PASSIM_ENCODING_IDENTITY) {
+		soup_message_headers_append(hdrs,
+					    "Content-Encoding",
+					    passim_encoding_to_string(encoding));
+	}
+
+	filename = g_uri_escape_string(passim_item_get_basename(item), NULL, TRUE);
+	content_disposition = g_strdup_printf("attachment; filename=\"%s\"", filename);
+	soup_message_headers_append(hdrs, "Content-Disposition", content_disposition);
+
+	passim_server_msg_connect_transfer(self, msg, item);
+	chunks = g_hash_table_lookup(self->chunked, hash);
+	if (chunks != NULL && path_variant == NULL)
+		passim_server_msg_send_chunked(self, msg, item, chunks);
+	else if (stored != NULL && encoding == PASSIM_ENCODING_IDENTITY)
+		passim_server_msg_send_stored(self, msg, item, path);
+	else
+		passim_server_msg_send_file(self, msg, path, path_variant);
+	if (encoding != PASSIM_ENCODING_IDENTITY &&
+	    soup_server_message_get_status(msg) == SOUP_STATUS_OK) {
+		guint64 size = path_variant != NULL ? variants->size[encoding] : stored->size;
+		passim_metrics_counter_add(self->metrics,
+					   PASSIM_METRICS_COUNTER_COMPRESSION_SAVED,
+					   passim_item_get_size(item) -
+					       MIN(passim_item_get_size(item), size));
+	}
+
+	/* downloaded a block at a time, which only counts once */
+	if (!passim_server_msg_range_before_end(msg, passim_item_get_size(item)))
+		passim_server_item_shared(self, item);
+}
+
+static void
+passim_server_request_free(PassimServerRequest *req)
+{
+	g_free(req->client);
+	g_free(req->hash);
+	g_free(req);
+}
+
+static PassimServerRequest *
+passim_server_request_new(guint64 id)
+{
+	PassimServerRequest *req = g_new0(PassimServerRequest, 1);
+	req->id = id;
+	req->start_time = g_get_monotonic_time();
+	req->lookup_us = -1;
+	req->first_byte_us = -1;
+	return req;
+}
+
+/* this is always set in ::request-started, but fall back for safety */
+static PassimServerRequest *
+passim_server_msg_get_request(SoupServerMessage *msg)
+{
+	PassimServerRequest *req = g_object_get_data(G_OBJECT(msg), "passim-request");
+	if (req == NULL) {
+		req = passim_server_request_new(0);
+		g_object_set_data_full(G_OBJECT(msg),
+				       "passim-request",
+				       req,
+				       (GDestroyNotify)passim_server_request_free);
+	}
+	return req;
+}
+
+static void
+passim_server_avahi_find_cb(GObject *source_object, GAsyncResult *res, gpointer data)
+{
+	guint index_random;
+	PassimServerRequest *req;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) addresses = NULL;
+	g_autoptr(PassimServerContext) ctx = (PassimServerContext *)data;
+
+	addresses = passim_avahi_find_finish(PASSIM_AVAHI(source_object), res, &error);
+	req = passim_server_msg_get_request(ctx->msg);
+	req->lookup_us = g_get_monotonic_time() - ctx->start_time;
+	PASSIM_TRACE3(lookup__done,
+		      ctx->msg,
+		      addresses != NULL ? addresses->len : 0,
+		      req->lookup_us);
+	passim_trace_mark(ctx->start_time, "lookup", ctx->key);
+	if (addresses == NULL && ctx->fallback != NULL) {
+		g_info("using fallback: %s", error->message);
+		passim_server_msg_send_redirect(ctx->msg, ctx->fallback);
+		return;
+	}
+	if (addresses == NULL) {
+		passim_server_msg_send_error(ctx->self, ctx->msg, 404, error->message);
+		return;
+	}
+
+	/* display all, and chose an option at random */
+	index_random = passim_policy_select_peer(addresses->len, NULL);
+	for (guint i = 0; i < addresses->len; i++) {
+		const gchar *address = g_ptr_array_index(addresses, i);
+		if (i == index_random) {
+			g_info("chosen address: %s", address);
+			passim_server_context_send_redirect(ctx, address);
+		} else {
+			g_info("ignore address: %s", address);
+		}
+	}
+}
+
+static void
+passim_server_msg_connected_cb(SoupServerMessage *msg, gpointer user_data)
+{
+	PassimServerRequest *req = passim_server_msg_get_request(msg);
+	PASSIM_TRACE2(tls__handshake, msg, g_get_monotonic_time() - req->start_time);
+	passim_trace_mark(req->start_time, "tls-handshake", NULL);
+}
+
+static void
+passim_server_msg_wrote_headers_cb(SoupServerMessage *msg, gpointer user_data)
+{
+	PassimServerRequest *req = passim_server_msg_get_request(msg);
+	if (req->first_byte_us < 0)
+		req->first_byte_us = g_get_monotonic_time() - req->start_time;
+}
+
+static void
+passim_server_msg_wrote_request_data_cb(SoupServerMessage *msg,
+					guint chunk_size,
+					gpointer user_data)
+{
+	PassimServerRequest *req = passim_server_msg_get_request(msg);
+	req->bytes += chunk_size;
+}
+
+static void
+passim_server_request_started_cb(SoupServer *server, SoupServerMessage *msg, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+
+	g_object_set_data_full(G_OBJECT(msg),
+			       "passim-request",
+			       passim_server_request_new(++self->request_id),
+			       (GDestroyNotify)passim_server_request_free);
+	PASSIM_TRACE1(request__accept, msg);
+
+	/* only emitted for the first request on each connection */
+	g_signal_connect(msg, "connected", G_CALLBACK(passim_server_msg_connected_cb), NULL);
+
+	/* for the access log */
+	g_signal_connect(msg,
+			 "wrote-headers",
+			 G_CALLBACK(passim_server_msg_wrote_headers_cb),
+			 NULL);
+	g_signal_connect(msg,
+			 "wrote-body-data",
+			 G_CALLBACK(passim_server_msg_wrote_request_data_cb),
+			 NULL);
+}
+
+static void
+passim_server_access_log_push(PassimServer *self, PassimServerRequest *req, guint status_code)
+{
+	PassimAccessLogEntry entry = {
+	    .request_id = req->id,
+	    .timestamp = g_get_real_time(),
+	    .status_code = status_code,
+	    .bytes = req->bytes,
+	    .lookup_us = req->lookup_us,
+	    .first_byte_us = req->first_byte_us,
+	    .total_us = g_get_monotonic_time() - req->start_time,
+	};
+
+	/* no formatting here, that is done in the writer thread */
+	if (req->client != NULL)
+		g_strlcpy(entry.client, req->client, sizeof(entry.client));
+	if (req->hash != NULL)
+		g_strlcpy(entry.hash, req->hash, sizeof(entry.hash));
+	if (!passim_access_log_push(self->access_log, &entry)) {
+		passim_metrics_counter_add(self->metrics,
+					   PASSIM_METRICS_COUNTER_ACCESS_LOG_DROPPED,
+					   1);
+	}
+}
+
+static void
+passim_server_msg_finished_cb(SoupServerMessage *msg, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	PassimServerRequest *req = passim_server_msg_get_request(msg);
+	guint status_code = soup_server_message_get_status(msg);
+
+	/* the index, metrics and static files are not items */
+	if (req->hash != NULL) {
+		passim_metrics_add_outcome(self->metrics,
+					   passim_metrics_outcome_from_status(status_code));
+	}
+	PASSIM_TRACE3(request__done, msg, status_code, g_get_monotonic_time() - req->start_time);
+	passim_trace_mark(req->start_time,
+			  "request",
+			  g_uri_get_path(soup_server_message_get_uri(msg)));
+	if (self->access_log != NULL)
+		passim_server_access_log_push(self, req, status_code);
+}
+
+static gboolean
+passim_server_is_loopback(const gchar *inet_addr)
+{
+	g_autoptr(GInetAddress) address = g_inet_address_new_from_string(inet_addr);
+	return g_inet_address_get_is_loopback(address);
+}
+
+/* anything other than sha256 is an alias */
+static PassimItem *
+passim_server_lookup_item(PassimServer *self, PassimDigestKind kind, const gchar *hash)
+{
+	const gchar *hash_item;
+	g_autofree gchar *key = NULL;
+
+	if (kind == PASSIM_DIGEST_KIND_SHA256)
+		return g_hash_table_lookup(self->items, hash);
+	key = passim_digest_build_key(kind, hash);
+	hash_item = g_hash_table_lookup(self->aliases, key);
+	if (hash_item == NULL)
+		return NULL;
+	return g_hash_table_lookup(self->items, hash_item);
+}
+
+/*
+ * the client is redirected to @basename on a random peer with the item, or to @fallback, or gets
+ * a 404 -- @basename can also be a path without the leading slash
+ */
+static void
+passim_server_msg_find_remote(PassimServer *self,
+			      SoupServerMessage *msg,
+			      const gchar *key,
+			      const gchar *basename,
+			      const gchar *query,
+			      const gchar *fallback)
+{
+	g_autoptr(PassimServerContext) ctx = g_new0(PassimServerContext, 1);
+
+	/* create context */
+	ctx->self = self;
+	ctx->msg = g_object_ref(msg);
+	ctx->key = g_strdup(key);
+	ctx->basename = g_strdup(basename);
+	ctx->query = g_strdup(query);
+	ctx->fallback = g_strdup(fallback);
+	ctx->start_time = g_get_monotonic_time();
+
+	/* look for remote servers with this hash */
+	g_info("searching for %s", key);
+	PASSIM_TRACE2(lookup__start, msg, ctx->key);
+	soup_server_message_pause(msg);
+	passim_avahi_find_async(self->avahi,
+				key,
+				NULL,
+				passim_server_avahi_find_cb,
+				g_steal_pointer(&ctx));
+}
+
+/* only called before the message has been paused */
+static void
+passim_server_msg_send_oci_error(PassimServer *self,
+				 SoupServerMessage *msg,
+				 guint status_code,
+				 const gchar *code,
+				 const gchar *message)
+{
+	g_autofree gchar *json = passim_oci_error_to_json(code, message);
+	soup_server_message_set_status(msg, status_code, NULL);
+	soup_server_message_set_response(msg,
+					 "application/json",
+					 SOUP_MEMORY_COPY,
+					 json,
+					 strlen(json));
+}
+
+static void
+passim_server_msg_send_oci_head(PassimServer *self, SoupServerMessage *msg, PassimItem *item)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	g_autofree gchar *digest = g_strdup_printf("sha256:%s", passim_item_get_hash(item));
+	g_autofree gchar *etag = g_strdup_printf("\"%s\"", passim_item_get_hash(item));
+
+	soup_message_headers_set_content_length(hdrs, passim_item_get_size(item));
+	soup_message_headers_replace(hdrs, "Content-Type", "application/octet-stream");
+	soup_message_headers_append(hdrs, "Docker-Content-Digest", digest);
+	soup_message_headers_append(hdrs, "ETag", etag);
+	soup_message_headers_append(hdrs, "Accept-Ranges", "bytes");
+	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+}
+
+/* blobs are always sent uncompressed, as the digest is of the exact bytes */
+static void
+passim_server_msg_send_oci_blob(PassimServer *self, SoupServerMessage *msg, PassimItem *item)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	SoupMessageHeaders *hdrs_req = soup_server_message_get_request_headers(msg);
+	g_autofree gchar *digest = g_strdup_printf("sha256:%s", passim_item_get_hash(item));
+
+	soup_message_headers_remove(hdrs_req, "Accept-Encoding");
+	passim_server_msg_send_item(self, msg, item, NULL);
+	if (soup_server_message_get_status(msg) >= 300)
+		return;
+	soup_message_headers_replace(hdrs, "Content-Type", "application/octet-stream");
+	soup_message_headers_append(hdrs, "Docker-Content-Digest", digest);
+}
+
+static void
+passim_server_msg_send_oci(PassimServer *self,
+			   SoupServerMessage *msg,
+			   const gchar *path,
+			   gboolean is_loopback)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	g_autoptr(PassimOciRoute) route = NULL;
+
+	if (!passim_config_get_oci_registry(self->kf)) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_NOT_FOUND, NULL);
+		return;
+	}
+	soup_message_headers_append(hdrs, "Docker-Distribution-API-Version", "registry/2.0");
+
+	route = passim_oci_route_new(self->items,
+				     soup_server_message_get_method(msg),
+				     path,
+				     is_loopback);
+	if (route->digest != NULL)
+		passim_server_msg_get_request(msg)->hash = g_strdup(route->digest);
+	if (route->action == PASSIM_OCI_ACTION_VERSION) {
+		soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+		soup_server_message_set_response(msg,
+						 "application/json",
+						 SOUP_MEMORY_STATIC,
+						 "{}",
+						 2);
+		return;
+	}
+	if (route->action == PASSIM_OCI_ACTION_ERROR) {
+		passim_server_msg_send_oci_error(self,
+						 msg,
+						 route->status_code,
+						 route->code,
+						 route->message);
+		return;
+	}
+	if (route->action == PASSIM_OCI_ACTION_HEAD) {
+		passim_server_msg_send_oci_head(self, msg, route->item);
+		return;
+	}
+	if (route->action == PASSIM_OCI_ACTION_BLOB) {
+		passim_server_msg_send_oci_blob(self, msg, route->item);
+		return;
+	}
+
+	/* to the same blob URL on the peer, so that it is also sent uncompressed */
+	passim_server_msg_find_remote(self, msg, route->digest, path + 1, NULL, NULL);
+}
+
+/*
+ * the item hash and this machine as the only peer, as seen by the client -- localhost forwards
+ * the lookup to a random peer that has the URI, in the same way as for a hash
+ */
+typedef struct {
+	PassimServerContext *ctx;
+	GPtrArray *addresses; /* of {host}:{port} */
+	guint index_random;
+} PassimServerLookupHelper;
+
+static void
+passim_server_lookup_helper_free(PassimServerLookupHelper *helper)
+{
+	passim_server_context_free(helper->ctx);
+	g_ptr_array_unref(helper->addresses);
+	g_free(helper);
+}
+
+/* the machines only advertise the URI key, so the item hash has to come from one of them */
+static void
+passim_server_lookup_thread_cb(GTask *task,
+			       gpointer source_object,
+			       gpointer task_data,
+			       GCancellable *cancellable)
+{
+	PassimServerLookupHelper *helper = (PassimServerLookupHelper *)task_data;
+
+	for (guint i = 0; i < helper->addresses->len; i++) {
+		guint idx = (helper->index_random + i) % helper->addresses->len;
+		const gchar *address = g_ptr_array_index(helper->addresses, idx);
+		g_autofree gchar *hash = NULL;
+		g_autofree gchar *str = NULL;
+		g_autofree gchar *uri = NULL;
+		g_autoptr(GBytes) blob = NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		uri = g_strdup_printf("https://%s/uri?%s", address, helper->ctx->query);
+		blob = passim_fetch_bytes(uri, NULL, 4096, 0, cancellable, &error_local);
+		if (blob == NULL) {
+			g_info("ignoring %s: %s", address, error_local->message);
+			continue;
+		}
+		str = g_strndup(g_bytes_get_data(blob, NULL), g_bytes_get_size(blob));
+		hash = passim_uri_lookup_get_hash(str);
+		if (!passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA256, hash)) {
+			g_info("ignoring %s: invalid hash", address);
+			continue;
+		}
+		g_task_return_pointer(task, g_steal_pointer(&hash), g_free);
+		return;
+	}
+	g_task_return_new_error(task,
+				G_IO_ERROR,
+				G_IO_ERROR_NOT_FOUND,
+				"no machine returned the hash for %s",
+				helper->ctx->key);
+}
+
+static void
+passim_server_lookup_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	PassimServerLookupHelper *helper = g_task_get_task_data(G_TASK(res));
+	PassimServerContext *ctx = helper->ctx;
+	g_autofree gchar *hash = NULL;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GError) error = NULL;
+
+	hash = g_task_propagate_pointer(G_TASK(res), &error);
+	if (hash == NULL) {
+		passim_server_msg_send_error(ctx->self,
+					     ctx->msg,
+					     SOUP_STATUS_NOT_FOUND,
+					     error->message);
+		return;
+	}
+	passim_server_msg_get_request(ctx->msg)->hash = g_strdup(hash);
+	str = passim_uri_lookup_to_string(hash, helper->addresses);
+	soup_server_message_set_status(ctx->msg, SOUP_STATUS_OK, NULL);
+	soup_server_message_set_response(ctx->msg,
+					 "text/plain",
+					 SOUP_MEMORY_COPY,
+					 str,
+					 strlen(str));
+	soup_server_message_unpause(ctx->msg);
+}
+
+static void
+passim_server_avahi_find_uri_cb(GObject *source_object, GAsyncResult *res, gpointer data)
+{
+	PassimServerLookupHelper *helper;
+	PassimServerRequest *req;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) addresses = NULL;
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(PassimServerContext) ctx = (PassimServerContext *)data;
+
+	addresses = passim_avahi_find_finish(PASSIM_AVAHI(source_object), res, &error);
+	req = passim_server_msg_get_request(ctx->msg);
+	req->lookup_us = g_get_monotonic_time() - ctx->start_time;
+	PASSIM_TRACE3(lookup__done,
+		      ctx->msg,
+		      addresses != NULL ? addresses->len : 0,
+		      req->lookup_us);
+	passim_trace_mark(ctx->start_time, "lookup", ctx->key);
+	if (addresses == NULL) {
+		passim_server_msg_send_error(ctx->self, ctx->msg, 404, error->message);
+		return;
+	}
+
+	/* all are returned, so that the client can download from more than one */
+	helper = g_new0(PassimServerLookupHelper, 1);
+	helper->index_random = passim_policy_select_peer(addresses->len, NULL);
+	helper->addresses = g_steal_pointer(&addresses);
+	helper->ctx = g_steal_pointer(&ctx);
+	task = g_task_new(NULL, NULL, passim_server_lookup_cb, NULL);
+	g_task_set_task_data(task, helper, (GDestroyNotify)passim_server_lookup_helper_free);
+	g_task_run_in_thread(task, passim_server_lookup_thread_cb);
+}
+
+static void
+passim_server_msg_find_uri(PassimServer *self,
+			   SoupServerMessage *msg,
+			   const gchar *key,
+			   const gchar *query)
+{
+	g_autoptr(PassimServerContext) ctx = g_new0(PassimServerContext, 1);
+
+	ctx->self = self;
+	ctx->msg = g_object_ref(msg);
+	ctx->key = g_strdup(key);
+	ctx->query = g_strdup(query);
+	ctx->start_time = g_get_monotonic_time();
+
+	g_info("searching for %s", key);
+	PASSIM_TRACE2(lookup__start, msg, ctx->key);
+	soup_server_message_pause(msg);
+	passim_avahi_find_async(self->avahi,
+				key,
+				NULL,
+				passim_server_avahi_find_uri_cb,
+				g_steal_pointer(&ctx));
+}
+
+static void
+passim_server_msg_send_uri_lookup(PassimServer *self,
+				  SoupServerMessage *msg,
+				  GHashTable *query,
+				  gboolean is_loopback)
+{
+	SoupMessageHeaders *hdrs = soup_server_message_get_response_headers(msg);
+	GUri *uri = soup_server_message_get_uri(msg);
+	PassimItem *item = NULL;
+	const gchar *etag = NULL;
+	const gchar *hash_item;
+	const gchar *origin = NULL;
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GPtrArray) addresses = g_ptr_array_new_with_free_func(g_free);
+
+	if (query != NULL) {
+		origin = g_hash_table_lookup(query, "uri");
+		etag = g_hash_table_lookup(query, "etag");
+	}
+	if (origin == NULL) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_BAD_REQUEST,
+					     "uri= argument required");
+		return;
+	}
+	key = passim_digest_build_uri_key(origin, etag);
+	hash_item = g_hash_table_lookup(self->aliases, key);
+	if (hash_item != NULL)
+		item = g_hash_table_lookup(self->items, hash_item);
+	if (item != NULL) {
+		if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED)) {
+			passim_server_msg_send_error(self, msg, SOUP_STATUS_LOCKED, NULL);
+			return;
+		}
+		passim_server_msg_get_request(msg)->hash = g_strdup(passim_item_get_hash(item));
+		if (passim_item_get_etag(item) != NULL)
+			soup_message_headers_append(hdrs,
+						    "Passim-Origin-ETag",
+						    passim_item_get_etag(item));
+		g_ptr_array_add(addresses,
+				g_strdup_printf("%s:%i",
+						g_uri_get_host(uri),
+						g_uri_get_port(uri) != -1 ? g_uri_get_port(uri)
+									  : self->port));
+		str = passim_uri_lookup_to_string(passim_item_get_hash(item), addresses);
+		soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+		soup_server_message_set_response(msg,
+						 "text/plain",
+						 SOUP_MEMORY_COPY,
+						 str,
+						 strlen(str));
+		return;
+	}
+
+	/* only localhost is allowed to scan */
+	if (!is_loopback) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+		return;
+	}
+	passim_server_msg_find_uri(self, msg, key, g_uri_get_query(uri));
+}
+
+/* for package managers that address files by digest in the path, so no query is needed */
+static void
+passim_server_msg_send_by_hash(PassimServer *self,
+			       SoupServerMessage *msg,
+			       const gchar *path,
+			       PassimDigestKind kind,
+			       const gchar *hash,
+			       gboolean is_loopback)
+{
+	PassimItem *item;
+	g_autofree gchar *mirror = passim_config_get_by_hash_mirror(self->kf);
+	g_autofree gchar *fallback = NULL;
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *query = NULL;
+
+	passim_server_msg_get_request(msg)->hash = g_strdup(hash);
+	item = passim_server_lookup_item(self, kind, hash);
+	if (item != NULL) {
+		if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED)) {
+			passim_server_msg_send_error(self, msg, SOUP_STATUS_LOCKED, NULL);
+			return;
+		}
+		passim_server_msg_send_item(self, msg, item, NULL);
+		return;
+	}
+
+	/* only localhost is allowed to scan for hashes */
+	if (!is_loopback) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+		return;
+	}
+	if (mirror != NULL)
+		fallback = g_strdup_printf("%s%s", mirror, path);
+	key = passim_digest_build_key(kind, hash);
+	query = g_strdup_printf("%s=%s", passim_digest_kind_to_string(kind), hash);
+	passim_server_msg_find_remote(self, msg, key, hash, query, fallback);
+}
+
+static void
+passim_server_msg_send_replicate(PassimServer *self,
+				 SoupServerMessage *msg,
+				 GHashTable *query,
+				 const gchar *inet_addrstr);
+
+static void
+passim_server_handler_cb(SoupServer *server,
+			 SoupServerMessage *msg,
+			 const gchar *path,
+			 GHashTable *query,
+			 gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	GInetAddress *inet_addr;
+	GSocketAddress *socket_addr;
+	PassimDigestKind kind;
+	PassimItem *item = NULL;
+	PassimServerPartial *partial = NULL;
+	PassimServerRequest *req = passim_server_msg_get_request(msg);
+	GUri *uri = soup_server_message_get_uri(msg);
+	gboolean is_loopback;
+	g_autofree gchar *bitmap = NULL;
+	g_autofree gchar *chunk_list = NULL;
+	g_autofree gchar *hash = NULL;
+	g_autofree gchar *hash_old = NULL;
+	g_autofree gchar *hash_old_tmp = NULL;
+	g_autofree gchar *hash_tmp = NULL;
+	g_autofree gchar *inet_addrstr = NULL;
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *merkle = NULL;
+	g_autofree gchar *query_peer = NULL;
+	g_auto(GStrv) request = NULL;
+
+	/* count the outcome however the request completes */
+	g_signal_connect(msg, "finished", G_CALLBACK(passim_server_msg_finished_cb), self);
+
+	/* only GET supported, apart from checking OCI blobs exist and replication requests */
+	if (soup_server_message_get_method(msg) != SOUP_METHOD_GET &&
+	    (soup_server_message_get_method(msg) != SOUP_METHOD_HEAD ||
+	     !g_str_has_prefix(path, "/v2/")) &&
+	    (soup_server_message_get_method(msg) != SOUP_METHOD_POST ||
+	     g_strcmp0(path, "/replicate") != 0)) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+		return;
+	}
+
+	/* who is connecting */
+	socket_addr = soup_server_message_get_remote_address(msg);
+	if (socket_addr == NULL) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_BAD_REQUEST,
+					     "failed to get client connection address");
+		return;
+	}
+	inet_addr = g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(socket_addr));
+	inet_addrstr = g_inet_address_to_string(inet_addr);
+	is_loopback = passim_server_is_loopback(inet_addrstr);
+	req->client = g_strdup(inet_addrstr);
+	g_debug("accepting HTTP/1.%u %s %s %s from %s:%u (%s)",
+		soup_server_message_get_http_version(msg),
+		soup_server_message_get_method(msg),
+		path,
+		g_uri_get_query(uri) != NULL ? g_uri_get_query(uri) : "",
+		inet_addrstr,
+		g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(socket_addr)),
+		is_loopback ? "loopback" : "remote");
+
+	/* just return the index */
+	if (g_strcmp0(path, "/") == 0) {
+		if (!is_loopback) {
+			passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+			return;
+		}
+		passim_server_send_index(self, msg);
+		return;
+	}
+	if (g_strcmp0(path, "/metrics") == 0) {
+		if (!is_loopback && !passim_config_get_metrics_allow_remote(self->kf)) {
+			passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+			return;
+		}
+		passim_server_send_metrics(self, msg);
+		return;
+	}
+	if (g_strcmp0(path, "/catalog") == 0) {
+		if (!passim_config_get_prefetch(self->kf)) {
+			passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+			return;
+		}
+		passim_server_send_catalog(self, msg);
+		return;
+	}
+	if (g_strcmp0(path, "/favicon.ico") == 0 || g_strcmp0(path, "/style.css") == 0) {
+		g_autofree gchar *datadir = passim_path_from_kind(PASSIM_PATH_KIND_DATADIR);
+		g_autofree gchar *fn = g_build_filename(datadir, PACKAGE_NAME, path, NULL);
+		if (!is_loopback) {
+			passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+			return;
+		}
+		passim_server_msg_send_file(self, msg, fn, NULL);
+		return;
+	}
+	if (g_strcmp0(path, "/v2") == 0 || g_str_has_prefix(path, "/v2/")) {
+		passim_server_msg_send_oci(self, msg, path, is_loopback);
+		return;
+	}
+	if (g_strcmp0(path, "/uri") == 0) {
+		passim_server_msg_send_uri_lookup(self, msg, query, is_loopback);
+		return;
+	}
+	if (g_strcmp0(path, "/replicate") == 0) {
+		passim_server_msg_send_replicate(self, msg, query, inet_addrstr);
+		return;
+	}
+	if (g_uri_get_query(uri) == NULL && passim_digest_parse_path(path, &kind, &hash)) {
+		passim_server_msg_send_by_hash(self, msg, path, kind, hash, is_loopback);
+		return;
+	}
+
+	/* find the request hash argument, where anything other than sha256 is an alias */
+	if (g_uri_get_query(uri) == NULL) {
+		g_autofree gchar *mirror = passim_config_get_by_hash_mirror(self->kf);
+
+		/* everything else in the repository comes from upstream */
+		if (mirror != NULL && is_loopback) {
+			g_autofree gchar *fallback = g_strdup_printf("%s%s", mirror, path);
+			passim_server_msg_send_redirect(msg, fallback);
+			return;
+		}
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_BAD_REQUEST, NULL);
+		return;
+	}
+	request = g_strsplit(g_uri_get_query(uri), "&", 2);
+	for (kind = PASSIM_DIGEST_KIND_SHA256; kind < PASSIM_DIGEST_KIND_LAST; kind++) {
+		hash = passim_query_get_value(g_uri_get_query(uri),
+					      passim_digest_kind_to_string(kind));
+		if (hash != NULL)
+			break;
+	}
+	if (hash == NULL) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_BAD_REQUEST,
+					     "sha256= argument required");
+		return;
+	}
+
+	/* the keys are all lowercase hex */
+	hash_tmp = g_steal_pointer(&hash);
+	hash = g_ascii_strdown(hash_tmp, -1);
+	if (!passim_digest_kind_is_valid(kind, hash)) {
+		g_autofree gchar *reason =
+		    g_strdup_printf("%s hash is malformed", passim_digest_kind_to_string(kind));
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_NOT_ACCEPTABLE, reason);
+		return;
+	}
+	req->hash = passim_digest_build_key(kind, hash);
+
+	/* a single chunk of any item in the chunk store */
+	if (g_strcmp0(path, "/chunk") == 0) {
+		passim_server_msg_send_chunk(self, msg, hash);
+		return;
+	}
+
+	/* optional, for a delta from a version the client already has */
+	hash_old_tmp = passim_query_get_value(g_uri_get_query(uri), "delta-from");
+	if (hash_old_tmp != NULL) {
+		hash_old = g_ascii_strdown(hash_old_tmp, -1);
+		if (!passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA256, hash_old)) {
+			passim_server_msg_send_error(self,
+						     msg,
+						     SOUP_STATUS_NOT_ACCEPTABLE,
+						     "delta-from hash is malformed");
+			return;
+		}
+	}
+
+	/* optional, for the chunk list, block hashes or blocks downloaded rather than the item */
+	chunk_list = passim_query_get_value(g_uri_get_query(uri), "chunks");
+	merkle = passim_query_get_value(g_uri_get_query(uri), "merkle");
+	bitmap = passim_query_get_value(g_uri_get_query(uri), "bitmap");
+
+	/* already exists locally */
+	item = passim_server_lookup_item(self, kind, hash);
+	if (item != NULL) {
+		if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED)) {
+			passim_server_msg_send_error(self, msg, SOUP_STATUS_LOCKED, NULL);
+			return;
+		}
+		if (chunk_list != NULL) {
+			passim_server_msg_send_chunk_list(self, msg, item);
+			return;
+		}
+		if (merkle != NULL) {
+			passim_server_msg_send_merkle(self, msg, item);
+			return;
+		}
+		passim_server_msg_send_item(self, msg, item, hash_old);
+		return;
+	}
+
+	/* still being downloaded here, which is only useful to other machines doing the same */
+	if (kind == PASSIM_DIGEST_KIND_SHA256)
+		partial = g_hash_table_lookup(self->partials, hash);
+	if (partial != NULL && !is_loopback) {
+		passim_server_msg_send_partial(self, msg, partial, merkle != NULL, bitmap != NULL);
+		return;
+	}
+
+	/* only localhost is allowed to scan for hashes */
+	if (!is_loopback) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+		return;
+	}
+	key = passim_digest_build_key(kind, hash);
+	if (hash_old != NULL) {
+		query_peer = g_strdup_printf("%s=%s&delta-from=%s",
+					     passim_digest_kind_to_string(kind),
+					     hash,
+					     hash_old);
+	} else {
+		query_peer = g_strdup_printf("%s=%s", passim_digest_kind_to_string(kind), hash);
+	}
+	passim_server_msg_find_remote(self, msg, key, request[0], query_peer, NULL);
+}
+
+static gboolean
+passim_server_item_origin_valid(PassimItem *item)
+{
+	const gchar *etag = passim_item_get_etag(item);
+	const gchar *uri = passim_item_get_uri(item);
+	g_autofree gchar *scheme = NULL;
+
+	if (uri == NULL)
+		return etag == NULL;
+	if (!g_uri_is_valid(uri, G_URI_FLAGS_NONE, NULL))
+		return FALSE;
+	scheme = g_uri_parse_scheme(uri);
+	if (g_strcmp0(scheme, "http") != 0 && g_strcmp0(scheme, "https") != 0)
+		return FALSE;
+	for (guint i = 0; etag != NULL && etag[i] != '\0'; i++) {
+		if (!g_ascii_isprint(etag[i]))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+passim_server_publish_file(PassimServer *self, GBytes *blob, PassimItem *item, GError **error)
+{
+	GBytes *blob_write = blob;
+	g_autofree gchar *hash = NULL;
+	g_autofree gchar *localstatedir = NULL;
+	g_autofree gchar *localstate_dir = NULL;
+	g_autofree gchar *localstate_filename = NULL;
+	g_autofree gchar *hashed_filename = NULL;
+	g_autoptr(GBytes) blob_chunks = NULL;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GPtrArray) chunks = NULL;
+	g_autoptr(PassimDigests) digests = NULL;
+	g_autoptr(PassimMerkle) merkle = passim_merkle_new_empty(PASSIM_MERKLE_BLOCK_SIZE);
+	gint64 start_time = g_get_monotonic_time();
+
+	/* the extra digests and the block hashes are computed at the same time */
+	digests = passim_digests_new_full(blob,
+					  self->digests_mask,
+					  PASSIM_MERKLE_BLOCK_SIZE,
+					  passim_server_merkle_block_cb,
+					  merkle);
+	hash = g_strdup(digests->values[PASSIM_DIGEST_KIND_SHA256]);
+	PASSIM_TRACE2(publish__stage, "hash", g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "publish-hash", hash);
+	if (g_hash_table_contains(self->items, hash)) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "%s already exists", hash);
+		return FALSE;
+	}
+	hashed_filename = g_strdup_printf("%s-%s", hash, passim_item_get_basename(item));
+
+	localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
+	localstate_dir = g_build_filename(localstatedir, "lib", PACKAGE_NAME, "data", NULL);
+	if (!passim_mkdir(localstate_dir, error))
+		return FALSE;
+	localstate_filename = g_build_filename(localstate_dir, hashed_filename, NULL);
+	if (g_file_test(localstate_filename, G_FILE_TEST_EXISTS)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_EXISTS,
+			    "%s already exists",
+			    localstate_filename);
+		return FALSE;
+	}
+
+	/* the data file is just the chunk list, and each chunk is shared with other items */
+	if (passim_config_get_chunk_store(self->kf)) {
+		gchar *str;
+		start_time = g_get_monotonic_time();
+		chunks = passim_chunk_split(blob);
+		if (!passim_server_chunks_write(self, blob, chunks, error))
+			return FALSE;
+		str = passim_chunk_list_to_string(chunks);
+		blob_chunks = g_bytes_new_take(str, strlen(str));
+		blob_write = blob_chunks;
+		PASSIM_TRACE2(publish__stage, "chunk", g_get_monotonic_time() - start_time);
+		passim_trace_mark(start_time, "publish-chunk", hash);
+
+	}
+
+	start_time = g_get_monotonic_time();
+	if (!g_file_set_contents(localstate_filename,
+				 g_bytes_get_data(blob_write, NULL),
+				 g_bytes_get_size(blob_write),
+				 error))
+		return FALSE;
+	PASSIM_TRACE2(publish__stage, "write", g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "publish-write", localstate_filename);
+	start_time = g_get_monotonic_time();
+	if (!passim_xattr_set_uint32(localstate_filename,
+				     "user.max_age",
+				     passim_item_get_max_age(item),
+				     error))
+		return FALSE;
+	if (!passim_xattr_set_uint32(localstate_filename,
+				     "user.share_limit",
+				     passim_item_get_share_limit(item),
+				     error))
+		return FALSE;
+	if (!passim_xattr_set_string(localstate_filename,
+				     "user.cmdline",
+				     passim_item_get_cmdline(item),
+				     error))
+		return FALSE;
+	if (passim_item_get_uri(item) != NULL) {
+		if (!passim_xattr_set_string(localstate_filename,
+					     "user.uri",
+					     passim_item_get_uri(item),
+					     error))
+			return FALSE;
+	}
+	if (passim_item_get_etag(item) != NULL) {
+		if (!passim_xattr_set_string(localstate_filename,
+					     "user.etag",
+					     passim_item_get_etag(item),
+					     error))
+			return FALSE;
+	}
+
+	if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_REPLICATING)) {
+		if (!passim_xattr_set_uint32(localstate_filename, "user.replicating", 1, error))
+			return FALSE;
+	}
+
+	/* only allowed when rebooted */
+	if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_NEXT_REBOOT)) {
+		g_autofree gchar *boot_time = passim_get_boot_time();
+		if (!passim_xattr_set_string(localstate_filename,
+					     "user.boot_time",
+					     boot_time,
+					     error))
+			return FALSE;
+		passim_item_add_flag(item, PASSIM_ITEM_FLAG_DISABLED);
+	}
+
+	if (chunks != NULL) {
+		if (!passim_xattr_set_string(localstate_filename, "user.encoding", "chunks", error))
+			return FALSE;
+	}
+	for (guint i = PASSIM_DIGEST_KIND_SHA256 + 1; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		g_autofree gchar *name = NULL;
+		if (digests->values[i] == NULL)
+			continue;
+		name = passim_server_digest_xattr_name(i);
+		if (!passim_xattr_set_string(localstate_filename, name, digests->values[i], error))
+			return FALSE;
+	}
+	PASSIM_TRACE2(publish__stage, "xattr", g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "publish-xattr", localstate_filename);
+	start_time = g_get_monotonic_time();
+	if (!passim_server_merkle_write(hash, merkle, error))
+		return FALSE;
+	PASSIM_TRACE2(publish__stage, "merkle", g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "publish-merkle", hash);
+
+	/* add to interface */
+	file = g_file_new_for_path(localstate_filename);
+	passim_item_set_hash(item, hash);
+	passim_item_set_file(item, file);
+	passim_item_set_size(item, g_bytes_get_size(blob));
+	g_debug("added %s", localstate_filename);
+	if (chunks != NULL)
+		passim_server_chunks_ref(self, hash, chunks);
+	passim_server_digests_add(self, hash, g_steal_pointer(&digests));
+	g_hash_table_insert(self->items, g_steal_pointer(&hash), g_object_ref(item));
+	passim_server_uris_add(self, item);
+
+	/* success */
+	start_time = g_get_monotonic_time();
+	if (!passim_server_avahi_register(self, error))
+		return FALSE;
+	PASSIM_TRACE2(publish__stage, "register", g_get_monotonic_time() - start_time);
+	passim_trace_mark(start_time, "publish-register", passim_item_get_hash(item));
+
+	/* keep as seekable zstd and build compressed variants in the background */
+	if (chunks == NULL && passim_config_get_compress_at_rest(self->kf) &&
+	    passim_encoding_is_supported(PASSIM_ENCODING_ZSTD))
+		passim_server_store_async(self, item, blob);
+	else
+		passim_server_variants_build(self, passim_item_get_hash(item), blob);
+	if (passim_config_get_compress_deltas(self->kf) &&
+	    passim_encoding_is_supported(PASSIM_ENCODING_ZSTD))
+		passim_server_delta_async(self, item, blob);
+	return TRUE;
+}
+
+static guint64
+passim_server_get_requests(PassimServer *self)
+{
+	guint64 requests = 0;
+	for (guint i = 0; i < PASSIM_METRICS_OUTCOME_LAST; i++)
+		requests += passim_metrics_get_outcome(self->metrics, i);
+	return requests;
+}
+
+static void
+passim_server_sample_take(PassimServer *self, PassimServerSample *sample)
+{
+	sample->timestamp = g_get_monotonic_time();
+	sample->requests = passim_server_get_requests(self);
+	sample->bytes_served =
+	    passim_metrics_get_counter(self->metrics, PASSIM_METRICS_COUNTER_BYTES_SERVED);
+}
+
+/* the 1-minute load average divided by the number of CPUs, or 0 if unknown */
+static gdouble
+passim_server_get_load(void)
+{
+	g_autofree gchar *buf = NULL;
+
+	if (!g_file_get_contents("/proc/loadavg", &buf, NULL, NULL))
+		return 0.0;
+	return g_ascii_strtod(buf, NULL) / MAX(g_get_num_processors(), 1);
+}
+
+static gboolean
+passim_server_sample_cb(gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	self->sample_prev = self->sample_cur;
+	passim_server_sample_take(self, &self->sample_cur);
+	if (passim_config_get_adaptive_share_limit(self->kf))
+		self->load = passim_server_get_load();
+	return G_SOURCE_CONTINUE;
+}
+
+typedef struct {
+	PassimServer *self;
+	gchar *uri;
+	PassimItem *item; /* nullable, and the checksum is only verified if set */
+	gsize max_size;
+	guint64 rate;
+	GPtrArray *peers; /* of utf-8 host:port with some of the item, or NULL */
+	GAsyncReadyCallback callback;
+} PassimServerFetchHelper;
+
+static void
+passim_server_fetch_helper_free(PassimServerFetchHelper *helper)
+{
+	if (helper->item != NULL)
+		g_object_unref(helper->item);
+	if (helper->peers != NULL)
+		g_ptr_array_unref(helper->peers);
+	g_free(helper->uri);
+	g_free(helper);
+}
+
+static void
+passim_server_fetch_thread_cb(GTask *task,
+			      gpointer source_object,
+			      gpointer task_data,
+			      GCancellable *cancellable)
+{
+	PassimServerFetchHelper *helper = (PassimServerFetchHelper *)task_data;
+	GBytes *blob;
+	GError *error = NULL;
+
+	/* this is only ever speculative, so should not slow down anything else */
+	passim_fetch_lower_priority();
+	blob = passim_fetch_bytes(helper->uri,
+				  helper->item != NULL ? passim_item_get_hash(helper->item) : NULL,
+				  helper->max_size,
+				  helper->rate,
+				  cancellable,
+				  &error);
+	if (blob == NULL) {
+		g_task_return_error(task, error);
+		return;
+	}
+	g_task_return_pointer(task, blob, (GDestroyNotify)g_bytes_unref);
+}
+
+static void
+passim_server_fetch_async(PassimServer *self,
+			  const gchar *uri,
+			  PassimItem *item,
+			  gsize max_size,
+			  guint64 rate,
+			  GAsyncReadyCallback callback)
+{
+	PassimServerFetchHelper *helper = g_new0(PassimServerFetchHelper, 1);
+	g_autoptr(GTask) task = g_task_new(NULL, NULL, callback, self);
+
+	helper->uri = g_strdup(uri);
+	helper->item = item != NULL ? g_object_ref(item) : NULL;
+	helper->max_size = max_size;
+	helper->rate = rate;
+	g_task_set_task_data(task, helper, (GDestroyNotify)passim_server_fetch_helper_free);
+	g_task_run_in_thread(task, passim_server_fetch_thread_cb);
+}
+
+/* from the download thread, as the partial items are only used from the main thread */
+typedef struct {
+	PassimServer *self;
+	gchar *hash;
+	guint idx;
+	PassimServerPartial *partial; /* nullable */
+} PassimServerPartialUpdate;
+
+static void
+passim_server_partial_update_free(PassimServerPartialUpdate *update)
+{
+	if (update->partial != NULL)
+		passim_server_partial_free(update->partial);
+	g_free(update->hash);
+	g_free(update);
+}
+
+static void
+passim_server_partial_update(PassimServer *self,
+			     const gchar *hash,
+			     guint idx,
+			     PassimServerPartial *partial,
+			     GSourceFunc func)
+{
+	PassimServerPartialUpdate *update = g_new0(PassimServerPartialUpdate, 1);
+	update->self = self;
+	update->hash = g_strdup(hash);
+	update->idx = idx;
+	update->partial = partial;
+	g_main_context_invoke_full(NULL,
+				   G_PRIORITY_DEFAULT,
+				   func,
+				   update,
+				   (GDestroyNotify)passim_server_partial_update_free);
+}
+
+static gboolean
+passim_server_partial_added_cb(gpointer user_data)
+{
+	PassimServerPartialUpdate *update = (PassimServerPartialUpdate *)user_data;
+	PassimServer *self = update->self;
+	g_autoptr(GError) error = NULL;
+
+	g_hash_table_insert(self->partials,
+			    g_strdup(update->hash),
+			    g_steal_pointer(&update->partial));
+	if (!passim_server_avahi_register(self, &error))
+		g_warning("failed to register: %s", error->message);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+passim_server_partial_block_cb(gpointer user_data)
+{
+	PassimServerPartialUpdate *update = (PassimServerPartialUpdate *)user_data;
+	PassimServerPartial *partial = g_hash_table_lookup(update->self->partials, update->hash);
+	if (partial != NULL)
+		passim_bitmap_set(partial->bitmap, update->idx);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+passim_server_partial_removed_cb(gpointer user_data)
+{
+	PassimServerPartialUpdate *update = (PassimServerPartialUpdate *)user_data;
+	PassimServer *self = update->self;
+	PassimServerPartial *partial = g_hash_table_lookup(self->partials, update->hash);
+	g_autoptr(GError) error = NULL;
+
+	if (partial == NULL)
+		return G_SOURCE_REMOVE;
+	if (g_unlink(partial->filename) != 0 && errno != ENOENT)
+		g_warning("failed to delete %s: %s", partial->filename, g_strerror(errno));
+	g_hash_table_remove(self->partials, update->hash);
+	if (!passim_server_avahi_register(self, &error))
+		g_warning("failed to register: %s", error->message);
+	return G_SOURCE_REMOVE;
+}
+
+/* the block hashes, which have to be for no more than the maximum size */
+static gchar *
+passim_server_swarm_fetch_merkle(PassimServerFetchHelper *helper,
+				 GCancellable *cancellable,
+				 GError **error)
+{
+	gsize max_size = (helper->max_size / PASSIM_MERKLE_BLOCK_SIZE + 1) * 65 + 256;
+	g_autofree gchar *uri = g_strdup_printf("%s&merkle=1", helper->uri);
+	g_autoptr(GBytes) blob = NULL;
+
+	blob = passim_fetch_bytes(uri, NULL, max_size, 0, cancellable, error);
+	if (blob == NULL)
+		return NULL;
+	return g_strndup(g_bytes_get_data(blob, NULL), g_bytes_get_size(blob));
+}
+
+/* what the other machines downloading the same item have now, dropping any that fail */
+static void
+passim_server_swarm_refresh(PassimServerFetchHelper *helper,
+			    GPtrArray *bitmaps,
+			    guint n_blocks,
+			    GCancellable *cancellable)
+{
+	g_autofree gchar *basename =
+	    g_uri_escape_string(passim_item_get_basename(helper->item), NULL, FALSE);
+	g_autoptr(GPtrArray) peers = g_ptr_array_new_with_free_func(g_free);
+
+	g_ptr_array_set_size(bitmaps, 0);
+	for (guint i = 0; i < helper->peers->len; i++) {
+		const gchar *address = g_ptr_array_index(helper->peers, i);
+		PassimBitmap *bitmap = NULL;
+		g_autofree gchar *str = NULL;
+		g_autofree gchar *uri = NULL;
+		g_autoptr(GBytes) blob = NULL;
+		g_autoptr(GError) error = NULL;
+
+		uri = g_strdup_printf("https://%s/%s?sha256=%s&bitmap=1",
+				      address,
+				      basename,
+				      passim_item_get_hash(helper->item));
+		blob = passim_fetch_bytes(uri, NULL, n_blocks / 4 + 32, 0, cancellable, &error);
+		if (blob != NULL) {
+			str = g_strndup(g_bytes_get_data(blob, NULL), g_bytes_get_size(blob));
+			bitmap = passim_bitmap_from_string(str, &error);
+		}
+		if (bitmap != NULL && passim_bitmap_get_size(bitmap) != n_blocks) {
+			g_set_error(&error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "expected %u blocks, got %u",
+				    n_blocks,
+				    passim_bitmap_get_size(bitmap));
+			g_clear_pointer(&bitmap, passim_bitmap_free);
+		}
+		if (bitmap == NULL) {
+			g_debug("not using %s: %s", address, error->message);
+			continue;
+		}
+		g_ptr_array_add(peers, g_strdup(address));
+		g_ptr_array_add(bitmaps, bitmap);
+	}
+	g_ptr_array_unref(helper->peers);
+	helper->peers = g_steal_pointer(&peers);
+}
+
+/* a random machine that has the block already, or -1 for none */
+static gint
+passim_server_swarm_select(GPtrArray *bitmaps, guint idx)
+{
+	g_autoptr(GArray) candidates = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	for (guint i = 0; i < bitmaps->len; i++) {
+		if (passim_bitmap_get(g_ptr_array_index(bitmaps, i), idx))
+			g_array_append_val(candidates, i);
+	}
+	if (candidates->len == 0)
+		return -1;
+	return g_array_index(candidates, guint, passim_policy_select_peer(candidates->len, NULL));
+}
+
+/* a block at a time, which only comes from the machine with all of it when nobody else has it */
+static GBytes *
+passim_server_swarm_download(PassimServerFetchHelper *helper,
+			     PassimMerkle *merkle,
+			     const gchar *filename,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	GOutputStream *ostream;
+	gint64 start_time = g_get_monotonic_time();
+	const gchar *hash = passim_item_get_hash(helper->item);
+	guint32 block_size = passim_merkle_get_block_size(merkle);
+	guint64 size = passim_merkle_get_size(merkle);
+	guint n_blocks = passim_merkle_get_n_blocks(merkle);
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *checksum = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GFile) file = g_file_new_for_path(filename);
+	g_autoptr(GFileIOStream) iostream = NULL;
+	g_autoptr(GPtrArray) bitmaps =
+	    g_ptr_array_new_with_free_func((GDestroyNotify)passim_bitmap_free);
+	g_autoptr(SoupSession) session = passim_fetch_session_new();
+
+	/* the whole file exists from the start, so that it can be mapped by the main thread */
+	iostream = g_file_create_readwrite(file, G_FILE_CREATE_PRIVATE, cancellable, error);
+	if (iostream == NULL)
+		return NULL;
+	if (!g_seekable_truncate(G_SEEKABLE(iostream), size, cancellable, error))
+		return NULL;
+	ostream = g_io_stream_get_output_stream(G_IO_STREAM(iostream));
+
+	basename = g_uri_escape_string(passim_item_get_basename(helper->item), NULL, FALSE);
+	for (guint i = 0; i < n_blocks; i++) {
+		guint64 offset = (guint64)i * block_size;
+		gsize length = MIN(block_size, size - offset);
+		gint idx = -1;
+		gint64 elapsed;
+		gint64 expected;
+		g_autoptr(GBytes) block = NULL;
+
+		if (helper->peers != NULL && i % PASSIM_SERVER_SWARM_REFRESH == 0)
+			passim_server_swarm_refresh(helper, bitmaps, n_blocks, cancellable);
+
+		/* a corrupt block means the peer is never used again */
+		idx = passim_server_swarm_select(bitmaps, i);
+		if (idx >= 0) {
+			const gchar *address = g_ptr_array_index(helper->peers, idx);
+			g_autofree gchar *uri = NULL;
+			g_autoptr(GError) error_local = NULL;
+
+			uri = g_strdup_printf("https://%s/%s?sha256=%s", address, basename, hash);
+			block = passim_fetch_range(session,
+						   uri,
+						   offset,
+						   length,
+						   cancellable,
+						   &error_local);
+			if (block != NULL &&
+			    !passim_merkle_verify_block(merkle, i, block, &error_local))
+				g_clear_pointer(&block, g_bytes_unref);
+			if (block == NULL) {
+				g_debug("not using %s again: %s", address, error_local->message);
+				g_ptr_array_remove_index(helper->peers, idx);
+				g_ptr_array_remove_index(bitmaps, idx);
+			}
+		}
+		if (block == NULL) {
+			block = passim_fetch_range(session,
+						   helper->uri,
+						   offset,
+						   length,
+						   cancellable,
+						   error);
+			if (block == NULL)
+				return NULL;
+			if (!passim_merkle_verify_block(merkle, i, block, error))
+				return NULL;
+		}
+		if (!g_seekable_seek(G_SEEKABLE(iostream), offset, G_SEEK_SET, cancellable, error))
+			return NULL;
+		if (!g_output_stream_write_all(ostream,
+					       g_bytes_get_data(block, NULL),
+					       g_bytes_get_size(block),
+					       NULL,
+					       cancellable,
+					       error))
+			return NULL;
+		passim_server_partial_update(helper->self,
+					     hash,
+					     i,
+					     NULL,
+					     passim_server_partial_block_cb);
+
+		/* sleep until the average is below the limit */
+		if (helper->rate == 0)
+			continue;
+		elapsed = g_get_monotonic_time() - start_time;
+		expected = (gint64)((offset + length) * G_USEC_PER_SEC / helper->rate);
+		if (expected > elapsed)
+			g_usleep(expected - elapsed);
+	}
+	if (!g_io_stream_close(G_IO_STREAM(iostream), cancellable, error))
+		return NULL;
+
+	/* the block hashes are only as trusted as the peer that sent them */
+	blob = passim_file_get_contents(filename, error);
+	if (blob == NULL)
+		return NULL;
+	checksum = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, blob);
+	if (g_strcmp0(checksum, hash) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s checksum was %s, expected %s",
+			    helper->uri,
+			    checksum,
+			    hash);
+		return NULL;
+	}
+	return g_steal_pointer(&blob);
+}
+
+static void
+passim_server_swarm_thread_cb(GTask *task,
+			      gpointer source_object,
+			      gpointer task_data,
+			      GCancellable *cancellable)
+{
+	PassimServerFetchHelper *helper = (PassimServerFetchHelper *)task_data;
+	PassimServerPartial *partial;
+	const gchar *hash = passim_item_get_hash(helper->item);
+	GBytes *blob;
+	GError *error = NULL;
+	g_autofree gchar *filename = passim_server_partial_filename(hash);
+	g_autofree gchar *str = NULL;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(PassimMerkle) merkle = NULL;
+
+	/* this is only ever speculative, so should not slow down anything else */
+	passim_fetch_lower_priority();
+
+	/* older versions and items published before block hashes were added */
+	str = passim_server_swarm_fetch_merkle(helper, cancellable, &error_local);
+	if (str != NULL)
+		merkle = passim_merkle_from_string(str, &error_local);
+	if (merkle != NULL && passim_merkle_get_size(merkle) > helper->max_size) {
+		g_set_error(&error_local,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s is larger than 0x%x bytes",
+			    hash,
+			    (guint)helper->max_size);
+		g_clear_pointer(&merkle, passim_merkle_free);
+	}
+	if (merkle == NULL || passim_merkle_get_size(merkle) < PASSIM_SERVER_SWARM_MIN_SIZE) {
+		if (merkle == NULL)
+			g_debug("downloading %s in one go: %s", hash, error_local->message);
+		blob = passim_fetch_bytes(helper->uri,
+					  hash,
+					  helper->max_size,
+					  helper->rate,
+					  cancellable,
+					  &error);
+		if (blob == NULL) {
+			g_task_return_error(task, error);
+			return;
+		}
+		g_task_return_pointer(task, blob, (GDestroyNotify)g_bytes_unref);
+		return;
+	}
+
+	/* owned by the main thread from now on, which removes the file once it is done */
+	if (!passim_mkdir_parent(filename, &error)) {
+		g_task_return_error(task, error);
+		return;
+	}
+	partial = g_new0(PassimServerPartial, 1);
+	partial->merkle = passim_merkle_from_string(str, NULL);
+	partial->bitmap = passim_bitmap_new(passim_merkle_get_n_blocks(merkle));
+	partial->filename = g_strdup(filename);
+	g_unlink(filename);
+	passim_server_partial_update(helper->self,
+				     hash,
+				     0,
+				     partial,
+				     passim_server_partial_added_cb);
+	blob = passim_server_swarm_download(helper, merkle, filename, cancellable, &error);
+	passim_server_partial_update(helper->self, hash, 0, NULL, passim_server_partial_removed_cb);
+	if (blob == NULL) {
+		g_task_return_error(task, error);
+		return;
+	}
+	g_task_return_pointer(task, blob, (GDestroyNotify)g_bytes_unref);
+}
+
+static void
+passim_server_download_find_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	PassimServerFetchHelper *helper = (PassimServerFetchHelper *)user_data;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GTask) task = g_task_new(NULL, NULL, helper->callback, helper->self);
+
+	/* not finding any is not an error */
+	helper->peers = passim_avahi_find_finish(PASSIM_AVAHI(source_object), res, &error);
+	if (helper->peers == NULL)
+		g_debug("no partial copies: %s", error->message);
+	g_task_set_task_data(task, helper, (GDestroyNotify)passim_server_fetch_helper_free);
+	g_task_run_in_thread(task, passim_server_swarm_thread_cb);
+}
+
+/* either downloading as a whole, or a block at a time */
+static gboolean
+passim_server_is_fetching(PassimServer *self, const gchar *hash)
+{
+	return g_hash_table_contains(self->fetching, hash) ||
+	       g_hash_table_contains(self->partials, hash);
+}
+
+/*
+ * large items are shared with other machines downloading the same thing before they complete --
+ * the @callback has to remove the item hash from self->fetching
+ */
+static void
+passim_server_download_async(PassimServer *self,
+			     const gchar *uri,
+			     PassimItem *item,
+			     gsize max_size,
+			     guint64 rate,
+			     GAsyncReadyCallback callback)
+{
+	PassimServerFetchHelper *helper = g_new0(PassimServerFetchHelper, 1);
+	g_autofree gchar *key = g_strdup_printf("partial-%s", passim_item_get_hash(item));
+
+	helper->self = self;
+	helper->uri = g_strdup(uri);
+	helper->item = g_object_ref(item);
+	helper->max_size = max_size;
+	helper->rate = rate;
+	helper->callback = callback;
+	g_hash_table_add(self->fetching, g_strdup(passim_item_get_hash(item)));
+	passim_avahi_find_async(self->avahi, key, NULL, passim_server_download_find_cb, helper);
+}
+
+/* what is left of PrefetchMaxSize, which can never be more than MaxItemSize */
+static guint64
+passim_server_prefetch_get_budget(PassimServer *self)
+{
+	GHashTableIter iter;
+	gpointer value;
+	guint64 max_size = passim_config_get_prefetch_max_size(self->kf);
+	guint64 total_size = 0;
+
+	g_hash_table_iter_init(&iter, self->items);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		PassimItem *item = PASSIM_ITEM(value);
+		if (g_strcmp0(passim_item_get_cmdline(item), PASSIM_SERVER_PREFETCH_CMDLINE) == 0)
+			total_size += passim_item_get_size(item);
+	}
+	if (total_size >= max_size)
+		return 0;
+	return MIN(max_size - total_size, passim_config_get_max_item_size(self->kf));
+}
+
+/* downloaded by the daemon itself, where @cmdline says why */
+static gboolean
+passim_server_publish_fetched(PassimServer *self,
+			      PassimItem *item,
+			      GBytes *blob,
+			      const gchar *cmdline,
+			      GError **error)
+{
+	g_autoptr(GDateTime) dt_now = g_date_time_new_now_utc();
+
+	/* published by something else while we were downloading */
+	if (g_hash_table_contains(self->items, passim_item_get_hash(item))) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_EXISTS,
+			    "%s already exists",
+			    passim_item_get_hash(item));
+		return FALSE;
+	}
+	passim_item_set_cmdline(item, cmdline);
+	passim_item_set_share_count(item, 0);
+	passim_item_set_ctime(item, dt_now);
+	return passim_server_publish_file(self, blob, item, error);
+}
+
+static void
+passim_server_prefetch_item_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	PassimServerFetchHelper *helper = g_task_get_task_data(G_TASK(res));
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GError) error = NULL;
+
+	self->prefetch_busy = FALSE;
+	g_hash_table_remove(self->fetching, passim_item_get_hash(helper->item));
+	blob = g_task_propagate_pointer(G_TASK(res), &error);
+	if (blob == NULL) {
+		g_warning("failed to prefetch: %s", error->message);
+		return;
+	}
+	if (!passim_server_publish_fetched(self,
+					   helper->item,
+					   blob,
+					   PASSIM_SERVER_PREFETCH_CMDLINE,
+					   &error)) {
+		g_warning("failed to publish prefetched item: %s", error->message);
+		return;
+	}
+	g_info("prefetched %s [%s]",
+	       passim_item_get_hash(helper->item),
+	       passim_item_get_basename(helper->item));
+	passim_metrics_counter_add(self->metrics,
+				   PASSIM_METRICS_COUNTER_PREFETCH_BYTES,
+				   g_bytes_get_size(blob));
+}
+
+static void
+passim_server_prefetch_catalog_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	PassimServerFetchHelper *helper = g_task_get_task_data(G_TASK(res));
+	PassimItem *item;
+	g_autofree gchar *address = NULL;
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *str = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) candidates = NULL;
+
+	blob = g_task_propagate_pointer(G_TASK(res), &error);
+	if (blob == NULL) {
+		g_warning("failed to get catalog: %s", error->message);
+		self->prefetch_busy = FALSE;
+		return;
+	}
+	str = g_strndup(g_bytes_get_data(blob, NULL), g_bytes_get_size(blob));
+	candidates = passim_index_catalog_parse(str, &error);
+	if (candidates == NULL) {
+		g_warning("failed to parse catalog from %s: %s", helper->uri, error->message);
+		self->prefetch_busy = FALSE;
+		return;
+	}
+	item = passim_policy_prefetch_select(candidates,
+					     self->items,
+					     passim_server_prefetch_get_budget(self));
+	if (item == NULL) {
+		g_debug("nothing to prefetch from %s", helper->uri);
+		self->prefetch_busy = FALSE;
+		return;
+	}
+	if (passim_server_is_fetching(self, passim_item_get_hash(item))) {
+		g_debug("already downloading %s", passim_item_get_hash(item));
+		self->prefetch_busy = FALSE;
+		return;
+	}
+
+	/* from the same peer, which is not trusted to send the right thing */
+	address = g_strndup(helper->uri, strlen(helper->uri) - strlen("/catalog"));
+	basename = g_uri_escape_string(passim_item_get_basename(item), NULL, FALSE);
+	uri = g_strdup_printf("%s/%s?sha256=%s", address, basename, passim_item_get_hash(item));
+	g_info("prefetching %s", uri);
+	passim_server_download_async(self,
+				     uri,
+				     item,
+				     passim_item_get_size(item),
+				     passim_config_get_prefetch_rate(self->kf),
+				     passim_server_prefetch_item_cb);
+}
+
+static void
+passim_server_prefetch_find_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	const gchar *address;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) addresses = NULL;
+
+	addresses = passim_avahi_find_finish(PASSIM_AVAHI(source_object), res, &error);
+	if (addresses == NULL) {
+		g_debug("no catalogs: %s", error->message);
+		self->prefetch_busy = FALSE;
+		return;
+	}
+	address = g_ptr_array_index(addresses, passim_policy_select_peer(addresses->len, NULL));
+	uri = g_strdup_printf("https://%s/catalog", address);
+	passim_server_fetch_async(self,
+				  uri,
+				  NULL,
+				  PASSIM_SERVER_CATALOG_MAX_SIZE,
+				  0,
+				  passim_server_prefetch_catalog_cb);
+}
+
+/* only when nobody else is using the machine or the network */
+static gboolean
+passim_server_prefetch_cb(gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	g_autofree gchar *hours = passim_config_get_prefetch_hours(self->kf);
+	g_autoptr(GDateTime) dt_now = g_date_time_new_now_local();
+
+	if (self->prefetch_busy || self->status != PASSIM_STATUS_RUNNING)
+		return G_SOURCE_CONTINUE;
+	if (g_network_monitor_get_network_metered(self->network_monitor))
+		return G_SOURCE_CONTINUE;
+	if (!passim_policy_prefetch_hour_allowed(hours, dt_now))
+		return G_SOURCE_CONTINUE;
+	if (self->sample_cur.requests != self->sample_prev.requests) {
+		g_debug("not prefetching as not idle");
+		return G_SOURCE_CONTINUE;
+	}
+	if (passim_server_prefetch_get_budget(self) == 0) {
+		g_debug("not prefetching as PrefetchMaxSize reached");
+		return G_SOURCE_CONTINUE;
+	}
+	self->prefetch_busy = TRUE;
+	passim_avahi_find_async(self->avahi,
+				"catalog",
+				NULL,
+				passim_server_prefetch_find_cb,
+				self);
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+passim_server_replicate_item_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	PassimServerFetchHelper *helper = g_task_get_task_data(G_TASK(res));
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GError) error = NULL;
+
+	g_hash_table_remove(self->fetching, passim_item_get_hash(helper->item));
+	blob = g_task_propagate_pointer(G_TASK(res), &error);
+	if (blob == NULL) {
+		g_warning("failed to replicate: %s", error->message);
+		return;
+	}
+	if (!passim_server_publish_fetched(self,
+					   helper->item,
+					   blob,
+					   PASSIM_SERVER_REPLICATE_CMDLINE,
+					   &error)) {
+		g_warning("failed to publish replicated item: %s", error->message);
+		return;
+	}
+	g_info("replicated %s [%s]",
+	       passim_item_get_hash(helper->item),
+	       passim_item_get_basename(helper->item));
+}
+
+/* anything older would be refused as expired anyway */
+static void
+passim_server_replicate_hmacs_prune(PassimServer *self, gint64 now)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, self->hmacs);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		gint64 timestamp = *((gint64 *)value);
+		if (ABS(now - timestamp) > PASSIM_SERVER_REPLICATE_MAX_SKEW)
+			g_hash_table_iter_remove(&iter);
+	}
+}
+
+/* another machine is asking us to copy an item from it, which is only done with the secret */
+static void
+passim_server_msg_send_replicate(PassimServer *self,
+				 SoupServerMessage *msg,
+				 GHashTable *query,
+				 const gchar *inet_addrstr)
+{
+	const gchar *basename = NULL;
+	const gchar *hash = NULL;
+	const gchar *port_str = NULL;
+	const gchar *signature = NULL;
+	const gchar *timestamp_str = NULL;
+	gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+	gint64 timestamp = 0;
+	guint64 port = 0;
+	g_autofree gchar *basename_escaped = NULL;
+	g_autofree gchar *secret = passim_config_get_replication_secret(self->kf);
+	g_autofree gchar *uri = NULL;
+	g_autoptr(PassimItem) item = NULL;
+
+	if (secret == NULL) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+		return;
+	}
+	if (soup_server_message_get_method(msg) != SOUP_METHOD_POST) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_METHOD_NOT_ALLOWED, NULL);
+		return;
+	}
+	if (query != NULL) {
+		hash = g_hash_table_lookup(query, "sha256");
+		basename = g_hash_table_lookup(query, "basename");
+		port_str = g_hash_table_lookup(query, "port");
+		timestamp_str = g_hash_table_lookup(query, "time");
+		signature = g_hash_table_lookup(query, "hmac");
+	}
+	if (hash == NULL || basename == NULL || port_str == NULL || timestamp_str == NULL ||
+	    signature == NULL) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_BAD_REQUEST,
+					     "sha256=, basename=, port=, time= and hmac= required");
+		return;
+	}
+	if (!passim_digest_kind_is_valid(PASSIM_DIGEST_KIND_SHA256, hash) ||
+	    basename[0] == '\0' || basename[0] == '.' || strchr(basename, '/') != NULL ||
+	    !g_ascii_string_to_unsigned(port_str, 10, 1, G_MAXUINT16, &port, NULL) ||
+	    !g_ascii_string_to_signed(timestamp_str, 10, 0, G_MAXINT64, &timestamp, NULL)) {
+		passim_server_msg_send_error(self, msg, SOUP_STATUS_NOT_ACCEPTABLE, NULL);
+		return;
+	}
+
+	/* a captured request cannot be replayed later */
+	if (ABS(now - timestamp) > PASSIM_SERVER_REPLICATE_MAX_SKEW) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_FORBIDDEN,
+					     "request has expired");
+		return;
+	}
+	if (!passim_digest_verify_replicate(secret,
+					    hash,
+					    basename,
+					    port,
+					    timestamp,
+					    signature)) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_FORBIDDEN,
+					     "invalid signature");
+		return;
+	}
+
+	/* ...or within the window */
+	passim_server_replicate_hmacs_prune(self, now);
+	if (g_hash_table_contains(self->hmacs, signature)) {
+		passim_server_msg_send_error(self,
+					     msg,
+					     SOUP_STATUS_FORBIDDEN,
+					     "request has already been used");
+		return;
+	}
+	g_hash_table_insert(self->hmacs,
+			    g_strdup(signature),
+			    g_memdup2(&timestamp, sizeof(timestamp)));
+	passim_server_msg_get_request(msg)->hash = g_strdup(hash);
+
+	/* nothing to do */
+	if (g_hash_table_contains(self->items, hash) || passim_server_is_fetching(self, hash)) {
+		soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+		return;
+	}
+
+	/* copied from the machine that asked, which is not trusted to send the right thing */
+	basename_escaped = g_uri_escape_string(basename, NULL, FALSE);
+	if (strchr(inet_addrstr, ':') != NULL) {
+		uri = g_strdup_printf("https://[%s]:%u/%s?sha256=%s",
+				      inet_addrstr,
+				      (guint)port,
+				      basename_escaped,
+				      hash);
+	} else {
+		uri = g_strdup_printf("https://%s:%u/%s?sha256=%s",
+				      inet_addrstr,
+				      (guint)port,
+				      basename_escaped,
+				      hash);
+	}
+	item = passim_item_new();
+	passim_item_set_hash(item, hash);
+	passim_item_set_basename(item, basename);
+	g_info("replicating %s", uri);
+	passim_server_download_async(self,
+				     uri,
+				     item,
+				     passim_config_get_max_item_size(self->kf),
+				     0,
+				     passim_server_replicate_item_cb);
+	soup_server_message_set_status(msg, SOUP_STATUS_ACCEPTED, NULL);
+}
+
+typedef struct {
+	PassimServer *self;
+	gchar *hash;
+	GPtrArray *holders; /* of utf-8 host:port, or NULL */
+} PassimServerReplicateHelper;
+
+static void
+passim_server_replicate_helper_free(PassimServerReplicateHelper *helper)
+{
+	if (helper->holders != NULL)
+		g_ptr_array_unref(helper->holders);
+	g_free(helper->hash);
+	g_free(helper);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimServerReplicateHelper, passim_server_replicate_helper_free)
+
+static void
+passim_server_replicate_post_thread_cb(GTask *task,
+				       gpointer source_object,
+				       gpointer task_data,
+				       GCancellable *cancellable)
+{
+	const gchar *uri = (const gchar *)task_data;
+	GError *error = NULL;
+
+	if (!passim_fetch_post(uri, cancellable, &error)) {
+		g_task_return_error(task, error);
+		return;
+	}
+	g_task_return_boolean(task, TRUE);
+}
+
+static void
+passim_server_replicate_post_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GError) error = NULL;
+	if (!g_task_propagate_boolean(G_TASK(res), &error))
+		g_warning("failed to ask for replication: %s", error->message);
+}
 
-	/* we've shared this enough now */
-	if (passim_item_get_share_limit(item) > 0 &&
-	    passim_item_get_share_count(item) >= passim_item_get_share_limit(item)) {
-		g_autoptr(GError) error = NULL;
-		g_debug("deleting %s as share limit reached", passim_item_get_hash(item));
-		if (!passim_server_delete_item(self, item, &error))
-			g_warning("failed: %s", error->message);
-	}
+/* the peer downloads the item from us, so only the request needs to be signed */
+static void
+passim_server_replicate_push(PassimServer *self,
+			     PassimItem *item,
+			     const gchar *address,
+			     const gchar *secret)
+{
+	gint64 timestamp = g_get_real_time() / G_USEC_PER_SEC;
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *signature = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(GTask) task = g_task_new(NULL, NULL, passim_server_replicate_post_cb, self);
+
+	signature = passim_digest_sign_replicate(secret,
+						 passim_item_get_hash(item),
+						 passim_item_get_basename(item),
+						 self->port,
+						 timestamp);
+	basename = g_uri_escape_string(passim_item_get_basename(item), NULL, FALSE);
+	uri = g_strdup_printf("https://%s/replicate?sha256=%s&basename=%s&port=%u"
+			      "&time=%" G_GINT64_FORMAT "&hmac=%s",
+			      address,
+			      passim_item_get_hash(item),
+			      basename,
+			      self->port,
+			      timestamp,
+			      signature);
+	g_info("asking %s to replicate %s", address, passim_item_get_hash(item));
+	g_task_set_task_data(task, g_steal_pointer(&uri), g_free);
+	g_task_run_in_thread(task, passim_server_replicate_post_thread_cb);
 }
 
 static void
-passim_server_avahi_find_cb(GObject *source_object, GAsyncResult *res, gpointer data)
+passim_server_replicate_find_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
-	guint index_random;
+	PassimItem *item;
+	g_autofree gchar *secret = NULL;
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GPtrArray) addresses = NULL;
-	g_autoptr(PassimServerContext) ctx = (PassimServerContext *)data;
+	g_autoptr(GPtrArray) peers = g_ptr_array_new();
+	g_autoptr(PassimServerReplicateHelper) helper = (PassimServerReplicateHelper *)user_data;
+	PassimServer *self = helper->self;
 
 	addresses = passim_avahi_find_finish(PASSIM_AVAHI(source_object), res, &error);
 	if (addresses == NULL) {
-		passim_server_msg_send_error(ctx->self, ctx->msg, 404, error->message);
+		g_debug("no machines will replicate: %s", error->message);
 		return;
 	}
+	item = g_hash_table_lookup(self->items, helper->hash);
+	secret = passim_config_get_replication_secret(self->kf);
+	if (item == NULL || secret == NULL)
+		return;
 
-	/* display all, and chose an option at random */
-	index_random = g_random_int_range(0, addresses->len);
+	/* only the machines that do not already have it */
 	for (guint i = 0; i < addresses->len; i++) {
 		const gchar *address = g_ptr_array_index(addresses, i);
-		if (i == index_random) {
-			g_info("chosen address: %s", address);
-			passim_server_context_send_redirect(ctx, address);
-		} else {
-			g_info("ignore address: %s", address);
-		}
+		if (helper->holders != NULL &&
+		    g_ptr_array_find_with_equal_func(helper->holders, address, g_str_equal, NULL))
+			continue;
+		g_ptr_array_add(peers, (gpointer)address);
 	}
+	if (peers->len == 0) {
+		g_debug("all machines that will replicate %s already have it", helper->hash);
+		return;
+	}
+	passim_server_replicate_push(self,
+				     item,
+				     g_ptr_array_index(peers,
+						       passim_policy_select_peer(peers->len, NULL)),
+				     secret);
 }
 
-static gboolean
-passim_server_is_loopback(const gchar *inet_addr)
+/* there are enough copies on the LAN, and so the normal policy applies */
+static void
+passim_server_item_replicated(PassimServer *self, PassimItem *item)
 {
-	g_autoptr(GInetAddress) address = g_inet_address_new_from_string(inet_addr);
-	return g_inet_address_get_is_loopback(address);
+	g_autofree gchar *filename = g_file_get_path(passim_item_get_file(item));
+	g_autoptr(GError) error = NULL;
+
+	g_info("%s now has %u replicas",
+	       passim_item_get_hash(item),
+	       GPOINTER_TO_UINT(g_hash_table_lookup(self->replicas, passim_item_get_hash(item))));
+	passim_item_remove_flag(item, PASSIM_ITEM_FLAG_REPLICATING);
+	if (!passim_xattr_replace_uint32(filename, "user.replicating", 0, &error))
+		g_warning("failed to clear replicating: %s", error->message);
+	passim_server_item_check_share_limit(self, item);
 }
 
 static void
-passim_server_handler_cb(SoupServer *server,
-			 SoupServerMessage *msg,
-			 const gchar *path,
-			 GHashTable *query,
-			 gpointer user_data)
-{
-	PassimServer *self = (PassimServer *)user_data;
-	GInetAddress *inet_addr;
-	GSocketAddress *socket_addr;
-	PassimItem *item;
-	GUri *uri = soup_server_message_get_uri(msg);
-	gboolean is_loopback;
-	g_autofree gchar *hash = NULL;
-	g_autofree gchar *inet_addrstr = NULL;
-	g_auto(GStrv) request = NULL;
-	g_autoptr(PassimServerContext) ctx = g_new0(PassimServerContext, 1);
+passim_server_replicas_find_cb(GObject *source_object, GAsyncResult *res, gpointer user_data);
 
-	/* only GET supported */
-	if (soup_server_message_get_method(msg) != SOUP_METHOD_GET) {
-		passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
-		return;
+static void
+passim_server_replicas_find_next(PassimServer *self)
+{
+	while (self->n_counting < PASSIM_SERVER_REPLICAS_MAX_FINDS &&
+	       !g_queue_is_empty(self->counting)) {
+		PassimServerReplicateHelper *helper = g_new0(PassimServerReplicateHelper, 1);
+		helper->self = self;
+		helper->hash = g_queue_pop_head(self->counting);
+		self->n_counting++;
+		passim_avahi_find_async(self->avahi,
+					helper->hash,
+					NULL,
+					passim_server_replicas_find_cb,
+					helper);
 	}
+}
 
-	/* who is connecting */
-	socket_addr = soup_server_message_get_remote_address(msg);
-	if (socket_addr == NULL) {
-		passim_server_msg_send_error(self,
-					     msg,
-					     SOUP_STATUS_BAD_REQUEST,
-					     "failed to get client connection address");
-		return;
-	}
-	inet_addr = g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(socket_addr));
-	inet_addrstr = g_inet_address_to_string(inet_addr);
-	is_loopback = passim_server_is_loopback(inet_addrstr);
-	g_info("accepting HTTP/1.%u %s %s %s from %s:%u (%s)",
-	       soup_server_message_get_http_version(msg),
-	       soup_server_message_get_method(msg),
-	       path,
-	       g_uri_get_query(uri) != NULL ? g_uri_get_query(uri) : "",
-	       inet_addrstr,
-	       g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(socket_addr)),
-	       is_loopback ? "loopback" : "remote");
+static void
+passim_server_replicas_find_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	PassimItem *item;
+	guint replicas;
+	g_autofree gchar *secret = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) addresses = NULL;
+	g_autoptr(PassimServerReplicateHelper) helper = (PassimServerReplicateHelper *)user_data;
+	PassimServer *self = helper->self;
 
-	/* just return the index */
-	if (g_strcmp0(path, "/") == 0) {
-		if (!is_loopback) {
-			passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
-			return;
-		}
-		passim_server_send_index(self, msg);
-		return;
-	}
-	if (g_strcmp0(path, "/favicon.ico") == 0 || g_strcmp0(path, "/style.css") == 0) {
-		g_autofree gchar *fn = g_build_filename(PACKAGE_DATADIR, PACKAGE_NAME, path, NULL);
-		if (!is_loopback) {
-			passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
-			return;
-		}
-		passim_server_msg_send_file(self, msg, fn);
-		return;
-	}
+	/* let the next item be counted */
+	self->n_counting--;
+	passim_server_replicas_find_next(self);
 
-	/* find the request hash argument */
-	if (g_uri_get_query(uri) == NULL) {
-		passim_server_msg_send_error(self, msg, SOUP_STATUS_BAD_REQUEST, NULL);
-		return;
-	}
-	request = g_strsplit(g_uri_get_query(uri), "&", -1);
-	for (guint i = 0; request[i] != NULL; i++) {
-		g_auto(GStrv) kv = g_strsplit(request[i], "=", -1);
-		if (g_strv_length(kv) != 2)
-			continue;
-		if (g_strcmp0(kv[0], "sha256") == 0) {
-			hash = g_strdup(kv[1]);
-			break;
-		}
-	}
-	if (hash == NULL) {
-		passim_server_msg_send_error(self,
-					     msg,
-					     SOUP_STATUS_BAD_REQUEST,
-					     "sha256= argument required");
+	/* not finding any is not an error */
+	addresses = passim_avahi_find_finish(PASSIM_AVAHI(source_object), res, &error);
+	replicas = addresses != NULL ? addresses->len : 0;
+	item = g_hash_table_lookup(self->items, helper->hash);
+	if (item == NULL)
 		return;
-	}
-	if (!g_str_is_ascii(hash) || strlen(hash) != 64) {
-		passim_server_msg_send_error(self,
-					     msg,
-					     SOUP_STATUS_NOT_ACCEPTABLE,
-					     "sha256 hash is malformed");
+	g_hash_table_insert(self->replicas, g_strdup(helper->hash), GUINT_TO_POINTER(replicas));
+	passim_server_item_adapt_share_limit(self, item);
+	if (!passim_item_has_flag(item, PASSIM_ITEM_FLAG_REPLICATING)) {
+		passim_server_item_check_share_limit(self, item);
 		return;
 	}
-
-	/* already exists locally */
-	item = g_hash_table_lookup(self->items, hash);
-	if (item != NULL) {
-		if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED)) {
-			passim_server_msg_send_error(self, msg, SOUP_STATUS_LOCKED, NULL);
-			return;
-		}
-		passim_server_msg_send_item(self, msg, item);
+	if (replicas >= passim_config_get_replication_target(self->kf)) {
+		passim_server_item_replicated(self, item);
 		return;
 	}
 
-	/* only localhost is allowed to scan for hashes */
-	if (!is_loopback) {
-		passim_server_msg_send_error(self, msg, SOUP_STATUS_FORBIDDEN, NULL);
+	/* ask a willing machine that does not have it yet */
+	secret = passim_config_get_replication_secret(self->kf);
+	if (secret == NULL)
 		return;
-	}
-
-	/* create context */
-	ctx->self = self;
-	ctx->msg = g_object_ref(msg);
-	ctx->hash = g_strdup(hash);
-	ctx->basename = g_strdup(request[0]);
-
-	/* look for remote servers with this hash */
-	g_info("searching for %s", hash);
-	soup_server_message_pause(msg);
+	helper->holders = g_steal_pointer(&addresses);
 	passim_avahi_find_async(self->avahi,
-				hash,
+				"replicate",
 				NULL,
-				passim_server_avahi_find_cb,
-				g_steal_pointer(&ctx));
+				passim_server_replicate_find_cb,
+				g_steal_pointer(&helper));
+}
+
+/* count the other machines advertising the item, once the ones already waiting are done */
+static void
+passim_server_replicas_update(PassimServer *self, PassimItem *item)
+{
+	const gchar *hash = passim_item_get_hash(item);
+	if (g_queue_find_custom(self->counting, hash, (GCompareFunc)g_strcmp0) == NULL)
+		g_queue_push_tail(self->counting, g_strdup(hash));
+	passim_server_replicas_find_next(self);
 }
 
 static gboolean
-passim_server_publish_file(PassimServer *self, GBytes *blob, PassimItem *item, GError **error)
+passim_server_replication_cb(gpointer user_data)
 {
-	g_autofree gchar *hash = NULL;
-	g_autofree gchar *localstate_dir = NULL;
-	g_autofree gchar *localstate_filename = NULL;
-	g_autofree gchar *hashed_filename = NULL;
-	g_autoptr(GFile) file = NULL;
+	PassimServer *self = (PassimServer *)user_data;
+	g_autoptr(GList) items = NULL;
 
-	hash = g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, blob);
-	if (g_hash_table_contains(self->items, hash)) {
-		g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "%s already exists", hash);
-		return FALSE;
+	if (self->status != PASSIM_STATUS_RUNNING)
+		return G_SOURCE_CONTINUE;
+	items = g_hash_table_get_values(self->items);
+	for (GList *l = items; l != NULL; l = l->next) {
+		PassimItem *item = PASSIM_ITEM(l->data);
+		if (!passim_item_has_flag(item, PASSIM_ITEM_FLAG_REPLICATING) ||
+		    passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED))
+			continue;
+		passim_server_replicas_update(self, item);
 	}
-	hashed_filename = g_strdup_printf("%s-%s", hash, passim_item_get_basename(item));
+	return G_SOURCE_CONTINUE;
+}
 
-	localstate_dir = g_build_filename(PACKAGE_LOCALSTATEDIR, "lib", PACKAGE_NAME, "data", NULL);
-	if (!passim_mkdir(localstate_dir, error))
-		return FALSE;
-	localstate_filename = g_build_filename(localstate_dir, hashed_filename, NULL);
-	if (g_file_test(localstate_filename, G_FILE_TEST_EXISTS)) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    G_IO_ERROR_EXISTS,
-			    "%s already exists",
-			    localstate_filename);
-		return FALSE;
+/* the replicating items are already checked more often */
+static gboolean
+passim_server_adapt_cb(gpointer user_data)
+{
+	PassimServer *self = (PassimServer *)user_data;
+	g_autoptr(GList) items = NULL;
+
+	if (self->status != PASSIM_STATUS_RUNNING)
+		return G_SOURCE_CONTINUE;
+	items = g_hash_table_get_values(self->items);
+	for (GList *l = items; l != NULL; l = l->next) {
+		PassimItem *item = PASSIM_ITEM(l->data);
+		if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_REPLICATING) ||
+		    passim_item_has_flag(item, PASSIM_ITEM_FLAG_DISABLED))
+			continue;
+		if (passim_item_get_share_limit(item) == 0 ||
+		    passim_item_get_share_limit(item) == G_MAXUINT32)
+			continue;
+		passim_server_replicas_update(self, item);
 	}
-	if (!g_file_set_contents(localstate_filename,
-				 g_bytes_get_data(blob, NULL),
-				 g_bytes_get_size(blob),
-				 error))
-		return FALSE;
-	if (!passim_xattr_set_uint32(localstate_filename,
-				     "user.max_age",
-				     passim_item_get_max_age(item),
-				     error))
-		return FALSE;
-	if (!passim_xattr_set_uint32(localstate_filename,
-				     "user.share_limit",
-				     passim_item_get_share_limit(item),
-				     error))
-		return FALSE;
-	if (!passim_xattr_set_string(localstate_filename,
-				     "user.cmdline",
-				     passim_item_get_cmdline(item),
-				     error))
-		return FALSE;
+	return G_SOURCE_CONTINUE;
+}
 
-	/* only allowed when rebooted */
-	if (passim_item_has_flag(item, PASSIM_ITEM_FLAG_NEXT_REBOOT)) {
-		g_autofree gchar *boot_time = passim_get_boot_time();
-		if (!passim_xattr_set_string(localstate_filename,
-					     "user.boot_time",
-					     boot_time,
-					     error))
-			return FALSE;
-		passim_item_add_flag(item, PASSIM_ITEM_FLAG_DISABLED);
+/* with the storage ratio and CPU cost for items compressed at rest, and any delta */
+static GVariant *
+passim_server_item_to_variant(PassimServer *self, PassimItem *item)
+{
+	PassimServerStored *stored = g_hash_table_lookup(self->stored, passim_item_get_hash(item));
+	PassimServerDelta *delta = g_hash_table_lookup(self->deltas, passim_item_get_hash(item));
+	GPtrArray *chunks = g_hash_table_lookup(self->chunked, passim_item_get_hash(item));
+	PassimDigests *digests = g_hash_table_lookup(self->digests, passim_item_get_hash(item));
+	GVariantBuilder builder;
+	gboolean has_digests = FALSE;
+	g_autoptr(GVariant) value = g_variant_ref_sink(passim_item_to_variant(item));
+	g_autoptr(GVariantDict) dict = NULL;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
+	for (guint i = PASSIM_DIGEST_KIND_SHA256 + 1; i < PASSIM_DIGEST_KIND_LAST; i++) {
+		const gchar *digest = digests != NULL ? digests->values[i] : NULL;
+		if (digest == NULL)
+			continue;
+		g_variant_builder_add(&builder, "{ss}", passim_digest_kind_to_string(i), digest);
+		has_digests = TRUE;
 	}
+	if (stored == NULL && delta == NULL && chunks == NULL && !has_digests) {
+		g_variant_builder_clear(&builder);
+		return g_steal_pointer(&value);
+	}
+	dict = g_variant_dict_new(value);
+	if (stored != NULL) {
+		g_variant_dict_insert(dict, "stored-size", "t", stored->size);
+		g_variant_dict_insert(dict, "compress-time", "t", stored->compress_us);
+		g_variant_dict_insert(dict, "decompress-time", "t", stored->decompress_us);
+	}
+	if (delta != NULL) {
+		g_variant_dict_insert(dict, "delta-from", "s", delta->hash_old);
+		g_variant_dict_insert(dict, "delta-size", "t", delta->size);
+	}
+	if (chunks != NULL)
+		g_variant_dict_insert(dict, "chunks", "u", chunks->len);
+	if (has_digests)
+		g_variant_dict_insert_value(dict, "digests", g_variant_builder_end(&builder));
+	else
+		g_variant_builder_clear(&builder);
+	return g_variant_dict_end(dict);
+}
 
-	/* add to interface */
-	file = g_file_new_for_path(localstate_filename);
-	passim_item_set_hash(item, hash);
-	passim_item_set_file(item, file);
-	g_debug("added %s", localstate_filename);
-	g_hash_table_insert(self->items, g_steal_pointer(&hash), g_object_ref(item));
+static GVariant *
+passim_server_get_statistics(PassimServer *self)
+{
+	GVariantBuilder builder;
+	GVariantBuilder builder_items;
+	PassimServerSample sample_now = {0};
+	const PassimServerSample *sample_old;
+	gdouble elapsed;
+	guint64 chunks_size = 0;
+	guint64 items_size = 0;
+	g_autoptr(GList) chunks = g_hash_table_get_values(self->chunks);
+	g_autoptr(GList) items = g_hash_table_get_values(self->items);
 
-	/* success */
-	return passim_server_avahi_register(self, error);
+	/* rates are averaged over the last sample interval or two */
+	passim_server_sample_take(self, &sample_now);
+	sample_old = self->sample_prev.timestamp != 0 ? &self->sample_prev : &self->sample_cur;
+	elapsed = (gdouble)(sample_now.timestamp - sample_old->timestamp) / G_USEC_PER_SEC;
+
+	g_variant_builder_init(&builder_items, G_VARIANT_TYPE("aa{sv}"));
+	for (GList *l = items; l != NULL; l = l->next) {
+		PassimItem *item = PASSIM_ITEM(l->data);
+		items_size += passim_item_get_size(item);
+		g_variant_builder_add_value(&builder_items,
+					    passim_server_item_to_variant(self, item));
+	}
+	for (GList *l = chunks; l != NULL; l = l->next) {
+		PassimServerChunk *chunk_srv = (PassimServerChunk *)l->data;
+		chunks_size += chunk_srv->size;
+	}
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(
+	    &builder,
+	    "{sv}",
+	    "uptime",
+	    g_variant_new_uint64((sample_now.timestamp - self->start_time) / G_USEC_PER_SEC));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "requests",
+			      g_variant_new_uint64(sample_now.requests));
+	for (guint i = 0; i < PASSIM_METRICS_OUTCOME_LAST; i++) {
+		g_autofree gchar *key =
+		    g_strdup_printf("requests-%s", passim_metrics_outcome_to_string(i));
+		g_variant_builder_add(
+		    &builder,
+		    "{sv}",
+		    key,
+		    g_variant_new_uint64(passim_metrics_get_outcome(self->metrics, i)));
+	}
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "served-size",
+			      g_variant_new_uint64(sample_now.bytes_served));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "evictions",
+			      g_variant_new_uint64(passim_metrics_get_counter(
+				  self->metrics,
+				  PASSIM_METRICS_COUNTER_EVICTIONS)));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "share-limit-deletions",
+			      g_variant_new_uint64(passim_metrics_get_counter(
+				  self->metrics,
+				  PASSIM_METRICS_COUNTER_SHARE_LIMIT_DELETIONS)));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "compression-saved",
+			      g_variant_new_uint64(passim_metrics_get_counter(
+				  self->metrics,
+				  PASSIM_METRICS_COUNTER_COMPRESSION_SAVED)));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "item-count",
+			      g_variant_new_uint32(g_hash_table_size(self->items)));
+	g_variant_builder_add(&builder, "{sv}", "item-size", g_variant_new_uint64(items_size));
+	if (g_hash_table_size(self->chunks) > 0) {
+		g_variant_builder_add(&builder,
+				      "{sv}",
+				      "chunk-count",
+				      g_variant_new_uint32(g_hash_table_size(self->chunks)));
+		g_variant_builder_add(&builder,
+				      "{sv}",
+				      "chunk-size",
+				      g_variant_new_uint64(chunks_size));
+	}
+	if (elapsed > 0) {
+		g_variant_builder_add(
+		    &builder,
+		    "{sv}",
+		    "request-rate",
+		    g_variant_new_double((sample_now.requests - sample_old->requests) / elapsed));
+		g_variant_builder_add(
+		    &builder,
+		    "{sv}",
+		    "served-rate",
+		    g_variant_new_double((sample_now.bytes_served - sample_old->bytes_served) /
+					 elapsed));
+	}
+	g_variant_builder_add(&builder, "{sv}", "items", g_variant_builder_end(&builder_items));
+	return g_variant_builder_end(&builder);
 }
 
 static gboolean
@@ -947,26 +4961,29 @@ passim_server_timed_exit_cb(gpointer user_data)
 static void
 passim_server_check_item_age(PassimServer *self)
 {
+	g_autoptr(GDateTime) dt_now = g_date_time_new_now_utc();
 	g_autoptr(GList) items = g_hash_table_get_values(self->items);
 	g_debug("checking for max-age");
 	for (GList *l = items; l != NULL; l = l->next) {
 		PassimItem *item = PASSIM_ITEM(l->data);
-		guint32 age = passim_item_get_age(item);
 
 		if (passim_item_get_max_age(item) == G_MAXUINT32)
 			continue;
-		if (age > passim_item_get_max_age(item)) {
+		if (passim_policy_item_expired(item, dt_now)) {
 			g_autoptr(GError) error = NULL;
 			g_debug("deleting %s [%s] as max-age reached",
 				passim_item_get_hash(item),
 				passim_item_get_basename(item));
+			passim_metrics_counter_add(self->metrics,
+						   PASSIM_METRICS_COUNTER_EVICTIONS,
+						   1);
 			if (!passim_server_delete_item(self, item, &error))
 				g_warning("failed: %s", error->message);
 		} else {
 			g_debug("%s [%s] has age %uh, maximum is %uh",
 				passim_item_get_hash(item),
 				passim_item_get_basename(item),
-				(guint)age / 3600u,
+				(guint)passim_item_get_age(item) / 3600u,
 				passim_item_get_max_age(item) / 3600u);
 		}
 	}
@@ -1051,16 +5068,14 @@ passim_server_method_call(GDBusConnection *connection,
 	GVariant *val = NULL;
 
 	if (g_strcmp0(method_name, "GetItems") == 0) {
-		GVariantBuilder builder;
-		g_autoptr(GList) items = g_hash_table_get_values(self->items);
-
 		g_debug("Called %s()", method_name);
-		g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
-		for (GList *l = items; l != NULL; l = l->next) {
-			PassimItem *item = PASSIM_ITEM(l->data);
-			g_variant_builder_add_value(&builder, passim_item_to_variant(item));
-		}
-		val = g_variant_builder_end(&builder);
+		val = passim_index_to_variant(self->items);
+		g_dbus_method_invocation_return_value(invocation, g_variant_new_tuple(&val, 1));
+		return;
+	}
+	if (g_strcmp0(method_name, "GetStatistics") == 0) {
+		g_debug("Called %s()", method_name);
+		val = passim_server_get_statistics(self);
 		g_dbus_method_invocation_return_value(invocation, g_variant_new_tuple(&val, 1));
 		return;
 	}
@@ -1109,6 +5124,15 @@ passim_server_method_call(GDBusConnection *connection,
 			return;
 		}
 
+		/* sanity check the origin, as this is sent in HTTP headers */
+		if (!passim_server_item_origin_valid(item)) {
+			g_dbus_method_invocation_return_error_literal(invocation,
+								      G_DBUS_ERROR,
+								      G_DBUS_ERROR_INVALID_ARGS,
+								      "invalid origin URI or ETag");
+			return;
+		}
+
 		/* sanity check share values */
 		if (passim_item_get_share_count(item) >= passim_item_get_share_limit(item)) {
 			g_dbus_method_invocation_return_error(invocation,
@@ -1159,6 +5183,10 @@ passim_server_method_call(GDBusConnection *connection,
 
 		/* only set by daemon */
 		passim_item_set_ctime(item, dt_now);
+		if (passim_config_get_replication_target(self->kf) > 0)
+			passim_item_add_flag(item, PASSIM_ITEM_FLAG_REPLICATING);
+		else
+			passim_item_remove_flag(item, PASSIM_ITEM_FLAG_REPLICATING);
 
 		/* publish the new file */
 		if (!passim_server_publish_file(self, blob, item, &error)) {
@@ -1196,6 +5224,32 @@ passim_server_method_call(GDBusConnection *connection,
 		g_dbus_method_invocation_return_value(invocation, NULL);
 		return;
 	}
+	if (g_strcmp0(method_name, "SetFaults") == 0) {
+		const gchar *spec = NULL;
+		g_autoptr(GError) error = NULL;
+
+		/* only callable by root */
+		if (!passim_server_sender_check_uid(self, sender, &error)) {
+			g_dbus_method_invocation_return_gerror(invocation, error);
+			return;
+		}
+
+		g_variant_get(parameters, "(&s)", &spec);
+		g_debug("Called %s(%s)", method_name, spec);
+#ifdef HAVE_FAULT_INJECTION
+		if (!passim_fault_setup(spec, &error)) {
+			g_dbus_method_invocation_return_gerror(invocation, error);
+			return;
+		}
+		g_dbus_method_invocation_return_value(invocation, NULL);
+#else
+		g_dbus_method_invocation_return_error(invocation,
+						      G_IO_ERROR,
+						      G_IO_ERROR_NOT_SUPPORTED,
+						      "not built with -Dfault_injection=true");
+#endif
+		return;
+	}
 	g_dbus_method_invocation_return_error(invocation,
 					      G_DBUS_ERROR,
 					      G_DBUS_ERROR_UNKNOWN_METHOD,
@@ -1297,11 +5351,13 @@ passim_server_dbus_name_lost_cb(GDBusConnection *connection, const gchar *name,
 static gboolean
 passim_server_start_dbus(PassimServer *self, GError **error)
 {
+	g_autofree gchar *datadir = NULL;
 	g_autofree gchar *introspection_fn = NULL;
 	g_autofree gchar *introspection_xml = NULL;
 
 	/* load introspection from file */
-	introspection_fn = g_build_filename(PACKAGE_DATADIR,
+	datadir = passim_path_from_kind(PASSIM_PATH_KIND_DATADIR);
+	introspection_fn = g_build_filename(datadir,
 					    "dbus-1",
 					    "interfaces",
 					    PASSIM_DBUS_INTERFACE ".xml",
@@ -1335,12 +5391,12 @@ static GTlsCertificate *
 passim_server_load_tls_certificate(GError **error)
 {
 	g_autofree gchar *cert_fn = NULL;
+	g_autofree gchar *localstatedir = passim_path_from_kind(PASSIM_PATH_KIND_LOCALSTATEDIR);
 	g_autofree gchar *secret_fn = NULL;
 	g_autoptr(GBytes) secret_blob = NULL;
 
 	/* create secret key */
-	secret_fn =
-	    g_build_filename(PACKAGE_LOCALSTATEDIR, "lib", PACKAGE_NAME, "secret.key", NULL);
+	secret_fn = g_build_filename(localstatedir, "lib", PACKAGE_NAME, "secret.key", NULL);
 	if (!g_file_test(secret_fn, G_FILE_TEST_EXISTS)) {
 		secret_blob = passim_gnutls_create_private_key(error);
 		if (secret_blob == NULL)
@@ -1352,7 +5408,7 @@ passim_server_load_tls_certificate(GError **error)
 	}
 
 	/* create TLS cert */
-	cert_fn = g_build_filename(PACKAGE_LOCALSTATEDIR, "lib", PACKAGE_NAME, "cert.pem", NULL);
+	cert_fn = g_build_filename(localstatedir, "lib", PACKAGE_NAME, "cert.pem", NULL);
 	if (!g_file_test(cert_fn, G_FILE_TEST_EXISTS)) {
 		g_autoptr(GBytes) cert_blob = NULL;
 		g_auto(gnutls_privkey_t) privkey = NULL;
@@ -1402,6 +5458,7 @@ main(int argc, char *argv[])
 {
 	gboolean version = FALSE;
 	gboolean timed_exit = FALSE;
+	g_autofree gchar *access_log = NULL;
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GOptionContext) context = g_option_context_new(NULL);
 	g_autoptr(GSource) unix_signal_source = g_unix_signal_source_new(SIGINT);
@@ -1429,22 +5486,82 @@ main(int argc, char *argv[])
 		return EXIT_SUCCESS;
 	}
 
+#ifdef HAVE_FAULT_INJECTION
+	/* also settable at runtime using SetFaults() */
+	if (!passim_fault_setup(g_getenv("PASSIM_FAULTS"), &error)) {
+		g_printerr("failed to parse PASSIM_FAULTS: %s\n", error->message);
+		return 1;
+	}
+#endif
+
 	self->status = PASSIM_STATUS_STARTING;
+	self->start_time = g_get_monotonic_time();
 	self->loop = g_main_loop_new(NULL, FALSE);
 	self->kf = passim_config_load(&error);
 	if (self->kf == NULL) {
 		g_printerr("failed to load config: %s\n", error->message);
 		return 1;
 	}
+	if (!passim_server_digests_setup(self, &error)) {
+		g_printerr("failed to load config: %s\n", error->message);
+		return 1;
+	}
 	self->poll_item_age_id =
 	    g_timeout_add_seconds(60 * 60, passim_server_check_item_age_cb, self);
 	if (timed_exit)
 		self->timed_exit_id = g_timeout_add_seconds(10, passim_server_timed_exit_cb, self);
+	self->metrics = passim_metrics_new();
+	passim_server_sample_take(self, &self->sample_cur);
+	if (passim_config_get_adaptive_share_limit(self->kf))
+		self->load = passim_server_get_load();
+	self->sample_id = g_timeout_add_seconds(30, passim_server_sample_cb, self);
+	if (passim_config_get_prefetch(self->kf))
+		self->prefetch_id = g_timeout_add_seconds(5 * 60, passim_server_prefetch_cb, self);
+	if (passim_config_get_replication_target(self->kf) > 0)
+		self->replication_id =
+		    g_timeout_add_seconds(60, passim_server_replication_cb, self);
+	if (passim_config_get_adaptive_share_limit(self->kf))
+		self->adapt_id = g_timeout_add_seconds(5 * 60, passim_server_adapt_cb, self);
+	self->save_id = g_timeout_add_seconds(5 * 60, passim_server_save_counters_cb, self);
 	self->avahi = passim_avahi_new(self->kf);
+	passim_avahi_set_metrics(self->avahi, self->metrics);
+	access_log = passim_config_get_access_log(self->kf);
+	if (access_log != NULL) {
+		self->access_log = passim_access_log_new();
+		if (!passim_access_log_open(self->access_log, access_log, &error)) {
+			g_warning("failed to open access log %s: %s", access_log, error->message);
+			return 1;
+		}
+	}
 	self->port = passim_config_get_port(self->kf);
 	self->root = passim_config_get_path(self->kf);
 	self->items =
 	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_object_unref);
+	self->variants = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	self->stored = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	self->deltas = g_hash_table_new_full(g_str_hash,
+					     g_str_equal,
+					     g_free,
+					     (GDestroyNotify)passim_server_delta_free);
+	self->chunks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	self->chunked = g_hash_table_new_full(g_str_hash,
+					      g_str_equal,
+					      g_free,
+					      (GDestroyNotify)g_ptr_array_unref);
+	self->digests = g_hash_table_new_full(g_str_hash,
+					      g_str_equal,
+					      g_free,
+					      (GDestroyNotify)passim_digests_free);
+	self->aliases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	self->replicas = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	self->fetching = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	self->saved = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	self->hmacs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	self->partials = g_hash_table_new_full(g_str_hash,
+					       g_str_equal,
+					       g_free,
+					       (GDestroyNotify)passim_server_partial_free);
+	self->counting = g_queue_new();
 	self->network_monitor = g_network_monitor_get_default();
 
 	g_signal_connect(G_NETWORK_MONITOR(self->network_monitor),
@@ -1485,6 +5602,10 @@ main(int argc, char *argv[])
 		return 1;
 	}
 	soup_server_add_handler(soup_server, NULL, passim_server_handler_cb, self, NULL);
+	g_signal_connect(soup_server,
+			 "request-started",
+			 G_CALLBACK(passim_server_request_started_cb),
+			 self);
 	uris = soup_server_get_uris(soup_server);
 	for (GSList *u = uris; u; u = u->next) {
 		g_autofree gchar *str = g_uri_to_string(u->data);
@@ -1503,5 +5624,6 @@ main(int argc, char *argv[])
 	g_source_attach(unix_signal_source, NULL);
 
 	g_main_loop_run(self->loop);
+	passim_server_save_counters(self);
 	return 0;
 }
@@ -0,0 +1,646 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <passim.h>
+
+#include "passim-common.h"
+#include "passim-policy.h"
+
+/* the same interval as the max-age check in the daemon */
+#define PASSIM_SIM_CHECK_AGE_INTERVAL G_TIME_SPAN_HOUR
+
+typedef enum {
+	PASSIM_SIM_EVENT_RELEASE,
+	PASSIM_SIM_EVENT_REQUEST,
+	PASSIM_SIM_EVENT_DOWNLOADED,
+	PASSIM_SIM_EVENT_HOST_DOWN,
+	PASSIM_SIM_EVENT_HOST_UP,
+	PASSIM_SIM_EVENT_CHECK_AGE,
+} PassimSimEventKind;
+
+typedef struct {
+	guint64 rate; /* bytes per second */
+	guint weight;
+} PassimSimBandwidth;
+
+typedef struct {
+	guint idx;
+	gchar *hash;
+	guint64 size;
+	GPtrArray *holders; /* of PassimSimHost, no-ref */
+} PassimSimRelease;
+
+typedef struct {
+	guint idx;
+	guint64 rate; /* bytes per second, both upload and download */
+	gboolean online;
+	gint64 busy_until;    /* virtual µs */
+	GHashTable *items;    /* release:PassimItem */
+	GPtrArray *pending;   /* of PassimSimRelease, requested while offline */
+	guint64 upload_bytes; /* served to peers */
+	guint uploads;
+} PassimSimHost;
+
+typedef struct {
+	gint64 time; /* virtual µs */
+	guint64 seq; /* keep the order stable for the same time */
+	PassimSimEventKind kind;
+	PassimSimHost *host;
+	PassimSimRelease *release;
+	gint64 requested; /* virtual µs */
+	gboolean from_peer;
+} PassimSimEvent;
+
+typedef struct {
+	GRand *rand;
+	GSequence *events; /* of PassimSimEvent */
+	GPtrArray *hosts;  /* of PassimSimHost */
+	GPtrArray *releases;
+	GArray *bandwidths; /* of PassimSimBandwidth */
+	GDateTime *dt_start;
+	GArray *latencies_peer; /* of gint64, µs */
+	GArray *latencies_cdn;	/* of gint64, µs */
+	gint64 now;		/* virtual µs */
+	guint64 seq;
+	guint64 size;
+	guint64 cdn_rate;
+	gint64 interval;
+	gint64 window;
+	gint64 duration;
+	gint64 uptime;
+	gint64 downtime;
+	guint32 share_limit;
+	guint32 max_age;
+	gboolean poisson;
+	guint64 requests;
+	guint64 bytes_peer;
+	guint64 bytes_cdn;
+	guint64 share_limit_deletions;
+	guint64 evictions;
+} PassimSim;
+
+static void
+passim_sim_host_free(PassimSimHost *host)
+{
+	g_hash_table_unref(host->items);
+	g_ptr_array_unref(host->pending);
+	g_free(host);
+}
+
+static void
+passim_sim_release_free(PassimSimRelease *release)
+{
+	g_ptr_array_unref(release->holders);
+	g_free(release->hash);
+	g_free(release);
+}
+
+static void
+passim_sim_free(PassimSim *self)
+{
+	if (self->rand != NULL)
+		g_rand_free(self->rand);
+	if (self->events != NULL)
+		g_sequence_free(self->events);
+	if (self->hosts != NULL)
+		g_ptr_array_unref(self->hosts);
+	if (self->releases != NULL)
+		g_ptr_array_unref(self->releases);
+	if (self->bandwidths != NULL)
+		g_array_unref(self->bandwidths);
+	if (self->dt_start != NULL)
+		g_date_time_unref(self->dt_start);
+	if (self->latencies_peer != NULL)
+		g_array_unref(self->latencies_peer);
+	if (self->latencies_cdn != NULL)
+		g_array_unref(self->latencies_cdn);
+	g_free(self);
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PassimSim, passim_sim_free)
+#pragma clang diagnostic pop
+
+static gint
+passim_sim_event_cmp_cb(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const PassimSimEvent *event_a = (const PassimSimEvent *)a;
+	const PassimSimEvent *event_b = (const PassimSimEvent *)b;
+	if (event_a->time != event_b->time)
+		return event_a->time < event_b->time ? -1 : 1;
+	if (event_a->seq != event_b->seq)
+		return event_a->seq < event_b->seq ? -1 : 1;
+	return 0;
+}
+
+static PassimSimEvent *
+passim_sim_schedule(PassimSim *self, gint64 time, PassimSimEventKind kind, PassimSimHost *host)
+{
+	PassimSimEvent *event = g_new0(PassimSimEvent, 1);
+	event->time = time;
+	event->seq = self->seq++;
+	event->kind = kind;
+	event->host = host;
+	g_sequence_insert_sorted(self->events, event, passim_sim_event_cmp_cb, NULL);
+	return event;
+}
+
+/* exponentially distributed, for the Poisson arrivals and the host churn */
+static gint64
+passim_sim_random_exp(PassimSim *self, gint64 mean)
+{
+	return (gint64)(-log(1.f - g_rand_double(self->rand)) * mean);
+}
+
+/* in the format MBIT:WEIGHT,MBIT:WEIGHT */
+static gboolean
+passim_sim_parse_bandwidths(PassimSim *self, const gchar *value, GError **error)
+{
+	g_auto(GStrv) sections = g_strsplit(value, ",", -1);
+
+	for (guint i = 0; sections[i] != NULL; i++) {
+		PassimSimBandwidth bandwidth = {.weight = 1};
+		guint64 tmp = 0;
+		g_auto(GStrv) kv = g_strsplit(sections[i], ":", 2);
+
+		if (!g_ascii_string_to_unsigned(kv[0], 10, 1, 100000, &tmp, error))
+			return FALSE;
+		bandwidth.rate = tmp * 1000 * 1000 / 8;
+		if (kv[1] != NULL) {
+			if (!g_ascii_string_to_unsigned(kv[1], 10, 1, 1000, &tmp, error))
+				return FALSE;
+			bandwidth.weight = tmp;
+		}
+		g_array_append_val(self->bandwidths, bandwidth);
+	}
+	return TRUE;
+}
+
+static guint64
+passim_sim_pick_bandwidth(PassimSim *self)
+{
+	guint total = 0;
+	guint value;
+
+	for (guint i = 0; i < self->bandwidths->len; i++)
+		total += g_array_index(self->bandwidths, PassimSimBandwidth, i).weight;
+	value = g_rand_int_range(self->rand, 0, total);
+	for (guint i = 0; i < self->bandwidths->len; i++) {
+		PassimSimBandwidth *bandwidth =
+		    &g_array_index(self->bandwidths, PassimSimBandwidth, i);
+		if (value < bandwidth->weight)
+			return bandwidth->rate;
+		value -= bandwidth->weight;
+	}
+	return g_array_index(self->bandwidths, PassimSimBandwidth, 0).rate;
+}
+
+static GDateTime *
+passim_sim_get_datetime(PassimSim *self)
+{
+	return g_date_time_add(self->dt_start, self->now);
+}
+
+static gint64
+passim_sim_transfer_duration(guint64 size, guint64 rate)
+{
+	return (gint64)((gdouble)size * G_USEC_PER_SEC / rate);
+}
+
+static void
+passim_sim_host_remove_item(PassimSimHost *host, PassimSimRelease *release)
+{
+	g_hash_table_remove(host->items, release);
+	g_ptr_array_remove(release->holders, host);
+}
+
+static void
+passim_sim_release(PassimSim *self, PassimSimRelease *release)
+{
+	for (guint i = 0; i < self->hosts->len; i++) {
+		PassimSimHost *host = g_ptr_array_index(self->hosts, i);
+		PassimSimEvent *event;
+		gint64 delay;
+
+		if (self->poisson)
+			delay = passim_sim_random_exp(self, self->window);
+		else
+			delay = (gint64)g_rand_double_range(self->rand, 0, self->window);
+		event = passim_sim_schedule(self,
+					    self->now + delay,
+					    PASSIM_SIM_EVENT_REQUEST,
+					    host);
+		event->release = release;
+	}
+}
+
+/* the client asks the local daemon, which redirects to a peer or returns 404 for the CDN */
+static void
+passim_sim_request(PassimSim *self, PassimSimHost *host, PassimSimRelease *release)
+{
+	PassimSimEvent *event;
+	gint64 start = self->now;
+	gint64 duration;
+	g_autoptr(GPtrArray) peers = g_ptr_array_new();
+
+	if (!host->online) {
+		g_ptr_array_add(host->pending, release);
+		return;
+	}
+	if (g_hash_table_contains(host->items, release))
+		return;
+	self->requests++;
+
+	/* only the peers that are online can be found using mDNS */
+	for (guint i = 0; i < release->holders->len; i++) {
+		PassimSimHost *peer = g_ptr_array_index(release->holders, i);
+		if (peer->online && peer != host)
+			g_ptr_array_add(peers, peer);
+	}
+	if (peers->len > 0) {
+		PassimSimHost *peer =
+		    g_ptr_array_index(peers, passim_policy_select_peer(peers->len, self->rand));
+		PassimItem *item = g_hash_table_lookup(peer->items, release);
+		g_autoptr(GDateTime) dt_now = passim_sim_get_datetime(self);
+
+		/* each peer sends one file at a time at the slower of the two link speeds */
+		start = MAX(self->now, peer->busy_until);
+		duration = passim_sim_transfer_duration(release->size, MIN(peer->rate, host->rate));
+		peer->busy_until = start + duration;
+		peer->upload_bytes += release->size;
+		peer->uploads++;
+		self->bytes_peer += release->size;
+		passim_policy_item_shared(item, dt_now);
+		if (passim_policy_item_share_limit_reached(item)) {
+			self->share_limit_deletions++;
+			passim_sim_host_remove_item(peer, release);
+		}
+	} else {
+		duration =
+		    passim_sim_transfer_duration(release->size, MIN(self->cdn_rate, host->rate));
+		self->bytes_cdn += release->size;
+	}
+	event = passim_sim_schedule(self, start + duration, PASSIM_SIM_EVENT_DOWNLOADED, host);
+	event->release = release;
+	event->requested = self->now;
+	event->from_peer = peers->len > 0;
+}
+
+/* the client then publishes the file to the local daemon */
+static void
+passim_sim_downloaded(PassimSim *self, PassimSimEvent *event)
+{
+	gint64 latency = self->now - event->requested;
+	g_autoptr(GDateTime) dt_now = passim_sim_get_datetime(self);
+	g_autoptr(PassimItem) item = passim_item_new();
+
+	g_array_append_val(event->from_peer ? self->latencies_peer : self->latencies_cdn, latency);
+	passim_item_set_hash(item, event->release->hash);
+	passim_item_set_size(item, event->release->size);
+	passim_item_set_ctime(item, dt_now);
+	passim_item_set_max_age(item, self->max_age);
+	passim_item_set_share_limit(item, self->share_limit);
+	g_hash_table_insert(event->host->items, event->release, g_steal_pointer(&item));
+	g_ptr_array_add(event->release->holders, event->host);
+}
+
+static void
+passim_sim_check_age(PassimSim *self)
+{
+	g_autoptr(GDateTime) dt_now = passim_sim_get_datetime(self);
+
+	for (guint i = 0; i < self->hosts->len; i++) {
+		PassimSimHost *host = g_ptr_array_index(self->hosts, i);
+		GHashTableIter iter;
+		gpointer key;
+		gpointer value;
+
+		g_hash_table_iter_init(&iter, host->items);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			PassimSimRelease *release = (PassimSimRelease *)key;
+			if (!passim_policy_item_expired(PASSIM_ITEM(value), dt_now))
+				continue;
+			self->evictions++;
+			g_ptr_array_remove(release->holders, host);
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+}
+
+static void
+passim_sim_host_up(PassimSim *self, PassimSimHost *host)
+{
+	g_autoptr(GPtrArray) pending = g_steal_pointer(&host->pending);
+
+	host->online = TRUE;
+	host->pending = g_ptr_array_new();
+	for (guint i = 0; i < pending->len; i++)
+		passim_sim_request(self, host, g_ptr_array_index(pending, i));
+	if (self->uptime > 0) {
+		passim_sim_schedule(self,
+				    self->now + passim_sim_random_exp(self, self->uptime),
+				    PASSIM_SIM_EVENT_HOST_DOWN,
+				    host);
+	}
+}
+
+static void
+passim_sim_host_down(PassimSim *self, PassimSimHost *host)
+{
+	host->online = FALSE;
+	passim_sim_schedule(self,
+			    self->now + passim_sim_random_exp(self, self->downtime),
+			    PASSIM_SIM_EVENT_HOST_UP,
+			    host);
+}
+
+static void
+passim_sim_run(PassimSim *self)
+{
+	while (g_sequence_get_length(self->events) > 0) {
+		GSequenceIter *iter = g_sequence_get_begin_iter(self->events);
+		PassimSimEvent *event = g_sequence_get(iter);
+
+		if (event->time > self->duration)
+			break;
+		self->now = event->time;
+		switch (event->kind) {
+		case PASSIM_SIM_EVENT_RELEASE:
+			passim_sim_release(self, event->release);
+			break;
+		case PASSIM_SIM_EVENT_REQUEST:
+			passim_sim_request(self, event->host, event->release);
+			break;
+		case PASSIM_SIM_EVENT_DOWNLOADED:
+			passim_sim_downloaded(self, event);
+			break;
+		case PASSIM_SIM_EVENT_HOST_DOWN:
+			passim_sim_host_down(self, event->host);
+			break;
+		case PASSIM_SIM_EVENT_HOST_UP:
+			passim_sim_host_up(self, event->host);
+			break;
+		case PASSIM_SIM_EVENT_CHECK_AGE:
+			passim_sim_check_age(self);
+			passim_sim_schedule(self,
+					    self->now + PASSIM_SIM_CHECK_AGE_INTERVAL,
+					    PASSIM_SIM_EVENT_CHECK_AGE,
+					    NULL);
+			break;
+		default:
+			g_assert_not_reached();
+		}
+
+		/* the iter is still valid as new events are always scheduled after this one */
+		g_sequence_remove(iter);
+	}
+}
+
+static gint
+passim_sim_sort_cb(gconstpointer a, gconstpointer b)
+{
+	gint64 val_a = *((const gint64 *)a);
+	gint64 val_b = *((const gint64 *)b);
+	if (val_a < val_b)
+		return -1;
+	if (val_a > val_b)
+		return 1;
+	return 0;
+}
+
+static gint64
+passim_sim_percentile(GArray *values, gdouble percentile)
+{
+	if (values->len == 0)
+		return 0;
+	return g_array_index(values,
+			     gint64,
+			     MIN((guint)((percentile / 100.f) * values->len), values->len - 1));
+}
+
+static void
+passim_sim_print_results(PassimSim *self, gboolean json)
+{
+	guint hosts_uploading = 0;
+	guint64 bytes_total = self->bytes_peer + self->bytes_cdn;
+	gdouble saved = bytes_total > 0 ? (gdouble)self->bytes_peer / bytes_total : 0;
+	g_autoptr(GArray) uploads = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+	for (guint i = 0; i < self->hosts->len; i++) {
+		PassimSimHost *host = g_ptr_array_index(self->hosts, i);
+		gint64 upload_bytes = host->upload_bytes;
+		if (host->uploads > 0)
+			hosts_uploading++;
+		g_array_append_val(uploads, upload_bytes);
+	}
+	g_array_sort(uploads, passim_sim_sort_cb);
+	g_array_sort(self->latencies_peer, passim_sim_sort_cb);
+	g_array_sort(self->latencies_cdn, passim_sim_sort_cb);
+
+	if (json) {
+		g_print("{\"hosts\":%u,\"releases\":%u,\"requests\":%" G_GUINT64_FORMAT
+			",\"from_peer\":%u,\"from_cdn\":%u,\"bytes_peer\":%" G_GUINT64_FORMAT
+			",\"bytes_cdn\":%" G_GUINT64_FORMAT ",\"cdn_saved\":%.4f"
+			",\"share_limit_deletions\":%" G_GUINT64_FORMAT
+			",\"evictions\":%" G_GUINT64_FORMAT ",\"hosts_uploading\":%u"
+			",\"upload_p50\":%" G_GINT64_FORMAT ",\"upload_p99\":%" G_GINT64_FORMAT
+			",\"upload_max\":%" G_GINT64_FORMAT
+			",\"latency_peer_p50_us\":%" G_GINT64_FORMAT
+			",\"latency_cdn_p50_us\":%" G_GINT64_FORMAT "}\n",
+			self->hosts->len,
+			self->releases->len,
+			self->requests,
+			self->latencies_peer->len,
+			self->latencies_cdn->len,
+			self->bytes_peer,
+			self->bytes_cdn,
+			saved,
+			self->share_limit_deletions,
+			self->evictions,
+			hosts_uploading,
+			passim_sim_percentile(uploads, 50),
+			passim_sim_percentile(uploads, 99),
+			passim_sim_percentile(uploads, 100),
+			passim_sim_percentile(self->latencies_peer, 50),
+			passim_sim_percentile(self->latencies_cdn, 50));
+		return;
+	}
+	g_print("Hosts:         %u\n", self->hosts->len);
+	g_print("Releases:      %u of %" G_GUINT64_FORMAT " bytes\n",
+		self->releases->len,
+		self->size);
+	g_print("Requests:      %" G_GUINT64_FORMAT " (%u from peers, %u from the CDN)\n",
+		self->requests,
+		self->latencies_peer->len,
+		self->latencies_cdn->len);
+	g_print("CDN saved:     %.1f%% (%" G_GUINT64_FORMAT " MB of %" G_GUINT64_FORMAT " MB)\n",
+		saved * 100.f,
+		self->bytes_peer / (1000 * 1000),
+		bytes_total / (1000 * 1000));
+	g_print("Deletions:     %" G_GUINT64_FORMAT " at share limit, %" G_GUINT64_FORMAT
+		" at max-age\n",
+		self->share_limit_deletions,
+		self->evictions);
+	g_print("Upload:        %u hosts, p50 %" G_GINT64_FORMAT " MB, p99 %" G_GINT64_FORMAT
+		" MB, max %" G_GINT64_FORMAT " MB\n",
+		hosts_uploading,
+		passim_sim_percentile(uploads, 50) / (1000 * 1000),
+		passim_sim_percentile(uploads, 99) / (1000 * 1000),
+		passim_sim_percentile(uploads, 100) / (1000 * 1000));
+	g_print("Download:      p50 %.1fs from peers, p50 %.1fs from the CDN\n",
+		(gdouble)passim_sim_percentile(self->latencies_peer, 50) / G_USEC_PER_SEC,
+		(gdouble)passim_sim_percentile(self->latencies_cdn, 50) / G_USEC_PER_SEC);
+}
+
+int
+main(int argc, char *argv[])
+{
+	gboolean json = FALSE;
+	gint hosts = 5000;
+	gint releases = 1;
+	gint share_limit = 5;
+	gint seed = 0;
+	gint64 size = 10 * 1000 * 1000;
+	gint64 cdn_mbit = 50;
+	gint64 interval = 24 * 60 * 60;
+	gint64 window = 5 * 60;
+	gint64 max_age = 24 * 60 * 60;
+	gint64 uptime = 0;
+	gint64 downtime = 60 * 60;
+	gint64 duration = 0;
+	g_autofree gchar *arrival = NULL;
+	g_autofree gchar *bandwidths = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GOptionContext) context = g_option_context_new(NULL);
+	g_autoptr(PassimSim) self = g_new0(PassimSim, 1);
+	const GOptionEntry options[] = {
+	    {"hosts", '\0', 0, G_OPTION_ARG_INT, &hosts, "Virtual hosts on the LAN", "COUNT"},
+	    {"releases", '\0', 0, G_OPTION_ARG_INT, &releases, "Files to release", "COUNT"},
+	    {"size", '\0', 0, G_OPTION_ARG_INT64, &size, "Bytes in each release", "BYTES"},
+	    {"interval", '\0', 0, G_OPTION_ARG_INT64, &interval, "Between releases", "SECS"},
+	    {"arrival",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_STRING,
+	     &arrival,
+	     "Arrival process, either 'burst' or 'poisson'",
+	     "PROCESS"},
+	    {"window",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_INT64,
+	     &window,
+	     "Burst length, or the mean delay for Poisson arrivals",
+	     "SECS"},
+	    {"bandwidth",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_STRING,
+	     &bandwidths,
+	     "Host link speed distribution, e.g. 100:70,1000:30",
+	     "MBIT:WEIGHT,..."},
+	    {"cdn-bandwidth",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_INT64,
+	     &cdn_mbit,
+	     "CDN download speed for each host",
+	     "MBIT"},
+	    {"share-limit", '\0', 0, G_OPTION_ARG_INT, &share_limit, "Share limit", "COUNT"},
+	    {"max-age", '\0', 0, G_OPTION_ARG_INT64, &max_age, "Maximum item age", "SECS"},
+	    {"uptime",
+	     '\0',
+	     0,
+	     G_OPTION_ARG_INT64,
+	     &uptime,
+	     "Mean time a host is online, or 0 for no churn",
+	     "SECS"},
+	    {"downtime", '\0', 0, G_OPTION_ARG_INT64, &downtime, "Mean time offline", "SECS"},
+	    {"duration", '\0', 0, G_OPTION_ARG_INT64, &duration, "Simulated time", "SECS"},
+	    {"seed", '\0', 0, G_OPTION_ARG_INT, &seed, "Random seed", "SEED"},
+	    {"json", '\0', 0, G_OPTION_ARG_NONE, &json, "Output JSON", NULL},
+	    {NULL}};
+
+	g_option_context_add_main_entries(context, options, NULL);
+	g_option_context_set_summary(context, "Simulate the LAN offload using the daemon policy.");
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("Failed to parse arguments: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	if (hosts <= 0 || releases <= 0 || size <= 0 || interval <= 0 || window <= 0 ||
+	    cdn_mbit <= 0 || share_limit < 0 || max_age <= 0 || max_age >= G_MAXUINT32 ||
+	    uptime < 0 || downtime <= 0 || duration < 0 ||
+	    (arrival != NULL && g_strcmp0(arrival, "burst") != 0 &&
+	     g_strcmp0(arrival, "poisson") != 0)) {
+		g_printerr("Invalid arguments\n");
+		return EXIT_FAILURE;
+	}
+	self->rand = g_rand_new_with_seed(seed);
+	self->events = g_sequence_new(g_free);
+	self->hosts = g_ptr_array_new_with_free_func((GDestroyNotify)passim_sim_host_free);
+	self->releases = g_ptr_array_new_with_free_func((GDestroyNotify)passim_sim_release_free);
+	self->bandwidths = g_array_new(FALSE, FALSE, sizeof(PassimSimBandwidth));
+	self->latencies_peer = g_array_new(FALSE, FALSE, sizeof(gint64));
+	self->latencies_cdn = g_array_new(FALSE, FALSE, sizeof(gint64));
+	self->dt_start = g_date_time_new_now_utc();
+	self->size = size;
+	self->cdn_rate = cdn_mbit * 1000 * 1000 / 8;
+	self->interval = interval * G_USEC_PER_SEC;
+	self->window = window * G_USEC_PER_SEC;
+	self->uptime = uptime * G_USEC_PER_SEC;
+	self->downtime = downtime * G_USEC_PER_SEC;
+	self->share_limit = share_limit;
+	self->max_age = max_age;
+	self->poisson = g_strcmp0(arrival, "poisson") == 0;
+	self->duration = duration > 0 ? duration * G_USEC_PER_SEC
+				      : (releases * interval + 2 * max_age) * G_USEC_PER_SEC;
+	if (!passim_sim_parse_bandwidths(self,
+					 bandwidths != NULL ? bandwidths : "100:70,1000:30",
+					 &error)) {
+		g_printerr("Failed to parse bandwidth: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	/* create the LAN */
+	for (gint i = 0; i < hosts; i++) {
+		PassimSimHost *host = g_new0(PassimSimHost, 1);
+		host->idx = i;
+		host->rate = passim_sim_pick_bandwidth(self);
+		host->items = g_hash_table_new_full(g_direct_hash,
+						    g_direct_equal,
+						    NULL,
+						    (GDestroyNotify)g_object_unref);
+		host->pending = g_ptr_array_new();
+		g_ptr_array_add(self->hosts, host);
+		passim_sim_host_up(self, host);
+	}
+	for (gint i = 0; i < releases; i++) {
+		PassimSimRelease *release = g_new0(PassimSimRelease, 1);
+		PassimSimEvent *event;
+
+		release->idx = i;
+		release->hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+							    (const guchar *)&release->idx,
+							    sizeof(release->idx));
+		release->size = size;
+		release->holders = g_ptr_array_new();
+		g_ptr_array_add(self->releases, release);
+		event = passim_sim_schedule(self,
+					    i * self->interval,
+					    PASSIM_SIM_EVENT_RELEASE,
+					    NULL);
+		event->release = release;
+	}
+	passim_sim_schedule(self, PASSIM_SIM_CHECK_AGE_INTERVAL, PASSIM_SIM_EVENT_CHECK_AGE, NULL);
+
+	passim_sim_run(self);
+	passim_sim_print_results(self, json);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2023 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
+/*
+ * USDT probes in the "passim" provider, see contrib/passim-latency.bt for an example of use.
+ * Durations are in µs and pointers are only used to correlate probes for the same request.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PASSIM_TRACE(name)		    DTRACE_PROBE(passim, name)
+#define PASSIM_TRACE1(name, a1)		    DTRACE_PROBE1(passim, name, a1)
+#define PASSIM_TRACE2(name, a1, a2)	    DTRACE_PROBE2(passim, name, a1, a2)
+#define PASSIM_TRACE3(name, a1, a2, a3)	    DTRACE_PROBE3(passim, name, a1, a2, a3)
+#define PASSIM_TRACE4(name, a1, a2, a3, a4) DTRACE_PROBE4(passim, name, a1, a2, a3, a4)
+#else
+#define PASSIM_TRACE(name)		    (void)0
+#define PASSIM_TRACE1(name, a1)		    (void)(a1)
+#define PASSIM_TRACE2(name, a1, a2)	    (void)(a1), (void)(a2)
+#define PASSIM_TRACE3(name, a1, a2, a3)	    (void)(a1), (void)(a2), (void)(a3)
+#define PASSIM_TRACE4(name, a1, a2, a3, a4) (void)(a1), (void)(a2), (void)(a3), (void)(a4)
+#endif
+
+/* add a sysprof mark from @begin_time, as returned by g_get_monotonic_time(), until now */
+static inline void
+passim_trace_mark(gint64 begin_time, const gchar *name, const gchar *message)
+{
+#ifdef HAVE_SYSPROF
+	gint64 duration = g_get_monotonic_time() - begin_time;
+	sysprof_collector_mark(begin_time * 1000,
+			       duration * 1000,
+			       "passim",
+			       name,
+			       "%s",
+			       message != NULL ? message : "");
+#endif
+}